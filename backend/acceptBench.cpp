@@ -0,0 +1,161 @@
+/**
+ * @file acceptBench.cpp
+ * @brief Measures how many connections per second the listeners can take on as acceptors are added.
+ * Runs 1, 2, 4, ... acceptors up to the core count, each round against fresh SO_REUSEPORT sockets.
+ * Clients connect and reset immediately, so the numbers reflect accept, SSL_new and thread
+ * start-up on the server side rather than full TLS handshakes.
+ *
+ * Usage: ./accept_bench [--seconds=2] [--clients=<2 x cores>] [--max_acceptors=<cores>] [--key=value server options]
+ * @author Kaden Oseen
+ */
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "config.h"
+#include "listener.h"
+#include "metrics.h"
+
+using namespace std;
+
+/**
+ * @brief Session stand-in for the benchmark. Finishes the (failing) handshake and cleans up.
+ * @param client_socket The accepted socket
+ * @param ssl The SSL object created by the listener
+ */
+static void drop_session(int client_socket, SSL* ssl) {
+    static atomic<int64_t>& sessions_active = Metrics::counter("sessions_active");
+    SSL_accept(ssl);
+    SSL_free(ssl);
+    close(client_socket);
+    --sessions_active;
+}
+
+/**
+ * @brief Connects to the listeners in a loop until told to stop.
+ * Each connection is closed with a reset so client ports never pile up in TIME_WAIT.
+ * @param port The port to connect to
+ * @param running Cleared when the round is over
+ */
+static void connect_loop(int port, const atomic<bool>* running) {
+    struct sockaddr_in server_address;
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct linger reset = {1, 0};
+
+    while (*running) {
+        int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(client_socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        connect(client_socket, (struct sockaddr*) &server_address, sizeof(server_address));
+        close(client_socket);
+    }
+}
+
+/**
+ * @brief Runs the benchmark rounds and prints one result line per acceptor count.
+ * @return int Exit code.
+ */
+int main(int argc, char* argv[]) {
+    unsigned int cores = max(1u, thread::hardware_concurrency());
+    int seconds = 2;
+    int clients = 2 * cores;
+    int max_acceptors = cores;
+
+    // Benchmark flags first; everything else is a server option (port, cert_file, ...)
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equals == string::npos) {
+            cerr << "Invalid argument: " << arg << " (expected --key=value)" << endl;
+            return 1;
+        }
+        string key = arg.substr(2, equals - 2);
+        string value = arg.substr(equals + 1);
+        if (key == "seconds") {
+            seconds = stoi(value);
+        } else if (key == "clients") {
+            clients = stoi(value);
+        } else if (key == "max_acceptors") {
+            max_acceptors = stoi(value);
+        } else if (!server_config.set(key, value)) {
+            return 1;
+        }
+    }
+    if (!server_config.validate()) {
+        return 1;
+    }
+
+    SSL_library_init();
+    SSL_load_error_strings();
+    SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_server_method());
+    if (SSL_CTX_use_certificate_file(ssl_ctx, server_config.cert_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ssl_ctx, server_config.key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
+        cerr << "Could not load certificate or key" << endl;
+        return 1;
+    }
+    atomic<int64_t>& sessions_accepted = Metrics::counter("sessions_accepted");
+    atomic<int64_t>& sessions_active = Metrics::counter("sessions_active");
+
+    for (int acceptors = 1; acceptors <= max_acceptors; acceptors *= 2) {
+        // Fresh sockets every round so the kernel balances over exactly this many acceptors
+        vector<unique_ptr<Listener>> listeners;
+        for (int i = 0; i < acceptors; ++i) {
+            int server_socket = Listener::openSocket(server_config.port, server_config.backlog, true);
+            if (server_socket < 0) {
+                return 1;
+            }
+            listeners.emplace_back(new Listener(i, server_socket, ssl_ctx, [](int client_socket, SSL* ssl) {
+                thread(drop_session, client_socket, ssl).detach();
+            }));
+        }
+        for (auto& listener : listeners) {
+            listener->start(server_config.pin_acceptors);
+        }
+
+        atomic<bool> running(true);
+        int64_t accepted_before = sessions_accepted;
+        auto started = chrono::steady_clock::now();
+        vector<thread> client_threads;
+        for (int i = 0; i < clients; ++i) {
+            client_threads.emplace_back(connect_loop, server_config.port, &running);
+        }
+        this_thread::sleep_for(chrono::seconds(seconds));
+        int64_t accepted = sessions_accepted - accepted_before;
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        running = false;
+        for (auto& client_thread : client_threads) {
+            client_thread.join();
+        }
+
+        // Tear the round down and let its session threads finish before the next one
+        for (auto& listener : listeners) {
+            listener->stop();
+        }
+        for (auto& listener : listeners) {
+            listener->join();
+        }
+        while (sessions_active > 0) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+
+        cout << "accept_bench acceptors=" << acceptors << " clients=" << clients
+             << " connections=" << accepted
+             << " connections_per_second=" << static_cast<int64_t>(accepted / elapsed) << endl;
+    }
+
+    SSL_CTX_free(ssl_ctx);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file appendVector.h
+ * @brief Declaration and implementation of the AppendVector class template.
+ * @author Kaden Oseen
+ */
+
+#ifndef APPEND_VECTOR_H
+#define APPEND_VECTOR_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+/**
+ * @class AppendVector
+ * @brief A growable array with one writer and any number of lock-free readers.
+ * Elements live in segments that double in size and never move, so an element can be
+ * found by index in constant time and read while the writer appends more. An element is
+ * only counted once it is written, and readers only look at counted elements.
+ */
+template <typename T>
+class AppendVector {
+public:
+    AppendVector() : count(0) {
+        for (auto& segment : segments) {
+            segment.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    ~AppendVector() {
+        for (auto& segment : segments) {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+    AppendVector(const AppendVector&) = delete;
+    AppendVector& operator=(const AppendVector&) = delete;
+
+    /**
+     * @brief Adds an element. Only one thread may append at a time.
+     * @param value The element
+     */
+    void push_back(const T& value) {
+        size_t index = count.load(std::memory_order_relaxed);
+        size_t segment = segmentOf(index);
+        T* elements = segments[segment].load(std::memory_order_relaxed);
+        if (elements == nullptr) {
+            elements = new T[FIRST << segment];
+            segments[segment].store(elements, std::memory_order_release);
+        }
+        elements[index - ((FIRST << segment) - FIRST)] = value;
+        // Publishes the element (and any new segment) to readers
+        count.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Returns the number of elements written so far. Safe while the writer appends.
+     */
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Returns an element, which must be below a size() already read.
+     */
+    const T& operator[](size_t index) const {
+        size_t segment = segmentOf(index);
+        return segments[segment].load(std::memory_order_acquire)[index - ((FIRST << segment) - FIRST)];
+    }
+
+private:
+    // Size of the first segment; segment k holds FIRST << k elements
+    static constexpr size_t FIRST = 16;
+    static constexpr size_t SEGMENTS = 40;
+
+    // Segment holding an element: the segments before k hold (FIRST << k) - FIRST elements
+    static size_t segmentOf(size_t index) {
+        return std::bit_width((index + FIRST) / FIRST) - 1;
+    }
+
+    std::atomic<T*> segments[SEGMENTS];
+    std::atomic<size_t> count;
+};
+
+#endif
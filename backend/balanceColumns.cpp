@@ -0,0 +1,117 @@
+/**
+ * @file balanceColumns.cpp
+ * @brief Implementation of the BalanceColumns class.
+ * @author Kaden Oseen
+ */
+
+#include "balanceColumns.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * @name BalanceColumns
+ * @brief Constructor for the BalanceColumns class. Segments are allocated as accounts are added.
+ */
+BalanceColumns::BalanceColumns() : segments(new atomic<atomic<int64_t>*>[MAX_SEGMENTS]), count(0) {
+    for (size_t segment = 0; segment < MAX_SEGMENTS; ++segment) {
+        segments[segment].store(nullptr, memory_order_relaxed);
+    }
+}
+
+/**
+ * @name ~BalanceColumns
+ * @brief Destructor for the BalanceColumns class.
+ */
+BalanceColumns::~BalanceColumns() {
+    for (size_t segment = 0; segment < MAX_SEGMENTS; ++segment) {
+        delete[] segments[segment].load(memory_order_relaxed);
+    }
+}
+
+/**
+ * @name add
+ * @brief Adds an account's balance and gives the account its id. Only one thread may add
+ * at a time (the holder of the accounts directory's lock).
+ *
+ * @param cents The balance
+ * @return The account's id
+ */
+uint32_t BalanceColumns::add(int64_t cents) {
+    size_t id = count.load(memory_order_relaxed);
+    atomic<int64_t>* segment = segments[id / SEGMENT].load(memory_order_relaxed);
+    if (segment == nullptr) {
+        segment = new atomic<int64_t>[SEGMENT];
+        segments[id / SEGMENT].store(segment, memory_order_release);
+    }
+    segment[id % SEGMENT].store(cents, memory_order_relaxed);
+    // Publishes the balance (and any new segment) to scans
+    count.store(id + 1, memory_order_release);
+    return static_cast<uint32_t>(id);
+}
+
+/**
+ * @name set
+ * @brief Records an account's new balance. Must hold the account's lock.
+ *
+ * @param id The account's id
+ * @param cents The balance
+ */
+void BalanceColumns::set(uint32_t id, int64_t cents) {
+    segments[id / SEGMENT].load(memory_order_relaxed)[id % SEGMENT].store(cents, memory_order_relaxed);
+}
+
+/**
+ * @name get
+ * @brief Reads an account's balance.
+ *
+ * @param id The account's id, which must be below a size() already read
+ * @return The balance in cents
+ */
+int64_t BalanceColumns::get(uint32_t id) const {
+    return segments[id / SEGMENT].load(memory_order_acquire)[id % SEGMENT].load(memory_order_relaxed);
+}
+
+/**
+ * @name size
+ * @brief Returns the number of accounts. Safe while accounts are added.
+ *
+ * @return The number of accounts
+ */
+size_t BalanceColumns::size() const {
+    return count.load(memory_order_acquire);
+}
+
+/**
+ * @name copySegment
+ * @brief Copies the balances of one segment, as they are at the moment each is read, into
+ * a plain array that scan kernels can work on without atomics.
+ *
+ * @param segment The segment
+ * @param out Room for SEGMENT balances
+ * @return The number of balances copied, 0 past the last account
+ */
+size_t BalanceColumns::copySegment(size_t segment, int64_t* out) const {
+    size_t total = size();
+    if (segment * SEGMENT >= total) {
+        return 0;
+    }
+    size_t copied = min(SEGMENT, total - segment * SEGMENT);
+    const atomic<int64_t>* balances = segments[segment].load(memory_order_acquire);
+    for (size_t i = 0; i < copied; ++i) {
+        out[i] = balances[i].load(memory_order_relaxed);
+    }
+    return copied;
+}
+
+/**
+ * @name toCents
+ * @brief Converts an amount in dollars to whole cents, rounding to the nearest cent.
+ *
+ * @param amount The amount
+ * @return The amount in cents
+ */
+int64_t BalanceColumns::toCents(double amount) {
+    return llround(amount * 100);
+}
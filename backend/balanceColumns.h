@@ -0,0 +1,49 @@
+/**
+ * @file balanceColumns.h
+ * @brief Declaration of the BalanceColumns class.
+ * @author Kaden Oseen
+ */
+
+#ifndef BALANCE_COLUMNS_H
+#define BALANCE_COLUMNS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @class BalanceColumns
+ * @brief Every account's balance in cents, stored by account id in one column, so a scan
+ * over all balances reads 8 bytes per account instead of walking User objects.
+ * An account's id is its position in the order accounts were added. The column grows in
+ * segments of SEGMENT balances that never move, so it can be read while accounts are added
+ * and balances change: each balance is written and read with one relaxed atomic access, by
+ * the holder of the account's lock and by any reader without a lock.
+ */
+class BalanceColumns {
+public:
+    // Balances per segment; a segment is the unit a scan copies and works on
+    static constexpr size_t SEGMENT = 65536;
+
+    // Constructor and destructor
+    BalanceColumns();
+    ~BalanceColumns();
+    BalanceColumns(const BalanceColumns&) = delete;
+    BalanceColumns& operator=(const BalanceColumns&) = delete;
+    // Methods
+    uint32_t add(int64_t cents);
+    void set(uint32_t id, int64_t cents);
+    int64_t get(uint32_t id) const;
+    size_t size() const;
+    size_t copySegment(size_t segment, int64_t* out) const;
+    static int64_t toCents(double amount);
+private:
+    // Segments for 2^32 accounts
+    static constexpr size_t MAX_SEGMENTS = (size_t(1) << 32) / SEGMENT;
+
+    std::unique_ptr<std::atomic<std::atomic<int64_t>*>[]> segments;
+    std::atomic<size_t> count;
+};
+
+#endif
@@ -0,0 +1,428 @@
+/**
+ * @file balanceReport.cpp
+ * @brief Implementation of the BalanceReport class.
+ * Each segment of balances goes through one fused pass that sums them, tracks the smallest
+ * and largest, counts them against every range bound and threshold, buckets them for the
+ * percentiles and picks out the accounts past the thresholds. The pass uses AVX2 where the
+ * CPU has it (checked once at runtime) and plain loops otherwise.
+ * @author Kaden Oseen
+ */
+
+#include "balanceReport.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+constexpr int64_t BalanceReport::RANGE_BOUNDS[];
+
+static const size_t BOUNDS = BalanceReport::RANGES - 1;
+
+// Percentile buckets: balances below 16 cents get one each, and every power of two above
+// is split into 16, so a bucket is never wider than 1/16 of the balances in it. Balances
+// are clamped to [0, 2^52) cents first.
+static const int64_t EXACT = 16;
+static const size_t BUCKETS = EXACT + (52 - 4) * 16;
+static const int64_t LARGEST = (int64_t(1) << 52) - 1;
+
+/**
+ * @struct Partial
+ * @brief What one scanning thread has seen so far.
+ */
+struct Partial {
+    int64_t total = 0;
+    int64_t min = numeric_limits<int64_t>::max();
+    int64_t max = numeric_limits<int64_t>::min();
+    // Balances under each range bound
+    size_t under[BOUNDS] = {0};
+    size_t above_count = 0;
+    size_t below_count = 0;
+    vector<uint32_t> above_ids;
+    vector<uint32_t> below_ids;
+    size_t buckets[BUCKETS] = {0};
+};
+
+/**
+ * @brief Finds the percentile bucket of a balance from the bits of it as a double, whose
+ * exponent and top four mantissa bits name the power of two and the sixteenth within it.
+ * @param cents The balance
+ * @return The bucket
+ */
+static size_t bucket_of(int64_t cents) {
+    cents = min(max(cents, int64_t(0)), LARGEST);
+    if (cents < EXACT) {
+        return static_cast<size_t>(cents);
+    }
+    double value = static_cast<double>(cents);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return static_cast<size_t>((bits >> 48) - ((1023 + 4) << 4) + EXACT);
+}
+
+/**
+ * @brief Returns the smallest balance a percentile bucket holds.
+ * @param bucket The bucket
+ * @return The balance in cents
+ */
+static int64_t bucket_floor(size_t bucket) {
+    if (bucket < EXACT) {
+        return static_cast<int64_t>(bucket);
+    }
+    size_t octave = (bucket - EXACT) / 16;
+    int64_t sixteenth = static_cast<int64_t>((bucket - EXACT) % 16);
+    return (16 + sixteenth) << octave;
+}
+
+/**
+ * @brief Scans a segment one balance at a time.
+ * @param balances The segment's balances
+ * @param count How many
+ * @param first_id The id of the first
+ * @param options The thresholds and the most ids to list
+ * @param partial The thread's results, updated in place
+ */
+static void scan_scalar(const int64_t* balances, size_t count, uint32_t first_id,
+                        const BalanceReport::Options& options, Partial& partial) {
+    for (size_t i = 0; i < count; ++i) {
+        int64_t cents = balances[i];
+        partial.total += cents;
+        partial.min = min(partial.min, cents);
+        partial.max = max(partial.max, cents);
+        for (size_t bound = 0; bound < BOUNDS; ++bound) {
+            partial.under[bound] += cents < BalanceReport::RANGE_BOUNDS[bound];
+        }
+        ++partial.buckets[bucket_of(cents)];
+        if (options.above >= 0 && cents >= options.above) {
+            ++partial.above_count;
+            if (partial.above_ids.size() < options.max_ids) {
+                partial.above_ids.push_back(first_id + static_cast<uint32_t>(i));
+            }
+        }
+        if (options.below >= 0 && cents < options.below) {
+            ++partial.below_count;
+            if (partial.below_ids.size() < options.max_ids) {
+                partial.below_ids.push_back(first_id + static_cast<uint32_t>(i));
+            }
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Adds the ids of the lanes set in a comparison mask to a list, up to a limit.
+ * @return The number of lanes set
+ */
+__attribute__((target("avx2")))
+static size_t collect_lanes(__m256i mask, uint32_t id, size_t limit, vector<uint32_t>& ids) {
+    int lanes = _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+    if (lanes == 0) {
+        return 0;
+    }
+    for (int lane = 0; lane < 4 && ids.size() < limit; ++lane) {
+        if (lanes & (1 << lane)) {
+            ids.push_back(id + lane);
+        }
+    }
+    return static_cast<size_t>(__builtin_popcount(lanes));
+}
+
+/**
+ * @brief scan_scalar four balances at a time with AVX2. The range counts subtract the
+ * all-ones lanes of each comparison, and the percentile buckets are computed for all four
+ * lanes at once by adding 2^52 to the balance as a double's mantissa.
+ */
+__attribute__((target("avx2")))
+static void scan_avx2(const int64_t* balances, size_t count, uint32_t first_id,
+                      const BalanceReport::Options& options, Partial& partial) {
+    __m256i total = _mm256_setzero_si256();
+    __m256i low = _mm256_set1_epi64x(partial.min);
+    __m256i high = _mm256_set1_epi64x(partial.max);
+    __m256i under[BOUNDS];
+    __m256i bounds[BOUNDS];
+    for (size_t bound = 0; bound < BOUNDS; ++bound) {
+        under[bound] = _mm256_setzero_si256();
+        bounds[bound] = _mm256_set1_epi64x(BalanceReport::RANGE_BOUNDS[bound]);
+    }
+    // v >= above is above - 1 < v; v < below is below > v
+    const __m256i above = _mm256_set1_epi64x(options.above - 1);
+    const __m256i below = _mm256_set1_epi64x(options.below);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i largest = _mm256_set1_epi64x(LARGEST);
+    const __m256i exact = _mm256_set1_epi64x(EXACT);
+    const __m256i magic = _mm256_set1_epi64x(0x4330000000000000);
+    const __m256d two_52 = _mm256_set1_pd(4503599627370496.0);
+    const __m256i bucket_base = _mm256_set1_epi64x(((1023 + 4) << 4) - EXACT);
+    alignas(32) int64_t buckets[4];
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i cents = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(balances + i));
+        total = _mm256_add_epi64(total, cents);
+        low = _mm256_blendv_epi8(low, cents, _mm256_cmpgt_epi64(low, cents));
+        high = _mm256_blendv_epi8(high, cents, _mm256_cmpgt_epi64(cents, high));
+        for (size_t bound = 0; bound < BOUNDS; ++bound) {
+            under[bound] = _mm256_sub_epi64(under[bound], _mm256_cmpgt_epi64(bounds[bound], cents));
+        }
+
+        // Clamp to [0, 2^52), read as a double's exponent and top mantissa bits
+        __m256i clamped = _mm256_blendv_epi8(cents, zero, _mm256_cmpgt_epi64(zero, cents));
+        clamped = _mm256_blendv_epi8(clamped, largest, _mm256_cmpgt_epi64(clamped, largest));
+        __m256d value = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(clamped, magic)), two_52);
+        __m256i bucket = _mm256_sub_epi64(_mm256_srli_epi64(_mm256_castpd_si256(value), 48), bucket_base);
+        bucket = _mm256_blendv_epi8(bucket, clamped, _mm256_cmpgt_epi64(exact, clamped));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(buckets), bucket);
+        ++partial.buckets[buckets[0]];
+        ++partial.buckets[buckets[1]];
+        ++partial.buckets[buckets[2]];
+        ++partial.buckets[buckets[3]];
+
+        uint32_t id = first_id + static_cast<uint32_t>(i);
+        if (options.above >= 0) {
+            partial.above_count += collect_lanes(_mm256_cmpgt_epi64(cents, above), id, options.max_ids, partial.above_ids);
+        }
+        if (options.below >= 0) {
+            partial.below_count += collect_lanes(_mm256_cmpgt_epi64(below, cents), id, options.max_ids, partial.below_ids);
+        }
+    }
+
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), total);
+    partial.total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), low);
+    partial.min = min(min(lanes[0], lanes[1]), min(lanes[2], lanes[3]));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), high);
+    partial.max = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+    for (size_t bound = 0; bound < BOUNDS; ++bound) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), under[bound]);
+        partial.under[bound] += static_cast<size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+    scan_scalar(balances + i, count - i, first_id + static_cast<uint32_t>(i), options, partial);
+}
+
+/**
+ * @brief Scans a segment, with AVX2 if the CPU has it and the options allow.
+ */
+static void scan(const int64_t* balances, size_t count, uint32_t first_id,
+                 const BalanceReport::Options& options, Partial& partial) {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2 && options.simd) {
+        scan_avx2(balances, count, first_id, options, partial);
+    } else {
+        scan_scalar(balances, count, first_id, options, partial);
+    }
+}
+#else
+/**
+ * @brief Scans a segment.
+ */
+static void scan(const int64_t* balances, size_t count, uint32_t first_id,
+                 const BalanceReport::Options& options, Partial& partial) {
+    scan_scalar(balances, count, first_id, options, partial);
+}
+#endif
+
+/**
+ * @brief Finds the balance below which a share of the accounts fall.
+ * @param buckets The merged percentile buckets
+ * @param accounts The number of accounts
+ * @param share The share, e.g. 0.99
+ * @return The smallest balance of the bucket the percentile falls in
+ */
+static int64_t percentile(const size_t* buckets, size_t accounts, double share) {
+    size_t rank = static_cast<size_t>(share * static_cast<double>(accounts));
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += buckets[bucket];
+        if (seen > rank) {
+            return bucket_floor(bucket);
+        }
+    }
+    return bucket_floor(BUCKETS - 1);
+}
+
+/**
+ * @name run
+ * @brief Scans every balance in the column once and reports on them.
+ *
+ * @param columns The balances
+ * @param options Thresholds and how many threads to scan with
+ * @return The report
+ */
+BalanceReport BalanceReport::run(const BalanceColumns& columns, const Options& options) {
+    auto started = chrono::steady_clock::now();
+    BalanceReport report;
+    report.options = options;
+    // Accounts added during the scan are left for the next report
+    size_t accounts = columns.size();
+    size_t segments = (accounts + BalanceColumns::SEGMENT - 1) / BalanceColumns::SEGMENT;
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, static_cast<int>(segments)));
+
+    vector<Partial> partials(threads);
+    atomic<size_t> next_segment(0);
+    auto work = [&](int worker) {
+        vector<int64_t> balances(BalanceColumns::SEGMENT);
+        for (size_t segment = next_segment++; segment < segments; segment = next_segment++) {
+            size_t copied = std::min(columns.copySegment(segment, balances.data()), accounts - segment * BalanceColumns::SEGMENT);
+            scan(balances.data(), copied, static_cast<uint32_t>(segment * BalanceColumns::SEGMENT), options, partials[worker]);
+        }
+    };
+    vector<thread> workers;
+    for (int worker = 1; worker < threads; ++worker) {
+        workers.emplace_back(work, worker);
+    }
+    work(0);
+    for (thread& worker : workers) {
+        worker.join();
+    }
+
+    // Merge what each thread saw
+    size_t under[BOUNDS] = {0};
+    size_t buckets[BUCKETS] = {0};
+    report.accounts = accounts;
+    report.min = numeric_limits<int64_t>::max();
+    report.max = numeric_limits<int64_t>::min();
+    for (const Partial& partial : partials) {
+        report.total += partial.total;
+        report.min = std::min(report.min, partial.min);
+        report.max = std::max(report.max, partial.max);
+        for (size_t bound = 0; bound < BOUNDS; ++bound) {
+            under[bound] += partial.under[bound];
+        }
+        for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            buckets[bucket] += partial.buckets[bucket];
+        }
+        report.above_count += partial.above_count;
+        report.below_count += partial.below_count;
+        report.above_ids.insert(report.above_ids.end(), partial.above_ids.begin(), partial.above_ids.end());
+        report.below_ids.insert(report.below_ids.end(), partial.below_ids.begin(), partial.below_ids.end());
+    }
+    if (accounts == 0) {
+        report.min = report.max = 0;
+    }
+    for (size_t range = 0; range < RANGES; ++range) {
+        size_t below_top = range < BOUNDS ? under[range] : accounts;
+        report.ranges[range] = below_top - (range > 0 ? under[range - 1] : 0);
+    }
+    // The percentiles never fall outside the balances actually seen
+    auto within = [&report](int64_t cents) { return std::min(std::max(cents, report.min), report.max); };
+    report.p50 = within(percentile(buckets, accounts, 0.5));
+    report.p90 = within(percentile(buckets, accounts, 0.9));
+    report.p99 = within(percentile(buckets, accounts, 0.99));
+    report.p999 = within(percentile(buckets, accounts, 0.999));
+    for (vector<uint32_t>* ids : {&report.above_ids, &report.below_ids}) {
+        sort(ids->begin(), ids->end());
+        if (ids->size() > options.max_ids) {
+            ids->resize(options.max_ids);
+        }
+    }
+    report.threads = threads;
+    report.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    return report;
+}
+
+/**
+ * @name parseQuery
+ * @brief Reads report options from a query string, e.g. "above=1000&below=10&limit=20",
+ * with the thresholds in dollars.
+ *
+ * @param query The query string
+ * @param options Receives the options; keys not given keep their values
+ * @return true if every key was known and every value a number
+ */
+bool BalanceReport::parseQuery(const string& query, Options& options) {
+    istringstream pairs(query);
+    string pair;
+    while (getline(pairs, pair, '&')) {
+        if (pair.empty()) {
+            continue;
+        }
+        size_t equals = pair.find('=');
+        if (equals == string::npos) {
+            return false;
+        }
+        string key = pair.substr(0, equals);
+        const char* value = pair.c_str() + equals + 1;
+        char* end = nullptr;
+        double number = strtod(value, &end);
+        if (end == value || *end != '\0' || number < 0) {
+            return false;
+        }
+        if (key == "above") {
+            options.above = BalanceColumns::toCents(number);
+        } else if (key == "below") {
+            options.below = BalanceColumns::toCents(number);
+        } else if (key == "limit") {
+            options.max_ids = static_cast<size_t>(number);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Writes an amount in cents as dollars.
+ */
+static string dollars(int64_t cents) {
+    ostringstream out;
+    out << fixed << setprecision(2) << static_cast<double>(cents) / 100;
+    return out.str();
+}
+
+/**
+ * @name describe
+ * @brief Renders the report as "key=value" lines.
+ *
+ * @param above_names Names of the accounts in above_ids, in the same order
+ * @param below_names Names of the accounts in below_ids, in the same order
+ * @return The report as text
+ */
+string BalanceReport::describe(const vector<string>& above_names, const vector<string>& below_names) const {
+    ostringstream out;
+    out << "accounts=" << accounts << "\n";
+    out << "total=" << dollars(total) << "\n";
+    out << "min=" << dollars(min) << "\n";
+    out << "max=" << dollars(max) << "\n";
+    out << "mean=" << dollars(accounts == 0 ? 0 : total / static_cast<int64_t>(accounts)) << "\n";
+    out << "p50=" << dollars(p50) << "\n";
+    out << "p90=" << dollars(p90) << "\n";
+    out << "p99=" << dollars(p99) << "\n";
+    out << "p999=" << dollars(p999) << "\n";
+    for (size_t range = 0; range < RANGES; ++range) {
+        out << "balances_";
+        if (range == 0) {
+            out << "under_" << dollars(RANGE_BOUNDS[0]);
+        } else if (range == RANGES - 1) {
+            out << dollars(RANGE_BOUNDS[range - 1]) << "_and_up";
+        } else {
+            out << dollars(RANGE_BOUNDS[range - 1]) << "_to_" << dollars(RANGE_BOUNDS[range]);
+        }
+        out << "=" << ranges[range] << "\n";
+    }
+    auto list = [&out](const char* name, int64_t threshold, size_t count, const vector<string>& names) {
+        if (threshold < 0) {
+            return;
+        }
+        out << name << "=" << dollars(threshold) << "\n" << name << "_count=" << count << "\n" << name << "_accounts=";
+        for (size_t i = 0; i < names.size(); ++i) {
+            out << (i > 0 ? "," : "") << names[i];
+        }
+        out << "\n";
+    };
+    list("above", options.above, above_count, above_names);
+    list("below", options.below, below_count, below_names);
+    out << "threads=" << threads << "\n";
+    out << "scan_ms=" << fixed << setprecision(3) << milliseconds << "\n";
+    return out.str();
+}
@@ -0,0 +1,76 @@
+/**
+ * @file balanceReport.h
+ * @brief Declaration of the BalanceReport class.
+ * @author Kaden Oseen
+ */
+
+#ifndef BALANCE_REPORT_H
+#define BALANCE_REPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "balanceColumns.h"
+
+/**
+ * @class BalanceReport
+ * @brief Bank-wide aggregates over a BalanceColumns: the total held, the smallest and
+ * largest balance, percentiles, the number of accounts per range of balances, and the
+ * accounts above or below a threshold.
+ *
+ * Several threads take segments of the column in turn. Each copies its segment into a
+ * private array and runs one pass of SIMD kernels over it (AVX2 when the CPU has it), so
+ * the column itself is read once, with no lock: balances keep changing during the scan,
+ * and each is counted as it was when its segment was copied. A transfer committed during
+ * the scan may therefore be seen on one side only.
+ */
+class BalanceReport {
+public:
+    /**
+     * @struct Options
+     * @brief What to report besides the aggregates, and how to scan.
+     */
+    struct Options {
+        // List accounts with at least / less than these balances in cents (< 0 for none)
+        int64_t above = -1;
+        int64_t below = -1;
+        // Most account ids listed per threshold
+        size_t max_ids = 100;
+        // Scanning threads, 0 for one per core
+        int threads = 0;
+        // Use the SIMD kernels when the CPU has them (off to measure the scalar ones)
+        bool simd = true;
+    };
+
+    // Upper ends in cents of the ranges the distribution counts accounts in; the last
+    // range holds everything from the last bound up
+    static constexpr int64_t RANGE_BOUNDS[] = {1, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    static constexpr size_t RANGES = sizeof(RANGE_BOUNDS) / sizeof(RANGE_BOUNDS[0]) + 1;
+
+    // Results
+    size_t accounts = 0;
+    int64_t total = 0;
+    int64_t min = 0;
+    int64_t max = 0;
+    // Balances at the 50th, 90th, 99th and 99.9th percentiles, rounded down by less than 1/16
+    int64_t p50 = 0;
+    int64_t p90 = 0;
+    int64_t p99 = 0;
+    int64_t p999 = 0;
+    size_t ranges[RANGES] = {0};
+    size_t above_count = 0;
+    size_t below_count = 0;
+    std::vector<uint32_t> above_ids;
+    std::vector<uint32_t> below_ids;
+    double milliseconds = 0;
+    int threads = 0;
+    Options options;
+
+    // Methods
+    static BalanceReport run(const BalanceColumns& columns, const Options& options);
+    static bool parseQuery(const std::string& query, Options& options);
+    std::string describe(const std::vector<std::string>& above_names, const std::vector<std::string>& below_names) const;
+};
+
+#endif
@@ -0,0 +1,1299 @@
+/**
+ * @file benchmark.cpp
+ * @brief Microbenchmarks for the core backend primitives.
+ * Each benchmark is run until it has taken at least --min_time_ms and reported as one JSON
+ * line with its time per operation and the allocations made per operation through operator
+ * new. Results are checked against the limits in bench_thresholds.txt so a performance
+ * regression fails the run.
+ *
+ * Usage: ./benchmark [--filter=<substring>] [--min_time_ms=200] [--thresholds=bench_thresholds.txt]
+ *        ./benchmark --crash_test=<rounds>
+ *        ./benchmark --snapshot_test=<rounds>
+ * The Replication benchmarks fork a standby process and follow it over a scratch Unix socket.
+ * @author Kaden Oseen
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "globals.h"
+#include "config.h"
+#include "databaseHandler.h"
+#include "transactionHandler.h"
+#include "request.h"
+#include "user.h"
+#include "response.h"
+#include "transferEngine.h"
+#include <jsoncpp/json/json.h>
+#include "replication.h"
+#include "intentModel.h"
+#include "historyFilter.h"
+#include "statementExport.h"
+#include "balanceReport.h"
+#include "crc32c.h"
+#include "historyArchive.h"
+#include "reconciliation.h"
+#include "lifecycle.h"
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+// Allocations made through operator new by any thread, counted for allocations_per_op
+static atomic<int64_t> allocations(0);
+
+void* operator new(size_t size) {
+    ++allocations;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+// Kept out of line: inlined into a caller, free() would look paired with operator new
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+// The sized deletes forward to the unsized ones, so every delete matches its new
+void operator delete(void* memory, size_t) noexcept {
+    operator delete(memory);
+}
+
+// std::pmr::new_delete_resource() allocates with the alignment it is asked for
+void* operator new(size_t size, align_val_t alignment) {
+    ++allocations;
+    size_t align = static_cast<size_t>(alignment);
+    void* memory = aligned_alloc(align, max<size_t>(1, (size + align - 1) / align) * align);
+    if (memory == nullptr) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+__attribute__((noinline)) void operator delete(void* memory, align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t, align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+/**
+ * @struct Run
+ * @brief One timed run of a benchmark. Bodies call resetTimer() after any setup they do,
+ * and stopTimer() before any teardown, such as fixtures going out of scope.
+ */
+struct Run {
+    int64_t iterations;
+    chrono::steady_clock::time_point started;
+    // Extra figures to report with the result, such as sizes
+    map<string, double> counters;
+    // The allocation count when the timer started
+    int64_t allocations_started;
+    // When the timer stopped and the allocation count then, once stopped
+    chrono::steady_clock::time_point stopped = {};
+    int64_t allocations_stopped = 0;
+
+    void resetTimer() {
+        started = chrono::steady_clock::now();
+        allocations_started = allocations.load();
+    }
+
+    // Only the first call counts, so measure() can stop a timer the body already stopped
+    void stopTimer() {
+        if (stopped == chrono::steady_clock::time_point()) {
+            stopped = chrono::steady_clock::now();
+            allocations_stopped = allocations.load();
+        }
+    }
+};
+
+/**
+ * @struct Benchmark
+ * @brief A named benchmark. The body runs the measured operation run.iterations times.
+ */
+struct Benchmark {
+    string name;
+    function<void(Run& run)> body;
+};
+
+// Every benchmark, in the order they run
+static vector<Benchmark> benchmarks;
+
+// Account counts used by the DatabaseHandler benchmarks
+static const int ACCOUNT_COUNTS[] = {100, 10000, 100000};
+
+// A chat completion response as returned by the NLP API
+static const string CANNED_RESPONSE = "{\n"
+    "  \"id\": \"chatcmpl-7QyqpwdfhqwajicIEznoc6Q47XAyW\",\n"
+    "  \"object\": \"chat.completion\",\n"
+    "  \"created\": 1677664795,\n"
+    "  \"model\": \"gpt-3.5-turbo-0613\",\n"
+    "  \"choices\": [\n"
+    "    {\n"
+    "      \"index\": 0,\n"
+    "      \"message\": {\n"
+    "        \"role\": \"assistant\",\n"
+    "        \"content\": \"(deposit,100)\"\n"
+    "      },\n"
+    "      \"finish_reason\": \"stop\"\n"
+    "    }\n"
+    "  ],\n"
+    "  \"usage\": {\n"
+    "    \"prompt_tokens\": 212,\n"
+    "    \"completion_tokens\": 5,\n"
+    "    \"total_tokens\": 217\n"
+    "  }\n"
+    "}\n";
+
+/**
+ * @brief Keeps the compiler from optimizing away a value computed by a benchmark.
+ * @param value The value to keep
+ */
+template <typename T>
+static void keep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+/**
+ * @brief Registers a benchmark.
+ * @param name The benchmark name, used in results and thresholds
+ * @param body Runs the measured operation a number of times
+ */
+static void add(const string& name, function<void(Run&)> body) {
+    benchmarks.push_back({name, body});
+}
+
+// Accounts in the scratch users file, or -1 if it has not been written
+static int users_file_accounts = -1;
+
+/**
+ * @brief Removes the scratch users file and the journal and history kept next to it.
+ */
+static void remove_scratch_files() {
+    for (const char* suffix : {"", ".journal", ".history", ".outbox", ".tmp", ".history.tmp", ".outbox.tmp"}) {
+        remove((server_config.users_file + suffix).c_str());
+    }
+    users_file_accounts = -1;
+}
+
+/**
+ * @brief Writes the scratch users file with the given number of accounts, unless it already has them.
+ * @param accounts Number of accounts to write
+ */
+static void write_users_file(int accounts) {
+    if (users_file_accounts == accounts) {
+        return;
+    }
+    remove_scratch_files();
+    users_file_accounts = accounts;
+    ofstream file(server_config.users_file, ios_base::trunc);
+    string password = get_hash("password");
+    for (int i = 0; i < accounts; ++i) {
+        file << "user" << i << ":" << password << ":" << (i % 1000) + 0.25 << "\n";
+    }
+}
+
+/**
+ * @brief Registers the benchmarks for the global helper functions.
+ */
+static void add_global_benchmarks() {
+    add("get_hash", [](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(get_hash("password123"));
+        }
+    });
+    add("getTimestamp", [](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(getTimestamp());
+        }
+    });
+    add("removeCharacters", [](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(removeCharacters("$1,234.56 dollars"));
+        }
+    });
+}
+
+/**
+ * @brief Registers the DatabaseHandler benchmarks at each account count.
+ */
+static void add_database_benchmarks() {
+    for (int accounts : ACCOUNT_COUNTS) {
+        string suffix = "/" + to_string(accounts);
+        add("DatabaseHandler::load" + suffix, [accounts](Run& run) {
+            write_users_file(accounts);
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                DatabaseHandler handler;
+                keep(handler.getUsers().size());
+            }
+        });
+        add("DatabaseHandler::getRecipient" + suffix, [accounts](Run& run) {
+            write_users_file(accounts);
+            DatabaseHandler handler;
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(handler.getRecipient("user" + to_string(i % accounts)));
+            }
+            run.stopTimer();
+        });
+        add("DatabaseHandler::userById" + suffix, [accounts](Run& run) {
+            write_users_file(accounts);
+            DatabaseHandler handler;
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(handler.userById(static_cast<uint32_t>(i % accounts)));
+            }
+            run.stopTimer();
+        });
+        add("DatabaseHandler::getUser" + suffix, [accounts](Run& run) {
+            write_users_file(accounts);
+            DatabaseHandler handler;
+            string password = get_hash("password");
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(handler.getUser("user" + to_string(i % accounts), password));
+            }
+            run.stopTimer();
+        });
+        add("DatabaseHandler::updateUserBalance" + suffix, [accounts](Run& run) {
+            write_users_file(accounts);
+            DatabaseHandler handler;
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                User* user = handler.getRecipient("user" + to_string(i % accounts));
+                user->updateBalance(1);
+                keep(handler.updateUserBalance(user));
+            }
+            run.stopTimer();
+        });
+    }
+}
+
+/**
+ * @brief Commits run.iterations single-account batches, shipping each to a standby running
+ * in a child process unless mode is "none".
+ * @param run The run
+ * @param mode "none", "async" or "sync"
+ */
+static void run_replicated_commits(Run& run, const string& mode) {
+    const int accounts = 1000;
+    write_users_file(accounts);
+    string socket_path = server_config.users_file + ".sock";
+    string primary_file = server_config.users_file;
+    pid_t child = -1;
+    if (mode != "none") {
+        // Forked before any thread starts; the standby keeps its files next to the primary's
+        child = fork();
+        if (child == 0) {
+            server_config.users_file = primary_file + ".standby";
+            remove_scratch_files();
+            Lifecycle::blockSignals();
+            Standby::follow(socket_path);
+            remove_scratch_files();
+            _exit(0);
+        }
+    }
+    DatabaseHandler handler;
+    Replication replication;
+    if (mode != "none") {
+        replication.start(socket_path, handler, mode == "sync", chrono::milliseconds(1000));
+        while (!replication.attached()) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    vector<User*> users;
+    for (User& user : handler.getUsers()) {
+        users.push_back(&user);
+    }
+    run.resetTimer();
+    for (int64_t i = 0; i < run.iterations; ++i) {
+        User* user = users[i % accounts];
+        user->updateBalance(1);
+        keep(handler.updateUserBalance(user));
+    }
+    run.stopTimer();
+    if (mode != "none") {
+        // The standby takes over once the primary stops, and exits
+        replication.stop();
+        waitpid(child, nullptr, 0);
+    }
+}
+
+/**
+ * @brief Registers the commit latency benchmarks for each replication mode.
+ */
+static void add_replication_benchmarks() {
+    for (const char* mode : {"none", "async", "sync"}) {
+        add(string("Replication::commit/") + mode, [mode](Run& run) {
+            run_replicated_commits(run, mode);
+        });
+    }
+}
+
+/**
+ * @brief Registers the TransactionHandler and User benchmarks.
+ */
+static void add_transaction_benchmarks() {
+    add("TransactionHandler::deposit", [](Run& run) {
+        User user("alice", "hash", 100);
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(TransactionHandler::handleTransaction(TransactionHandler::TransactionType::DEPOSIT, &user, 10));
+        }
+    });
+    add("TransactionHandler::withdraw", [](Run& run) {
+        User user("alice", "hash", 1e12);
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(TransactionHandler::handleTransaction(TransactionHandler::TransactionType::WITHDRAW, &user, 10));
+        }
+    });
+    add("TransactionHandler::handleTransfer", [](Run& run) {
+        User sender("alice", "hash", 1e12);
+        User recipient("bob", "hash", 0);
+        TransactionHandler handler;
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(handler.handleTransfer(&sender, &recipient, 10));
+        }
+    });
+    for (int entries : {100, 10000}) {
+        add("User::getTransactionLog/" + to_string(entries), [entries](Run& run) {
+            User user("alice", "hash", 1e12);
+            for (int i = 0; i < entries; ++i) {
+                TransactionHandler::handleTransaction(TransactionHandler::TransactionType::WITHDRAW, &user, 10);
+            }
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(user.getTransactionLog());
+            }
+        });
+    }
+}
+
+/**
+ * @brief Fills a user's history with a year of entries, ten a day: deposits, withdrawals and
+ * transfers in and out, a hundred of which are sent to bob.
+ * @param user The user, named alice
+ * @param entries How many entries
+ */
+static void fill_history(User& user, int entries) {
+    for (int i = 0; i < entries; ++i) {
+        int day = i / 10;
+        char timestamp[32];
+        snprintf(timestamp, sizeof(timestamp), "[2024-%02d-%02d %02d:%02d:00]", 1 + day / 28 % 12, 1 + day % 28, i % 10, i % 60);
+        string other = i % 100 == 2 ? "bob" : "user" + to_string(i % 97);
+        static const char* const KINDS[] = {" --- Deposit --- $", " --- Withdrawal --- $", " --- Transfer --- $", " --- Transfer --- $"};
+        string entry = string(timestamp) + KINDS[i % 4] + to_string(10 + i % 990);
+        if (i % 4 == 2) {
+            entry += " --- alice -> " + other;
+        } else if (i % 4 == 3) {
+            entry += " --- " + other + " -> alice";
+        }
+        user.addTransaction(entry);
+    }
+}
+
+/**
+ * @brief Registers the benchmarks for filtered history queries through the history indexes,
+ * next to the scan of every formatted entry they replace.
+ */
+static void add_history_query_benchmarks() {
+    const int entries = 10000;
+    static const pair<const char*, const char*> QUERIES[] = {
+        {"counterparty", "transfers to bob"},
+        {"type+range", "withdrawals on 2024-06-10"},
+        {"limit", "last 5 deposits"},
+    };
+    for (const auto& query : QUERIES) {
+        add(string("User::findTransactions/") + query.first + "/" + to_string(entries), [entries, query](Run& run) {
+            User user("alice", "hash", 1e12);
+            fill_history(user, entries);
+            HistoryLog::Query conditions = HistoryFilter::parse(query.second, time(nullptr));
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(user.findTransactions(user.getTransactions(), conditions));
+            }
+        });
+    }
+    add("User::findTransactions/scan/" + to_string(entries), [entries](Run& run) {
+        User user("alice", "hash", 1e12);
+        fill_history(user, entries);
+        HistoryLog::Query conditions = HistoryFilter::parse("transfers to bob", time(nullptr));
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            vector<const string*> found;
+            string counterparty;
+            for (const string& entry : user.getTransactions()) {
+                HistoryLog::Record record = HistoryLog::parse(entry, "alice", counterparty);
+                if ((conditions.types & (1u << static_cast<unsigned>(record.type))) != 0 && counterparty == conditions.counterparty) {
+                    found.push_back(&entry);
+                }
+            }
+            keep(found);
+        }
+    });
+}
+
+/**
+ * @brief Registers the statement export benchmarks: the time to encode one chunk of the
+ * default size, which is what a session does between two chunks sent to the client.
+ */
+static void add_statement_export_benchmarks() {
+    const int entries = 10000;
+    for (auto format : {StatementExport::Format::CSV, StatementExport::Format::BINARY}) {
+        add("StatementExport::encode/" + string(StatementExport::name(format)) + "/65536", [entries, format](Run& run) {
+            User user("alice", "hash", 1e12);
+            fill_history(user, entries);
+            string chunk;
+            size_t position = 0;
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                chunk.clear();
+                position = StatementExport::encode(user, format, position, entries, 65536, chunk);
+                position = position == static_cast<size_t>(entries) ? 0 : position;
+                keep(chunk);
+            }
+        });
+    }
+}
+
+/**
+ * @brief Registers the history archive benchmarks: coding a year of one account's history,
+ * reporting its size per entry next to the checksummed text lines it replaces, decoding
+ * all of it back to text, and the history queries answered by decoding only the blocks
+ * that can match.
+ */
+static void add_history_archive_benchmarks() {
+    const int entries = 10000;
+    add("HistoryArchive::encode/" + to_string(entries), [entries](Run& run) {
+        User user("alice", "hash", 1e12);
+        fill_history(user, entries);
+        string text;
+        BlockFile::Writer lines(text);
+        for (const string& entry : user.getTransactions()) {
+            lines.add("alice", entry);
+        }
+        lines.finish();
+        string archive;
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            archive.clear();
+            HistoryArchive::Writer writer(archive);
+            writer.add("alice", user.getTransactions());
+            writer.finish();
+            keep(archive);
+        }
+        run.counters["bytes_per_entry"] = static_cast<double>(archive.size()) / entries;
+        run.counters["text_bytes_per_entry"] = static_cast<double>(text.size()) / entries;
+    });
+    // Decodes the archive of a year of alice's history
+    auto archived = [entries](string& archive, HistoryArchive::Reader& reader) {
+        User user("alice", "hash", 1e12);
+        fill_history(user, entries);
+        HistoryArchive::Writer writer(archive);
+        writer.add("alice", user.getTransactions());
+        writer.finish();
+        reader.open(archive);
+    };
+    add("HistoryArchive::decode/" + to_string(entries), [entries, archived](Run& run) {
+        string archive;
+        HistoryArchive::Reader reader;
+        archived(archive, reader);
+        vector<string> decoded;
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            decoded.clear();
+            reader.read(0, decoded);
+            keep(decoded);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - run.started).count();
+        run.counters["entries_per_second"] = seconds > 0 ? entries * run.iterations / seconds : 0;
+    });
+    static const pair<const char*, const char*> QUERIES[] = {
+        {"counterparty", "transfers to bob"},
+        {"type+range", "withdrawals on 2024-06-10"},
+        {"limit", "last 5 deposits"},
+    };
+    for (const auto& query : QUERIES) {
+        add(string("HistoryArchive::query/") + query.first + "/" + to_string(entries), [query, archived](Run& run) {
+            string archive;
+            HistoryArchive::Reader reader;
+            archived(archive, reader);
+            HistoryLog::Query conditions = HistoryFilter::parse(query.second, time(nullptr));
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(reader.query(0, conditions));
+            }
+        });
+    }
+}
+
+/**
+ * @brief Registers the TransferEngine benchmarks: transfers per second from several
+ * submitting threads, with accounts picked uniformly and with most transfers touching a
+ * few hot accounts. The time per operation includes each batch's commit to the users file.
+ */
+static void add_transfer_benchmarks() {
+    const int accounts = 10000;
+    const int submitters = 8;
+    // Percentage of transfers that touch one of the first few accounts
+    for (auto skew : {pair<const char*, int>{"uniform", 0}, pair<const char*, int>{"hot", 90}}) {
+        add(string("TransferEngine::") + skew.first + "/" + to_string(accounts), [accounts, skew](Run& run) {
+            write_users_file(accounts);
+            DatabaseHandler handler;
+            vector<User*> users;
+            for (User& user : handler.getUsers()) {
+                users.push_back(&user);
+            }
+            TransferEngine engine;
+            engine.start(handler, 4, 4096);
+            atomic<int64_t> outstanding(run.iterations);
+            run.resetTimer();
+            vector<thread> threads;
+            for (int t = 0; t < submitters; ++t) {
+                threads.emplace_back([&, t]() {
+                    mt19937 random(t);
+                    auto pick = [&]() {
+                        bool hot = static_cast<int>(random() % 100) < skew.second;
+                        return users[random() % (hot ? 8 : accounts)];
+                    };
+                    for (int64_t i = t; i < run.iterations; i += submitters) {
+                        TransferEngine::Transfer transfer;
+                        transfer.from = pick();
+                        do {
+                            transfer.to = pick();
+                        } while (transfer.to == transfer.from);
+                        transfer.amount = 0.01;
+                        engine.submit(transfer, [&outstanding](const TransferEngine::Result&) { --outstanding; });
+                    }
+                });
+            }
+            for (auto& submitter : threads) {
+                submitter.join();
+            }
+            engine.stop();
+            run.stopTimer();
+            keep(outstanding.load());
+        });
+    }
+}
+
+/**
+ * @brief Runs run.iterations balance and history reads of random accounts, split across
+ * reader threads, while two writer threads keep changing random accounts.
+ * @param run The run
+ * @param readers Number of reader threads
+ * @param locked Read under the account lock instead of from a snapshot
+ */
+static void run_mixed_reads(Run& run, int readers, bool locked) {
+    const int accounts = 10000;
+    write_users_file(accounts);
+    DatabaseHandler handler;
+    vector<User*> users;
+    for (User& user : handler.getUsers()) {
+        users.push_back(&user);
+    }
+    atomic<bool> writing(true);
+    vector<thread> writers;
+    for (int w = 0; w < 2; ++w) {
+        writers.emplace_back([&, w]() {
+            mt19937 random(w);
+            while (writing.load(memory_order_relaxed)) {
+                User* user = users[random() % accounts];
+                {
+                    auto lock = handler.lockAccount(user);
+                    user->beginUpdate();
+                    user->updateBalance(1);
+                    user->addTransaction("deposit");
+                    user->endUpdate();
+                }
+                // A steady stream of changes rather than a saturating one
+                this_thread::sleep_for(chrono::microseconds(1));
+            }
+        });
+    }
+    run.resetTimer();
+    vector<thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r]() {
+            mt19937 random(100 + r);
+            for (int64_t i = r; i < run.iterations; i += readers) {
+                User* user = users[random() % accounts];
+                if (locked) {
+                    auto lock = handler.lockAccount(user);
+                    keep(user->getBalance() + user->getTransactions().size());
+                } else {
+                    User::Snapshot snapshot = user->snapshot();
+                    keep(snapshot.balance + snapshot.history.size());
+                }
+            }
+        });
+    }
+    for (auto& reader : threads) {
+        reader.join();
+    }
+    run.stopTimer();
+    writing = false;
+    for (auto& writer : writers) {
+        writer.join();
+    }
+}
+
+/**
+ * @brief Registers the mixed read/write benchmarks: balance and history reads from 1, 2,
+ * 4, ... reader threads, up to the core count, while writers are active, both from
+ * lock-free snapshots and under the account locks. With snapshots the time per read
+ * should fall in proportion to the number of readers.
+ */
+static void add_snapshot_benchmarks() {
+    int cores = max(1u, thread::hardware_concurrency());
+    for (int readers = 1; readers <= cores; readers *= 2) {
+        add("User::snapshot/readers=" + to_string(readers), [readers](Run& run) {
+            run_mixed_reads(run, readers, false);
+        });
+        add("DatabaseHandler::lockedRead/readers=" + to_string(readers), [readers](Run& run) {
+            run_mixed_reads(run, readers, true);
+        });
+    }
+}
+
+/**
+ * @brief Registers the balance report benchmarks: one report over a million balances with
+ * the AVX2 and the scalar kernels, and over the accounts of a loaded database against
+ * the same total summed one User at a time.
+ */
+static void add_balance_report_benchmarks() {
+    const int balances = 1000000;
+    for (bool simd : {true, false}) {
+        add(string("BalanceReport::run/") + (simd ? "simd" : "scalar") + "/" + to_string(balances), [balances, simd](Run& run) {
+            BalanceColumns columns;
+            mt19937 random(1);
+            for (int i = 0; i < balances; ++i) {
+                columns.add(static_cast<int64_t>(random() % 100000000));
+            }
+            BalanceReport::Options options;
+            options.above = 99000000;
+            options.below = 100;
+            options.threads = 1;
+            options.simd = simd;
+            run.resetTimer();
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(BalanceReport::run(columns, options).total);
+            }
+        });
+    }
+    const int accounts = 100000;
+    add("DatabaseHandler::sumBalances/" + to_string(accounts), [accounts](Run& run) {
+        write_users_file(accounts);
+        DatabaseHandler handler;
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            double total = 0;
+            for (const User& user : handler.getUsers()) {
+                total += user.getBalance();
+            }
+            keep(total);
+        }
+        run.stopTimer();
+    });
+    add("BalanceReport::run/" + to_string(accounts), [accounts](Run& run) {
+        write_users_file(accounts);
+        DatabaseHandler handler;
+        BalanceReport::Options options;
+        options.threads = 1;
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(BalanceReport::run(handler.getBalances(), options).total);
+        }
+        run.stopTimer();
+    });
+}
+
+/**
+ * @brief Registers the integrity benchmarks: CRC-32C of 64 KiB with the CPU's instruction
+ * and with the table it falls back on, and a reconciliation of checkpointed files of
+ * 100k accounts with four history entries each.
+ */
+static void add_integrity_benchmarks() {
+    string block(65536, '\0');
+    mt19937 random(1);
+    for (char& byte : block) {
+        byte = static_cast<char>(random());
+    }
+    add("Crc32c::extend/65536", [block](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(Crc32c::extend(0, block.data(), block.size()));
+        }
+    });
+    add("Crc32c::extendPortable/65536", [block](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(Crc32c::extendPortable(0, block.data(), block.size()));
+        }
+    });
+    const int accounts = 100000;
+    add("Reconciliation::run/" + to_string(accounts), [accounts](Run& run) {
+        write_users_file(accounts);
+        {
+            DatabaseHandler handler;
+            for (User& user : handler.getUsers()) {
+                user.beginUpdate();
+                for (int entry = 0; entry < 4; ++entry) {
+                    user.updateBalance(10);
+                    user.addTransaction("[2024-01-0" + to_string(entry + 1) + " 12:00:00] --- Deposit --- $10");
+                }
+                user.endUpdate();
+            }
+            handler.checkpoint();
+        }
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            Reconciliation report = Reconciliation::run(server_config.users_file, 1);
+            if (!report.clean()) {
+                cerr << report.describe();
+            }
+            keep(report.accounts);
+        }
+        run.stopTimer();
+        // The users file now has history, unlike the one other benchmarks expect
+        remove_scratch_files();
+    });
+}
+
+/**
+ * @brief Builds a long chat completion response: the content has escapes and non-ASCII
+ * text, and a choice carries per-token log probabilities before its message.
+ * @return The response
+ */
+static string large_response() {
+    string tokens;
+    for (int i = 0; i < 64; ++i) {
+        tokens += string(i == 0 ? "" : ",") + "{\"token\":\"tok" + to_string(i) + "\",\"logprob\":-0." + to_string(i) +
+                  ",\"bytes\":[116,111,107],\"top_logprobs\":[]}";
+    }
+    return "{\"id\":\"chatcmpl-7QyqpwdfhqwajicIEznoc6Q47XAyW\",\"object\":\"chat.completion\",\"created\":1677664795,"
+           "\"model\":\"gpt-3.5-turbo-0613\",\"choices\":[{\"index\":0,\"logprobs\":{\"content\":[" + tokens + "]},"
+           "\"message\":{\"role\":\"assistant\",\"content\":\"(transfer,25.50)\\n\\\"caf\\u00e9\\\" \\ud83d\\ude00 "
+           "to bob\"},\"finish_reason\":\"stop\"}],\"usage\":{\"prompt_tokens\":212,\"completion_tokens\":64,\"total_tokens\":276}}";
+}
+
+/**
+ * @brief The request body as it was built before the template: a JSON tree holding the
+ * system message, serialized with styling. Kept as the baseline for buildBody.
+ * @param input The user input
+ * @return The request body
+ */
+static string build_body_jsoncpp(const string& input) {
+    Json::Value requestBody;
+    requestBody["model"] = server_config.nlp_model;
+    Json::Value messages(Json::arrayValue);
+    Json::Value systemMessage;
+    systemMessage["role"] = "system";
+    systemMessage["content"] = "You are a banking system where users use natural language to withdraw, deposit, transfer, check balance, view history, go back (backwards), view their options, or logout. \
+    After a message from the user, you will respond with a single message. Give ONLY two words for what the user is trying to do in the exact format: (action,amount) \
+    where action is a single word string (deposit, transfer, withdraw, balance, history, backwards, options or logout) and amount is a number with maximum 2 decimal places (0 for balance, history, backwards, options or logout). \
+    If a user requests to change to regular prompts or or go back in any way, respond with (backwards,0). If a user does not specify an amount with a request such as deposit, withdraw or transfer, return -1 as the value.\
+    Remove ALL spaces. If unknown or not 100% sure, return (unknown,0).";
+    messages.append(systemMessage);
+    Json::Value userMessage;
+    userMessage["role"] = "user";
+    userMessage["content"] = input;
+    messages.append(userMessage);
+    requestBody["messages"] = messages;
+    return requestBody.toStyledString();
+}
+
+/**
+ * @brief A response parsed the way it was before the extractor: into a JSON tree.
+ * Kept as the baseline for parseResponse.
+ * @param raw The response
+ * @param content Set to choices[0].message.content
+ * @return true if the response parsed
+ */
+static bool parse_response_jsoncpp(const string& raw, string& content) {
+    Json::Value root;
+    Json::CharReaderBuilder builder;
+    unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    string errors;
+    if (!reader->parse(raw.c_str(), raw.c_str() + raw.size(), &root, &errors)) {
+        return false;
+    }
+    content = root["choices"][0]["message"]["content"].asString();
+    return true;
+}
+
+/**
+ * @brief Registers the NLP request building and parsing benchmarks, each next to the
+ * JSON tree baseline it replaced.
+ */
+static void add_request_benchmarks() {
+    add("Request::buildBody", [](Run& run) {
+        Request request("I would like to deposit one hundred dollars please");
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(request.buildBody());
+        }
+    });
+    add("Request::buildBody/jsoncpp", [](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(build_body_jsoncpp("I would like to deposit one hundred dollars please"));
+        }
+    });
+    // The request buffers of one NLP dialog step, from the default heap and from an arena
+    // released after each step as a session's is
+    add("Request::step", [](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            Request request("I would like to deposit one hundred dollars please");
+            keep(request.buildBody());
+            pmr::string content;
+            keep(Request::parseResponse(CANNED_RESPONSE, content));
+        }
+    });
+    add("Request::step/arena", [](Run& run) {
+        alignas(max_align_t) byte memory[8192];
+        pmr::monotonic_buffer_resource arena(memory, sizeof(memory));
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            {
+                Request request("I would like to deposit one hundred dollars please", &arena);
+                keep(request.buildBody());
+                pmr::string content(&arena);
+                keep(Request::parseResponse(CANNED_RESPONSE, content));
+            }
+            arena.release();
+        }
+    });
+    static const string LARGE_RESPONSE = large_response();
+    for (auto payload : {pair<const char*, const string*>{"", &CANNED_RESPONSE}, pair<const char*, const string*>{"/large", &LARGE_RESPONSE}}) {
+        add(string("Request::parseResponse") + payload.first, [payload](Run& run) {
+            pmr::string content;
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(Request::parseResponse(*payload.second, content));
+            }
+        });
+        add(string("Request::parseResponse") + payload.first + "/jsoncpp", [payload](Run& run) {
+            string content;
+            for (int64_t i = 0; i < run.iterations; ++i) {
+                keep(parse_response_jsoncpp(*payload.second, content));
+            }
+        });
+    }
+}
+
+/**
+ * @brief Registers the benchmarks for the local intent model, trained on intents_train.tsv.
+ */
+static void add_intent_benchmarks() {
+    static IntentModel model;
+    vector<IntentModel::Example> examples;
+    if (!IntentModel::readExamples("intents_train.tsv", examples)) {
+        return;
+    }
+    model.train(examples, 30, 16384);
+    add("IntentModel::interpret", [](Run& run) {
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(model.interpret("I would like to deposit one hundred dollars please", 0.5));
+        }
+    });
+    add("IntentModel::interpret/long", [](Run& run) {
+        string text = "hi there, I just got paid this morning and would really like to put $1,250.50 into my "
+                      "checking account before the weekend so that my rent goes through without any trouble";
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            keep(model.interpret(text, 0.5));
+        }
+    });
+}
+
+/**
+ * @brief Registers the benchmarks for rendering replies to the client.
+ */
+static void add_response_benchmarks() {
+    add("Response::balance", [](Run& run) {
+        Response reply;
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            reply.begin() << "Your balance is: " << Amount{1234.5 + i} << Messages::WHAT_ELSE << Messages::OPTIONS;
+            keep(reply.size());
+        }
+    });
+    add("Response::history/100", [](Run& run) {
+        User user("alice", "hash", 1e12);
+        for (int i = 0; i < 100; ++i) {
+            TransactionHandler::handleTransaction(TransactionHandler::TransactionType::WITHDRAW, &user, 10);
+        }
+        Response reply;
+        run.resetTimer();
+        for (int64_t i = 0; i < run.iterations; ++i) {
+            reply.begin() << user.getUsername() << "'s Transaction Log:\n" << user.getTransactions()
+                          << Messages::WHAT_ELSE << Messages::OPTIONS;
+            keep(reply.size());
+        }
+    });
+}
+
+/**
+ * @brief Adds up the effect of the transfers in a user's history on their balance.
+ * @param user The user
+ * @return Money received minus money sent
+ */
+static double history_net(const User& user) {
+    double net = 0;
+    for (const string& entry : user.getTransactions()) {
+        size_t amount = entry.find(" --- Transfer --- $");
+        size_t parties = amount == string::npos ? amount : entry.find(" --- ", amount + 19);
+        size_t arrow = parties == string::npos ? parties : entry.find(" -> ", parties);
+        if (arrow == string::npos) {
+            continue;
+        }
+        double value = stod(entry.substr(amount + 19, parties - amount - 19));
+        if (entry.compare(parties + 5, arrow - parties - 5, user.getUsername()) == 0) {
+            net -= value;
+        }
+        if (entry.compare(arrow + 4, string::npos, user.getUsername()) == 0) {
+            net += value;
+        }
+    }
+    return net;
+}
+
+/**
+ * @brief Crash-injection check for the journal. In each round a child process commits
+ * random transfers, some of them to external recipients, until it is killed at a random
+ * moment, and half the time part of one more batch is left at the end of the journal as
+ * if its write had been torn. The accounts and unsettled payouts recovered from disk must
+ * hold the same total as before, and each balance must match its own history.
+ * @param rounds Number of crashes
+ * @return true if every recovery was consistent
+ */
+static bool run_crash_test(int rounds) {
+    const int accounts = 1000;
+    // Small enough that crashes also land in the middle of checkpoints
+    server_config.checkpoint_bytes = 16384;
+    mt19937 random(getpid());
+    int failures = 0;
+    int64_t history_entries = 0;
+    for (int round = 0; round < rounds; ++round) {
+        remove_scratch_files();
+        write_users_file(accounts);
+        map<string, double> initial;
+        double initial_total = 0;
+        {
+            DatabaseHandler handler;
+            for (const User& user : handler.getUsers()) {
+                initial[user.getUsername()] = user.getBalance();
+                initial_total += user.getBalance();
+            }
+        }
+
+        pid_t child = fork();
+        if (child == 0) {
+            DatabaseHandler handler;
+            vector<User*> users;
+            for (User& user : handler.getUsers()) {
+                users.push_back(&user);
+            }
+            TransferEngine engine;
+            engine.start(handler, 2, 64);
+            atomic<int> outstanding(0);
+            mt19937 transfers(round);
+            while (true) {
+                if (outstanding.load() > 256) {
+                    this_thread::yield();
+                    continue;
+                }
+                TransferEngine::Transfer transfer;
+                transfer.from = users[transfers() % accounts];
+                // One in ten is paid out to an external recipient, settled by nobody here
+                if (transfers() % 10 == 0) {
+                    transfer.recipient = "someone@example.com";
+                } else {
+                    do {
+                        transfer.to = users[transfers() % accounts];
+                    } while (transfer.to == transfer.from);
+                }
+                transfer.amount = 1 + transfers() % 5;
+                ++outstanding;
+                engine.submit(transfer, [&outstanding](const TransferEngine::Result&) { --outstanding; });
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(20 + random() % 300));
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+
+        // Half the time, leave part of one more batch at the end of the journal, as if the
+        // server had died in the middle of writing it
+        if (random() % 2 == 0) {
+            string torn = "B:999999999:2\nU:user1:1000000:torn\nU:user2:-1000000:torn\nE:999999999:0\n";
+            ofstream journal(server_config.users_file + ".journal", ios::binary | ios::app);
+            journal << torn.substr(0, 1 + random() % (torn.size() - 1));
+        }
+
+        DatabaseHandler recovered;
+        double total = 0;
+        bool consistent = recovered.getUsers().size() == initial.size();
+        for (const User& user : recovered.getUsers()) {
+            total += user.getBalance();
+            consistent = consistent && user.getBalance() == initial[user.getUsername()] + history_net(user);
+            history_entries += user.getTransactions().size();
+        }
+        for (const auto& payout : recovered.pendingPayouts()) {
+            total += payout.amount;
+        }
+        consistent = consistent && total == initial_total;
+        failures += consistent ? 0 : 1;
+    }
+    remove_scratch_files();
+    printf("{\"name\":\"crash_test\",\"rounds\":%d,\"history_entries\":%lld,\"failures\":%d,\"status\":\"%s\"}\n",
+           rounds, static_cast<long long>(history_entries), failures, failures == 0 ? "ok" : "failed");
+    return failures == 0;
+}
+
+/**
+ * @brief Copies a user's history entries.
+ * @param user The user
+ * @return The entries, oldest first
+ */
+static vector<string> history_of(const User& user) {
+    vector<string> entries;
+    for (const string& entry : user.getTransactions()) {
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+/**
+ * @brief Snapshot check for replication. In each round a standby attaches at a random
+ * moment while transfers stream through a TransferEngine, so its snapshot is taken with
+ * batches in flight. Once the primary stops, the standby takes over and checkpoints; its
+ * accounts must then have exactly the primary's balances and history, with no batch
+ * applied twice.
+ * @param rounds Number of standbys attached
+ * @return true if every standby matched its primary
+ */
+static bool run_snapshot_test(int rounds) {
+    const int accounts = 1000;
+    string primary_file = server_config.users_file;
+    string standby_file = primary_file + ".standby";
+    string socket_path = primary_file + ".sock";
+    mt19937 random(getpid());
+    int failures = 0;
+    int64_t history_entries = 0;
+    for (int round = 0; round < rounds; ++round) {
+        server_config.users_file = primary_file;
+        remove_scratch_files();
+        write_users_file(accounts);
+        // Forked before any thread starts; the standby keeps trying until the primary listens
+        pid_t child = fork();
+        if (child == 0) {
+            server_config.users_file = standby_file;
+            remove_scratch_files();
+            Lifecycle::blockSignals();
+            bool promoted = Standby::follow(socket_path) == Standby::Outcome::PROMOTED;
+            _exit(promoted && DatabaseHandler::shared().checkpoint() ? 0 : 1);
+        }
+
+        DatabaseHandler handler;
+        vector<User*> users;
+        for (User& user : handler.getUsers()) {
+            users.push_back(&user);
+        }
+        TransferEngine engine;
+        engine.start(handler, 2, 64);
+        Replication replication;
+        atomic<int> outstanding(0);
+        mt19937 transfers(round);
+        auto started = chrono::steady_clock::now();
+        auto attach_at = started + chrono::milliseconds(random() % 200);
+        bool listening = false;
+        // Long enough for the standby's next connection attempt to land mid-stream
+        while (chrono::steady_clock::now() - started < chrono::milliseconds(1000)) {
+            if (!listening && chrono::steady_clock::now() >= attach_at) {
+                listening = replication.start(socket_path, handler, false, chrono::milliseconds(1000));
+            }
+            if (outstanding.load() > 256) {
+                this_thread::yield();
+                continue;
+            }
+            TransferEngine::Transfer transfer;
+            transfer.from = users[transfers() % accounts];
+            do {
+                transfer.to = users[transfers() % accounts];
+            } while (transfer.to == transfer.from);
+            transfer.amount = 1 + transfers() % 5;
+            ++outstanding;
+            engine.submit(transfer, [&outstanding](const TransferEngine::Result&) { --outstanding; });
+        }
+        bool attached = listening && replication.attached();
+        engine.stop();
+        // The standby receives every batch, sees the primary go and takes over
+        replication.stop();
+        int status = 0;
+        waitpid(child, &status, 0);
+
+        bool consistent = attached && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (consistent) {
+            server_config.users_file = standby_file;
+            DatabaseHandler standby;
+            consistent = standby.getUsers().size() == handler.getUsers().size();
+            for (const User& user : handler.getUsers()) {
+                User* copy = standby.getRecipient(user.getUsername());
+                consistent = consistent && copy != nullptr && copy->getBalance() == user.getBalance() &&
+                             history_of(*copy) == history_of(user);
+                history_entries += user.getTransactions().size();
+            }
+        }
+        failures += consistent ? 0 : 1;
+        server_config.users_file = standby_file;
+        remove_scratch_files();
+    }
+    server_config.users_file = primary_file;
+    remove_scratch_files();
+    printf("{\"name\":\"snapshot_test\",\"rounds\":%d,\"history_entries\":%lld,\"failures\":%d,\"status\":\"%s\"}\n",
+           rounds, static_cast<long long>(history_entries), failures, failures == 0 ? "ok" : "failed");
+    return failures == 0;
+}
+
+/**
+ * @brief Runs a benchmark with growing iteration counts until it takes at least the minimum time.
+ * @param benchmark The benchmark to run
+ * @param min_time_ms The minimum measured time
+ * @param iterations Set to the iteration count of the final run
+ * @param counters Set to the counters of the final run, with its allocations per iteration
+ * @return Nanoseconds per iteration
+ */
+static double measure(const Benchmark& benchmark, int min_time_ms, int64_t& iterations, map<string, double>& counters) {
+    iterations = 1;
+    while (true) {
+        Run run = {iterations, chrono::steady_clock::now(), {}, allocations.load()};
+        benchmark.body(run);
+        run.stopTimer();
+        double elapsed = chrono::duration<double, nano>(run.stopped - run.started).count();
+        if (elapsed >= min_time_ms * 1e6 || iterations >= (int64_t(1) << 40)) {
+            counters = run.counters;
+            counters["allocations_per_op"] = static_cast<double>(run.allocations_stopped - run.allocations_started) / iterations;
+            return elapsed / iterations;
+        }
+        // Aim a little past the minimum so most benchmarks finish in one more run
+        double scale = elapsed <= 0 ? 100 : min(100.0, 1.2 * min_time_ms * 1e6 / elapsed);
+        iterations = max(iterations + 1, static_cast<int64_t>(iterations * scale));
+    }
+}
+
+/**
+ * @brief Reads "name max_ns_per_op" lines from a thresholds file.
+ * @param path The thresholds file
+ * @return Maximum nanoseconds per operation by benchmark name
+ */
+static map<string, double> read_thresholds(const string& path) {
+    map<string, double> thresholds;
+    ifstream file(path);
+    string name;
+    double limit;
+    while (file >> name) {
+        if (name[0] == '#') {
+            getline(file, name);
+            continue;
+        }
+        if (file >> limit) {
+            thresholds[name] = limit;
+        }
+    }
+    return thresholds;
+}
+
+/**
+ * @brief Runs the selected benchmarks and prints one JSON result per line.
+ * @return int 0 if every benchmark is within its threshold, 1 otherwise.
+ */
+int main(int argc, char* argv[]) {
+    string filter = "";
+    int min_time_ms = 200;
+    string thresholds_path = "bench_thresholds.txt";
+    int crash_rounds = 0;
+    int snapshot_rounds = 0;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--filter=", 0) == 0) {
+            filter = arg.substr(9);
+        } else if (arg.rfind("--min_time_ms=", 0) == 0) {
+            min_time_ms = stoi(arg.substr(14));
+        } else if (arg.rfind("--thresholds=", 0) == 0) {
+            thresholds_path = arg.substr(13);
+        } else if (arg.rfind("--crash_test=", 0) == 0) {
+            crash_rounds = stoi(arg.substr(13));
+        } else if (arg.rfind("--snapshot_test=", 0) == 0) {
+            snapshot_rounds = stoi(arg.substr(16));
+        } else {
+            cerr << "Usage: ./benchmark [--filter=<substring>] [--min_time_ms=200] [--thresholds=<file>] [--crash_test=<rounds>] [--snapshot_test=<rounds>]" << endl;
+            return 1;
+        }
+    }
+    map<string, double> thresholds = read_thresholds(thresholds_path);
+
+    // The database benchmarks work on a scratch users file, never the real one
+    server_config.users_file = "/tmp/nlpbanking_bench_users_" + to_string(getpid()) + ".txt";
+    // Results are printed with printf; the server's own messages would only get in the way
+    cerr.setstate(ios_base::failbit);
+    cout.setstate(ios_base::failbit);
+    if (crash_rounds > 0) {
+        return run_crash_test(crash_rounds) ? 0 : 1;
+    }
+    if (snapshot_rounds > 0) {
+        return run_snapshot_test(snapshot_rounds) ? 0 : 1;
+    }
+
+    add_global_benchmarks();
+    add_database_benchmarks();
+    add_transaction_benchmarks();
+    add_history_query_benchmarks();
+    add_statement_export_benchmarks();
+    add_history_archive_benchmarks();
+    add_transfer_benchmarks();
+    add_replication_benchmarks();
+    add_snapshot_benchmarks();
+    add_balance_report_benchmarks();
+    add_integrity_benchmarks();
+    add_request_benchmarks();
+    add_intent_benchmarks();
+    add_response_benchmarks();
+
+    bool regressed = false;
+    for (const auto& benchmark : benchmarks) {
+        if (benchmark.name.find(filter) == string::npos) {
+            continue;
+        }
+        int64_t iterations = 0;
+        map<string, double> counters;
+        double ns_per_op = measure(benchmark, min_time_ms, iterations, counters);
+        auto threshold = thresholds.find(benchmark.name);
+        string status = "no_threshold";
+        if (threshold != thresholds.end()) {
+            status = ns_per_op <= threshold->second ? "ok" : "regressed";
+            regressed = regressed || status == "regressed";
+        }
+        string extra;
+        for (const auto& counter : counters) {
+            char figure[64];
+            snprintf(figure, sizeof(figure), ",\"%s\":%.2f", counter.first.c_str(), counter.second);
+            extra += figure;
+        }
+        printf("{\"name\":\"%s\",\"iterations\":%lld,\"ns_per_op\":%.1f%s,\"threshold_ns\":%.1f,\"status\":\"%s\"}\n",
+               benchmark.name.c_str(), static_cast<long long>(iterations), ns_per_op, extra.c_str(),
+               threshold == thresholds.end() ? 0.0 : threshold->second, status.c_str());
+        fflush(stdout);
+    }
+
+    remove_scratch_files();
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file blockFile.cpp
+ * @brief Implementation of the BlockFile class.
+ * @author Kaden Oseen
+ */
+
+#include "blockFile.h"
+#include "crc32c.h"
+#include <algorithm>
+#include <charconv>
+
+using namespace std;
+
+constexpr string_view BlockFile::FORMAT_LINE;
+
+static const string_view BLOCK_PREFIX = "#block:";
+static const string_view SEQUENCE_PREFIX = "#sequence:";
+// ":" and 8 hex digits
+static const size_t SEAL_LENGTH = 9;
+
+/**
+ * @name Writer
+ * @brief Constructor for the Writer class. The first block starts at the end of out.
+ *
+ * @param out The file contents to append to
+ */
+BlockFile::Writer::Writer(string& out) : out(out), records(0), block_start(out.size()) {}
+
+/**
+ * @name header
+ * @brief Appends a header line, which the next block line covers but does not count.
+ *
+ * @param line The line, starting with '#'
+ */
+void BlockFile::Writer::header(string_view line) {
+    out.append(line);
+    out.push_back('\n');
+}
+
+/**
+ * @name add
+ * @brief Appends a record and its checksum.
+ *
+ * @param record The record, without a line break
+ */
+void BlockFile::Writer::add(string_view record) {
+    uint32_t crc = Crc32c::compute(record.data(), record.size());
+    out.append(record);
+    out.push_back(':');
+    out.append(Crc32c::hex(crc));
+    out.push_back('\n');
+    counted();
+}
+
+/**
+ * @name add
+ * @brief Appends the record "owner:record" and its checksum, without building it first.
+ *
+ * @param owner The first field
+ * @param record The rest of the record
+ */
+void BlockFile::Writer::add(string_view owner, string_view record) {
+    size_t start = out.size();
+    out.append(owner);
+    out.push_back(':');
+    out.append(record);
+    uint32_t crc = Crc32c::compute(out.data() + start, out.size() - start);
+    out.push_back(':');
+    out.append(Crc32c::hex(crc));
+    out.push_back('\n');
+    counted();
+}
+
+/**
+ * @name finish
+ * @brief Closes the last block, so the end of the file is checked too.
+ */
+void BlockFile::Writer::finish() {
+    if (records != 0 || out.size() != block_start) {
+        uint32_t crc = Crc32c::compute(out.data() + block_start, out.size() - block_start);
+        out.append(BLOCK_PREFIX);
+        out.append(to_string(records));
+        out.push_back(':');
+        out.append(Crc32c::hex(crc));
+        out.push_back('\n');
+        records = 0;
+        block_start = out.size();
+    }
+}
+
+/**
+ * @brief Counts a record just added, closing the block once it is full.
+ */
+void BlockFile::Writer::counted() {
+    if (++records == BLOCK) {
+        finish();
+    }
+}
+
+/**
+ * @name Reader
+ * @brief Constructor for the Reader class.
+ *
+ * @param sealed Whether the lines are checksummed, for a reader starting after the
+ * format line (see split()); otherwise it is known once the format line is read
+ */
+BlockFile::Reader::Reader(bool sealed) : sealed(sealed), block_crc(0), records(0) {}
+
+/**
+ * @name read
+ * @brief Reads the next line of the file and checks it: a record against its checksum,
+ * and a block line against the records and bytes read since the block began.
+ *
+ * @param line The line, without its line break
+ * @param kind Receives what the line is
+ * @param record Receives a record's contents, without its checksum, even if it is damaged
+ * @return false if the line, or the block it closes, is damaged
+ */
+bool BlockFile::Reader::read(string_view line, Line& kind, string_view& record) {
+    if (sealed && line.substr(0, BLOCK_PREFIX.size()) == BLOCK_PREFIX) {
+        kind = Line::BLOCK;
+        string_view fields = line.substr(BLOCK_PREFIX.size());
+        size_t colon = fields.find(':');
+        size_t count = 0;
+        uint32_t expected = 0;
+        bool valid = colon != string_view::npos &&
+                     from_chars(fields.data(), fields.data() + colon, count).ptr == fields.data() + colon &&
+                     Crc32c::parseHex(fields.substr(colon + 1), expected) && count == records && expected == block_crc;
+        block_crc = 0;
+        records = 0;
+        return valid;
+    }
+    block_crc = Crc32c::extend(block_crc, line.data(), line.size());
+    block_crc = Crc32c::extend(block_crc, "\n", 1);
+    if (line == FORMAT_LINE || line.substr(0, SEQUENCE_PREFIX.size()) == SEQUENCE_PREFIX) {
+        sealed = sealed || line == FORMAT_LINE;
+        kind = Line::HEADER;
+        return true;
+    }
+    kind = Line::RECORD;
+    if (!sealed) {
+        record = line;
+        return true;
+    }
+    ++records;
+    uint32_t expected;
+    if (line.size() < SEAL_LENGTH || line[line.size() - SEAL_LENGTH] != ':' ||
+        !Crc32c::parseHex(line.substr(line.size() - SEAL_LENGTH + 1), expected)) {
+        record = line;
+        return false;
+    }
+    record = line.substr(0, line.size() - SEAL_LENGTH);
+    return Crc32c::compute(record.data(), record.size()) == expected;
+}
+
+/**
+ * @name isSealed
+ * @brief Whether the lines read so far include the format line.
+ *
+ * @return true if records are checksummed
+ */
+bool BlockFile::Reader::isSealed() const {
+    return sealed;
+}
+
+/**
+ * @name seal
+ * @brief Returns a record line with its checksum, for appending outside any block.
+ *
+ * @param record The record
+ * @return The line, with its line break
+ */
+string BlockFile::seal(string_view record) {
+    string line;
+    Writer(line).add(record);
+    return line;
+}
+
+/**
+ * @name isSealed
+ * @brief Whether a file's contents are checksummed: the format line is its first or
+ * second line.
+ *
+ * @param contents The file's contents
+ * @return true if the file has the format line
+ */
+bool BlockFile::isSealed(string_view contents) {
+    size_t first = contents.find('\n');
+    if (contents.substr(0, first) == FORMAT_LINE) {
+        return true;
+    }
+    if (first == string_view::npos) {
+        return false;
+    }
+    size_t second = contents.find('\n', first + 1);
+    return contents.substr(first + 1, second == string_view::npos ? second : second - first - 1) == FORMAT_LINE;
+}
+
+/**
+ * @name split
+ * @brief Splits a file's contents into about equal parts that can be read separately:
+ * after block lines if it is checksummed (so each part holds whole blocks), after any
+ * line otherwise. Read every part but the first with Reader(isSealed(contents)).
+ *
+ * @param contents The file's contents
+ * @param parts The most parts wanted
+ * @return The parts, in order
+ */
+vector<string_view> BlockFile::split(string_view contents, size_t parts) {
+    bool sealed = isSealed(contents);
+    vector<string_view> pieces;
+    size_t start = 0;
+    for (size_t part = 1; part < parts && start < contents.size(); ++part) {
+        size_t target = max(start + 1, contents.size() * part / parts);
+        size_t end;
+        if (sealed) {
+            size_t block = contents.find("\n#block:", target - 1);
+            end = block == string_view::npos ? string_view::npos : contents.find('\n', block + 1);
+        } else {
+            end = contents.find('\n', target - 1);
+        }
+        if (end == string_view::npos) {
+            break;
+        }
+        pieces.push_back(contents.substr(start, end + 1 - start));
+        start = end + 1;
+    }
+    if (start < contents.size()) {
+        pieces.push_back(contents.substr(start));
+    }
+    return pieces;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file blockFile.h
+ * @brief Declaration of the BlockFile class.
+ * @author Kaden Oseen
+ */
+
+#ifndef BLOCK_FILE_H
+#define BLOCK_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class BlockFile
+ * @brief The checksummed layout of the users and history files. A file starts with the
+ * line "#format:crc32c" (after the history file's "#sequence" line), every record line
+ * ends with ":" and the CRC-32C of the rest of the line in 8 hex digits, and after every
+ * BLOCK records comes a line "#block:<records>:<CRC-32C>" whose checksum covers every
+ * byte since the previous block line, or since the start of the file. A damaged record
+ * fails its own checksum; a record lost, repeated or moved between blocks, or a file cut
+ * short at a line boundary, fails its block's. Records appended after the last block line
+ * (new accounts) are covered by their own checksums only.
+ *
+ * Files written before checksums lack the format line, and are read as they are.
+ */
+class BlockFile {
+public:
+    // Records per block
+    static constexpr size_t BLOCK = 1024;
+    static constexpr std::string_view FORMAT_LINE = "#format:crc32c";
+
+    /**
+     * @class Writer
+     * @brief Appends checksummed records and block lines to a file's contents.
+     */
+    class Writer {
+    public:
+        explicit Writer(std::string& out);
+        void header(std::string_view line);
+        void add(std::string_view record);
+        void add(std::string_view owner, std::string_view record);
+        void finish();
+    private:
+        std::string& out;
+        size_t records;
+        size_t block_start;
+
+        void counted();
+    };
+
+    /**
+     * @class Reader
+     * @brief Checks a file's lines in order, as they are read.
+     */
+    class Reader {
+    public:
+        enum class Line {
+            HEADER,
+            RECORD,
+            BLOCK
+        };
+
+        explicit Reader(bool sealed = false);
+        bool read(std::string_view line, Line& kind, std::string_view& record);
+        bool isSealed() const;
+    private:
+        bool sealed;
+        uint32_t block_crc;
+        size_t records;
+    };
+
+    static std::string seal(std::string_view record);
+    static bool isSealed(std::string_view contents);
+    static std::vector<std::string_view> split(std::string_view contents, size_t parts);
+};
+
+#endif
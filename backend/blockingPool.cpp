@@ -0,0 +1,98 @@
+/**
+ * @file blockingPool.cpp
+ * @brief Implementation of the BlockingPool class.
+ * @author Kaden Oseen
+ */
+
+#include "blockingPool.h"
+
+using namespace std;
+
+/**
+ * @name BlockingPool
+ * @brief Constructor for the BlockingPool class. No threads run until start().
+ */
+BlockingPool::BlockingPool() : running(false), stopped(false) {}
+
+/**
+ * @name ~BlockingPool
+ * @brief Destructor for the BlockingPool class. Stops the threads.
+ */
+BlockingPool::~BlockingPool() {
+    stop();
+}
+
+/**
+ * @name start
+ * @brief Starts the pool's threads.
+ *
+ * @param threads Number of threads
+ */
+void BlockingPool::start(int threads) {
+    lock_guard<mutex> guard(jobs_mutex);
+    running = true;
+    stopped = false;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(&BlockingPool::work, this);
+    }
+}
+
+/**
+ * @name stop
+ * @brief Finishes the queued jobs and stops the threads.
+ */
+void BlockingPool::stop() {
+    {
+        lock_guard<mutex> guard(jobs_mutex);
+        running = false;
+        stopped = true;
+    }
+    jobs_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+/**
+ * @name submit
+ * @brief Queues a job to run on one of the pool's threads. Once the pool is stopped the
+ * job runs at once on the caller's thread, so a coroutine waiting for it still resumes.
+ *
+ * @param job The job
+ */
+void BlockingPool::submit(function<void()> job) {
+    bool accepted = false;
+    {
+        lock_guard<mutex> guard(jobs_mutex);
+        if (!stopped) {
+            jobs.push_back(move(job));
+            accepted = true;
+        }
+    }
+    if (!accepted) {
+        job();
+        return;
+    }
+    jobs_cv.notify_one();
+}
+
+/**
+ * @name work
+ * @brief Runs queued jobs until the pool is stopped and the queue is empty.
+ */
+void BlockingPool::work() {
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(jobs_mutex);
+            jobs_cv.wait(lock, [this]() { return !running || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job = move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,82 @@
+/**
+ * @file blockingPool.h
+ * @brief Declaration of the BlockingPool class.
+ * @author Kaden Oseen
+ */
+
+#ifndef BLOCKING_POOL_H
+#define BLOCKING_POOL_H
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "eventLoop.h"
+
+/**
+ * @class BlockingPool
+ * @brief A few threads for calls that block, such as NLP requests, so coroutines on an
+ * EventLoop can wait for them without holding up the loop.
+ */
+class BlockingPool {
+public:
+    /**
+     * @struct CallAwaiter
+     * @brief Runs a blocking call on the pool and resumes the coroutine on its own loop
+     * with the result.
+     */
+    template <typename T>
+    struct CallAwaiter {
+        BlockingPool& pool;
+        std::function<T()> call;
+        std::optional<T> result;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            EventLoop* loop = EventLoop::current();
+            pool.submit([this, loop, handle]() {
+                result = call();
+                loop->post(handle);
+            });
+        }
+        T await_resume() { return std::move(*result); }
+    };
+
+    // Constructor and destructor
+    BlockingPool();
+    ~BlockingPool();
+    // Methods
+    void start(int threads);
+    void stop();
+    void submit(std::function<void()> job);
+
+    /**
+     * @brief Returns an awaiter that runs the call on the pool.
+     * Must be awaited from a coroutine running on an EventLoop.
+     * @param call The blocking call
+     * @return The awaiter, which yields the call's result
+     */
+    template <typename T>
+    CallAwaiter<T> run(std::function<T()> call) {
+        return CallAwaiter<T>{*this, std::move(call), std::nullopt};
+    }
+private:
+    // Variables
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_cv;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool running;
+    // Set by stop(); later jobs run on the caller's thread
+    bool stopped;
+
+    // Methods
+    void work();
+};
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * @file circuitBreaker.cpp
+ * @brief Implementation of the CircuitBreaker class.
+ * @author Kaden Oseen
+ */
+
+#include "circuitBreaker.h"
+#include "metrics.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @name CircuitBreaker
+ * @brief Constructor for the CircuitBreaker class. Starts closed with the default settings.
+ */
+CircuitBreaker::CircuitBreaker() : current(State::CLOSED), probing(false) {}
+
+/**
+ * @name configure
+ * @brief Replaces the settings and closes the breaker.
+ *
+ * @param settings When to open and for how long
+ */
+void CircuitBreaker::configure(const Settings& settings) {
+    lock_guard<mutex> guard(breaker_mutex);
+    this->settings = settings;
+    current = State::CLOSED;
+    samples.clear();
+    successes.clear();
+    probing = false;
+}
+
+/**
+ * @name allow
+ * @brief Whether a call may go ahead. Once an open breaker's cooldown is over, the first
+ * caller gets to make the probe call. A caller that is allowed must record() the outcome.
+ *
+ * @return true if the call may go ahead
+ */
+bool CircuitBreaker::allow() {
+    lock_guard<mutex> guard(breaker_mutex);
+    if (current == State::OPEN && chrono::steady_clock::now() - opened_at >= settings.cooldown) {
+        current = State::HALF_OPEN;
+        probing = false;
+    }
+    if (current == State::HALF_OPEN) {
+        if (probing) {
+            return false;
+        }
+        probing = true;
+        return true;
+    }
+    return current == State::CLOSED;
+}
+
+/**
+ * @name record
+ * @brief Records the outcome of an allowed call, opening the breaker if the window shows
+ * too many failures or too high a latency, or closing it after a successful probe.
+ *
+ * @param success Whether the call succeeded
+ * @param latency How long it took (the deadline, if it timed out)
+ */
+void CircuitBreaker::record(bool success, chrono::milliseconds latency) {
+    lock_guard<mutex> guard(breaker_mutex);
+    if (success) {
+        successes.push_back(latency);
+        if (successes.size() > LATENCY_HISTORY) {
+            successes.pop_front();
+        }
+    }
+    if (current == State::HALF_OPEN) {
+        probing = false;
+        if (success) {
+            current = State::CLOSED;
+            samples.clear();
+            cout << "NLP circuit breaker closed" << endl;
+        } else {
+            trip("the probe request failed");
+        }
+        return;
+    }
+    if (current == State::OPEN) {
+        return;
+    }
+    samples.push_back({success, latency});
+    if (samples.size() > settings.window) {
+        samples.pop_front();
+    }
+    if (samples.size() < settings.window) {
+        return;
+    }
+    size_t failures = count_if(samples.begin(), samples.end(), [](const Sample& sample) { return !sample.success; });
+    if (failures * 100 >= settings.window * settings.error_percent) {
+        trip(to_string(failures) + " of the last " + to_string(samples.size()) + " requests failed");
+    } else {
+        chrono::milliseconds p95 = windowLatency(0.95);
+        if (p95 > settings.latency_limit) {
+            trip("p95 latency reached " + to_string(p95.count()) + " ms");
+        }
+    }
+}
+
+/**
+ * @name state
+ * @brief Returns whether calls are let through.
+ *
+ * @return The state
+ */
+CircuitBreaker::State CircuitBreaker::state() {
+    lock_guard<mutex> guard(breaker_mutex);
+    return current;
+}
+
+/**
+ * @name percentile
+ * @brief Returns a percentile of the latency of the last few hundred successful calls.
+ *
+ * @param fraction The percentile as a fraction (0.95 for p95)
+ * @return The latency, or 0 if no call has succeeded yet
+ */
+chrono::milliseconds CircuitBreaker::percentile(double fraction) {
+    lock_guard<mutex> guard(breaker_mutex);
+    return latencyAt(fraction, vector<chrono::milliseconds>(successes.begin(), successes.end()));
+}
+
+/**
+ * @name status
+ * @brief Renders the breaker's state for the metrics endpoint.
+ *
+ * @return "key=value" lines
+ */
+string CircuitBreaker::status() {
+    lock_guard<mutex> guard(breaker_mutex);
+    static const char* STATE_NAMES[] = {"closed", "open", "half_open"};
+    size_t failures = count_if(samples.begin(), samples.end(), [](const Sample& sample) { return !sample.success; });
+    ostringstream out;
+    out << "breaker=" << STATE_NAMES[static_cast<int>(current)] << "\n";
+    out << "window_requests=" << samples.size() << "\n";
+    out << "window_failures=" << failures << "\n";
+    out << "window_p95_ms=" << windowLatency(0.95).count() << "\n";
+    return out.str();
+}
+
+/**
+ * @name trip
+ * @brief Opens the breaker for a cooldown. Must hold breaker_mutex.
+ *
+ * @param reason Why, for the log
+ */
+void CircuitBreaker::trip(const string& reason) {
+    static atomic<int64_t>& nlp_breaker_trips = Metrics::counter("nlp_breaker_trips");
+    current = State::OPEN;
+    opened_at = chrono::steady_clock::now();
+    samples.clear();
+    ++nlp_breaker_trips;
+    cerr << "NLP circuit breaker opened for " << settings.cooldown.count() << " ms: " << reason << endl;
+}
+
+/**
+ * @name windowLatency
+ * @brief Returns a percentile of the latency of every call in the window. Must hold breaker_mutex.
+ *
+ * @param fraction The percentile as a fraction
+ * @return The latency, or 0 if the window is empty
+ */
+chrono::milliseconds CircuitBreaker::windowLatency(double fraction) const {
+    vector<chrono::milliseconds> latencies;
+    latencies.reserve(samples.size());
+    for (const Sample& sample : samples) {
+        latencies.push_back(sample.latency);
+    }
+    return latencyAt(fraction, move(latencies));
+}
+
+/**
+ * @name latencyAt
+ * @brief Returns a percentile of a set of latencies.
+ *
+ * @param fraction The percentile as a fraction
+ * @param latencies The latencies, reordered in place
+ * @return The latency, or 0 if there are none
+ */
+chrono::milliseconds CircuitBreaker::latencyAt(double fraction, vector<chrono::milliseconds> latencies) {
+    if (latencies.empty()) {
+        return chrono::milliseconds(0);
+    }
+    size_t index = min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()));
+    nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+    return latencies[index];
+}
@@ -0,0 +1,85 @@
+/**
+ * @file circuitBreaker.h
+ * @brief Declaration of the CircuitBreaker class.
+ * @author Kaden Oseen
+ */
+
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @class CircuitBreaker
+ * @brief Stops calls to an upstream service while it is failing or slow.
+ * Keeps the outcome and latency of the last few calls. Once the window is full and either
+ * too many of them failed or the slowest of them are too slow, the breaker opens and every
+ * call is refused at once for a cooldown. Then a single probe call is let through: if it
+ * succeeds the breaker closes, otherwise it stays open for another cooldown.
+ * The latency of the last few hundred successful calls gives the percentile used to time
+ * hedged calls, since a window small enough to react quickly is too small to estimate a p95.
+ */
+class CircuitBreaker {
+public:
+    // Whether calls are let through
+    enum class State : uint8_t {
+        CLOSED,     // every call
+        OPEN,       // none, until the cooldown is over
+        HALF_OPEN   // one probe call
+    };
+
+    /**
+     * @struct Settings
+     * @brief When the breaker opens and for how long.
+     */
+    struct Settings {
+        size_t window = 20;
+        int error_percent = 50;
+        std::chrono::milliseconds latency_limit{3000};
+        std::chrono::milliseconds cooldown{10000};
+    };
+
+    // Constructor
+    CircuitBreaker();
+    // Methods
+    void configure(const Settings& settings);
+    bool allow();
+    void record(bool success, std::chrono::milliseconds latency);
+    State state();
+    std::chrono::milliseconds percentile(double fraction);
+    std::string status();
+private:
+    /**
+     * @struct Sample
+     * @brief The outcome of one call.
+     */
+    struct Sample {
+        bool success;
+        std::chrono::milliseconds latency;
+    };
+
+    // How many successful latencies percentile() looks at
+    static const size_t LATENCY_HISTORY = 256;
+
+    // Variables
+    std::mutex breaker_mutex;
+    Settings settings;
+    State current;
+    std::deque<Sample> samples;
+    std::deque<std::chrono::milliseconds> successes;
+    std::chrono::steady_clock::time_point opened_at;
+    // Whether the probe call of the half-open state is in flight
+    bool probing;
+
+    // Methods
+    void trip(const std::string& reason);
+    std::chrono::milliseconds windowLatency(double fraction) const;
+    static std::chrono::milliseconds latencyAt(double fraction, std::vector<std::chrono::milliseconds> latencies);
+};
+
+#endif
@@ -0,0 +1,548 @@
+/**
+ * @file cluster.cpp
+ * @brief Implementation of the Cluster class and the ClusterSettlementGateway.
+ * Nodes call each other with one request per connection: the caller writes its lines and
+ * shuts down its side, and the callee answers with one line per request line:
+ *   PREPARE:<amount>:<username>   ->   YES or NO
+ *   COMMIT:<key>:<amount>:<sender>:<username>   ->   SETTLED, RETRY or REJECTED
+ * @author Kaden Oseen
+ */
+
+#include "cluster.h"
+#include "databaseHandler.h"
+#include "metrics.h"
+#include "transferEngine.h"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <map>
+#include <sstream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Largest request or reply read from another node
+static const size_t MAX_MESSAGE = 1 << 20;
+
+/**
+ * @brief Reads from a socket until the other side shuts down its end.
+ * @param connection The socket
+ * @param message Receives what was read
+ * @return true if the whole message was read
+ */
+static bool read_all(int connection, string& message) {
+    char buffer[4096];
+    while (message.size() < MAX_MESSAGE) {
+        ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            return true;
+        }
+        if (received < 0) {
+            return false;
+        }
+        message.append(buffer, received);
+    }
+    return false;
+}
+
+/**
+ * @brief Writes a whole message to a socket.
+ * @param connection The socket
+ * @param message The message
+ * @return true if every byte was sent
+ */
+static bool write_all(int connection, const string& message) {
+    size_t sent = 0;
+    while (sent < message.size()) {
+        ssize_t result = send(connection, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+/**
+ * @name Cluster
+ * @brief Constructor for the Cluster class. Until configure() is called the server is a
+ * single node that owns every account.
+ */
+Cluster::Cluster() : node_id(0), database(nullptr), engine(nullptr), listen_socket(-1), running(false), active_calls(0) {}
+
+/**
+ * @name ~Cluster
+ * @brief Destructor for the Cluster class. Stops answering other nodes.
+ */
+Cluster::~Cluster() {
+    stop();
+}
+
+/**
+ * @name configure
+ * @brief Reads the list of nodes and which of them this server is.
+ *
+ * @param nodes Comma separated "host:client_port:cluster_port" entries, or "" for a single node
+ * @param node_id Position of this server in the list
+ * @return true if the list is valid
+ */
+bool Cluster::configure(const string& nodes, int node_id) {
+    this->nodes.clear();
+    this->node_id = node_id;
+    if (nodes.empty()) {
+        return true;
+    }
+    stringstream entries(nodes);
+    string entry;
+    while (getline(entries, entry, ',')) {
+        Node node;
+        size_t first = entry.find(':');
+        size_t second = first == string::npos ? first : entry.find(':', first + 1);
+        struct in_addr address;
+        try {
+            if (second == string::npos) {
+                throw invalid_argument(entry);
+            }
+            node.host = entry.substr(entry.find_first_not_of(' '), first - entry.find_first_not_of(' '));
+            node.client_port = stoi(entry.substr(first + 1, second - first - 1));
+            node.cluster_port = stoi(entry.substr(second + 1));
+        } catch (const exception& e) {
+            cerr << "Config error: cluster_nodes entry \"" << entry << "\" is not host:client_port:cluster_port" << endl;
+            return false;
+        }
+        if (inet_pton(AF_INET, node.host.c_str(), &address) != 1 || node.client_port < 1 || node.client_port > 65535 ||
+            node.cluster_port < 1 || node.cluster_port > 65535) {
+            cerr << "Config error: cluster_nodes entry \"" << entry << "\" needs an IPv4 address and two ports" << endl;
+            return false;
+        }
+        this->nodes.push_back(node);
+    }
+    if (node_id >= static_cast<int>(this->nodes.size())) {
+        cerr << "Config error: node_id " << node_id << " is not in cluster_nodes" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @name enabled
+ * @brief Whether the server is part of a cluster.
+ *
+ * @return true if cluster_nodes is set
+ */
+bool Cluster::enabled() const {
+    return !nodes.empty();
+}
+
+/**
+ * @name size
+ * @brief Returns the number of nodes.
+ *
+ * @return The number of nodes, 0 for a single server
+ */
+size_t Cluster::size() const {
+    return nodes.size();
+}
+
+/**
+ * @name self
+ * @brief Returns this server's node id.
+ *
+ * @return The node id
+ */
+int Cluster::self() const {
+    return node_id;
+}
+
+/**
+ * @name node
+ * @brief Returns the addresses of a node.
+ *
+ * @param id The node id
+ * @return The node
+ */
+const Cluster::Node& Cluster::node(int id) const {
+    return nodes[id];
+}
+
+/**
+ * @name ownerOf
+ * @brief Returns the node owning an account, whether or not the account exists.
+ * FNV-1a of the username, so every node agrees without asking the others.
+ *
+ * @param username The username
+ * @return The node id
+ */
+int Cluster::ownerOf(string_view username) const {
+    if (nodes.empty()) {
+        return node_id;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : username) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash % nodes.size();
+}
+
+/**
+ * @name isLocal
+ * @brief Whether this node owns an account.
+ *
+ * @param username The username
+ * @return true if the account belongs on this node
+ */
+bool Cluster::isLocal(string_view username) const {
+    return ownerOf(username) == node_id;
+}
+
+/**
+ * @name start
+ * @brief Starts answering the other nodes on this node's cluster port.
+ *
+ * @param database The accounts this node owns
+ * @param engine The engine that credits transfers from other nodes
+ * @return true if the port is open, or the server is not part of a cluster
+ */
+bool Cluster::start(DatabaseHandler& database, TransferEngine& engine) {
+    if (!enabled()) {
+        return true;
+    }
+    this->database = &database;
+    this->engine = &engine;
+    const Node& own = nodes[node_id];
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(own.cluster_port);
+    inet_pton(AF_INET, own.host.c_str(), &address.sin_addr);
+    if (bind(listen_socket, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(listen_socket, 128) < 0) {
+        cerr << "Could not listen for cluster nodes on " << own.host << ":" << own.cluster_port << endl;
+        close(listen_socket);
+        listen_socket = -1;
+        return false;
+    }
+    running = true;
+    acceptor = thread(&Cluster::accept, this);
+    cout << "Node " << node_id << " of " << nodes.size() << ", cluster port " << own.cluster_port << endl;
+    return true;
+}
+
+/**
+ * @name stop
+ * @brief Stops accepting calls from other nodes and waits for the ones being answered, so
+ * every credit they started is committed before the TransferEngine stops.
+ */
+void Cluster::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    // Wakes the blocked accept()
+    shutdown(listen_socket, SHUT_RDWR);
+    if (acceptor.joinable()) {
+        acceptor.join();
+    }
+    close(listen_socket);
+    listen_socket = -1;
+    unique_lock<mutex> lock(calls_mutex);
+    calls_cv.wait(lock, [this]() { return active_calls == 0; });
+}
+
+/**
+ * @name accept
+ * @brief Answers each connection from another node on its own thread until stopped.
+ */
+void Cluster::accept() {
+    while (running) {
+        int connection = ::accept(listen_socket, nullptr, nullptr);
+        if (connection < 0) {
+            continue;
+        }
+        {
+            lock_guard<mutex> guard(calls_mutex);
+            ++active_calls;
+        }
+        thread(&Cluster::answer, this, connection).detach();
+    }
+}
+
+/**
+ * @name answer
+ * @brief Reads one request from another node, answers it and closes the connection.
+ *
+ * @param connection The accepted connection
+ */
+void Cluster::answer(int connection) {
+    timeval timeout = {CALL_TIMEOUT_MS / 1000, (CALL_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    string request;
+    if (read_all(connection, request)) {
+        write_all(connection, handle(request));
+    }
+    close(connection);
+    lock_guard<mutex> guard(calls_mutex);
+    --active_calls;
+    calls_cv.notify_all();
+}
+
+/**
+ * @name handle
+ * @brief Answers every line of a request. Credits are submitted together, so a batch of
+ * transfers from another node is committed with one journal append.
+ *
+ * @param request The request lines
+ * @return One answer line per request line
+ */
+string Cluster::handle(const string& request) {
+    static atomic<int64_t>& cluster_prepares = Metrics::counter("cluster_prepares");
+    static atomic<int64_t>& cluster_transfers_received = Metrics::counter("cluster_transfers_received");
+    stringstream lines(request);
+    string line;
+    vector<string> answers;
+    vector<TransferEngine::Transfer> credits;
+    vector<size_t> credit_answers;
+    while (getline(lines, line)) {
+        // Fields after the command; the last one, the username, may hold anything but a newline
+        size_t first = line.find(':');
+        size_t second = first == string::npos ? first : line.find(':', first + 1);
+        string command = line.substr(0, first);
+        if (command == "PREPARE" && second != string::npos) {
+            ++cluster_prepares;
+            double amount = strtod(line.c_str() + first + 1, nullptr);
+            string username = line.substr(second + 1);
+            bool exists = isLocal(username) && database->getRecipient(username) != nullptr;
+            answers.push_back(exists && amount >= 0 ? "YES" : "NO");
+            continue;
+        }
+        size_t third = second == string::npos ? second : line.find(':', second + 1);
+        size_t fourth = third == string::npos ? third : line.find(':', third + 1);
+        if (command != "COMMIT" || fourth == string::npos) {
+            answers.push_back("REJECTED");
+            continue;
+        }
+        TransferEngine::Transfer credit;
+        credit.kind = TransferEngine::Kind::RECEIVE;
+        credit.payout = strtoull(line.c_str() + first + 1, nullptr, 10);
+        credit.amount = strtod(line.c_str() + second + 1, nullptr);
+        credit.recipient = line.substr(third + 1, fourth - third - 1);
+        string username = line.substr(fourth + 1);
+        credit.to = isLocal(username) ? database->getRecipient(username) : nullptr;
+        if (database->hasReceived(credit.payout)) {
+            // Credited before, but the acknowledgement was lost
+            answers.push_back("SETTLED");
+            continue;
+        }
+        if (credit.to == nullptr || credit.amount < 0) {
+            answers.push_back("REJECTED");
+            continue;
+        }
+        {
+            lock_guard<mutex> guard(calls_mutex);
+            if (!receiving.insert(credit.payout).second) {
+                // The same transfer is being credited for an earlier call
+                answers.push_back("RETRY");
+                continue;
+            }
+        }
+        answers.push_back("");
+        credits.push_back(credit);
+        credit_answers.push_back(answers.size() - 1);
+    }
+
+    if (!credits.empty()) {
+        latch done(credits.size());
+        for (const auto& credit : credits) {
+            engine->submit(credit, [&done](const TransferEngine::Result&) { done.count_down(); });
+        }
+        done.wait();
+        lock_guard<mutex> guard(calls_mutex);
+        for (size_t i = 0; i < credits.size(); ++i) {
+            // Only a credit whose batch reached the journal is acknowledged
+            bool committed = database->hasReceived(credits[i].payout);
+            answers[credit_answers[i]] = committed ? "SETTLED" : "RETRY";
+            cluster_transfers_received += committed ? 1 : 0;
+            receiving.erase(credits[i].payout);
+        }
+    }
+
+    string reply;
+    for (const auto& answer : answers) {
+        reply += answer + "\n";
+    }
+    return reply;
+}
+
+/**
+ * @name call
+ * @brief Sends a request to another node and waits for its answer.
+ *
+ * @param node The node
+ * @param request The request lines
+ * @return The answer, or "" if the node could not be reached in time
+ */
+string Cluster::call(int node, const string& request) {
+    static atomic<int64_t>& cluster_calls_failed = Metrics::counter("cluster_calls_failed");
+    int connection = socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout = {CALL_TIMEOUT_MS / 1000, (CALL_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(nodes[node].cluster_port);
+    inet_pton(AF_INET, nodes[node].host.c_str(), &address.sin_addr);
+    string answer;
+    bool answered = connect(connection, (struct sockaddr*) &address, sizeof(address)) == 0 &&
+                    write_all(connection, request) && shutdown(connection, SHUT_WR) == 0 && read_all(connection, answer);
+    close(connection);
+    if (!answered) {
+        ++cluster_calls_failed;
+        cerr << "Error: node " << node << " did not answer" << endl;
+        return "";
+    }
+    return answer;
+}
+
+/**
+ * @name prepare
+ * @brief First phase of a transfer to another node: asks the recipient's node whether it
+ * can be credited. Blocks on the network, so coroutine sessions run it on the blocking pool.
+ *
+ * @param node The recipient's node
+ * @param username The recipient
+ * @param amount The amount to transfer
+ * @return The recipient node's vote
+ */
+Cluster::Vote Cluster::prepare(int node, const string& username, double amount) {
+    ostringstream request;
+    request << setprecision(Journal::BALANCE_PRECISION) << "PREPARE:" << amount << ":" << username << "\n";
+    string answer = call(node, request.str());
+    if (answer.empty()) {
+        return Vote::UNAVAILABLE;
+    }
+    return answer == "YES\n" ? Vote::YES : Vote::NO;
+}
+
+/**
+ * @name commit
+ * @brief Second phase of transfers to another node: delivers committed payouts to the
+ * recipients' node. Safe to repeat; the node credits each payout once.
+ *
+ * @param node The recipients' node
+ * @param payouts Payouts to "node:<node>:<username>" recipients
+ * @return One outcome per payout; RETRY for every one if the node did not answer
+ */
+vector<SettlementGateway::Outcome> Cluster::commit(int node, const vector<Journal::Payout>& payouts) {
+    ostringstream request;
+    request << setprecision(Journal::BALANCE_PRECISION);
+    for (const auto& payout : payouts) {
+        int recipient_node;
+        string username;
+        parseRecipient(payout.recipient, recipient_node, username);
+        // Payout ids are only unique per node, so the key includes the sender's node
+        uint64_t key = static_cast<uint64_t>(node_id) << 48 | payout.id;
+        request << "COMMIT:" << key << ":" << payout.amount << ":" << payout.username << ":" << username << "\n";
+    }
+    stringstream answer(call(node, request.str()));
+    vector<SettlementGateway::Outcome> outcomes;
+    string line;
+    while (outcomes.size() < payouts.size() && getline(answer, line)) {
+        if (line == "SETTLED") {
+            outcomes.push_back(SettlementGateway::Outcome::SETTLED);
+        } else if (line == "REJECTED") {
+            outcomes.push_back(SettlementGateway::Outcome::REJECTED);
+        } else {
+            outcomes.push_back(SettlementGateway::Outcome::RETRY);
+        }
+    }
+    outcomes.resize(payouts.size(), SettlementGateway::Outcome::RETRY);
+    return outcomes;
+}
+
+/**
+ * @name recipientFor
+ * @brief Returns the payout recipient standing for an account on another node.
+ *
+ * @param node The account's node
+ * @param username The account
+ * @return "node:<node>:<username>"
+ */
+string Cluster::recipientFor(int node, const string& username) {
+    return "node:" + to_string(node) + ":" + username;
+}
+
+/**
+ * @name parseRecipient
+ * @brief Reads back a recipient made by recipientFor.
+ *
+ * @param recipient The payout recipient
+ * @param node Receives the account's node
+ * @param username Receives the account
+ * @return true if the recipient is an account on a node, false if it is external
+ */
+bool Cluster::parseRecipient(const string& recipient, int& node, string& username) {
+    size_t separator = recipient.find(':', 5);
+    if (recipient.rfind("node:", 0) != 0 || separator == string::npos) {
+        return false;
+    }
+    node = atoi(recipient.c_str() + 5);
+    username = recipient.substr(separator + 1);
+    return true;
+}
+
+
+/**
+ * @name ClusterSettlementGateway
+ * @brief Constructor for the ClusterSettlementGateway class.
+ *
+ * @param cluster The cluster holding the recipients' nodes
+ * @param external The gateway for external recipients
+ */
+ClusterSettlementGateway::ClusterSettlementGateway(Cluster& cluster, unique_ptr<SettlementGateway> external)
+    : cluster(cluster), external(move(external)) {}
+
+/**
+ * @name settle
+ * @brief Delivers payouts to other nodes, one call per node, and the rest to the external gateway.
+ *
+ * @param payouts The payouts
+ * @return One outcome per payout
+ */
+vector<SettlementGateway::Outcome> ClusterSettlementGateway::settle(const vector<Journal::Payout>& payouts) {
+    vector<Outcome> outcomes(payouts.size(), Outcome::RETRY);
+    // Indexes of the payouts for each node, and of the external ones under -1
+    map<int, vector<size_t>> groups;
+    for (size_t i = 0; i < payouts.size(); ++i) {
+        int node = -1;
+        string username;
+        Cluster::parseRecipient(payouts[i].recipient, node, username);
+        groups[node].push_back(i);
+    }
+    for (const auto& group : groups) {
+        vector<Journal::Payout> batch;
+        for (size_t index : group.second) {
+            batch.push_back(payouts[index]);
+        }
+        vector<Outcome> results;
+        if (group.first < 0) {
+            results = external->settle(batch);
+        } else if (group.first < static_cast<int>(cluster.size())) {
+            results = cluster.commit(group.first, batch);
+        } else {
+            // A node that is no longer in the cluster
+            results.assign(batch.size(), Outcome::REJECTED);
+        }
+        results.resize(batch.size(), Outcome::RETRY);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            outcomes[group.second[i]] = results[i];
+        }
+    }
+    return outcomes;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file cluster.h
+ * @brief Declaration of the Cluster class and the gateway that settles transfers between nodes.
+ * @author Kaden Oseen
+ */
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "journal.h"
+#include "settlementGateway.h"
+
+class DatabaseHandler;
+class TransferEngine;
+
+/**
+ * @class Cluster
+ * @brief Splits the accounts between several servers by a hash of the username.
+ * Each node owns the accounts whose hash falls on it and is the only one that loads,
+ * changes or logs them in, so its login registry is the cluster's for those accounts and
+ * a client asking another node for them is redirected. Nodes talk over a plain line
+ * protocol on their cluster port, which must only be reachable by the other nodes.
+ *
+ * A transfer to an account on another node is a two-phase commit coordinated by the
+ * sender's node: the recipient's node first votes on it (PREPARE), then the debit and a
+ * payout to "node:<id>:<username>" are committed together on the sender's node, which is
+ * the point of no return. The Outbox delivers the payout (COMMIT) until the recipient's
+ * node acknowledges it; that node credits each transfer once, by its cluster-wide key, and
+ * a payout it rejects is refunded like any other.
+ */
+class Cluster {
+public:
+    // Answer to a PREPARE
+    enum class Vote : uint8_t {
+        YES,            // the recipient exists and can be credited
+        NO,             // there is no such recipient
+        UNAVAILABLE     // the recipient's node did not answer
+    };
+
+    /**
+     * @struct Node
+     * @brief Where a node accepts clients and where it accepts other nodes.
+     */
+    struct Node {
+        std::string host;
+        int client_port = 0;
+        int cluster_port = 0;
+    };
+
+    // Constructor and destructor
+    Cluster();
+    ~Cluster();
+    // Methods
+    bool configure(const std::string& nodes, int node_id);
+    bool enabled() const;
+    size_t size() const;
+    int self() const;
+    const Node& node(int id) const;
+    int ownerOf(std::string_view username) const;
+    bool isLocal(std::string_view username) const;
+    bool start(DatabaseHandler& database, TransferEngine& engine);
+    void stop();
+    Vote prepare(int node, const std::string& username, double amount);
+    std::vector<SettlementGateway::Outcome> commit(int node, const std::vector<Journal::Payout>& payouts);
+    static std::string recipientFor(int node, const std::string& username);
+    static bool parseRecipient(const std::string& recipient, int& node, std::string& username);
+private:
+    // How long a call to another node may take before it counts as unanswered
+    static const int CALL_TIMEOUT_MS = 2000;
+
+    // Variables
+    std::vector<Node> nodes;
+    int node_id;
+    DatabaseHandler* database;
+    TransferEngine* engine;
+    int listen_socket;
+    std::thread acceptor;
+    std::atomic<bool> running;
+    // Connections being answered, so stop() can wait for them
+    std::mutex calls_mutex;
+    std::condition_variable calls_cv;
+    int active_calls;
+    // Keys of the transfers being credited, so a repeated COMMIT cannot credit one twice
+    std::unordered_set<uint64_t> receiving;
+
+    // Methods
+    void accept();
+    void answer(int connection);
+    std::string handle(const std::string& request);
+    std::string call(int node, const std::string& request);
+};
+
+/**
+ * @class ClusterSettlementGateway
+ * @brief Settles payouts to accounts on other nodes through the Cluster, and hands every
+ * other payout to the gateway for external recipients.
+ */
+class ClusterSettlementGateway : public SettlementGateway {
+public:
+    // Constructor
+    ClusterSettlementGateway(Cluster& cluster, std::unique_ptr<SettlementGateway> external);
+    // Methods
+    std::vector<Outcome> settle(const std::vector<Journal::Payout>& payouts) override;
+private:
+    // Variables
+    Cluster& cluster;
+    std::unique_ptr<SettlementGateway> external;
+};
+
+#endif
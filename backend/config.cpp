@@ -0,0 +1,358 @@
+/**
+ * @file config.cpp
+ * @brief Implementation of the ServerConfig class.
+ * Replaces the ports, paths and limits that used to be hard-coded across the server.
+ * @author Kaden Oseen
+ */
+
+#include "config.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+
+ServerConfig server_config;
+
+// Every setting by name, grouped by type so set() and describe() can share them
+static const pair<const char*, int ServerConfig::*> INT_OPTIONS[] = {
+    {"port", &ServerConfig::port},
+    {"backlog", &ServerConfig::backlog},
+    {"acceptor_threads", &ServerConfig::acceptor_threads},
+    {"max_sessions", &ServerConfig::max_sessions},
+    {"event_loops", &ServerConfig::event_loops},
+    {"blocking_threads", &ServerConfig::blocking_threads},
+    {"transfer_threads", &ServerConfig::transfer_threads},
+    {"transfer_batch", &ServerConfig::transfer_batch},
+    {"checkpoint_bytes", &ServerConfig::checkpoint_bytes},
+    {"settlement_batch", &ServerConfig::settlement_batch},
+    {"settlement_attempts", &ServerConfig::settlement_attempts},
+    {"settlement_retry_ms", &ServerConfig::settlement_retry_ms},
+    {"settlement_stub_failure_percent", &ServerConfig::settlement_stub_failure_percent},
+    {"settlement_stub_latency_ms", &ServerConfig::settlement_stub_latency_ms},
+    {"node_id", &ServerConfig::node_id},
+    {"replication_timeout_ms", &ServerConfig::replication_timeout_ms},
+    {"nlp_timeout_ms", &ServerConfig::nlp_timeout_ms},
+    {"nlp_hedge_min_ms", &ServerConfig::nlp_hedge_min_ms},
+    {"nlp_breaker_window", &ServerConfig::nlp_breaker_window},
+    {"nlp_breaker_error_percent", &ServerConfig::nlp_breaker_error_percent},
+    {"nlp_breaker_latency_ms", &ServerConfig::nlp_breaker_latency_ms},
+    {"nlp_breaker_cooldown_ms", &ServerConfig::nlp_breaker_cooldown_ms},
+    {"intent_min_confidence_percent", &ServerConfig::intent_min_confidence_percent},
+    {"handshake_timeout_ms", &ServerConfig::handshake_timeout_ms},
+    {"login_timeout_ms", &ServerConfig::login_timeout_ms},
+    {"idle_timeout_ms", &ServerConfig::idle_timeout_ms},
+    {"export_chunk_bytes", &ServerConfig::export_chunk_bytes},
+    {"report_threads", &ServerConfig::report_threads},
+    {"drain_timeout_ms", &ServerConfig::drain_timeout_ms},
+    {"metrics_port", &ServerConfig::metrics_port},
+};
+static const pair<const char*, bool ServerConfig::*> BOOL_OPTIONS[] = {
+    {"reuse_port", &ServerConfig::reuse_port},
+    {"tcp_nodelay", &ServerConfig::tcp_nodelay},
+    {"pin_acceptors", &ServerConfig::pin_acceptors},
+    {"nlp_hedge", &ServerConfig::nlp_hedge},
+};
+static const pair<const char*, string ServerConfig::*> STRING_OPTIONS[] = {
+    {"session_mode", &ServerConfig::session_mode},
+    {"settlement_gateway", &ServerConfig::settlement_gateway},
+    {"cluster_nodes", &ServerConfig::cluster_nodes},
+    {"replication_socket", &ServerConfig::replication_socket},
+    {"replication_mode", &ServerConfig::replication_mode},
+    {"replicate_from", &ServerConfig::replicate_from},
+    {"history_format", &ServerConfig::history_format},
+    {"users_file", &ServerConfig::users_file},
+    {"cert_file", &ServerConfig::cert_file},
+    {"key_file", &ServerConfig::key_file},
+    {"nlp_endpoint", &ServerConfig::nlp_endpoint},
+    {"nlp_model", &ServerConfig::nlp_model},
+    {"nlp_api_key", &ServerConfig::nlp_api_key},
+    {"intent_model", &ServerConfig::intent_model},
+    {"handoff_socket", &ServerConfig::handoff_socket},
+};
+
+/**
+ * @brief Removes leading and trailing whitespace from a string
+ * @param str String to be trimmed
+ * @return Trimmed string
+ */
+static string trim(const string& str) {
+    size_t start = str.find_first_not_of(" \t\r\n");
+    if (start == string::npos) {
+        return "";
+    }
+    size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(start, end - start + 1);
+}
+
+/**
+ * @name load
+ * @brief Loads the configuration from a file and the command line.
+ * The file is given by --config=<path>, or "server.conf" if it exists.
+ * Every other --key=value flag overrides the matching file setting.
+ *
+ * @param argc Argument count from main
+ * @param argv Argument vector from main
+ * @return true if everything parsed and validated
+ */
+bool ServerConfig::load(int argc, char* argv[]) {
+    string path = "";
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--config=", 0) == 0) {
+            path = arg.substr(9);
+        }
+    }
+    if (path != "") {
+        if (!loadFile(path)) {
+            return false;
+        }
+    } else if (access("server.conf", R_OK) == 0 && !loadFile("server.conf")) {
+        return false;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equals == string::npos) {
+            cerr << "Invalid argument: " << arg << " (expected --key=value)" << endl;
+            return false;
+        }
+        string key = arg.substr(2, equals - 2);
+        if (key == "config") {
+            continue;
+        }
+        if (!set(key, arg.substr(equals + 1))) {
+            return false;
+        }
+    }
+    return validate();
+}
+
+/**
+ * @name loadFile
+ * @brief Reads "key = value" lines from a file. Blank lines and lines starting with # are skipped.
+ *
+ * @param path Path of the configuration file
+ * @return true if the file was read and every line was valid
+ */
+bool ServerConfig::loadFile(const string& path) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "Could not open config file " << path << endl;
+        return false;
+    }
+    string line;
+    int line_number = 0;
+    while (getline(file, line)) {
+        ++line_number;
+        line = trim(line);
+        if (line == "" || line[0] == '#') {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == string::npos) {
+            cerr << path << ":" << line_number << ": expected key = value" << endl;
+            return false;
+        }
+        if (!set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)))) {
+            cerr << path << ":" << line_number << ": invalid setting" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @name set
+ * @brief Sets a single option by name.
+ *
+ * @param key The option name
+ * @param value The option value as text
+ * @return true if the option exists and the value has the right type
+ */
+bool ServerConfig::set(const string& key, const string& value) {
+    for (const auto& option : INT_OPTIONS) {
+        if (key == option.first) {
+            try {
+                size_t used = 0;
+                int parsed = stoi(value, &used);
+                if (used != value.size()) {
+                    throw invalid_argument(value);
+                }
+                this->*option.second = parsed;
+                return true;
+            } catch (const exception& e) {
+                cerr << "Option " << key << " expects a number, got \"" << value << "\"" << endl;
+                return false;
+            }
+        }
+    }
+    for (const auto& option : BOOL_OPTIONS) {
+        if (key == option.first) {
+            if (value == "true" || value == "1" || value == "yes") {
+                this->*option.second = true;
+            } else if (value == "false" || value == "0" || value == "no") {
+                this->*option.second = false;
+            } else {
+                cerr << "Option " << key << " expects true or false, got \"" << value << "\"" << endl;
+                return false;
+            }
+            return true;
+        }
+    }
+    for (const auto& option : STRING_OPTIONS) {
+        if (key == option.first) {
+            this->*option.second = value;
+            return true;
+        }
+    }
+    cerr << "Unknown option: " << key << endl;
+    return false;
+}
+
+/**
+ * @name validate
+ * @brief Checks ranges and that the files the server needs can be read.
+ * Reports every problem found rather than stopping at the first.
+ *
+ * @return true if the configuration is usable
+ */
+bool ServerConfig::validate() const {
+    bool valid = true;
+    auto fail = [&valid](const string& message) {
+        cerr << "Config error: " << message << endl;
+        valid = false;
+    };
+    if (port < 1 || port > 65535) {
+        fail("port must be between 1 and 65535");
+    }
+    if (backlog < 1) {
+        fail("backlog must be at least 1");
+    }
+    if (acceptor_threads < 0 || acceptor_threads > 1024) {
+        fail("acceptor_threads must be between 0 (one per core) and 1024");
+    }
+    if (max_sessions < 0) {
+        fail("max_sessions cannot be negative");
+    }
+    if (session_mode != "threads" && session_mode != "coroutines") {
+        fail("session_mode must be threads or coroutines");
+    }
+    if (event_loops < 0 || event_loops > 1024) {
+        fail("event_loops must be between 0 (one per core) and 1024");
+    }
+    if (blocking_threads < 1 || blocking_threads > 1024) {
+        fail("blocking_threads must be between 1 and 1024");
+    }
+    if (transfer_threads < 1 || transfer_threads > 1024) {
+        fail("transfer_threads must be between 1 and 1024");
+    }
+    if (transfer_batch < 1) {
+        fail("transfer_batch must be at least 1");
+    }
+    if (checkpoint_bytes <= 0) {
+        fail("checkpoint_bytes must be positive");
+    }
+    if (settlement_gateway != "stub") {
+        fail("settlement_gateway must be stub");
+    }
+    if (settlement_batch < 1 || settlement_attempts < 1) {
+        fail("settlement_batch and settlement_attempts must be at least 1");
+    }
+    if (settlement_retry_ms < 0 || settlement_stub_latency_ms < 0) {
+        fail("settlement delays cannot be negative");
+    }
+    if (settlement_stub_failure_percent < 0 || settlement_stub_failure_percent > 100) {
+        fail("settlement_stub_failure_percent must be between 0 and 100");
+    }
+    if (node_id < 0 || (cluster_nodes == "" && node_id != 0)) {
+        fail("node_id must be the position of this server in cluster_nodes, counting from 0");
+    }
+    if (replication_socket.size() >= 108 || replicate_from.size() >= 108) {
+        fail("replication_socket and replicate_from paths must be shorter than 108 characters");
+    }
+    if (replication_socket != "" && replication_socket == replicate_from) {
+        fail("replicate_from must be another server's replication_socket");
+    }
+    if (replication_mode != "async" && replication_mode != "sync") {
+        fail("replication_mode must be async or sync");
+    }
+    if (history_format != "text" && history_format != "archive") {
+        fail("history_format must be text or archive");
+    }
+    if (replication_timeout_ms <= 0) {
+        fail("replication_timeout_ms must be positive");
+    }
+    if (nlp_timeout_ms <= 0 || nlp_hedge_min_ms < 0) {
+        fail("nlp_timeout_ms must be positive and nlp_hedge_min_ms cannot be negative");
+    }
+    if (nlp_breaker_window < 1 || nlp_breaker_error_percent < 1 || nlp_breaker_error_percent > 100) {
+        fail("nlp_breaker_window must be at least 1 and nlp_breaker_error_percent between 1 and 100");
+    }
+    if (nlp_breaker_latency_ms <= 0 || nlp_breaker_cooldown_ms <= 0) {
+        fail("nlp_breaker_latency_ms and nlp_breaker_cooldown_ms must be positive");
+    }
+    if (intent_model != "" && access(intent_model.c_str(), R_OK) != 0) {
+        fail("cannot read intent_model " + intent_model);
+    }
+    if (intent_min_confidence_percent < 0 || intent_min_confidence_percent > 100) {
+        fail("intent_min_confidence_percent must be between 0 and 100");
+    }
+    if (handshake_timeout_ms <= 0 || login_timeout_ms <= 0 || idle_timeout_ms <= 0) {
+        fail("timeouts must be positive");
+    }
+    if (export_chunk_bytes < 1024 || export_chunk_bytes > 16777216) {
+        fail("export_chunk_bytes must be between 1024 and 16777216");
+    }
+    if (report_threads < 0) {
+        fail("report_threads cannot be negative");
+    }
+    if (drain_timeout_ms < 0) {
+        fail("drain_timeout_ms cannot be negative");
+    }
+    if (handoff_socket.size() >= 108) {
+        fail("handoff_socket path must be shorter than 108 characters");
+    }
+    if (metrics_port < 0 || metrics_port > 65535 || (metrics_port != 0 && metrics_port == port)) {
+        fail("metrics_port must be 0 (disabled) or a free port other than port");
+    }
+    if (access(cert_file.c_str(), R_OK) != 0) {
+        fail("cannot read cert_file " + cert_file);
+    }
+    if (access(key_file.c_str(), R_OK) != 0) {
+        fail("cannot read key_file " + key_file);
+    }
+    if (users_file == "") {
+        fail("users_file cannot be empty");
+    }
+    if (nlp_endpoint == "" || nlp_model == "") {
+        fail("nlp_endpoint and nlp_model cannot be empty");
+    }
+    return valid;
+}
+
+/**
+ * @name describe
+ * @brief Renders the effective configuration as "key=value" lines, hiding the API key.
+ *
+ * @return The configuration as text
+ */
+string ServerConfig::describe() const {
+    ostringstream out;
+    for (const auto& option : INT_OPTIONS) {
+        out << option.first << "=" << this->*option.second << "\n";
+    }
+    for (const auto& option : BOOL_OPTIONS) {
+        out << option.first << "=" << (this->*option.second ? "true" : "false") << "\n";
+    }
+    for (const auto& option : STRING_OPTIONS) {
+        string value = this->*option.second;
+        if (option.second == &ServerConfig::nlp_api_key) {
+            value = "<hidden>";
+        }
+        out << option.first << "=" << value << "\n";
+    }
+    return out.str();
+}
@@ -0,0 +1,125 @@
+/**
+ * @file config.h
+ * @brief Declaration of the ServerConfig class.
+ * @author Kaden Oseen
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+
+/**
+ * @class ServerConfig
+ * @brief Runtime settings for the server.
+ * Read from a "key = value" file and then overridden by "--key=value" command line flags.
+ * Validated once at startup and treated as read-only afterwards.
+ */
+class ServerConfig {
+public:
+    // Socket options
+    int port = 3001;
+    int backlog = 128;
+    bool reuse_port = false;
+    bool tcp_nodelay = true;
+
+    // Acceptor threads (0 means one per core) and session limit (0 means unlimited)
+    int acceptor_threads = 1;
+    bool pin_acceptors = true;
+    int max_sessions = 0;
+
+    // How sessions run: "threads" gives each session its own thread; "coroutines" runs them
+    // on event_loops epoll threads (0 means one per core), with blocking_threads for NLP requests
+    std::string session_mode = "threads";
+    int event_loops = 0;
+    int blocking_threads = 8;
+
+    // Balance changes: threads applying each batch, and the most changes committed together
+    int transfer_threads = 4;
+    int transfer_batch = 4096;
+    // Journal size at which committed changes are folded into the users file
+    int checkpoint_bytes = 4194304;
+
+    // Settlement of transfers to external recipients: the gateway ("stub" is a local
+    // stand-in), payouts per batch, attempts before a refund and the first retry delay
+    std::string settlement_gateway = "stub";
+    int settlement_batch = 100;
+    int settlement_attempts = 5;
+    int settlement_retry_ms = 1000;
+    int settlement_stub_failure_percent = 0;
+    int settlement_stub_latency_ms = 50;
+
+    // Cluster: every node as "host:client_port:cluster_port", comma separated, and which of
+    // them this server is (empty runs a single node owning every account)
+    std::string cluster_nodes = "";
+    int node_id = 0;
+
+    // Replication: the Unix socket a standby follows this server on (empty disables it),
+    // whether commits wait for the standby ("sync") or not ("async") and for how long, and
+    // the primary's socket when this server starts as a standby (empty starts a primary)
+    std::string replication_socket = "";
+    std::string replication_mode = "async";
+    int replication_timeout_ms = 1000;
+    std::string replicate_from = "";
+
+    // How the history file is written: "text", a checksummed line per entry, or "archive",
+    // a compact binary HistoryArchive; either is read
+    std::string history_format = "text";
+
+    // Storage and TLS paths
+    std::string users_file = "users.txt";
+    std::string cert_file = "server.crt";
+    std::string key_file = "server.key";
+
+    // NLP API
+    std::string nlp_endpoint = "https://api.openai.com/v1/chat/completions";
+    std::string nlp_model = "gpt-3.5-turbo";
+    std::string nlp_api_key = "API_KEY_HERE";
+    // NLP deadlines: time allowed per request, and whether to send a duplicate once a request
+    // has taken longer than 95% of recent ones (but at least nlp_hedge_min_ms)
+    int nlp_timeout_ms = 5000;
+    bool nlp_hedge = false;
+    int nlp_hedge_min_ms = 100;
+    // NLP circuit breaker: over the last nlp_breaker_window requests, the failure percentage
+    // or p95 latency that stops NLP requests for nlp_breaker_cooldown_ms
+    int nlp_breaker_window = 20;
+    int nlp_breaker_error_percent = 50;
+    int nlp_breaker_latency_ms = 3000;
+    int nlp_breaker_cooldown_ms = 10000;
+    // Local intent model: a weights file from ./intent_tool used instead of the NLP API
+    // (empty to use the API), and the confidence below which a request is unknown
+    std::string intent_model = "";
+    int intent_min_confidence_percent = 50;
+
+    // Idle timeouts per session state
+    int handshake_timeout_ms = 10000;
+    int login_timeout_ms = 60000;
+    int idle_timeout_ms = 300000;
+
+    // Statement exports: history is encoded and sent this many bytes at a time
+    int export_chunk_bytes = 65536;
+
+    // Balance reports (the metrics port's /report page): threads scanning the balances,
+    // 0 for one per core
+    int report_threads = 0;
+
+    // Shutdown: time allowed for in-flight transactions, and the Unix socket used to hand
+    // the listening sockets to a replacement server (empty disables hot restart)
+    int drain_timeout_ms = 30000;
+    std::string handoff_socket = "";
+
+    // Metrics endpoint on localhost (0 disables it)
+    int metrics_port = 0;
+
+    // Methods
+    bool load(int argc, char* argv[]);
+    bool loadFile(const std::string& path);
+    bool set(const std::string& key, const std::string& value);
+    bool validate() const;
+    std::string describe() const;
+};
+
+// Global configuration, filled in by main before anything else starts
+extern ServerConfig server_config;
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * @file crc32c.cpp
+ * @brief Implementation of the Crc32c class.
+ * The instruction is checked for once at runtime, so the binary still runs on CPUs
+ * without it, using a byte-at-a-time table instead.
+ * @author Kaden Oseen
+ */
+
+#include "crc32c.h"
+#include <array>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+using namespace std;
+
+// The Castagnoli polynomial, bit-reversed
+static const uint32_t POLYNOMIAL = 0x82f63b78;
+
+/**
+ * @brief Builds the table of the checksum of every byte value.
+ * @return The table
+ */
+static constexpr array<uint32_t, 256> make_table() {
+    array<uint32_t, 256> table = {};
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0);
+        }
+        table[byte] = crc;
+    }
+    return table;
+}
+
+static constexpr array<uint32_t, 256> TABLE = make_table();
+
+/**
+ * @name compute
+ * @brief Returns the checksum of some bytes.
+ *
+ * @param data The bytes
+ * @param length How many
+ * @return The checksum
+ */
+uint32_t Crc32c::compute(const char* data, size_t length) {
+    return extend(0, data, length);
+}
+
+/**
+ * @name extendPortable
+ * @brief extend() one byte at a time from a table, for CPUs without a CRC32 instruction.
+ *
+ * @param crc The checksum of the bytes before
+ * @param data The bytes that follow
+ * @param length How many
+ * @return The checksum of all the bytes
+ */
+uint32_t Crc32c::extendPortable(uint32_t crc, const char* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = (crc >> 8) ^ TABLE[(crc ^ static_cast<unsigned char>(data[i])) & 0xff];
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief extend() with the SSE4.2 CRC32 instruction, eight bytes at a time.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t extend_sse42(uint32_t crc, const char* data, size_t length) {
+    uint64_t state = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        state = _mm_crc32_u64(state, word);
+    }
+    uint32_t tail = static_cast<uint32_t>(state);
+    for (; i < length; ++i) {
+        tail = _mm_crc32_u8(tail, static_cast<unsigned char>(data[i]));
+    }
+    return ~tail;
+}
+
+/**
+ * @name extend
+ * @brief Returns the checksum of some bytes following others whose checksum is known, so
+ * a checksum can be built up a piece at a time. Uses SSE4.2 if the CPU has it.
+ *
+ * @param crc The checksum of the bytes before, 0 for none
+ * @param data The bytes that follow
+ * @param length How many
+ * @return The checksum of all the bytes
+ */
+uint32_t Crc32c::extend(uint32_t crc, const char* data, size_t length) {
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    return has_sse42 ? extend_sse42(crc, data, length) : extendPortable(crc, data, length);
+}
+#elif defined(__ARM_FEATURE_CRC32)
+/**
+ * @name extend
+ * @brief Returns the checksum of some bytes following others whose checksum is known, so
+ * a checksum can be built up a piece at a time. Uses the ARM CRC32C instructions.
+ *
+ * @param crc The checksum of the bytes before, 0 for none
+ * @param data The bytes that follow
+ * @param length How many
+ * @return The checksum of all the bytes
+ */
+uint32_t Crc32c::extend(uint32_t crc, const char* data, size_t length) {
+    crc = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; i < length; ++i) {
+        crc = __crc32cb(crc, static_cast<unsigned char>(data[i]));
+    }
+    return ~crc;
+}
+#else
+/**
+ * @name extend
+ * @brief Returns the checksum of some bytes following others whose checksum is known, so
+ * a checksum can be built up a piece at a time.
+ *
+ * @param crc The checksum of the bytes before, 0 for none
+ * @param data The bytes that follow
+ * @param length How many
+ * @return The checksum of all the bytes
+ */
+uint32_t Crc32c::extend(uint32_t crc, const char* data, size_t length) {
+    return extendPortable(crc, data, length);
+}
+#endif
+
+/**
+ * @name hex
+ * @brief Writes a checksum as the 8 lowercase hex digits stored in files.
+ *
+ * @param crc The checksum
+ * @return The digits
+ */
+string Crc32c::hex(uint32_t crc) {
+    static const char DIGITS[] = "0123456789abcdef";
+    string text(8, '0');
+    for (int i = 7; i >= 0; --i) {
+        text[i] = DIGITS[crc & 0xf];
+        crc >>= 4;
+    }
+    return text;
+}
+
+/**
+ * @name parseHex
+ * @brief Reads a checksum written by hex().
+ *
+ * @param text Exactly 8 hex digits
+ * @param crc Receives the checksum
+ * @return true if the text was a checksum
+ */
+bool Crc32c::parseHex(string_view text, uint32_t& crc) {
+    if (text.size() != 8) {
+        return false;
+    }
+    crc = 0;
+    for (char c : text) {
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        crc = (crc << 4) | digit;
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file crc32c.h
+ * @brief Declaration of the Crc32c class.
+ * @author Kaden Oseen
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @class Crc32c
+ * @brief CRC-32C (Castagnoli) checksums of the records, blocks and journal batches the
+ * database writes. Uses the CPU's CRC32 instruction (SSE4.2 on x86, the CRC extension on
+ * ARM) where there is one, eight bytes per instruction, and a table otherwise.
+ */
+class Crc32c {
+public:
+    static uint32_t compute(const char* data, size_t length);
+    static uint32_t extend(uint32_t crc, const char* data, size_t length);
+    static uint32_t extendPortable(uint32_t crc, const char* data, size_t length);
+    static std::string hex(uint32_t crc);
+    static bool parseHex(std::string_view text, uint32_t& crc);
+};
+
+#endif
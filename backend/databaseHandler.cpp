@@ -5,35 +5,261 @@
  */
 
 #include "databaseHandler.h"
+#include "cluster.h"
+#include "replication.h"
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <iomanip>
+#include <fstream>
 
 using namespace std;
 
+// Digits written for a balance: enough that a balance read back is the balance written
+// (the default of 6 turned 12345.67 into 12345.7)
+static const int BALANCE_PRECISION = Journal::BALANCE_PRECISION;
+
+/**
+ * @brief Atomically replaces a file: writes a temporary file, flushes it to stable storage
+ * and renames it over the original, so a crash leaves either the old file or the new one.
+ * @param path The file to replace
+ * @param contents Its new contents
+ * @return true if the new file is durable
+ */
+static bool replace_file(const string& path, const string& contents) {
+    string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error: could not open " << temporary << endl;
+        return false;
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t result = write(fd, contents.data() + written, contents.size() - written);
+        if (result <= 0) {
+            cerr << "Error: could not write " << temporary << endl;
+            close(fd);
+            return false;
+        }
+        written += result;
+    }
+    bool durable = fsync(fd) == 0;
+    close(fd);
+    if (!durable || rename(temporary.c_str(), path.c_str()) != 0) {
+        cerr << "Error: could not replace " << path << endl;
+        return false;
+    }
+    return true;
+}
+
 /**
  * @name DatabaseHandler
  * @brief Constructor for the DatabaseHandler class.
+ * Loads the users file, the history file and the outbox file, then replays the changes
+ * committed to the journal since they were written. Accounts owned by another node of
+ * the cluster are skipped, so every node can start from a copy of the same users file.
  */
-DatabaseHandler::DatabaseHandler() {
+DatabaseHandler::DatabaseHandler() : journal(server_config.users_file + ".journal"), next_payout_id(1),
+                                     replication(nullptr) {
     // Open the users file
-    ifstream file("users.txt");
+    ifstream file(server_config.users_file);
+    // Accounts from a users file written before opening balances were recorded
+    vector<User*> unopened;
     if (file.is_open()) {
         string line;
+        size_t skipped = 0;
+        size_t line_number = 0;
+        BlockFile::Reader reader;
         // Create a User object for each line in the file
         while (getline(file, line)) {
-            istringstream iss(line);
+            ++line_number;
+            BlockFile::Reader::Line kind;
+            string_view record;
+            // A damaged record is still loaded if it can be read, so the account is not dropped
+            // at the next checkpoint; reconcile_tool shows whether its balance is right
+            if (!reader.read(line, kind, record)) {
+                cerr << "Error: checksum mismatch at line " << line_number << " of " << server_config.users_file << endl;
+            }
+            if (kind != BlockFile::Reader::Line::RECORD) {
+                continue;
+            }
+            // username:password:balance, then the opening balance if it was recorded
+            istringstream iss{string(record)};
             string username, password;
-            double balance;
+            double balance, opening;
             if (getline(iss, username, ':') && getline(iss, password, ':') && iss >> balance) {
-                // Add the User object to the users vector
-                users.push_back(User(username, password, balance));
+                if (!cluster.isLocal(username)) {
+                    ++skipped;
+                    continue;
+                }
+                User* user = index(username, password, balance);
+                if (iss.get() == ':' && iss >> opening) {
+                    user->setOpening(opening);
+                } else {
+                    unopened.push_back(user);
+                }
             } else {
                 cerr << "Error parsing line: " << line << endl;
             }
         }
+        if (skipped != 0) {
+            cout << "Skipped " << skipped << " accounts owned by other nodes" << endl;
+        }
     } else {
-        cerr << "Could not open users.txt" << endl;
+        cerr << "Could not open " << server_config.users_file << endl;
+    }
+
+    // Balances in the journal are absolute, so replaying one already in the users file is
+    // harmless; history entries and payouts are only replayed for batches newer than their file
+    uint64_t checkpointed = loadHistory();
+    uint64_t payouts_checkpointed = loadPayouts();
+    auto replay_payout = [this, payouts_checkpointed](uint64_t sequence, const Journal::Payout& payout, bool settled) {
+        next_payout_id = max<uint64_t>(next_payout_id, payout.id + 1);
+        if (sequence <= payouts_checkpointed) {
+            return;
+        }
+        if (settled) {
+            payouts.erase(payout.id);
+        } else {
+            payouts[payout.id] = payout;
+        }
+    };
+    auto replay_receipt = [this](uint64_t, uint64_t key) {
+        receipts.insert(key);
+    };
+    journal.recover(checkpointed, [this, checkpointed](uint64_t sequence, const Journal::Record& record) {
+        User* user = getRecipient(record.username);
+        if (user == nullptr) {
+            cerr << "Error: journal entry for unknown user " << record.username << endl;
+            return;
+        }
+        user->setBalance(record.balance);
+        if (sequence > checkpointed && !record.history.empty()) {
+            user->addTransaction(record.history);
+        }
+    }, replay_payout, replay_receipt);
+
+    // Taken as reconciled as loaded; from the next checkpoint on, the opening balance is kept
+    for (User* user : unopened) {
+        user->setOpening(user->getBalance() - user->historyNet() / 100.0);
     }
 }
 
+/**
+ * @name loadHistory
+ * @brief Loads every user's transaction history from the history file, as checksummed
+ * lines or as a HistoryArchive. The first line records the last journal batch the file includes.
+ *
+ * @return The sequence number of that batch, or 0 if there is no history file
+ */
+uint64_t DatabaseHandler::loadHistory() {
+    string path = server_config.users_file + ".history";
+    ifstream input(path, ios::binary);
+    string contents((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    uint64_t sequence = 0;
+    if (sscanf(contents.c_str(), "#sequence:%" SCNu64, &sequence) != 1) {
+        return 0;
+    }
+    // Either format is read, whatever history_format writes
+    if (HistoryArchive::isArchive(contents)) {
+        HistoryArchive::Reader archive;
+        if (!archive.open(contents)) {
+            cerr << "Error: " << path << " is damaged after " << archive.accounts() << " accounts" << endl;
+        }
+        vector<string> entries;
+        for (size_t account = 0; account < archive.accounts(); ++account) {
+            User* user = getRecipient(archive.owner(account));
+            if (user == nullptr) {
+                continue;
+            }
+            entries.clear();
+            if (archive.read(account, entries) != 0) {
+                cerr << "Error: checksum mismatch in the history of " << user->getUsername() << " in " << path << endl;
+            }
+            for (const string& entry : entries) {
+                user->addTransaction(entry);
+            }
+        }
+        return sequence;
+    }
+    istringstream file(contents);
+    string line;
+    getline(file, line);
+    BlockFile::Reader reader;
+    BlockFile::Reader::Line kind;
+    string_view record;
+    reader.read(line, kind, record);
+    size_t line_number = 1;
+    while (getline(file, line)) {
+        ++line_number;
+        if (!reader.read(line, kind, record)) {
+            cerr << "Error: checksum mismatch at line " << line_number << " of " << path << endl;
+        }
+        if (kind != BlockFile::Reader::Line::RECORD) {
+            continue;
+        }
+        size_t separator = record.find(':');
+        User* user = separator == string::npos ? nullptr : getRecipient(record.substr(0, separator));
+        if (user != nullptr) {
+            user->addTransaction(string(record.substr(separator + 1)));
+        }
+    }
+    return sequence;
+}
+
+/**
+ * @name loadPayouts
+ * @brief Loads the payouts that were waiting for settlement at the last checkpoint, and the
+ * keys of the transfers received from other nodes. The first line records the last journal
+ * batch the file includes.
+ *
+ * @return The sequence number of that batch, or 0 if there is no outbox file
+ */
+uint64_t DatabaseHandler::loadPayouts() {
+    ifstream file(server_config.users_file + ".outbox");
+    string line;
+    uint64_t sequence = 0;
+    if (!getline(file, line) || sscanf(line.c_str(), "#sequence:%" SCNu64, &sequence) != 1) {
+        return 0;
+    }
+    // id:amount:username:recipient, the same fields as a queued payout in the journal,
+    // or R:key for a transfer received from another node
+    while (getline(file, line)) {
+        if (line.rfind("R:", 0) == 0) {
+            receipts.insert(stoull(line.substr(2)));
+            continue;
+        }
+        Journal::Payout payout;
+        size_t first = line.find(':');
+        size_t second = first == string::npos ? first : line.find(':', first + 1);
+        size_t third = second == string::npos ? second : line.find(':', second + 1);
+        if (third == string::npos) {
+            cerr << "Error parsing line: " << line << endl;
+            continue;
+        }
+        payout.id = stoull(line.substr(0, first));
+        payout.amount = stod(line.substr(first + 1, second - first - 1));
+        payout.username = line.substr(second + 1, third - second - 1);
+        payout.recipient = line.substr(third + 1);
+        next_payout_id = max<uint64_t>(next_payout_id, payout.id + 1);
+        payouts[payout.id] = payout;
+    }
+    return sequence;
+}
+
+/**
+ * @name shared
+ * @brief Returns the database shared by every session, loading it on first use.
+ *
+ * @return DatabaseHandler& The shared database
+ */
+DatabaseHandler& DatabaseHandler::shared() {
+    static DatabaseHandler database;
+    return database;
+}
+
 /**
  * @name updateUser
  * @brief Update the balance of a user.
@@ -42,62 +268,299 @@ DatabaseHandler::DatabaseHandler() {
  * @param value The value to update the balance with
  */
 bool DatabaseHandler::updateUser(const string& username, double value) {
-    for (auto& user : users) {
-        if (user.getUsername() == username) {
-            user.updateBalance(value);
-            return true;
-        }
+    User* user = getRecipient(username);
+    if (user == nullptr) {
+        return false;
     }
-    return false;
+    auto lock = lockAccount(user);
+    user->beginUpdate();
+    user->updateBalance(value);
+    user->endUpdate();
+    return true;
 }
 
 /**
  * @name updateUserBalance
- * @brief Update the balance of a user in users.txt file.
+ * @brief Makes a user's current balance durable.
  * 
  * @param user The user object to update the balance of
  * @return true if the balance was updated successfully
  */
 bool DatabaseHandler::updateUserBalance(User* user) {
-    // Open the users file
-    ifstream infile("users.txt");
-    string line;
-    ostringstream updated_file;
-    while (getline(infile, line)) {
-        istringstream iss(line);
-        string username, password, balance_str;
-        double balance;
-        if (getline(iss, username, ':') && getline(iss, password, ':') && getline(iss, balance_str)) {
-            // If the username matches the username of the user object, update the balance
-            if (username == user->getUsername()) {
-                try {
-                    // Gets user balance and updates the file
-                    balance = user->getBalance();
-                    updated_file << username << ":" << password << ":" << balance << "\n";
-                }
-                catch (const exception& e) {
-                    cerr << "Error: " << e.what() << endl;
-                    return false;
-                }
+    Journal::Record record;
+    record.username = user->getUsername();
+    {
+        auto lock = lockAccount(user);
+        record.balance = user->getBalance();
+    }
+    return commit({record});
+}
+
+/**
+ * @name commit
+ * @brief Makes a batch of applied changes durable with one append to the journal.
+ * All records in the batch survive a crash together or not at all, so both sides of a
+ * transfer are always committed together. Checkpoints once the journal has grown past
+ * checkpoint_bytes. With a standby, the batch is shipped to it as written, and with
+ * replication_mode = sync this returns only once the standby has it too.
+ *
+ * @param records Each changed account's new balance and the history entry added, in order
+ * @param queued Payouts to external recipients debited in this batch
+ * @param settled Payouts settled or refunded in this batch
+ * @param received Keys of the transfers from other nodes credited in this batch
+ * @return true if the batch is durable
+ */
+bool DatabaseHandler::commit(const vector<Journal::Record>& records, const vector<Journal::Payout>& queued,
+                             const vector<uint64_t>& settled, const vector<uint64_t>& received) {
+    uint64_t sequence;
+    Replication* standby;
+    {
+        lock_guard<mutex> file_guard(file_mutex);
+        if (!journal.append(records, queued, settled, received)) {
+            return false;
+        }
+        sequence = journal.lastSequence();
+        standby = replication;
+        // Shipped under the lock, so the standby receives batches in journal order
+        if (standby != nullptr) {
+            standby->ship(sequence, journal.lastBatch());
+        }
+        receipts.insert(received.begin(), received.end());
+        for (const auto& payout : queued) {
+            payouts[payout.id] = payout;
+        }
+        for (uint64_t id : settled) {
+            payouts.erase(id);
+        }
+        if (journal.size() >= static_cast<size_t>(server_config.checkpoint_bytes)) {
+            // The batch is already durable, so a failed checkpoint only leaves a longer journal
+            writeCheckpoint();
+        }
+    }
+    // Other batches can be committed while this one waits for the standby
+    if (standby != nullptr) {
+        standby->waitFor(sequence);
+    }
+    return true;
+}
+
+/**
+ * @name checkpoint
+ * @brief Writes every account to the users file, every history to the history file and
+ * every unsettled payout to the outbox file, then empties the journal. Used on shutdown, so the users file is complete on its own.
+ *
+ * @return true if the checkpoint is durable
+ */
+bool DatabaseHandler::checkpoint() {
+    lock_guard<mutex> file_guard(file_mutex);
+    return writeCheckpoint();
+}
+
+/**
+ * @name writeCheckpoint
+ * @brief Replaces the history and outbox files and then the users file with the current
+ * accounts, then empties the journal. A crash at any point leaves files the journal can still be replayed
+ * onto. Refused once the journal has failed. Must hold file_mutex.
+ *
+ * @return true if the checkpoint is durable
+ */
+bool DatabaseHandler::writeCheckpoint() {
+    // Memory then holds a batch the journal refused, which was reported as failed
+    if (journal.failed()) {
+        cerr << "Error: not checkpointing changes the journal could not hold" << endl;
+        return false;
+    }
+    string users_contents, history_contents, outbox_contents;
+    checkpointContents(users_contents, history_contents, outbox_contents);
+    return replace_file(server_config.users_file + ".history", history_contents) &&
+           replace_file(server_config.users_file + ".outbox", outbox_contents) &&
+           replace_file(server_config.users_file, users_contents) && journal.reset();
+}
+
+/**
+ * @name checkpointContents
+ * @brief Builds the users, history and outbox files for the current accounts, as of the
+ * last journal batch. Balances are read under their account locks; the TransferEngine
+ * commits between batches, when no transfer is half applied. Must hold file_mutex.
+ *
+ * @param users_contents Receives the users file
+ * @param history_contents Receives the history file
+ * @param outbox_contents Receives the outbox file
+ */
+void DatabaseHandler::checkpointContents(string& users_contents, string& history_contents, string& outbox_contents) {
+    ostringstream outbox_file;
+    outbox_file << setprecision(BALANCE_PRECISION);
+    users_contents.clear();
+    history_contents.clear();
+    BlockFile::Writer users_file(users_contents);
+    BlockFile::Writer history_file(history_contents);
+    HistoryArchive::Writer history_archive(history_contents);
+    bool archived = server_config.history_format == "archive";
+    users_file.header(BlockFile::FORMAT_LINE);
+    history_file.header("#sequence:" + to_string(journal.lastSequence()));
+    if (!archived) {
+        history_file.header(BlockFile::FORMAT_LINE);
+    }
+    outbox_file << "#sequence:" << journal.lastSequence() << "\n";
+    for (const auto& entry : payouts) {
+        const Journal::Payout& payout = entry.second;
+        outbox_file << payout.id << ":" << payout.amount << ":" << payout.username << ":" << payout.recipient << "\n";
+    }
+    for (uint64_t key : receipts) {
+        outbox_file << "R:" << key << "\n";
+    }
+    {
+        shared_lock<shared_mutex> directory_guard(directory_mutex);
+        ostringstream record;
+        record << setprecision(BALANCE_PRECISION);
+        for (const auto& user : users) {
+            auto lock = lockAccount(&user);
+            record.str("");
+            record << user.getUsername() << ":" << user.getPassword() << ":" << user.getBalance() << ":" << user.getOpening();
+            users_file.add(record.str());
+            if (archived) {
+                history_archive.add(user.getUsername(), user.getTransactions());
+                continue;
             }
-            else {
-                updated_file << line << "\n";
+            for (const string& entry : user.getTransactions()) {
+                history_file.add(user.getUsername(), entry);
             }
         }
     }
-    infile.close();
+    users_file.finish();
+    if (archived) {
+        history_archive.finish();
+    } else {
+        history_file.finish();
+    }
+    outbox_contents = outbox_file.str();
+}
+
+/**
+ * @name newPayoutId
+ * @brief Returns an id for a new payout, never used before in this database.
+ *
+ * @return The id
+ */
+uint64_t DatabaseHandler::newPayoutId() {
+    return next_payout_id++;
+}
 
-    // Write the updated file to users.txt
-    ofstream outfile("users.txt");
-    if (outfile.is_open()) {
-        outfile << updated_file.str();
-        outfile.close();
-        return true;
+/**
+ * @name pendingPayouts
+ * @brief Returns the payouts committed but not yet settled or refunded.
+ *
+ * @return The payouts, oldest first
+ */
+vector<Journal::Payout> DatabaseHandler::pendingPayouts() {
+    lock_guard<mutex> file_guard(file_mutex);
+    vector<Journal::Payout> pending;
+    for (const auto& entry : payouts) {
+        pending.push_back(entry.second);
     }
-    else {
-        cerr << "Error: could not open file" << endl;
+    return pending;
+}
+
+/**
+ * @name hasReceived
+ * @brief Whether a transfer from another node has already been credited.
+ *
+ * @param key The transfer's cluster-wide key
+ * @return true if it is committed
+ */
+bool DatabaseHandler::hasReceived(uint64_t key) {
+    lock_guard<mutex> file_guard(file_mutex);
+    return receipts.count(key) != 0;
+}
+
+/**
+ * @name replicateTo
+ * @brief Ships every batch committed from now on to a standby, or stops shipping.
+ *
+ * @param replication The standby's connection, or nullptr
+ */
+void DatabaseHandler::replicateTo(Replication* replication) {
+    lock_guard<mutex> file_guard(file_mutex);
+    this->replication = replication;
+}
+
+/**
+ * @name snapshot
+ * @brief Hands the contents a checkpoint would write to send, holding the file lock, so
+ * no batch is committed between the snapshot and whatever send queues after it. Taken
+ * between batches, so it holds exactly the batches the journal has.
+ *
+ * @param send Receives the sequence number of the last batch included and the three files
+ */
+void DatabaseHandler::snapshot(const function<void(uint64_t sequence, const string& users_contents,
+                                                   const string& history_contents, const string& outbox_contents)>& send) {
+    auto batch_guard = lockBatch();
+    lock_guard<mutex> file_guard(file_mutex);
+    string users_contents, history_contents, outbox_contents;
+    checkpointContents(users_contents, history_contents, outbox_contents);
+    send(journal.lastSequence(), users_contents, history_contents, outbox_contents);
+}
+
+/**
+ * @name installSnapshot
+ * @brief Replaces the users, history and outbox files with a primary's snapshot and drops
+ * the journal, so the database loaded next starts exactly where the primary was.
+ * Must be called before shared() is first used.
+ *
+ * @param users_contents The users file
+ * @param history_contents The history file
+ * @param outbox_contents The outbox file
+ * @return true if the snapshot is durable
+ */
+bool DatabaseHandler::installSnapshot(const string& users_contents, const string& history_contents,
+                                      const string& outbox_contents) {
+    // The journal holds batches of an older snapshot, numbered like the new one's
+    string journal_path = server_config.users_file + ".journal";
+    if (unlink(journal_path.c_str()) != 0 && errno != ENOENT) {
+        cerr << "Error: could not remove " << journal_path << endl;
         return false;
     }
+    return replace_file(server_config.users_file + ".history", history_contents) &&
+           replace_file(server_config.users_file + ".outbox", outbox_contents) &&
+           replace_file(server_config.users_file, users_contents);
+}
+
+/**
+ * @name applyReplicated
+ * @brief Applies a batch committed by the primary and commits it to this database's journal.
+ * Balances and history entries are applied as the primary recorded them, so the standby
+ * ends up with the same accounts without redoing any transfer.
+ *
+ * @param batch The batch, which must follow the last one committed here
+ * @return true if the batch is durable
+ */
+bool DatabaseHandler::applyReplicated(const Journal::Batch& batch) {
+    auto batch_guard = lockBatch();
+    {
+        lock_guard<mutex> file_guard(file_mutex);
+        if (batch.sequence != journal.lastSequence() + 1) {
+            cerr << "Error: replicated batch " << batch.sequence << " does not follow batch " << journal.lastSequence() << endl;
+            return false;
+        }
+    }
+    for (const Journal::Record& record : batch.records) {
+        User* user = getRecipient(record.username);
+        if (user == nullptr) {
+            cerr << "Error: replicated entry for unknown user " << record.username << endl;
+            continue;
+        }
+        auto lock = lockAccount(user);
+        user->beginUpdate();
+        user->setBalance(record.balance);
+        if (!record.history.empty()) {
+            user->addTransaction(record.history);
+        }
+        user->endUpdate();
+    }
+    for (const Journal::Payout& payout : batch.queued) {
+        next_payout_id = max<uint64_t>(next_payout_id, payout.id + 1);
+    }
+    return commit(batch.records, batch.queued, batch.settled, batch.received);
 }
 
 /**
@@ -108,11 +571,10 @@ bool DatabaseHandler::updateUserBalance(User* user) {
  * @param password The password of the user to get
  * @return User* The User object
  */
-User* DatabaseHandler::getUser(string username, string password) {
-    for (auto &user : users) {
-        if (user.getUsername() == username && user.getPassword() == password) {
-            return &user;
-        }
+User* DatabaseHandler::getUser(string_view username, string_view password) {
+    User* user = getRecipient(username);
+    if (user != nullptr && user->getPassword() == password) {
+        return user;
     }
     return nullptr;
 }
@@ -124,53 +586,198 @@ User* DatabaseHandler::getUser(string username, string password) {
  * @param username The username of the user to get
  * @return User* The User object
  */
-User* DatabaseHandler::getRecipient(string username) {
-    for (auto &user : users) {
-        if (user.getUsername() == username) {
-            return &user;
-        }
-    }
-    return nullptr;
+User* DatabaseHandler::getRecipient(string_view username) {
+    return userById(idOf(username));
+}
+
+/**
+ * @name idOf
+ * @brief Looks up an account's id by username, without building a string.
+ * 
+ * @param username The username
+ * @return uint32_t The id, or NO_ACCOUNT if there is no such account
+ */
+uint32_t DatabaseHandler::idOf(string_view username) const {
+    shared_lock<shared_mutex> guard(directory_mutex);
+    auto it = users_by_name.find(username);
+    return it == users_by_name.end() ? NO_ACCOUNT : it->second;
+}
+
+/**
+ * @name userById
+ * @brief Get a User object by its id, in constant time and without a lock.
+ * 
+ * @param id The account id
+ * @return User* The User object, or nullptr if there is no such account
+ */
+User* DatabaseHandler::userById(uint32_t id) const {
+    return id < users_by_id.size() ? users_by_id[id] : nullptr;
 }
 
 /**
  * @name addUser
- * @brief Add a User object to the users vector.
+ * @brief Add a User object to the users deque.
+ * Fails if the username is taken, including by an account created at the same moment
+ * by another session.
  * 
  * @param username The username of the user to add
  * @param password The password of the user to add
  * @param balance The balance of the user to add
- * @return true if the user was added successfully
+ * @return User* The new user, or nullptr if it could not be added
  */
 User* DatabaseHandler::addUser(const string& username, const string& password, double balance) {
-    for (auto& user : users) {
-        if (user.getUsername() == username) {
-            return nullptr;
-        }
-    }
-    users.push_back(User(username, password, balance));
-    
-    // add user in format username:password:balance to new line in users.txt file
-    ofstream outfile("users.txt", ios_base::app);
-    if (outfile.is_open()) {
-        outfile << username << ":" << password << ":" << balance << "\n";
-        outfile.close();
-        cout << "User " << username << " added successfully" << endl;
-        return getUser(username, password);
-    }
-    else {
-        cerr << "Error: could not open file" << endl;
+    // Held across the append so a concurrent commit cannot replace the file without this user,
+    // and so no other account with the name can be added before this one is indexed
+    lock_guard<mutex> file_guard(file_mutex);
+    // A leading '#' would read as a header line of the users file, and ':' or a line
+    // break would split the record
+    if (idOf(username) != NO_ACCOUNT || username.empty() || username[0] == '#' ||
+        username.find_first_of(":\r\n") != string::npos) {
         return nullptr;
     }
+
+    // add user in format username:password:balance:opening to new line in users.txt file with
+    // its checksum, durably, since the journal may soon hold transfers to the new account
+    ostringstream line;
+    line << setprecision(BALANCE_PRECISION) << username << ":" << password << ":" << balance << ":" << balance;
+    string entry = BlockFile::seal(line.str());
+    int fd = open(server_config.users_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    off_t end = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+    if (end < 0 || write(fd, entry.data(), entry.size()) != static_cast<ssize_t>(entry.size()) || fdatasync(fd) != 0) {
+        cerr << "Error: could not add " << username << " to " << server_config.users_file << endl;
+        if (fd >= 0) {
+            // Cut off any part of the line that was written, so the next account starts a line
+            if (end >= 0 && ftruncate(fd, end) != 0) {
+                cerr << "Error: could not cut " << server_config.users_file << " back" << endl;
+            }
+            close(fd);
+        }
+        return nullptr;
+    }
+    close(fd);
+    // Only indexed once durable, so a failed append leaves no account behind
+    User* user;
+    {
+        unique_lock<shared_mutex> guard(directory_mutex);
+        user = index(username, password, balance);
+    }
+    if (replication != nullptr) {
+        replication->shipAccount(entry);
+    }
+    cout << "User " << username << " added successfully" << endl;
+    return user;
 }
 
 
 /**
  * @name getUsers
- * @brief Get the users vector.
+ * @brief Get the users deque.
  * 
- * @return vector<User>& The users vector
+ * @return deque<User>& The users deque
  */
-vector<User>& DatabaseHandler::getUsers() {
+deque<User>& DatabaseHandler::getUsers() {
     return users;
 }
+
+/**
+ * @name getBalances
+ * @brief Get every account's balance, by account id.
+ * 
+ * @return const BalanceColumns& The balance column
+ */
+const BalanceColumns& DatabaseHandler::getBalances() const {
+    return balance_columns;
+}
+
+/**
+ * @name usernameOf
+ * @brief Get the username of an account by its id.
+ * 
+ * @param id The account id, from the balance column
+ * @return string The username, or "" if there is no such account
+ */
+string DatabaseHandler::usernameOf(uint32_t id) const {
+    User* user = userById(id);
+    return user == nullptr ? "" : user->getUsername();
+}
+
+/**
+ * @name lockBatch
+ * @brief Keeps snapshots out while a batch is applied to the accounts and committed.
+ * A snapshot taken in between would hold the batch under the previous batch's sequence
+ * number, and the standby would then apply it twice.
+ *
+ * @return The held lock
+ */
+unique_lock<mutex> DatabaseHandler::lockBatch() {
+    return unique_lock<mutex>(batch_mutex);
+}
+
+/**
+ * @name lockAccount
+ * @brief Locks a user's balance and transaction log.
+ *
+ * @param user The user
+ * @return The held lock
+ */
+unique_lock<mutex> DatabaseHandler::lockAccount(const User* user) {
+    return unique_lock<mutex>(stripeFor(user));
+}
+
+/**
+ * @name lockAccounts
+ * @brief Locks two users' balances and transaction logs without risk of deadlock.
+ * Either user may be nullptr, but not both, and they may share a lock stripe.
+ *
+ * @param first The first user, or nullptr
+ * @param second The second user, or nullptr
+ * @return The held locks
+ */
+pair<unique_lock<mutex>, unique_lock<mutex>> DatabaseHandler::lockAccounts(const User* first, const User* second) {
+    if (first == nullptr) {
+        swap(first, second);
+    }
+    unique_lock<mutex> first_lock(stripeFor(first), defer_lock);
+    if (second == nullptr || &stripeFor(second) == first_lock.mutex()) {
+        first_lock.lock();
+        return {move(first_lock), unique_lock<mutex>()};
+    }
+    unique_lock<mutex> second_lock(stripeFor(second), defer_lock);
+    lock(first_lock, second_lock);
+    return {move(first_lock), move(second_lock)};
+}
+
+/**
+ * @name stripeFor
+ * @brief Returns the lock stripe guarding a user.
+ *
+ * @param user The user
+ * @return The stripe's mutex
+ */
+mutex& DatabaseHandler::stripeFor(const User* user) {
+    // Ids are dense, so accounts created one after another land on different stripes
+    return account_locks[user->getId() % LOCK_STRIPES];
+}
+
+/**
+ * @name index
+ * @brief Adds an account to the users deque and gives it the next id, in the balance
+ * column and in the indexes by id and by username. Must hold directory_mutex exclusively,
+ * unless no other thread can see the database yet.
+ *
+ * @param username The username
+ * @param password The password hash
+ * @param balance The balance
+ * @return The new user
+ */
+User* DatabaseHandler::index(const string& username, const string& password, double balance) {
+    users.emplace_back(username, password, balance);
+    User* user = &users.back();
+    user->attach(balance_columns);
+    // The ids given by the balance column are the positions in users_by_id
+    users_by_id.push_back(user);
+    users_by_name[username] = user->getId();
+    return user;
+}
+
+
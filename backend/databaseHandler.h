@@ -8,31 +8,134 @@
 #define DATABASEHANDLER_H
 
 #include <vector>
+#include <atomic>
+#include <map>
+#include <deque>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include "user.h"
+#include "appendVector.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
 #include "globals.h"
+#include "config.h"
+#include "journal.h"
+#include "balanceColumns.h"
+#include "blockFile.h"
+#include "historyArchive.h"
+
+// Forward declaration of Replication class
+class Replication;
 
 /**
  * @class DatabaseHandler
  * @brief Class for handling the database.
+ * One instance (shared()) holds every account for the whole server, so all sessions see
+ * the same balances. Users live in a deque, so a User* stays valid as accounts are added.
+ * A balance or transaction log may only be touched while holding lockAccount() for it.
+ * Committed changes go to a journal next to the users file; checkpoint() folds them into
+ * the users file, a history file and an outbox file of unsettled payouts, and empties the journal.
+ * In a cluster, only the accounts this node owns are loaded.
+ * With replication, every committed batch and new account is also shipped to a standby.
+ * Every account has a dense 32-bit id, in the order accounts were loaded or created. A
+ * username is turned into its id once (idOf(), at login or when a recipient is looked up);
+ * from then on accounts are found by id without a lock or a string hash, and the session
+ * registry, the account locks and the balance column all work on ids.
+ * Every balance is mirrored by account id into a column that BalanceReport scans.
+ * The users and history files carry a CRC-32C per record and per block (see BlockFile),
+ * and each account records its opening balance, so the files can be reconciled offline.
+ * With history_format = archive the history file is written as a HistoryArchive instead.
  */
 class DatabaseHandler {
 public:
+    // The id of no account
+    static constexpr uint32_t NO_ACCOUNT = UINT32_MAX;
+
     // Constructor
     DatabaseHandler();
+    static DatabaseHandler& shared();
     // Methods
     bool updateUser(const std::string& username, double value);
     bool updateUserBalance(User* user);
     User* addUser(const std::string& username, const std::string& password, double balance);
-    User* getUser(std::string username, std::string password);
-    User* getRecipient(std::string username);
-    std::vector<User>& getUsers();
+    User* getUser(std::string_view username, std::string_view password);
+    User* getRecipient(std::string_view username);
+    uint32_t idOf(std::string_view username) const;
+    User* userById(uint32_t id) const;
+    std::deque<User>& getUsers();
+    const BalanceColumns& getBalances() const;
+    std::string usernameOf(uint32_t id) const;
+    std::unique_lock<std::mutex> lockAccount(const User* user);
+    std::unique_lock<std::mutex> lockBatch();
+    std::pair<std::unique_lock<std::mutex>, std::unique_lock<std::mutex>> lockAccounts(const User* first, const User* second);
+    bool commit(const std::vector<Journal::Record>& records, const std::vector<Journal::Payout>& queued = {},
+                const std::vector<uint64_t>& settled = {}, const std::vector<uint64_t>& received = {});
+    bool checkpoint();
+    uint64_t newPayoutId();
+    std::vector<Journal::Payout> pendingPayouts();
+    bool hasReceived(uint64_t key);
+    void replicateTo(Replication* replication);
+    void snapshot(const std::function<void(uint64_t sequence, const std::string& users_contents,
+                                           const std::string& history_contents, const std::string& outbox_contents)>& send);
+    bool applyReplicated(const Journal::Batch& batch);
+    static bool installSnapshot(const std::string& users_contents, const std::string& history_contents,
+                                const std::string& outbox_contents);
 private:
-    // Array of Users
-    std::vector<User> users;
+    // Number of account lock stripes
+    static const size_t LOCK_STRIPES = 256;
+
+    /**
+     * @struct NameHash
+     * @brief Hashes a username given as a string or a string_view alike, so a lookup
+     * builds no string.
+     */
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+
+    // Array of Users, the id of each by username, and each by id (read without a lock)
+    std::deque<User> users;
+    std::unordered_map<std::string, uint32_t, NameHash, std::equal_to<>> users_by_name;
+    AppendVector<User*> users_by_id;
+    // Every balance in cents by account id, for reports that scan all accounts
+    BalanceColumns balance_columns;
+    // Guards users and users_by_name (shared for lookups, exclusive to add), and orders the
+    // appends to users_by_id
+    mutable std::shared_mutex directory_mutex;
+    // Held while a batch is applied and committed, so a snapshot never holds changes the
+    // journal does not have yet (taken before the account locks and file_mutex)
+    std::mutex batch_mutex;
+    // Serializes writes to the users file
+    std::mutex file_mutex;
+    // Balance and transaction log locks, one per stripe of accounts
+    std::mutex account_locks[LOCK_STRIPES];
+    // Changes committed since the last checkpoint
+    Journal journal;
+    // Payouts to external recipients not yet settled, by id (guarded by file_mutex)
+    std::map<uint64_t, Journal::Payout> payouts;
+    std::atomic<uint64_t> next_payout_id;
+    // Keys of the transfers from other nodes already credited (guarded by file_mutex)
+    std::unordered_set<uint64_t> receipts;
+    // Where committed batches are shipped, if a standby follows this server (guarded by file_mutex)
+    Replication* replication;
+
+    // Methods
+    uint64_t loadHistory();
+    uint64_t loadPayouts();
+    bool writeCheckpoint();
+    void checkpointContents(std::string& users_contents, std::string& history_contents, std::string& outbox_contents);
+    User* index(const std::string& username, const std::string& password, double balance);
+    std::mutex& stripeFor(const User* user);
 };
 
 #endif
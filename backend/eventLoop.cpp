@@ -0,0 +1,236 @@
+/**
+ * @file eventLoop.cpp
+ * @brief Implementation of the EventLoop class.
+ * Lets thousands of sessions share a few threads: a session only holds a thread while it
+ * is processing a message, and waits for the next one as a suspended coroutine.
+ * @author Kaden Oseen
+ */
+
+#include "eventLoop.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Most readiness events handled per epoll_wait call
+static const int MAX_EVENTS = 128;
+
+// The loop running on the current thread, if any
+static thread_local EventLoop* current_loop = nullptr;
+
+/**
+ * @name EventLoop
+ * @brief Constructor for the EventLoop class. Creates the epoll set and the wake-up eventfd.
+ */
+EventLoop::EventLoop() : running(false) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // The wake-up eventfd is the only registration whose data pointer is null
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_fd < 0 || wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+        cerr << "Could not create event loop: " << strerror(errno) << endl;
+    }
+}
+
+/**
+ * @name ~EventLoop
+ * @brief Destructor for the EventLoop class. Stops the thread and closes the descriptors.
+ */
+EventLoop::~EventLoop() {
+    stop();
+    join();
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+/**
+ * @name start
+ * @brief Starts the loop's thread.
+ *
+ * @param index The loop number, used to choose a core
+ * @param pin_to_core Pin the thread to core index % cores
+ */
+void EventLoop::start(int index, bool pin_to_core) {
+    running = true;
+    worker = thread(&EventLoop::run, this);
+    if (pin_to_core) {
+        unsigned int cores = thread::hardware_concurrency();
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % (cores == 0 ? 1 : cores), &cpus);
+        if (pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus) != 0) {
+            cerr << "Could not pin event loop " << index << " to a core" << endl;
+        }
+    }
+}
+
+/**
+ * @name stop
+ * @brief Asks the loop's thread to exit. Coroutines still suspended on it are abandoned.
+ */
+void EventLoop::stop() {
+    running = false;
+    uint64_t wake = 1;
+    if (write(wake_fd, &wake, sizeof(wake)) < 0) {
+        cerr << "Could not wake event loop" << endl;
+    }
+}
+
+/**
+ * @name join
+ * @brief Waits for the loop's thread to exit.
+ */
+void EventLoop::join() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+/**
+ * @name post
+ * @brief Resumes a coroutine on this loop's thread. Safe to call from any thread.
+ *
+ * @param handle The coroutine to resume
+ */
+void EventLoop::post(coroutine_handle<> handle) {
+    {
+        lock_guard<mutex> guard(posted_mutex);
+        posted.push_back(handle);
+    }
+    uint64_t wake = 1;
+    if (write(wake_fd, &wake, sizeof(wake)) < 0) {
+        cerr << "Could not wake event loop" << endl;
+    }
+}
+
+/**
+ * @name spawn
+ * @brief Starts a task on this loop's thread. The task frees itself when it finishes.
+ *
+ * @param task The task to run
+ */
+void EventLoop::spawn(Task<void> task) {
+    post(task.detach());
+}
+
+/**
+ * @name wait
+ * @brief Returns an awaiter that suspends the calling coroutine until the socket is ready.
+ * Must be awaited from a coroutine running on this loop.
+ *
+ * @param fd The socket to wait on
+ * @param events The epoll events to wait for
+ * @return The awaiter
+ */
+EventLoop::ReadyAwaiter EventLoop::wait(int fd, uint32_t events) {
+    return ReadyAwaiter{*this, fd, events, 0, nullptr};
+}
+
+/**
+ * @name yield
+ * @brief Returns an awaiter that lets the loop resume the other coroutines that are ready
+ * before it resumes the calling one, so a long task can run in slices without holding up
+ * the rest of the loop. Must be awaited from a coroutine running on this loop.
+ *
+ * @return The awaiter
+ */
+EventLoop::YieldAwaiter EventLoop::yield() {
+    return YieldAwaiter{*this};
+}
+
+/**
+ * @name await_suspend
+ * @brief Registers the socket for one event and suspends the coroutine until it arrives.
+ * The registration is one-shot, so a socket is only ever watched while a coroutine waits on it.
+ *
+ * @param handle The waiting coroutine
+ * @return false to resume immediately if the socket cannot be watched
+ */
+bool EventLoop::ReadyAwaiter::await_suspend(coroutine_handle<> handle) {
+    waiting = handle;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events | EPOLLONESHOT | EPOLLRDHUP;
+    event.data.ptr = this;
+    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0) {
+        return true;
+    }
+    if (errno == ENOENT && epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) {
+        return true;
+    }
+    ready_events = EPOLLERR;
+    return false;
+}
+
+/**
+ * @name forget
+ * @brief Stops watching a socket. Call before closing it.
+ *
+ * @param fd The socket
+ */
+void EventLoop::forget(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+/**
+ * @name current
+ * @brief Returns the loop running on the calling thread.
+ *
+ * @return The loop, or nullptr if the thread is not a loop thread
+ */
+EventLoop* EventLoop::current() {
+    return current_loop;
+}
+
+/**
+ * @name resumePosted
+ * @brief Resumes every coroutine posted since the last wake-up.
+ */
+void EventLoop::resumePosted() {
+    uint64_t count;
+    while (read(wake_fd, &count, sizeof(count)) > 0) {
+    }
+    vector<coroutine_handle<>> ready;
+    {
+        lock_guard<mutex> guard(posted_mutex);
+        ready.swap(posted);
+    }
+    for (auto handle : ready) {
+        handle.resume();
+    }
+}
+
+/**
+ * @name run
+ * @brief Waits for ready sockets and posted coroutines and resumes them until stop().
+ */
+void EventLoop::run() {
+    current_loop = this;
+    struct epoll_event events[MAX_EVENTS];
+    while (running) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0 && errno != EINTR) {
+            cerr << "Event loop failed: " << strerror(errno) << endl;
+            break;
+        }
+        for (int i = 0; i < ready && running; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                resumePosted();
+                continue;
+            }
+            ReadyAwaiter* awaiter = static_cast<ReadyAwaiter*>(events[i].data.ptr);
+            awaiter->ready_events = events[i].events;
+            awaiter->waiting.resume();
+        }
+    }
+    current_loop = nullptr;
+}
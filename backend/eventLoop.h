@@ -0,0 +1,83 @@
+/**
+ * @file eventLoop.h
+ * @brief Declaration of the EventLoop class.
+ * @author Kaden Oseen
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "task.h"
+
+/**
+ * @class EventLoop
+ * @brief A thread that runs coroutines and resumes them when their sockets are ready.
+ * Coroutines wait on a socket with co_await loop.wait(fd, EPOLLIN); the loop resumes them
+ * from epoll_wait. Other threads hand work to the loop with post(), which wakes it through
+ * an eventfd. Every coroutine started on a loop stays on that loop's thread.
+ */
+class EventLoop {
+public:
+    /**
+     * @struct ReadyAwaiter
+     * @brief Suspends a coroutine until a socket has one of the requested events.
+     * co_await yields the events that occurred (EPOLLIN, EPOLLOUT, EPOLLHUP, ...).
+     */
+    struct ReadyAwaiter {
+        EventLoop& loop;
+        int fd;
+        uint32_t events;
+        uint32_t ready_events = 0;
+        std::coroutine_handle<> waiting;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        uint32_t await_resume() const noexcept { return ready_events; }
+    };
+
+    /**
+     * @struct YieldAwaiter
+     * @brief Suspends a coroutine until the loop has run everything else that is ready.
+     */
+    struct YieldAwaiter {
+        EventLoop& loop;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { loop.post(handle); }
+        void await_resume() const noexcept {}
+    };
+
+    // Constructor and destructor
+    EventLoop();
+    ~EventLoop();
+    // Methods
+    void start(int index, bool pin_to_core);
+    void stop();
+    void join();
+    void post(std::coroutine_handle<> handle);
+    void spawn(Task<void> task);
+    ReadyAwaiter wait(int fd, uint32_t events);
+    YieldAwaiter yield();
+    void forget(int fd);
+    static EventLoop* current();
+private:
+    // Variables
+    int epoll_fd;
+    int wake_fd;
+    std::mutex posted_mutex;
+    std::vector<std::coroutine_handle<>> posted;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    // Methods
+    void run();
+    void resumePosted();
+};
+
+#endif
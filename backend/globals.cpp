@@ -7,13 +7,61 @@
 */
 
 #include "globals.h"
+#include "transferEngine.h"
+#include "outbox.h"
+#include "cluster.h"
+#include "replication.h"
+#include "circuitBreaker.h"
+#include "intentModel.h"
 
 using namespace std;
 
 // Global variables for storing active sessions
-unordered_map<string, Session*> active_sessions;
+unordered_map<uint32_t, Session*> active_sessions;
 mutex active_sessions_mutex;
 
+// Idle deadlines for every connection, handshake through logout
+SessionTimeouts session_timeouts;
+TimerWheel session_timers;
+
+// Threads for blocking calls made by coroutine sessions (NLP requests)
+BlockingPool blocking_pool;
+
+// Applies and commits every balance change
+TransferEngine transfer_engine;
+
+// Settles transfers to external recipients
+Outbox outbox;
+
+// The nodes sharing the accounts, if the server is one of several
+Cluster cluster;
+
+// Ships committed changes to a standby, if one follows this server
+Replication replication;
+
+// Stops NLP requests while the NLP server is failing or slow
+CircuitBreaker nlp_breaker;
+
+// Interprets natural language requests locally, if intent_model is set
+IntentModel intent_model;
+
+
+/**
+ * @brief Returns the idle timeout for a session state
+ * @param state The state the session is in
+ * @return Time the session may wait for the client in that state
+ */
+chrono::milliseconds SessionTimeouts::forState(SessionState state) const {
+    switch (state) {
+        case SessionState::HANDSHAKE:
+            return handshake;
+        case SessionState::LOGIN:
+            return login;
+        default:
+            return authenticated;
+    }
+}
+
 
 /**
  * @brief Hashes a string using SHA256
@@ -21,15 +69,17 @@ mutex active_sessions_mutex;
  * @param str String to be hashed
  * @return Hashed string
  */
-string get_hash(const string& str) {
+string get_hash(string_view str) {
+    static const char HEX[] = "0123456789abcdef";
     unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256(reinterpret_cast<const unsigned char*>(str.c_str()), str.size(), hash);
-    stringstream ss;
-    ss << hex << setfill('0');
-    for (unsigned char i : hash) {
-        ss << setw(2) << static_cast<unsigned int>(i);
+    SHA256(reinterpret_cast<const unsigned char*>(str.data()), str.size(), hash);
+    // Written straight into the result, which is its only allocation
+    string digest(2 * SHA256_DIGEST_LENGTH, '0');
+    for (size_t i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+        digest[2 * i] = HEX[hash[i] >> 4];
+        digest[2 * i + 1] = HEX[hash[i] & 0xf];
     }
-    return ss.str();
+    return digest;
 }
 
 
@@ -41,10 +91,12 @@ string get_hash(const string& str) {
 string getTimestamp() {
     auto currentTime = chrono::system_clock::now();
     time_t time = chrono::system_clock::to_time_t(currentTime);
-    tm localTime = *localtime(&time);
-    stringstream timestamp;
-    timestamp << put_time(&localTime, "[%Y-%m-%d %H:%M:%S]");
-    return timestamp.str();
+    // localtime_r reads the time zone once, where localtime checks it on every call
+    tm localTime;
+    localtime_r(&time, &localTime);
+    char timestamp[32];
+    size_t length = strftime(timestamp, sizeof(timestamp), "[%Y-%m-%d %H:%M:%S]", &localTime);
+    return string(timestamp, length);
 }
 
 /**
@@ -53,9 +105,13 @@ string getTimestamp() {
  * @param str String to be filtered
  * @return Filtered string
 */
-string removeCharacters(string str) {
-    string new_string = str;
-    regex regex_filter("[^0-9.]");
-    string result = regex_replace(new_string, regex_filter, "");
+string removeCharacters(string_view str) {
+    string result;
+    result.reserve(str.size());
+    for (char c : str) {
+        if ((c >= '0' && c <= '9') || c == '.') {
+            result += c;
+        }
+    }
     return result;
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #define GLOBALS_H
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <mutex>
 #include <openssl/sha.h>
@@ -15,18 +16,54 @@
 #include <sstream>
 #include <ctime>
 #include <chrono>
-#include <regex>
+#include "timerWheel.h"
+#include "blockingPool.h"
 
-// Forward declaration of Session class
+// Forward declaration of Session, TransferEngine, Outbox, Cluster, Replication, CircuitBreaker and IntentModel classes
 class Session;
+class TransferEngine;
+class Outbox;
+class Cluster;
+class Replication;
+class CircuitBreaker;
+class IntentModel;
+
+// States a connection passes through, each with its own idle timeout
+enum class SessionState {
+    HANDSHAKE,
+    LOGIN,
+    AUTHENTICATED
+};
+
+/**
+ * @struct SessionTimeouts
+ * @brief How long a connection may sit idle in each state before it is closed.
+ */
+struct SessionTimeouts {
+    std::chrono::milliseconds handshake{10000};
+    std::chrono::milliseconds login{60000};
+    std::chrono::milliseconds authenticated{300000};
+
+    std::chrono::milliseconds forState(SessionState state) const;
+};
 
 // Global variables
-extern std::unordered_map<std::string, Session*> active_sessions;
+// Logged in sessions by account id
+extern std::unordered_map<uint32_t, Session*> active_sessions;
 extern std::mutex active_sessions_mutex;
+extern SessionTimeouts session_timeouts;
+extern TimerWheel session_timers;
+extern BlockingPool blocking_pool;
+extern TransferEngine transfer_engine;
+extern Outbox outbox;
+extern Cluster cluster;
+extern Replication replication;
+extern CircuitBreaker nlp_breaker;
+extern IntentModel intent_model;
 
 // Global general use functions
-std::string get_hash(const std::string& str);
+std::string get_hash(std::string_view str);
 std::string getTimestamp();
-std::string removeCharacters(std::string str);
+std::string removeCharacters(std::string_view str);
 
 #endif
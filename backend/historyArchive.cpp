@@ -0,0 +1,692 @@
+/**
+ * @file historyArchive.cpp
+ * @brief Implementation of the HistoryArchive class.
+ * @author Kaden Oseen
+ */
+
+#include "historyArchive.h"
+#include "crc32c.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+constexpr string_view HistoryArchive::FORMAT_LINE;
+
+// The high bit of an entry's first byte marks an entry kept as text
+static const uint8_t LITERAL = 0x80;
+// Amounts beyond this many cents are kept as text, as are their entries
+static const double LARGEST_CENTS = 1e15;
+// The kind of each type as written in an entry
+static const char* const KIND_NAMES[] = {"Deposit", "Withdrawal", "Transfer", "Transfer", "Refund"};
+
+/**
+ * @brief Appends an unsigned variable length integer, seven bits per byte, low bits first.
+ */
+static void put_varint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/**
+ * @brief Appends a signed variable length integer, zigzag coded so small negative numbers
+ * stay short.
+ */
+static void put_signed(string& out, int64_t value) {
+    put_varint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+/**
+ * @brief Appends a 32-bit number in 4 bytes, low byte first.
+ */
+static void put_fixed(string& out, uint32_t value) {
+    for (int byte = 0; byte < 4; ++byte) {
+        out.push_back(static_cast<char>(value >> (8 * byte)));
+    }
+}
+
+/**
+ * @brief Reads an unsigned variable length integer, unless it runs past end.
+ */
+static bool get_varint(const char*& position, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && position < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*position++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Reads a zigzag coded signed variable length integer.
+ */
+static bool get_signed(const char*& position, const char* end, int64_t& value) {
+    uint64_t coded;
+    if (!get_varint(position, end, coded)) {
+        return false;
+    }
+    value = static_cast<int64_t>(coded >> 1) ^ -static_cast<int64_t>(coded & 1);
+    return true;
+}
+
+/**
+ * @brief Reads a 32-bit number written by put_fixed.
+ */
+static bool get_fixed(const char*& position, const char* end, uint32_t& value) {
+    if (end - position < 4) {
+        return false;
+    }
+    value = 0;
+    for (int byte = 0; byte < 4; ++byte) {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(*position++)) << (8 * byte);
+    }
+    return true;
+}
+
+/**
+ * @brief The checksum of a block: its bytes, after its owner's dictionary number, so a
+ * block read as another account's fails.
+ */
+static uint32_t block_crc(uint32_t owner, string_view bytes) {
+    char number[4];
+    for (int byte = 0; byte < 4; ++byte) {
+        number[byte] = static_cast<char>(owner >> (8 * byte));
+    }
+    return Crc32c::extend(Crc32c::compute(number, sizeof(number)), bytes.data(), bytes.size());
+}
+
+/**
+ * @brief Converts a time as YYYYMMDDhhmmss to seconds since 1970-01-01 00:00:00 of the same
+ * clock, by the civil calendar, so the seconds between two entries are a small number.
+ */
+static int64_t seconds_of(int64_t time) {
+    int64_t year = time / 10000000000;
+    int64_t month = time / 100000000 % 100;
+    int64_t day = time / 1000000 % 100;
+    int64_t clock = time % 1000000;
+    // Days since 1970-01-01, counting years from March so leap days come last
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int64_t days = era * 146097 + day_of_era - 719468;
+    return days * 86400 + clock / 10000 * 3600 + clock / 100 % 100 * 60 + clock % 100;
+}
+
+/**
+ * @brief Converts seconds since 1970-01-01 back to a time as YYYYMMDDhhmmss.
+ */
+static int64_t time_of(int64_t seconds) {
+    int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    int64_t clock = seconds - days * 86400;
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t day_of_era = days - era * 146097;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t shifted_month = (5 * day_of_year + 2) / 153;
+    int64_t day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    int64_t month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    int64_t year = year_of_era + era * 400 + (month <= 2);
+    return ((year * 100 + month) * 100 + day) * 1000000 + clock / 3600 * 10000 + clock / 60 % 60 * 100 + clock % 60;
+}
+
+/**
+ * @brief Writes the last digits of a number into text, right to left.
+ */
+static void put_digits(char* text, int64_t value, int digits) {
+    for (int digit = digits - 1; digit >= 0; --digit) {
+        text[digit] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+}
+
+/**
+ * @brief Whether entries of a type name another party.
+ */
+static bool has_counterparty(HistoryLog::Type type) {
+    return type == HistoryLog::Type::TRANSFER_OUT || type == HistoryLog::Type::TRANSFER_IN ||
+           type == HistoryLog::Type::REFUND;
+}
+
+/**
+ * @brief Writes an entry as the TransactionHandler and TransferEngine do, such as
+ * "[2024-05-01 12:00:00] --- Transfer --- $25.5 --- alice -> bob".
+ */
+static void format_entry(string& out, int64_t time, HistoryLog::Type type, int64_t cents, string_view owner,
+                         string_view counterparty) {
+    // Built in place, as this is most of the work of decoding
+    char text[64] = "[0000-00-00 00:00:00] --- ";
+    put_digits(text + 1, time / 10000000000, 4);
+    put_digits(text + 6, time / 100000000, 2);
+    put_digits(text + 9, time / 1000000, 2);
+    put_digits(text + 12, time / 10000, 2);
+    put_digits(text + 15, time / 100, 2);
+    put_digits(text + 18, time, 2);
+    size_t length = 26;
+    const char* kind = KIND_NAMES[static_cast<size_t>(type)];
+    while (*kind != '\0') {
+        text[length++] = *kind++;
+    }
+    memcpy(text + length, " --- $", 6);
+    length += 6;
+    // As a stream prints it: no trailing zeros after the point
+    if (cents < 0) {
+        text[length++] = '-';
+        cents = -cents;
+    }
+    char dollars[20];
+    char* first = dollars + sizeof(dollars);
+    int64_t whole = cents / 100;
+    do {
+        *--first = static_cast<char>('0' + whole % 10);
+        whole /= 10;
+    } while (whole != 0);
+    memcpy(text + length, first, dollars + sizeof(dollars) - first);
+    length += dollars + sizeof(dollars) - first;
+    if (cents % 100 != 0) {
+        text[length++] = '.';
+        text[length++] = static_cast<char>('0' + cents / 10 % 10);
+        if (cents % 10 != 0) {
+            text[length++] = static_cast<char>('0' + cents % 10);
+        }
+    }
+    out.append(text, length);
+    if (type == HistoryLog::Type::TRANSFER_OUT) {
+        out.append(" --- ").append(owner).append(" -> ").append(counterparty);
+    } else if (type == HistoryLog::Type::TRANSFER_IN) {
+        out.append(" --- ").append(counterparty).append(" -> ").append(owner);
+    } else if (type == HistoryLog::Type::REFUND) {
+        out.append(" --- ").append(counterparty);
+    }
+}
+
+/**
+ * @brief Whether a decoded entry was kept as text. Only such entries have no type, and
+ * only entries with no type can be empty.
+ */
+static bool is_literal(const HistoryArchive::Entry& entry) {
+    return entry.type == HistoryLog::Type::OTHER || !entry.literal.empty();
+}
+
+/**
+ * @brief Finds the other party of an entry kept as text, as HistoryLog::parse does.
+ */
+static string literal_counterparty(const HistoryArchive::Entry& entry, string_view owner) {
+    string counterparty;
+    HistoryLog::parse(string(entry.literal), string(owner), counterparty);
+    return counterparty;
+}
+
+/**
+ * @name Writer
+ * @brief Constructor for the Writer class. The archive is appended to out by finish(),
+ * after any header lines already there.
+ *
+ * @param out The file contents to append to
+ */
+HistoryArchive::Writer::Writer(string& out) : out(out), accounts(0) {}
+
+/**
+ * @name add
+ * @brief Codes an account's entries, in blocks of BLOCK. An account with no entries is
+ * left out.
+ *
+ * @param owner The account's username
+ * @param entries The entries, oldest first
+ */
+void HistoryArchive::Writer::add(const string& owner, const HistoryLog::View& entries) {
+    if (entries.empty()) {
+        return;
+    }
+    uint32_t number = name(owner);
+    put_varint(body, number);
+    put_varint(body, (entries.size() + BLOCK - 1) / BLOCK);
+    const string* pending[BLOCK];
+    size_t count = 0;
+    for (const string& entry : entries) {
+        pending[count++] = &entry;
+        if (count == BLOCK) {
+            block(number, owner, pending, count);
+            count = 0;
+        }
+    }
+    if (count != 0) {
+        block(number, owner, pending, count);
+    }
+    ++accounts;
+}
+
+/**
+ * @name finish
+ * @brief Appends the format line, the dictionary and every account added.
+ */
+void HistoryArchive::Writer::finish() {
+    out.append(FORMAT_LINE);
+    out.push_back('\n');
+    size_t start = out.size();
+    put_varint(out, dictionary.size());
+    for (const string* text : dictionary) {
+        put_varint(out, text->size());
+        out.append(*text);
+    }
+    put_fixed(out, Crc32c::compute(out.data() + start, out.size() - start));
+    put_varint(out, accounts);
+    out.append(body);
+    body.clear();
+    accounts = 0;
+}
+
+/**
+ * @brief Returns a name's dictionary number, adding it if it is new.
+ */
+uint32_t HistoryArchive::Writer::name(const string& text) {
+    auto found = names.find(text);
+    if (found == names.end()) {
+        found = names.emplace(text, static_cast<uint32_t>(dictionary.size())).first;
+        dictionary.push_back(&found->first);
+    }
+    return found->second;
+}
+
+/**
+ * @brief Codes one block of an account's entries. Each entry is decoded again as it is
+ * coded, and kept as text unless that gives back exactly the same entry.
+ */
+void HistoryArchive::Writer::block(uint32_t owner, const string& username, const string* const* entries, size_t count) {
+    HistoryLog::Record records[BLOCK];
+    int64_t cents[BLOCK];
+    uint32_t parties[BLOCK];
+    bool coded[BLOCK];
+    int64_t oldest = numeric_limits<int64_t>::max();
+    int64_t newest = 0;
+    uint32_t types = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const string& entry = *entries[i];
+        records[i] = HistoryLog::parse(entry, username, counterparty);
+        oldest = min(oldest, records[i].time);
+        newest = max(newest, records[i].time);
+        types |= 1u << static_cast<unsigned>(records[i].type);
+        coded[i] = records[i].type != HistoryLog::Type::OTHER && fabs(records[i].amount) * 100 < LARGEST_CENTS;
+        if (!coded[i]) {
+            continue;
+        }
+        cents[i] = llround(records[i].amount * 100);
+        decoded.clear();
+        format_entry(decoded, time_of(seconds_of(records[i].time)), records[i].type, cents[i], username, counterparty);
+        coded[i] = decoded == entry;
+        parties[i] = coded[i] && has_counterparty(records[i].type) ? name(counterparty) : NONE;
+    }
+
+    payload.clear();
+    int64_t previous = seconds_of(oldest);
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t type = static_cast<uint8_t>(records[i].type);
+        if (!coded[i]) {
+            payload.push_back(static_cast<char>(type | LITERAL));
+            put_varint(payload, entries[i]->size());
+            payload.append(*entries[i]);
+            continue;
+        }
+        int64_t seconds = seconds_of(records[i].time);
+        payload.push_back(static_cast<char>(type));
+        put_signed(payload, seconds - previous);
+        put_signed(payload, cents[i]);
+        if (parties[i] != NONE) {
+            put_varint(payload, parties[i]);
+        }
+        previous = seconds;
+    }
+
+    size_t start = body.size();
+    put_varint(body, count);
+    put_varint(body, oldest);
+    put_varint(body, newest - oldest);
+    put_varint(body, types);
+    put_varint(body, payload.size());
+    body.append(payload);
+    put_fixed(body, block_crc(owner, string_view(body).substr(start)));
+}
+
+/**
+ * @name open
+ * @brief Reads a history file's header lines, dictionary and the header of every block,
+ * without decoding any block.
+ *
+ * @param contents The file's contents, which must outlive the Reader
+ * @return false if the file is not an archive or is damaged; the accounts found before
+ * the damage can still be read
+ */
+bool HistoryArchive::Reader::open(string_view contents) {
+    dictionary.clear();
+    names.clear();
+    account_of.clear();
+    all_accounts.clear();
+    all_blocks.clear();
+    // Header lines, up to the format line
+    size_t start = 0;
+    while (true) {
+        size_t end = contents.find('\n', start);
+        if (end == string_view::npos || contents[start] != '#') {
+            return false;
+        }
+        string_view line = contents.substr(start, end - start);
+        start = end + 1;
+        if (line == FORMAT_LINE) {
+            break;
+        }
+    }
+
+    const char* position = contents.data() + start;
+    const char* end = contents.data() + contents.size();
+    uint64_t count;
+    if (!get_varint(position, end, count) || count > static_cast<uint64_t>(end - position)) {
+        return false;
+    }
+    dictionary.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t length;
+        if (!get_varint(position, end, length) || length > static_cast<uint64_t>(end - position)) {
+            return false;
+        }
+        dictionary.emplace_back(position, length);
+        position += length;
+    }
+    uint32_t crc;
+    uint32_t expected = Crc32c::compute(contents.data() + start, position - contents.data() - start);
+    if (!get_fixed(position, end, crc) || crc != expected) {
+        dictionary.clear();
+        return false;
+    }
+    names.reserve(dictionary.size());
+    for (uint32_t i = 0; i < dictionary.size(); ++i) {
+        names.emplace(dictionary[i], i);
+    }
+    account_of.assign(dictionary.size(), NONE);
+
+    uint64_t accounts;
+    if (!get_varint(position, end, accounts)) {
+        return false;
+    }
+    all_accounts.reserve(min<uint64_t>(accounts, dictionary.size()));
+    for (uint64_t i = 0; i < accounts; ++i) {
+        uint64_t owner, blocks;
+        if (!get_varint(position, end, owner) || owner >= dictionary.size() || !get_varint(position, end, blocks)) {
+            return false;
+        }
+        account_of[owner] = static_cast<uint32_t>(all_accounts.size());
+        all_accounts.push_back({static_cast<uint32_t>(owner), static_cast<uint32_t>(all_blocks.size()), 0, 0});
+        Account& account = all_accounts.back();
+        for (uint64_t index = 0; index < blocks; ++index) {
+            const char* header = position;
+            uint64_t entries, oldest, span, types, length;
+            if (!get_varint(position, end, entries) || entries == 0 || entries > BLOCK ||
+                !get_varint(position, end, oldest) || !get_varint(position, end, span) ||
+                !get_varint(position, end, types) || !get_varint(position, end, length) ||
+                length > static_cast<uint64_t>(end - position)) {
+                return false;
+            }
+            Block block;
+            block.owner = static_cast<uint32_t>(owner);
+            block.entries = static_cast<uint32_t>(entries);
+            block.oldest = static_cast<int64_t>(oldest);
+            block.newest = static_cast<int64_t>(oldest + span);
+            block.types = static_cast<uint32_t>(types);
+            block.payload = string_view(position, length);
+            position += length;
+            block.bytes = string_view(header, position - header);
+            if (!get_fixed(position, end, block.crc)) {
+                return false;
+            }
+            all_blocks.push_back(block);
+            ++account.block_count;
+            account.entries += block.entries;
+        }
+    }
+    return position == end;
+}
+
+/**
+ * @name accounts
+ * @brief Returns how many accounts have history in the file.
+ *
+ * @return The number of accounts
+ */
+size_t HistoryArchive::Reader::accounts() const {
+    return all_accounts.size();
+}
+
+/**
+ * @name owner
+ * @brief Returns an account's username.
+ *
+ * @param account The account, below accounts()
+ * @return The username
+ */
+string_view HistoryArchive::Reader::owner(size_t account) const {
+    return dictionary[all_accounts[account].owner];
+}
+
+/**
+ * @name find
+ * @brief Finds an account by username.
+ *
+ * @param owner The username
+ * @return The account, or NONE if it has no history in the file
+ */
+size_t HistoryArchive::Reader::find(string_view owner) const {
+    auto found = names.find(owner);
+    return found == names.end() ? NONE : account_of[found->second];
+}
+
+/**
+ * @name entries
+ * @brief Returns how many entries an account has, from the block headers.
+ *
+ * @param account The account
+ * @return The number of entries
+ */
+size_t HistoryArchive::Reader::entries(size_t account) const {
+    return all_accounts[account].entries;
+}
+
+/**
+ * @name blocks
+ * @brief Returns how many blocks an account's entries are in.
+ *
+ * @param account The account
+ * @return The number of blocks
+ */
+size_t HistoryArchive::Reader::blocks(size_t account) const {
+    return all_accounts[account].block_count;
+}
+
+/**
+ * @name block
+ * @brief Returns one of an account's blocks, oldest first.
+ *
+ * @param account The account
+ * @param index The block, below blocks(account)
+ * @return The block
+ */
+const HistoryArchive::Block& HistoryArchive::Reader::block(size_t account, size_t index) const {
+    return all_blocks[all_accounts[account].first_block + index];
+}
+
+/**
+ * @name decode
+ * @brief Checks a block against its checksum and decodes its entries.
+ *
+ * @param block The block
+ * @param entries Receives the entries, oldest first
+ * @return false if the block is damaged
+ */
+bool HistoryArchive::Reader::decode(const Block& block, vector<Entry>& entries) const {
+    entries.clear();
+    if (block_crc(block.owner, block.bytes) != block.crc) {
+        return false;
+    }
+    static const string NOBODY;
+    const char* position = block.payload.data();
+    const char* end = position + block.payload.size();
+    int64_t previous = seconds_of(block.oldest);
+    for (uint32_t i = 0; i < block.entries; ++i) {
+        if (position == end) {
+            return false;
+        }
+        uint8_t tag = static_cast<uint8_t>(*position++);
+        if ((tag & ~LITERAL) >= static_cast<uint8_t>(HistoryLog::Type::COUNT)) {
+            return false;
+        }
+        Entry entry = {0, 0, static_cast<HistoryLog::Type>(tag & ~LITERAL), NONE, string_view()};
+        if (tag & LITERAL) {
+            uint64_t length;
+            if (!get_varint(position, end, length) || length > static_cast<uint64_t>(end - position)) {
+                return false;
+            }
+            entry.literal = string_view(position, length);
+            position += length;
+            // Rare, so parsed again rather than stored twice; the type was read above
+            string counterparty;
+            HistoryLog::Record record = HistoryLog::parse(string(entry.literal), NOBODY, counterparty);
+            entry.time = record.time;
+            entry.amount = record.amount;
+            entries.push_back(entry);
+            continue;
+        }
+        int64_t delta, cents;
+        if (!get_signed(position, end, delta) || !get_signed(position, end, cents)) {
+            return false;
+        }
+        previous += delta;
+        entry.time = time_of(previous);
+        entry.amount = static_cast<double>(cents) / 100;
+        if (has_counterparty(entry.type)) {
+            uint64_t party;
+            if (!get_varint(position, end, party) || party >= dictionary.size()) {
+                return false;
+            }
+            entry.counterparty = static_cast<uint32_t>(party);
+        }
+        entries.push_back(entry);
+    }
+    return position == end;
+}
+
+/**
+ * @name text
+ * @brief Appends an entry's text, exactly as it was before it was coded.
+ *
+ * @param entry The entry, from decode()
+ * @param owner The username of the entry's account
+ * @param out The string to append to
+ */
+void HistoryArchive::Reader::text(const Entry& entry, string_view owner, string& out) const {
+    if (is_literal(entry)) {
+        out.append(entry.literal);
+        return;
+    }
+    string_view counterparty = entry.counterparty == NONE ? string_view() : dictionary[entry.counterparty];
+    format_entry(out, entry.time, entry.type, llround(entry.amount * 100), owner, counterparty);
+}
+
+/**
+ * @name read
+ * @brief Decodes every entry of an account into its text.
+ *
+ * @param account The account
+ * @param entries Receives the entries, oldest first, appended
+ * @return The number of damaged blocks, whose entries are left out
+ */
+size_t HistoryArchive::Reader::read(size_t account, vector<string>& entries) const {
+    size_t damaged = 0;
+    vector<Entry> decoded;
+    string_view name = owner(account);
+    for (size_t index = 0; index < blocks(account); ++index) {
+        if (!decode(block(account, index), decoded)) {
+            ++damaged;
+            continue;
+        }
+        for (const Entry& entry : decoded) {
+            entries.emplace_back();
+            text(entry, name, entries.back());
+        }
+    }
+    return damaged;
+}
+
+/**
+ * @name query
+ * @brief Finds an account's entries that match a query, as HistoryLog::query does, and
+ * decodes only the blocks whose times and types can hold a match, newest first, so a
+ * limit stops the search early. Damaged blocks are skipped.
+ *
+ * @param account The account
+ * @param query The conditions
+ * @return The matching entries, oldest first
+ */
+vector<string> HistoryArchive::Reader::query(size_t account, const HistoryLog::Query& query) const {
+    vector<string> found;
+    size_t limit = query.limit == 0 ? numeric_limits<size_t>::max() : query.limit;
+    uint32_t party = NONE;
+    uint32_t types = query.types == 0 ? ~0u : query.types;
+    if (query.counterparty != "") {
+        auto name = names.find(query.counterparty);
+        party = name == names.end() ? NONE : name->second;
+        types &= (1u << static_cast<unsigned>(HistoryLog::Type::TRANSFER_OUT)) |
+                 (1u << static_cast<unsigned>(HistoryLog::Type::TRANSFER_IN)) |
+                 (1u << static_cast<unsigned>(HistoryLog::Type::REFUND));
+    }
+    string_view username = owner(account);
+    vector<Entry> decoded;
+    for (size_t index = blocks(account); index-- > 0 && found.size() < limit;) {
+        const Block& candidate = block(account, index);
+        if (candidate.newest < query.from || candidate.oldest > query.to || (candidate.types & types) == 0 ||
+            !decode(candidate, decoded)) {
+            continue;
+        }
+        for (size_t i = decoded.size(); i-- > 0 && found.size() < limit;) {
+            const Entry& entry = decoded[i];
+            if ((types & (1u << static_cast<unsigned>(entry.type))) == 0 || entry.time < query.from ||
+                entry.time > query.to || entry.amount < query.min_amount || entry.amount > query.max_amount) {
+                continue;
+            }
+            if (query.counterparty != "" &&
+                (is_literal(entry) ? literal_counterparty(entry, username) != query.counterparty : entry.counterparty != party)) {
+                continue;
+            }
+            found.emplace_back();
+            text(entry, username, found.back());
+        }
+    }
+    reverse(found.begin(), found.end());
+    return found;
+}
+
+/**
+ * @name isArchive
+ * @brief Whether a history file is an archive: the format line is its first or second line.
+ *
+ * @param contents The file's contents
+ * @return true if the file is an archive
+ */
+bool HistoryArchive::isArchive(string_view contents) {
+    size_t first = contents.find('\n');
+    if (first == string_view::npos) {
+        return false;
+    }
+    if (contents.substr(0, first) == FORMAT_LINE) {
+        return true;
+    }
+    size_t second = contents.find('\n', first + 1);
+    return second != string_view::npos && contents.substr(first + 1, second - first - 1) == FORMAT_LINE;
+}
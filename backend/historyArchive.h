@@ -0,0 +1,138 @@
+/**
+ * @file historyArchive.h
+ * @brief Declaration of the HistoryArchive class.
+ * @author Kaden Oseen
+ */
+
+#ifndef HISTORY_ARCHIVE_H
+#define HISTORY_ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "historyLog.h"
+
+/**
+ * @class HistoryArchive
+ * @brief A compact binary layout of every account's history, used for the history file
+ * with history_format = archive. After the header lines comes a dictionary of every
+ * username and counterparty, then each account's entries in blocks of BLOCK. An entry is
+ * coded as its type, the seconds since the entry before it, its amount in cents and the
+ * dictionary number of its other party, each as a variable length integer, and is turned
+ * back into exactly the text it was made from. An entry that would not come back the same
+ * (an unusual amount or kind) is kept as its text.
+ *
+ * Each block starts afresh, so one can be decoded without the blocks before it, and
+ * carries the range of its times, the types it holds and a CRC-32C of its bytes. A query
+ * decodes only the blocks that can hold a match.
+ */
+class HistoryArchive {
+public:
+    // Entries per block
+    static constexpr size_t BLOCK = 64;
+    static constexpr std::string_view FORMAT_LINE = "#format:archive";
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    /**
+     * @struct Entry
+     * @brief A decoded entry. Its text is made by Reader::text().
+     */
+    struct Entry {
+        // Local time as YYYYMMDDhhmmss, as in HistoryLog::Record
+        int64_t time;
+        double amount;
+        HistoryLog::Type type;
+        // Dictionary number of the other party of a transfer or refund, or NONE
+        uint32_t counterparty;
+        // The entry as written, if it was kept as text
+        std::string_view literal;
+    };
+
+    /**
+     * @struct Block
+     * @brief Where a block is and what it holds, read without decoding it.
+     */
+    struct Block {
+        // Dictionary number of the owner, which the checksum also covers
+        uint32_t owner;
+        uint32_t entries;
+        int64_t oldest;
+        int64_t newest;
+        // A bit (1 << Type) per type present
+        uint32_t types;
+        // The block's header and entries, which its checksum covers
+        std::string_view bytes;
+        std::string_view payload;
+        uint32_t crc;
+    };
+
+    /**
+     * @class Writer
+     * @brief Builds a history file. The dictionary goes first, so accounts are kept aside
+     * until finish().
+     */
+    class Writer {
+    public:
+        explicit Writer(std::string& out);
+        void add(const std::string& owner, const HistoryLog::View& entries);
+        void finish();
+    private:
+        std::string& out;
+        std::string body;
+        size_t accounts;
+        std::unordered_map<std::string, uint32_t> names;
+        std::vector<const std::string*> dictionary;
+        // Reused while coding, so each entry costs no allocation
+        std::string counterparty;
+        std::string decoded;
+        std::string payload;
+
+        uint32_t name(const std::string& text);
+        void block(uint32_t owner, const std::string& username, const std::string* const* entries, size_t count);
+    };
+
+    /**
+     * @class Reader
+     * @brief Finds the accounts and blocks of a history file and decodes blocks on
+     * request. Safe to use from several threads once open.
+     */
+    class Reader {
+    public:
+        bool open(std::string_view contents);
+        size_t accounts() const;
+        std::string_view owner(size_t account) const;
+        size_t find(std::string_view owner) const;
+        size_t entries(size_t account) const;
+        size_t blocks(size_t account) const;
+        const Block& block(size_t account, size_t index) const;
+        bool decode(const Block& block, std::vector<Entry>& entries) const;
+        void text(const Entry& entry, std::string_view owner, std::string& out) const;
+        size_t read(size_t account, std::vector<std::string>& entries) const;
+        std::vector<std::string> query(size_t account, const HistoryLog::Query& query) const;
+    private:
+        /**
+         * @struct Account
+         * @brief An account's owner and its blocks in all_blocks.
+         */
+        struct Account {
+            uint32_t owner;
+            uint32_t first_block;
+            uint32_t block_count;
+            uint32_t entries;
+        };
+
+        std::vector<std::string_view> dictionary;
+        std::unordered_map<std::string_view, uint32_t> names;
+        // The account of each dictionary name, or NONE
+        std::vector<uint32_t> account_of;
+        std::vector<Account> all_accounts;
+        std::vector<Block> all_blocks;
+    };
+
+    static bool isArchive(std::string_view contents);
+};
+
+#endif
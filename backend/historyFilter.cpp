@@ -0,0 +1,351 @@
+/**
+ * @file historyFilter.cpp
+ * @brief Implementation of the HistoryFilter class.
+ * @author Kaden Oseen
+ */
+
+#include "historyFilter.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// Type bits of a query
+static const uint32_t DEPOSITS = 1u << static_cast<unsigned>(HistoryLog::Type::DEPOSIT);
+static const uint32_t WITHDRAWALS = 1u << static_cast<unsigned>(HistoryLog::Type::WITHDRAWAL);
+static const uint32_t SENT = 1u << static_cast<unsigned>(HistoryLog::Type::TRANSFER_OUT);
+static const uint32_t RECEIVED = 1u << static_cast<unsigned>(HistoryLog::Type::TRANSFER_IN);
+static const uint32_t REFUNDS = 1u << static_cast<unsigned>(HistoryLog::Type::REFUND);
+
+/**
+ * @brief Returns a local time as the number YYYYMMDDhhmmss used by history records.
+ * @param time The time, normalized by mktime
+ * @return The number
+ */
+static int64_t time_key(const tm& time) {
+    return (((((time.tm_year + 1900) * 100LL + time.tm_mon + 1) * 100 + time.tm_mday) * 100 + time.tm_hour) * 100 +
+            time.tm_min) * 100 + time.tm_sec;
+}
+
+/**
+ * @brief Returns the start of a day, counted from today, as a time key.
+ * @param now The current time
+ * @param days_ago How many days before today (0 for today)
+ * @return The key of midnight at the start of that day
+ */
+static int64_t day_start(time_t now, int days_ago) {
+    tm day = *localtime(&now);
+    day.tm_mday -= days_ago;
+    day.tm_hour = day.tm_min = day.tm_sec = 0;
+    day.tm_isdst = -1;
+    mktime(&day);
+    return time_key(day);
+}
+
+/**
+ * @brief Returns the start of a month or year, counted back from the current one, as a time key.
+ * @param now The current time
+ * @param months_ago Months before the current one
+ * @param year Whether to go to the start of that month's year
+ * @return The key of midnight on the first day
+ */
+static int64_t period_start(time_t now, int months_ago, bool year) {
+    tm day = *localtime(&now);
+    day.tm_mon -= months_ago;
+    day.tm_mday = 1;
+    day.tm_hour = day.tm_min = day.tm_sec = 0;
+    day.tm_isdst = -1;
+    mktime(&day);
+    if (year) {
+        day.tm_mon = 0;
+    }
+    return time_key(day);
+}
+
+/**
+ * @brief Moves a date by whole days.
+ * @param key The time key of midnight at the start of the date
+ * @param days Days to move by
+ * @return The time key of midnight at the start of the new date
+ */
+static int64_t shift_day(int64_t key, int days) {
+    tm day = {};
+    day.tm_year = static_cast<int>(key / 10000000000) - 1900;
+    day.tm_mon = static_cast<int>(key / 100000000 % 100) - 1;
+    day.tm_mday = static_cast<int>(key / 1000000 % 100) + days;
+    day.tm_isdst = -1;
+    mktime(&day);
+    return time_key(day);
+}
+
+/**
+ * @brief Reads a YYYY-MM-DD date.
+ * @param word The text
+ * @param key Receives the key of midnight at its start
+ * @return true if it is a date
+ */
+static bool parse_date(const string& word, int64_t& key) {
+    int year, month, day;
+    char end;
+    if (word.size() != 10 || sscanf(word.c_str(), "%4d-%2d-%2d%c", &year, &month, &day, &end) != 3 ||
+        month < 1 || month > 12 || day < 1 || day > 31) {
+        return false;
+    }
+    key = ((year * 100LL + month) * 100 + day) * 1000000;
+    return true;
+}
+
+/**
+ * @brief Reads an amount of money such as "500", "$1,250.50" or "20.5".
+ * @param word The text
+ * @param amount Receives the amount
+ * @return true if it is an amount
+ */
+static bool parse_amount(const string& word, double& amount) {
+    string digits;
+    for (char c : word) {
+        if (c != '$' && c != ',') {
+            digits += c;
+        }
+    }
+    if (digits.empty() || !isdigit(static_cast<unsigned char>(digits[0]))) {
+        return false;
+    }
+    char* end;
+    amount = strtod(digits.c_str(), &end);
+    return *end == '\0';
+}
+
+/**
+ * @brief Reads a whole number of at most a few digits.
+ * @param word The text
+ * @param number Receives the number
+ * @return true if it is one
+ */
+static bool parse_count(const string& word, int& number) {
+    if (word.empty() || word.size() > 6 || !all_of(word.begin(), word.end(), [](unsigned char c) { return isdigit(c); })) {
+        return false;
+    }
+    number = stoi(word);
+    return true;
+}
+
+/**
+ * @brief Formats a time key as YYYY-MM-DD.
+ * @param key The key
+ * @return The date
+ */
+static string format_date(int64_t key) {
+    ostringstream out;
+    out << key / 10000000000 << "-" << setw(2) << setfill('0') << key / 100000000 % 100 << "-" << setw(2)
+        << setfill('0') << key / 1000000 % 100;
+    return out.str();
+}
+
+/**
+ * @name parse
+ * @brief Reads the conditions in a request: kinds of transaction (deposits, withdrawals,
+ * transfers, sent, received, refunds), a counterparty ("to bob", "from alice", "with bob"),
+ * amounts ("over $500", "less than 20", "at least 100", "exactly 50"), dates ("today",
+ * "yesterday", "this week|month|year", "last month|year", "last 30 days", "since|after|before|
+ * until|on YYYY-MM-DD", "between YYYY-MM-DD and YYYY-MM-DD") and a count ("last 5 transfers").
+ *
+ * @param text What the user typed
+ * @param now The current time, for relative dates
+ * @return The query
+ */
+HistoryLog::Query HistoryFilter::parse(const string& text, time_t now) {
+    HistoryLog::Query query;
+    // Words as typed (usernames are case sensitive) and lowercased, without trailing punctuation
+    vector<string> words;
+    vector<string> lower;
+    istringstream input(text);
+    string word;
+    while (input >> word) {
+        while (!word.empty() && string(",.?!;:").find(word.back()) != string::npos) {
+            word.pop_back();
+        }
+        if (!word.empty()) {
+            words.push_back(word);
+            lower.push_back(word);
+            transform(lower.back().begin(), lower.back().end(), lower.back().begin(), [](unsigned char c) { return tolower(c); });
+        }
+    }
+    static const string NOT_NAMES[] = {"me", "my", "myself", "the", "a", "an", "date", "now", "today", "someone", "anyone"};
+    auto next = [&](size_t i, size_t ahead) { return i + ahead < lower.size() ? lower[i + ahead] : string(); };
+    auto is_name = [&](size_t i) {
+        double amount;
+        int64_t date;
+        return i < words.size() && find(begin(NOT_NAMES), end(NOT_NAMES), lower[i]) == end(NOT_NAMES) &&
+               !parse_amount(words[i], amount) && !parse_date(words[i], date);
+    };
+    // The direction of transfers asked for by "to", "from", "sent" and "received"
+    uint32_t direction = 0;
+    uint32_t types = 0;
+    for (size_t i = 0; i < lower.size(); ++i) {
+        const string& w = lower[i];
+        double amount;
+        int64_t date;
+        int count;
+        if (w.rfind("deposit", 0) == 0) {
+            types |= DEPOSITS;
+        } else if (w.rfind("withdr", 0) == 0) {
+            types |= WITHDRAWALS;
+        } else if (w.rfind("refund", 0) == 0) {
+            types |= REFUNDS;
+        } else if (w.rfind("transfer", 0) == 0 || w.rfind("payment", 0) == 0) {
+            types |= SENT | RECEIVED;
+        } else if (w == "sent" || w == "outgoing") {
+            direction |= SENT;
+        } else if (w == "received" || w == "incoming") {
+            direction |= RECEIVED;
+        } else if ((w == "to" || w == "until") && parse_date(next(i, 1), date)) {
+            query.to = date + 235959;
+            ++i;
+        } else if ((w == "from" || w == "since" || w == "after") && parse_date(next(i, 1), date)) {
+            query.from = w == "after" ? shift_day(date, 1) : date;
+            ++i;
+        } else if (w == "before" && parse_date(next(i, 1), date)) {
+            query.to = shift_day(date, -1) + 235959;
+            ++i;
+        } else if (w == "on" && parse_date(next(i, 1), date)) {
+            query.from = date;
+            query.to = date + 235959;
+            ++i;
+        } else if (w == "between" && parse_date(next(i, 1), date)) {
+            query.from = date;
+            int64_t last;
+            if (next(i, 2) == "and" && parse_date(next(i, 3), last)) {
+                query.to = last + 235959;
+                i += 2;
+            }
+            ++i;
+        } else if ((w == "to" || w == "from" || w == "with") && is_name(i + 1)) {
+            query.counterparty = words[i + 1];
+            direction |= w == "to" ? SENT : w == "from" ? RECEIVED : SENT | RECEIVED;
+            ++i;
+        } else if ((w == "over" || w == "above" || w == "exceeding") && parse_amount(next(i, 1), amount)) {
+            query.min_amount = amount;
+            ++i;
+        } else if ((w == "under" || w == "below") && parse_amount(next(i, 1), amount)) {
+            query.max_amount = amount;
+            ++i;
+        } else if ((w == "more" || w == "greater" || w == "larger" || w == "bigger") && next(i, 1) == "than" &&
+                   parse_amount(next(i, 2), amount)) {
+            query.min_amount = amount;
+            i += 2;
+        } else if ((w == "less" || w == "smaller" || w == "fewer") && next(i, 1) == "than" && parse_amount(next(i, 2), amount)) {
+            query.max_amount = amount;
+            i += 2;
+        } else if (w == "at" && (next(i, 1) == "least" || next(i, 1) == "most") && parse_amount(next(i, 2), amount)) {
+            (next(i, 1) == "least" ? query.min_amount : query.max_amount) = amount;
+            i += 2;
+        } else if (w == "exactly" && parse_amount(next(i, 1), amount)) {
+            query.min_amount = query.max_amount = amount;
+            ++i;
+        } else if (w == "today") {
+            query.from = day_start(now, 0);
+        } else if (w == "yesterday") {
+            query.from = day_start(now, 1);
+            query.to = day_start(now, 1) + 235959;
+        } else if (w == "this" && (next(i, 1) == "week" || next(i, 1) == "month" || next(i, 1) == "year")) {
+            query.from = next(i, 1) == "week" ? day_start(now, 6) : period_start(now, 0, next(i, 1) == "year");
+            ++i;
+        } else if ((w == "last" || w == "past" || w == "previous") && (next(i, 1) == "month" || next(i, 1) == "year")) {
+            bool year = next(i, 1) == "year";
+            query.from = year ? period_start(now, 12, true) : period_start(now, 1, false);
+            query.to = shift_day(period_start(now, 0, year), -1) + 235959;
+            ++i;
+        } else if ((w == "last" || w == "past" || w == "previous") && next(i, 1) == "week") {
+            query.from = day_start(now, 7);
+            ++i;
+        } else if ((w == "last" || w == "past" || w == "latest" || w == "recent") && parse_count(next(i, 1), count)) {
+            string unit = next(i, 2);
+            if (unit.rfind("day", 0) == 0) {
+                query.from = day_start(now, count);
+                ++i;
+            } else if (unit.rfind("week", 0) == 0) {
+                query.from = day_start(now, 7 * count);
+                ++i;
+            } else if (unit.rfind("month", 0) == 0) {
+                query.from = period_start(now, count, false);
+                ++i;
+            } else {
+                query.limit = count;
+            }
+            ++i;
+        }
+    }
+    // "to bob" alone means transfers to bob; with refunds it means refunds of transfers to bob
+    if ((types & (SENT | RECEIVED)) != 0 && direction != 0) {
+        types = (types & ~(SENT | RECEIVED)) | direction;
+    } else if (types == 0 || query.counterparty == "") {
+        types |= direction;
+    }
+    query.types = types;
+    return query;
+}
+
+/**
+ * @name describe
+ * @brief Puts a query into words, to head the reply, e.g. "transfers to bob over $500.00 since 2024-05-01".
+ *
+ * @param query The query
+ * @return The description
+ */
+string HistoryFilter::describe(const HistoryLog::Query& query) {
+    ostringstream out;
+    out << fixed << setprecision(2);
+    vector<string> kinds;
+    if (query.types & DEPOSITS) {
+        kinds.push_back("deposits");
+    }
+    if (query.types & WITHDRAWALS) {
+        kinds.push_back("withdrawals");
+    }
+    uint32_t transfers = query.types & (SENT | RECEIVED);
+    if (transfers != 0) {
+        kinds.push_back(transfers == SENT ? "transfers sent" : transfers == RECEIVED ? "transfers received" : "transfers");
+    }
+    if (query.types & REFUNDS) {
+        kinds.push_back("refunds");
+    }
+    if (kinds.empty()) {
+        kinds.push_back("transactions");
+    }
+    for (size_t i = 0; i < kinds.size(); ++i) {
+        out << (i == 0 ? "" : i + 1 == kinds.size() ? " and " : ", ") << kinds[i];
+    }
+    if (query.counterparty != "") {
+        out << (transfers == SENT ? " to " : transfers == RECEIVED ? " from " : " with ") << query.counterparty;
+    }
+    bool capped = query.max_amount != numeric_limits<double>::infinity();
+    if (query.min_amount == query.max_amount) {
+        out << " of $" << query.min_amount;
+    } else if (query.min_amount != 0 && capped) {
+        out << " between $" << query.min_amount << " and $" << query.max_amount;
+    } else if (query.min_amount != 0) {
+        out << " of $" << query.min_amount << " or more";
+    } else if (capped) {
+        out << " of $" << query.max_amount << " or less";
+    }
+    bool ends = query.to != numeric_limits<int64_t>::max();
+    if (query.from % 1000000 == 0 && query.to - query.from == 235959) {
+        out << " on " << format_date(query.from);
+    } else if (query.from != 0 && ends) {
+        out << " from " << format_date(query.from) << " to " << format_date(query.to);
+    } else if (query.from != 0) {
+        out << " since " << format_date(query.from);
+    } else if (ends) {
+        out << " until " << format_date(query.to);
+    }
+    if (query.limit != 0) {
+        out << " (newest " << query.limit << ")";
+    }
+    return out.str();
+}
@@ -0,0 +1,27 @@
+/**
+ * @file historyFilter.h
+ * @brief Declaration of the HistoryFilter class.
+ * @author Kaden Oseen
+ */
+
+#ifndef HISTORY_FILTER_H
+#define HISTORY_FILTER_H
+
+#include <ctime>
+#include <string>
+#include "historyLog.h"
+
+/**
+ * @class HistoryFilter
+ * @brief Reads a history query from what the user typed, in the menu's search prompt or
+ * in a natural language request, e.g. "transfers to bob last month", "deposits over $500",
+ * "withdrawals since 2024-05-01" or "last 5 transfers". Words it does not know are ignored,
+ * so a request with no conditions asks for the whole history.
+ */
+class HistoryFilter {
+public:
+    static HistoryLog::Query parse(const std::string& text, std::time_t now);
+    static std::string describe(const HistoryLog::Query& query);
+};
+
+#endif
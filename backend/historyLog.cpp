@@ -0,0 +1,366 @@
+/**
+ * @file historyLog.cpp
+ * @brief Implementation of the HistoryLog class.
+ * @author Kaden Oseen
+ */
+
+#include "historyLog.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+
+using namespace std;
+
+/**
+ * @name HistoryLog
+ * @brief Constructor for the HistoryLog class. The entries and indexes are made by the first append.
+ */
+HistoryLog::HistoryLog() : count(0) {}
+
+/**
+ * @name ~HistoryLog
+ * @brief Destructor for the HistoryLog class.
+ */
+HistoryLog::~HistoryLog() {}
+
+/**
+ * @name Index
+ * @brief Constructor for the Index struct. The first chunk is allocated by the first append.
+ */
+HistoryLog::Index::Index() : head(nullptr), tail(nullptr), tail_used(0), pending{0, {}} {}
+
+/**
+ * @name ~Index
+ * @brief Destructor for the Index struct. Frees every chunk.
+ */
+HistoryLog::Index::~Index() {
+    Chunk* chunk = head;
+    while (chunk != nullptr) {
+        Chunk* next = chunk->next.load(memory_order_relaxed);
+        delete chunk;
+        chunk = next;
+    }
+}
+
+/**
+ * @name append
+ * @brief Adds an entry and indexes it. Only one thread may append at a time (the holder
+ * of the account's lock).
+ *
+ * @param entry The entry
+ * @param owner The username of the log's owner, to tell transfers in from transfers out
+ */
+void HistoryLog::append(const string& entry, const string& owner) {
+    if (index == nullptr) {
+        // Published to readers with the first entry
+        index = make_unique<Index>();
+    }
+    Index& log = *index;
+    if (log.tail == nullptr) {
+        log.head = log.tail = new Chunk(FIRST_CHUNK);
+    } else if (log.tail_used == log.tail->capacity) {
+        Chunk* next = new Chunk(min(log.tail->capacity * 2, LARGEST_CHUNK));
+        log.tail->next.store(next, memory_order_release);
+        log.tail = next;
+        log.tail_used = 0;
+    }
+    log.tail->entries[log.tail_used] = entry;
+    const string* stored = &log.tail->entries[log.tail_used++];
+
+    size_t position = log.records.size();
+    string counterparty;
+    Record record = parse(*stored, owner, counterparty);
+    record.entry = stored;
+    log.records.push_back(record);
+    if (counterparty != "") {
+        auto found = log.counterparties.find(counterparty);
+        if (found == log.counterparties.end()) {
+            unique_lock<shared_mutex> guard(log.counterparties_mutex);
+            found = log.counterparties.emplace(counterparty, make_unique<AppendVector<uint32_t>>()).first;
+        }
+        found->second->push_back(static_cast<uint32_t>(position));
+    }
+    log.pending.type_words[static_cast<size_t>(record.type)] |= uint64_t(1) << (position % BLOCK);
+    log.pending.newest_time = max(log.pending.newest_time, record.time);
+    if (position % BLOCK == BLOCK - 1) {
+        log.blocks.push_back(log.pending);
+        // The newest time carries over, since it covers every entry up to the block's end
+        fill(log.pending.type_words, log.pending.type_words + TYPES, 0);
+    }
+    // Publishes the entry, its indexes (and any new chunk or index) to readers
+    count.fetch_add(1, memory_order_release);
+}
+
+/**
+ * @name view
+ * @brief Returns the entries written so far. Safe to call while the writer appends.
+ *
+ * @return The entries
+ */
+HistoryLog::View HistoryLog::view() const {
+    size_t counted = count.load(memory_order_acquire);
+    return counted == 0 ? View() : View(index->head, counted);
+}
+
+/**
+ * @name record
+ * @brief Returns the parsed fields of an entry, in constant time. Safe to call while the
+ * writer appends.
+ *
+ * @param position The entry, which must be below the size of a View already taken
+ * @return The entry's record
+ */
+const HistoryLog::Record& HistoryLog::record(size_t position) const {
+    return index->records[position];
+}
+
+/**
+ * @name sign
+ * @brief Which way an entry of a type moves its owner's balance.
+ *
+ * @param type The type
+ * @return 1 for money in, -1 for money out, 0 for entries that do not move the balance
+ */
+int HistoryLog::sign(Type type) {
+    switch (type) {
+        case Type::DEPOSIT:
+        case Type::TRANSFER_IN:
+        case Type::REFUND:
+            return 1;
+        case Type::WITHDRAWAL:
+        case Type::TRANSFER_OUT:
+            return -1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @name back
+ * @brief Returns the newest entry. Only for the writer, and only if there is one.
+ *
+ * @return The entry
+ */
+const string& HistoryLog::back() const {
+    return index->tail->entries[index->tail_used - 1];
+}
+
+/**
+ * @name filtered
+ * @brief Whether the query leaves any entry out.
+ *
+ * @return false if it asks for the whole history
+ */
+bool HistoryLog::Query::filtered() const {
+    return from != 0 || to != numeric_limits<int64_t>::max() || types != 0 || counterparty != "" ||
+           min_amount != 0 || max_amount != numeric_limits<double>::infinity() || limit != 0;
+}
+
+/**
+ * @name query
+ * @brief Finds the entries of a view that match a query, without reading the others:
+ * the date range is found by binary search over the blocks, then only the entries with
+ * the counterparty, or the set bits of the bitmaps of the types, are visited.
+ * Safe to call while the writer appends.
+ *
+ * @param view The entries to search, from view()
+ * @param query The conditions
+ * @return The matching entries, oldest first
+ */
+vector<const string*> HistoryLog::query(const View& view, const Query& query) const {
+    vector<const string*> found;
+    size_t end = view.size();
+    if (end == 0) {
+        return found;
+    }
+    const Index& log = *index;
+    size_t low = firstAtOrAfter(end, query.from);
+    size_t high = query.to == numeric_limits<int64_t>::max() ? end : firstAtOrAfter(end, query.to + 1);
+    if (low >= high) {
+        return found;
+    }
+    size_t limit = query.limit == 0 ? numeric_limits<size_t>::max() : query.limit;
+    // Each candidate is checked against every condition, so the index used only narrows the search
+    auto consider = [&](size_t position) {
+        const Record& record = log.records[position];
+        if (matches(record, query)) {
+            found.push_back(record.entry);
+        }
+        return found.size() < limit;
+    };
+
+    // Newest first, so a limit keeps the most recent
+    if (query.counterparty != "") {
+        const AppendVector<uint32_t>* positions = nullptr;
+        {
+            shared_lock<shared_mutex> guard(log.counterparties_mutex);
+            auto entry = log.counterparties.find(query.counterparty);
+            positions = entry == log.counterparties.end() ? nullptr : entry->second.get();
+        }
+        if (positions != nullptr) {
+            // The first posting at or past high, by binary search
+            size_t first = 0;
+            size_t last = positions->size();
+            while (first < last) {
+                size_t middle = first + (last - first) / 2;
+                if ((*positions)[middle] < high) {
+                    first = middle + 1;
+                } else {
+                    last = middle;
+                }
+            }
+            while (first > 0 && (*positions)[first - 1] >= low && consider((*positions)[first - 1])) {
+                --first;
+            }
+        }
+    } else if (query.types != 0) {
+        // Entries of the block still being filled have no bitmap word yet
+        size_t indexed = end / BLOCK * BLOCK;
+        size_t position = high;
+        while (position > max(low, indexed) && consider(position - 1)) {
+            --position;
+        }
+        if (position <= low || found.size() >= limit) {
+            reverse(found.begin(), found.end());
+            return found;
+        }
+        for (size_t word = (position - 1) / BLOCK + 1; word-- > low / BLOCK;) {
+            uint64_t bits = 0;
+            for (size_t type = 0; type < TYPES; ++type) {
+                if (query.types & (1u << type)) {
+                    bits |= log.blocks[word].type_words[type];
+                }
+            }
+            // Only the positions within [low, position)
+            size_t base = word * BLOCK;
+            if (position - base < BLOCK) {
+                bits &= (uint64_t(1) << (position - base)) - 1;
+            }
+            if (low > base) {
+                bits &= ~((uint64_t(1) << (low - base)) - 1);
+            }
+            while (bits != 0) {
+                int bit = 63 - __builtin_clzll(bits);
+                bits &= ~(uint64_t(1) << bit);
+                if (!consider(base + bit)) {
+                    reverse(found.begin(), found.end());
+                    return found;
+                }
+            }
+        }
+    } else {
+        for (size_t position = high; position > low && consider(position - 1); --position) {
+        }
+    }
+    reverse(found.begin(), found.end());
+    return found;
+}
+
+/**
+ * @name parse
+ * @brief Reads the time, kind, amount and other party of an entry, such as
+ * "[2024-05-01 12:00:00] --- Transfer --- $25 --- alice -> bob".
+ *
+ * @param entry The entry
+ * @param owner The username of the log's owner
+ * @param counterparty Receives the other party of a transfer or refund, or ""
+ * @return The record (without its entry pointer)
+ */
+HistoryLog::Record HistoryLog::parse(const string& entry, const string& owner, string& counterparty) {
+    Record record = {0, 0, Type::OTHER, nullptr};
+    counterparty.clear();
+    // "[YYYY-MM-DD HH:MM:SS]": the 14 digits in order
+    if (entry.size() >= 21 && entry[0] == '[') {
+        int digits = 0;
+        for (size_t i = 1; i < 20; ++i) {
+            if (entry[i] >= '0' && entry[i] <= '9') {
+                record.time = record.time * 10 + (entry[i] - '0');
+                ++digits;
+            }
+        }
+        record.time = digits == 14 ? record.time : 0;
+    }
+    size_t kind = entry.find(" --- ");
+    if (kind == string::npos) {
+        return record;
+    }
+    kind += 5;
+    size_t dollar = entry.find(" --- $", kind);
+    if (dollar == string::npos) {
+        return record;
+    }
+    string_view name(entry.data() + kind, dollar - kind);
+    record.amount = strtod(entry.c_str() + dollar + 6, nullptr);
+    size_t parties = entry.find(" --- ", dollar + 6);
+    string_view other = parties == string::npos ? string_view() : string_view(entry).substr(parties + 5);
+    if (name == "Deposit") {
+        record.type = Type::DEPOSIT;
+    } else if (name == "Withdrawal") {
+        record.type = Type::WITHDRAWAL;
+    } else if (name == "Refund") {
+        record.type = Type::REFUND;
+        counterparty = other;
+    } else if (name == "Transfer") {
+        size_t arrow = other.find(" -> ");
+        if (arrow == string_view::npos) {
+            return record;
+        }
+        string_view sender = other.substr(0, arrow);
+        string_view recipient = other.substr(arrow + 4);
+        bool outgoing = sender == owner;
+        record.type = outgoing ? Type::TRANSFER_OUT : Type::TRANSFER_IN;
+        counterparty = outgoing ? recipient : sender;
+    }
+    return record;
+}
+
+/**
+ * @name firstAtOrAfter
+ * @brief Finds the first entry at or after a time: a binary search for the first block
+ * whose newest time reaches it, then a scan of that block.
+ *
+ * @param end Entries to consider
+ * @param time The time, as YYYYMMDDhhmmss
+ * @return The position, or end if every entry is older
+ */
+size_t HistoryLog::firstAtOrAfter(size_t end, int64_t time) const {
+    const Index& log = *index;
+    size_t first = 0;
+    size_t last = end / BLOCK;
+    while (first < last) {
+        size_t middle = first + (last - first) / 2;
+        if (log.blocks[middle].newest_time < time) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    size_t position = first * BLOCK;
+    while (position < end && log.records[position].time < time) {
+        ++position;
+    }
+    return position;
+}
+
+/**
+ * @name matches
+ * @brief Whether a record meets every condition of a query.
+ *
+ * @param record The record
+ * @param query The query
+ * @return true if it does
+ */
+bool HistoryLog::matches(const Record& record, const Query& query) {
+    if (query.types != 0 && (query.types & (1u << static_cast<unsigned>(record.type))) == 0) {
+        return false;
+    }
+    if (record.time < query.from || record.time > query.to) {
+        return false;
+    }
+    if (record.amount < query.min_amount || record.amount > query.max_amount) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file historyLog.h
+ * @brief Declaration of the HistoryLog class.
+ * @author Kaden Oseen
+ */
+
+#ifndef HISTORY_LOG_H
+#define HISTORY_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "appendVector.h"
+
+/**
+ * @class HistoryLog
+ * @brief A user's transaction history: append-only, one writer, any number of readers.
+ * Entries live in linked chunks that never move, and an entry is only counted once it is
+ * fully written, so a reader can walk the entries it has counted while the writer appends
+ * more, without taking a lock. The chunks and indexes are made by the first append and
+ * chunks grow geometrically, so a user with no history costs a pointer and a count and a
+ * long history costs few allocations.
+ *
+ * Each entry is also parsed once, as it is appended, into a Record, and indexed so a
+ * query() costs time in proportion to what it returns rather than to the whole history:
+ * the newest time at the end of every block of 64 entries (entries are appended in time
+ * order, so a date range is found by binary search), a bitmap per type with one word per
+ * block, and the positions of the entries with each counterparty. The indexes are
+ * append-only too, so queries take no lock either, except briefly to look a counterparty up.
+ */
+class HistoryLog {
+    /**
+     * @struct Chunk
+     * @brief A block of entries. The writer links the next chunk before counting its entries.
+     */
+    struct Chunk {
+        explicit Chunk(size_t capacity) : capacity(capacity), entries(new std::string[capacity]), next(nullptr) {}
+        size_t capacity;
+        std::unique_ptr<std::string[]> entries;
+        std::atomic<Chunk*> next;
+    };
+
+public:
+    // What an entry records; transfers are in or out as seen by the log's owner
+    enum class Type : uint8_t {
+        DEPOSIT,
+        WITHDRAWAL,
+        TRANSFER_OUT,
+        TRANSFER_IN,
+        REFUND,
+        OTHER,
+        COUNT
+    };
+
+    /**
+     * @struct Record
+     * @brief The parsed fields of an entry.
+     */
+    struct Record {
+        // Local time of the entry as the number YYYYMMDDhhmmss, so times compare as numbers
+        int64_t time;
+        double amount;
+        Type type;
+        const std::string* entry;
+    };
+
+    /**
+     * @struct Query
+     * @brief Which entries to find. Every condition set must hold.
+     */
+    struct Query {
+        // Times as YYYYMMDDhhmmss, both included
+        int64_t from = 0;
+        int64_t to = std::numeric_limits<int64_t>::max();
+        // A bit (1 << Type) per type wanted, or 0 for every type
+        uint32_t types = 0;
+        // The other party of a transfer or refund, or "" for anyone
+        std::string counterparty;
+        double min_amount = 0;
+        double max_amount = std::numeric_limits<double>::infinity();
+        // Only the newest this many matches, or 0 for all
+        size_t limit = 0;
+
+        bool filtered() const;
+    };
+
+    /**
+     * @class Iterator
+     * @brief Walks the entries of a View, oldest first.
+     */
+    class Iterator {
+    public:
+        Iterator(const Chunk* chunk, size_t position) : chunk(chunk), position(position), slot(0) {}
+        const std::string& operator*() const { return chunk->entries[slot]; }
+        const std::string* operator->() const { return &chunk->entries[slot]; }
+        Iterator& operator++() {
+            ++position;
+            if (++slot == chunk->capacity) {
+                chunk = chunk->next.load(std::memory_order_acquire);
+                slot = 0;
+            }
+            return *this;
+        }
+        bool operator!=(const Iterator& other) const { return position != other.position; }
+        bool operator==(const Iterator& other) const { return position == other.position; }
+    private:
+        const Chunk* chunk;
+        size_t position;
+        size_t slot;
+    };
+
+    /**
+     * @class View
+     * @brief The first entries of a log, as counted at one moment. Stays valid while the
+     * writer appends, for as long as the log itself exists.
+     */
+    class View {
+    public:
+        View() : head(nullptr), count(0) {}
+        View(const Chunk* head, size_t count) : head(head), count(count) {}
+        Iterator begin() const { return Iterator(head, 0); }
+        Iterator end() const { return Iterator(nullptr, count); }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+    private:
+        const Chunk* head;
+        size_t count;
+    };
+
+    // Constructor and destructor
+    HistoryLog();
+    ~HistoryLog();
+    HistoryLog(const HistoryLog&) = delete;
+    HistoryLog& operator=(const HistoryLog&) = delete;
+    // Methods
+    void append(const std::string& entry, const std::string& owner);
+    View view() const;
+    const std::string& back() const;
+    const Record& record(size_t position) const;
+    std::vector<const std::string*> query(const View& view, const Query& query) const;
+    static Record parse(const std::string& entry, const std::string& owner, std::string& counterparty);
+    static int sign(Type type);
+private:
+    // Capacity of the first chunk and the largest chunk
+    static constexpr size_t FIRST_CHUNK = 4;
+    static constexpr size_t LARGEST_CHUNK = 256;
+    // Entries per block of the time index, one bitmap word each
+    static constexpr size_t BLOCK = 64;
+    static constexpr size_t TYPES = static_cast<size_t>(Type::COUNT);
+
+    /**
+     * @struct Block
+     * @brief The index of a full block: the newest time up to its end, and per type one
+     * word, whose bit i is set if entry i of the block has the type.
+     */
+    struct Block {
+        int64_t newest_time;
+        uint64_t type_words[TYPES];
+    };
+
+    /**
+     * @struct Index
+     * @brief The entries and their indexes, made by the first append, so a log with no
+     * entries is only a pointer and a count. Written only by the appending thread.
+     */
+    struct Index {
+        Index();
+        ~Index();
+        Chunk* head;
+        Chunk* tail;
+        size_t tail_used;
+        AppendVector<Record> records;
+        AppendVector<Block> blocks;
+        // The block being filled
+        Block pending;
+        // Positions of the entries with each counterparty; the mutex guards only the map
+        std::unordered_map<std::string, std::unique_ptr<AppendVector<uint32_t>>> counterparties;
+        mutable std::shared_mutex counterparties_mutex;
+    };
+
+    // Variables
+    // Null until the first append; readers only look at it once count is above zero
+    std::unique_ptr<Index> index;
+    std::atomic<size_t> count;
+
+    // Methods
+    size_t firstAtOrAfter(size_t end, int64_t time) const;
+    static bool matches(const Record& record, const Query& query);
+};
+
+#endif
@@ -0,0 +1,566 @@
+/**
+ * @file intentModel.cpp
+ * @brief Implementation of the IntentModel class.
+ * Scoring adds one row of CLASSES floats per feature, with AVX2 where the CPU has it
+ * (checked once at runtime, so the binary still runs without it), NEON on ARM, and plain
+ * loops otherwise.
+ * @author Kaden Oseen
+ */
+
+#include "intentModel.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+const char* const IntentModel::ACTIONS[IntentModel::CLASSES] = {
+    "deposit", "transfer", "withdraw", "balance", "history", "backwards", "options", "logout"
+};
+
+// First line of a weights file
+static const char* FILE_HEADER = "intent_model 1";
+
+// Hash seeds keeping the kinds of feature apart
+static const uint32_t WORD_SEED = 0x01;
+static const uint32_t PAIR_SEED = 0x02;
+static const uint32_t TRIGRAM_SEED = 0x03;
+// Stand-ins for the start and end of an utterance, so its first and last words form pairs too
+static const uint32_t START_HASH = 0x5bd1e995;
+static const uint32_t END_HASH = 0x1b873593;
+
+/**
+ * @brief FNV-1a hash of some bytes, continuing from a previous hash.
+ * @param hash The hash so far
+ * @param data The bytes
+ * @param size How many
+ * @return The new hash
+ */
+static uint32_t fnv1a(uint32_t hash, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Spreads the bits of a hash, so its low bits can pick a bucket.
+ * @param hash The hash
+ * @param seed The kind of feature
+ * @return The mixed hash
+ */
+static uint32_t mix(uint32_t hash, uint32_t seed) {
+    hash ^= seed * 0x9e3779b9u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/**
+ * @brief Adds the weight rows of the features to the scores, one float per class.
+ * @param weights The weight rows
+ * @param features Row indexes
+ * @param count How many
+ * @param scores The scores, updated in place
+ */
+static void add_rows_scalar(const float* weights, const uint32_t* features, size_t count, float* scores) {
+    for (size_t i = 0; i < count; ++i) {
+        const float* row = weights + static_cast<size_t>(features[i]) * IntentModel::CLASSES;
+        for (int c = 0; c < IntentModel::CLASSES; ++c) {
+            scores[c] += row[c];
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static_assert(IntentModel::CLASSES == 8, "a weight row is one AVX register");
+
+/**
+ * @brief add_rows_scalar with one AVX2 add per feature. Two sums are kept so consecutive
+ * adds do not wait on each other.
+ */
+__attribute__((target("avx2")))
+static void add_rows_avx2(const float* weights, const uint32_t* features, size_t count, float* scores) {
+    __m256 even = _mm256_loadu_ps(scores);
+    __m256 odd = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 1 < count; i += 2) {
+        even = _mm256_add_ps(even, _mm256_loadu_ps(weights + static_cast<size_t>(features[i]) * IntentModel::CLASSES));
+        odd = _mm256_add_ps(odd, _mm256_loadu_ps(weights + static_cast<size_t>(features[i + 1]) * IntentModel::CLASSES));
+    }
+    if (i < count) {
+        even = _mm256_add_ps(even, _mm256_loadu_ps(weights + static_cast<size_t>(features[i]) * IntentModel::CLASSES));
+    }
+    _mm256_storeu_ps(scores, _mm256_add_ps(even, odd));
+}
+
+/**
+ * @brief Adds the weight rows of the features to the scores, with AVX2 if the CPU has it.
+ */
+static void add_rows(const float* weights, const uint32_t* features, size_t count, float* scores) {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        add_rows_avx2(weights, features, count, scores);
+    } else {
+        add_rows_scalar(weights, features, count, scores);
+    }
+}
+#elif defined(__ARM_NEON)
+static_assert(IntentModel::CLASSES == 8, "a weight row is two NEON registers");
+
+/**
+ * @brief Adds the weight rows of the features to the scores, two NEON adds per feature.
+ */
+static void add_rows(const float* weights, const uint32_t* features, size_t count, float* scores) {
+    float32x4_t low = vld1q_f32(scores);
+    float32x4_t high = vld1q_f32(scores + 4);
+    for (size_t i = 0; i < count; ++i) {
+        const float* row = weights + static_cast<size_t>(features[i]) * IntentModel::CLASSES;
+        low = vaddq_f32(low, vld1q_f32(row));
+        high = vaddq_f32(high, vld1q_f32(row + 4));
+    }
+    vst1q_f32(scores, low);
+    vst1q_f32(scores + 4, high);
+}
+#else
+/**
+ * @brief Adds the weight rows of the features to the scores.
+ */
+static void add_rows(const float* weights, const uint32_t* features, size_t count, float* scores) {
+    add_rows_scalar(weights, features, count, scores);
+}
+#endif
+
+/**
+ * @brief Turns scores into probabilities in place.
+ * @param scores One score per class
+ * @return The index of the highest
+ */
+static int softmax(float* scores) {
+    int best = static_cast<int>(max_element(scores, scores + IntentModel::CLASSES) - scores);
+    float top = scores[best];
+    float total = 0;
+    for (int c = 0; c < IntentModel::CLASSES; ++c) {
+        scores[c] = exp(scores[c] - top);
+        total += scores[c];
+    }
+    for (int c = 0; c < IntentModel::CLASSES; ++c) {
+        scores[c] /= total;
+    }
+    return best;
+}
+
+/**
+ * @name IntentModel
+ * @brief Constructor for the IntentModel class. Starts empty; load() or train() it before use.
+ */
+IntentModel::IntentModel() : buckets(0) {
+    fill(bias, bias + CLASSES, 0.0f);
+}
+
+/**
+ * @name load
+ * @brief Loads weights written by save().
+ *
+ * @param path The weights file
+ * @return true if the file was read, false (with the reason on cerr) otherwise
+ */
+bool IntentModel::load(const string& path) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "Could not open intent model " << path << endl;
+        return false;
+    }
+    string line;
+    if (!getline(file, line) || line != FILE_HEADER) {
+        cerr << path << " is not an intent model" << endl;
+        return false;
+    }
+    string key;
+    uint32_t size = 0;
+    if (!(file >> key >> size) || key != "buckets" || size == 0 || (size & (size - 1)) != 0) {
+        cerr << path << ": buckets must be a power of two" << endl;
+        return false;
+    }
+    file >> key;
+    for (int c = 0; c < CLASSES; ++c) {
+        string action;
+        if (!(file >> action) || action != ACTIONS[c]) {
+            cerr << path << ": classes do not match this server's actions" << endl;
+            return false;
+        }
+    }
+    vector<float> rows(static_cast<size_t>(size) * CLASSES, 0.0f);
+    float loaded_bias[CLASSES];
+    file >> key;
+    for (int c = 0; c < CLASSES; ++c) {
+        file >> loaded_bias[c];
+    }
+    if (!file || key != "bias") {
+        cerr << path << ": missing bias" << endl;
+        return false;
+    }
+    uint32_t row;
+    while (file >> row) {
+        if (row >= size) {
+            cerr << path << ": row " << row << " out of range" << endl;
+            return false;
+        }
+        for (int c = 0; c < CLASSES; ++c) {
+            file >> rows[static_cast<size_t>(row) * CLASSES + c];
+        }
+    }
+    if (!file.eof()) {
+        cerr << path << ": malformed weights" << endl;
+        return false;
+    }
+    buckets = size;
+    weights.swap(rows);
+    copy(loaded_bias, loaded_bias + CLASSES, bias);
+    return true;
+}
+
+/**
+ * @name save
+ * @brief Writes the weights as text, leaving out rows that are all zero.
+ *
+ * @param path The weights file
+ * @return true if the file was written
+ */
+bool IntentModel::save(const string& path) const {
+    ofstream file(path, ios_base::trunc);
+    if (!file) {
+        cerr << "Could not write intent model " << path << endl;
+        return false;
+    }
+    file << FILE_HEADER << "\nbuckets " << buckets << "\nclasses";
+    for (const char* action : ACTIONS) {
+        file << " " << action;
+    }
+    file << "\nbias";
+    file.precision(6);
+    for (float value : bias) {
+        file << " " << value;
+    }
+    file << "\n";
+    for (uint32_t row = 0; row < buckets; ++row) {
+        const float* values = &weights[static_cast<size_t>(row) * CLASSES];
+        if (all_of(values, values + CLASSES, [](float value) { return value == 0.0f; })) {
+            continue;
+        }
+        file << row;
+        for (int c = 0; c < CLASSES; ++c) {
+            file << " " << values[c];
+        }
+        file << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+/**
+ * @name loaded
+ * @brief Whether the model has weights.
+ *
+ * @return true once load() or train() has succeeded
+ */
+bool IntentModel::loaded() const {
+    return buckets != 0;
+}
+
+/**
+ * @name train
+ * @brief Fits the weights to labelled utterances by stochastic gradient descent on the
+ * softmax loss. Examples labelled unknown are left out; the model abstains on them by
+ * not being confident. The same examples always give the same weights.
+ *
+ * @param examples The labelled utterances
+ * @param epochs Passes over the examples
+ * @param buckets Hashed feature rows, a power of two
+ */
+void IntentModel::train(const vector<Example>& examples, int epochs, uint32_t buckets) {
+    this->buckets = buckets;
+    weights.assign(static_cast<size_t>(buckets) * CLASSES, 0.0f);
+    fill(bias, bias + CLASSES, 0.0f);
+
+    // Features are taken once; every epoch reuses them
+    vector<vector<uint32_t>> inputs;
+    vector<int> labels;
+    uint32_t scratch[MAX_FEATURES];
+    for (const Example& example : examples) {
+        int label = actionIndex(example.reply);
+        if (label < 0) {
+            continue;
+        }
+        size_t count = features(example.text, scratch);
+        inputs.emplace_back(scratch, scratch + count);
+        labels.push_back(label);
+    }
+    vector<size_t> order(inputs.size());
+    iota(order.begin(), order.end(), 0);
+    mt19937 generator(42);
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        shuffle(order.begin(), order.end(), generator);
+        float rate = 0.2f / (1.0f + 0.1f * epoch);
+        for (size_t index : order) {
+            const vector<uint32_t>& input = inputs[index];
+            float scores[CLASSES];
+            score(input.data(), input.size(), scores);
+            softmax(scores);
+            // The gradient of the loss is the predicted probability less the true one
+            for (int c = 0; c < CLASSES; ++c) {
+                float step = rate * (scores[c] - (c == labels[index] ? 1.0f : 0.0f));
+                bias[c] -= step;
+                for (uint32_t feature : input) {
+                    weights[static_cast<size_t>(feature) * CLASSES + c] -= step;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @name predict
+ * @brief Classifies an utterance and reads its amount.
+ *
+ * @param text The utterance
+ * @param min_confidence Probability below which no action is chosen
+ * @return The action (or -1), its probability and the amount in the text ("" if none)
+ */
+IntentModel::Prediction IntentModel::predict(const string& text, double min_confidence) const {
+    uint32_t found[MAX_FEATURES];
+    size_t count = features(text, found);
+    float scores[CLASSES];
+    score(found, count, scores);
+    int best = softmax(scores);
+    Prediction prediction;
+    prediction.confidence = scores[best];
+    prediction.action = prediction.confidence >= min_confidence ? best : -1;
+    prediction.amount = amountIn(text);
+    return prediction;
+}
+
+/**
+ * @name interpret
+ * @brief Classifies an utterance into the reply the NLP API would give: "(action,amount)",
+ * with -1 for a missing amount where one is needed, 0 where none is, and "(unknown,0)"
+ * if no action is confident enough.
+ *
+ * @param text The utterance
+ * @param min_confidence Probability below which the utterance is unknown
+ * @return The reply
+ */
+string IntentModel::interpret(const string& text, double min_confidence) const {
+    Prediction prediction = predict(text, min_confidence);
+    if (prediction.action < 0) {
+        return "(unknown,0)";
+    }
+    // Only deposit, transfer and withdraw take an amount
+    string amount = prediction.action <= 2 ? (prediction.amount == "" ? "-1" : prediction.amount) : "0";
+    return string("(") + ACTIONS[prediction.action] + "," + amount + ")";
+}
+
+/**
+ * @name readExamples
+ * @brief Reads labelled utterances, one "(action,amount)<TAB>utterance" per line.
+ * Blank lines and lines starting with # are skipped.
+ *
+ * @param path The examples file
+ * @param examples Receives the examples
+ * @return true if the file was read
+ */
+bool IntentModel::readExamples(const string& path, vector<Example>& examples) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "Could not open " << path << endl;
+        return false;
+    }
+    string line;
+    int number = 0;
+    while (getline(file, line)) {
+        ++number;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t tab = line.find('\t');
+        if (tab == string::npos || line[0] != '(' || line[tab - 1] != ')') {
+            cerr << path << ":" << number << ": expected (action,amount)<TAB>utterance" << endl;
+            continue;
+        }
+        examples.push_back({line.substr(0, tab), line.substr(tab + 1)});
+    }
+    return true;
+}
+
+/**
+ * @name actionIndex
+ * @brief Finds the action of a reply in ACTIONS.
+ *
+ * @param reply A reply, "(action,amount)"
+ * @return The index, or -1 for unknown
+ */
+int IntentModel::actionIndex(const string& reply) {
+    string name = reply.substr(1, reply.find(',') - 1);
+    for (int c = 0; c < CLASSES; ++c) {
+        if (name == ACTIONS[c]) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @name features
+ * @brief Hashes an utterance into feature rows: each word, each pair of neighbouring
+ * words (with the start and end of the utterance) and each character trigram of a word
+ * padded with < and >. Letters are lowercased and every number is the same word, #.
+ *
+ * @param text The utterance
+ * @param out Receives at most MAX_FEATURES row indexes
+ * @return How many
+ */
+size_t IntentModel::features(const string& text, uint32_t* out) const {
+    uint32_t mask = buckets - 1;
+    size_t count = 0;
+    uint32_t previous = START_HASH;
+    char word[34];
+    size_t i = 0;
+    while (i < text.size() && count + 40 < MAX_FEATURES) {
+        unsigned char c = text[i];
+        size_t length = 0;
+        if (isdigit(c)) {
+            while (i < text.size() && (isdigit(static_cast<unsigned char>(text[i])) || text[i] == '.' || text[i] == ',')) {
+                ++i;
+            }
+            word[1] = '#';
+            length = 1;
+        } else if (isalpha(c)) {
+            while (i < text.size() && isalpha(static_cast<unsigned char>(text[i]))) {
+                if (length < sizeof(word) - 2) {
+                    word[1 + length++] = static_cast<char>(tolower(static_cast<unsigned char>(text[i])));
+                }
+                ++i;
+            }
+        } else {
+            ++i;
+            continue;
+        }
+        uint32_t hash = fnv1a(2166136261u, word + 1, length);
+        out[count++] = mix(hash, WORD_SEED) & mask;
+        out[count++] = mix(previous * 31 + hash, PAIR_SEED) & mask;
+        previous = hash;
+        word[0] = '<';
+        word[length + 1] = '>';
+        for (size_t start = 0; start + 3 <= length + 2; ++start) {
+            out[count++] = mix(fnv1a(2166136261u, word + start, 3), TRIGRAM_SEED) & mask;
+        }
+    }
+    out[count++] = mix(previous * 31 + END_HASH, PAIR_SEED) & mask;
+    return count;
+}
+
+/**
+ * @name score
+ * @brief Adds up the bias and the weight rows of the features.
+ *
+ * @param features Row indexes
+ * @param count How many
+ * @param scores Receives one score per class
+ */
+void IntentModel::score(const uint32_t* features, size_t count, float* scores) const {
+    copy(bias, bias + CLASSES, scores);
+    add_rows(weights.data(), features, count, scores);
+}
+
+/**
+ * @name amountIn
+ * @brief Finds the amount of money in an utterance: the first number written in digits
+ * ("$1,250.5"), or else the first written in words ("two hundred and fifty").
+ * Digits inside a word, as in a username, are not an amount.
+ *
+ * @param text The utterance
+ * @return The amount with at most two decimals, or "" if there is none
+ */
+string IntentModel::amountIn(const string& text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (!isdigit(static_cast<unsigned char>(text[i])) || (i > 0 && isalpha(static_cast<unsigned char>(text[i - 1])))) {
+            continue;
+        }
+        string amount;
+        size_t decimals = string::npos;
+        for (; i < text.size(); ++i) {
+            char c = text[i];
+            if (isdigit(static_cast<unsigned char>(c))) {
+                if (decimals == string::npos || decimals++ < 2) {
+                    amount += c;
+                }
+            } else if (c == '.' && decimals == string::npos && i + 1 < text.size() && isdigit(static_cast<unsigned char>(text[i + 1]))) {
+                amount += c;
+                decimals = 0;
+            } else if (c != ',' || decimals != string::npos) {
+                break;
+            }
+        }
+        return amount;
+    }
+
+    // Numbers in words, up to the thousands
+    static const char* const UNITS[] = {"zero", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine", "ten",
+                                        "eleven", "twelve", "thirteen", "fourteen", "fifteen", "sixteen", "seventeen",
+                                        "eighteen", "nineteen"};
+    static const char* const TENS[] = {"twenty", "thirty", "forty", "fifty", "sixty", "seventy", "eighty", "ninety"};
+    istringstream words(text);
+    string word;
+    long total = 0;
+    long group = 0;
+    bool found = false;
+    while (words >> word) {
+        transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return tolower(c); });
+        word.erase(remove_if(word.begin(), word.end(), [](unsigned char c) { return !isalpha(c) && c != '-'; }), word.end());
+        long value = -1;
+        for (int n = 0; n < 20; ++n) {
+            if (word == UNITS[n]) {
+                value = n;
+            }
+        }
+        for (int n = 0; n < 8; ++n) {
+            if (word.rfind(TENS[n], 0) == 0) {
+                value = 20 + 10 * n;
+                // "twenty-five"
+                size_t dash = word.find('-');
+                for (int unit = 1; unit < 10 && dash != string::npos; ++unit) {
+                    if (word.compare(dash + 1, string::npos, UNITS[unit]) == 0) {
+                        value += unit;
+                    }
+                }
+            }
+        }
+        if (value >= 0) {
+            group += value;
+            found = true;
+        } else if (found && word == "hundred") {
+            group = max(group, 1L) * 100;
+        } else if (found && word == "thousand") {
+            total += max(group, 1L) * 1000;
+            group = 0;
+        } else if (found && word != "and") {
+            break;
+        }
+    }
+    return found ? to_string(total + group) : "";
+}
@@ -0,0 +1,78 @@
+/**
+ * @file intentModel.h
+ * @brief Declaration of the IntentModel class.
+ * @author Kaden Oseen
+ */
+
+#ifndef INTENT_MODEL_H
+#define INTENT_MODEL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @class IntentModel
+ * @brief Local classifier for natural language requests, used instead of the NLP API.
+ * An utterance is turned into hashed features (words, word pairs and the character
+ * trigrams of each word, so misspellings still score) and every feature adds its row of
+ * weights to one score per action: a linear model whose rows are exactly one 8-float
+ * vector wide, so scoring is one vector add per feature. The amount is read from the text
+ * itself. Replies are in the same "(action,amount)" form as the NLP API's.
+ */
+class IntentModel {
+public:
+    // Number of actions the model chooses between, one score lane each
+    static const int CLASSES = 8;
+    // The actions, in the order of their scores
+    static const char* const ACTIONS[CLASSES];
+
+    /**
+     * @struct Example
+     * @brief A labelled utterance for training or evaluation.
+     */
+    struct Example {
+        // The expected reply, "(action,amount)"; "(unknown,0)" if the model should abstain
+        std::string reply;
+        std::string text;
+    };
+
+    /**
+     * @struct Prediction
+     * @brief The model's reading of an utterance.
+     */
+    struct Prediction {
+        // Index into ACTIONS, or -1 if no action was confident enough
+        int action;
+        double confidence;
+        std::string amount;
+    };
+
+    // Constructor
+    IntentModel();
+    // Methods
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+    bool loaded() const;
+    void train(const std::vector<Example>& examples, int epochs, uint32_t buckets);
+    Prediction predict(const std::string& text, double min_confidence) const;
+    std::string interpret(const std::string& text, double min_confidence) const;
+    static bool readExamples(const std::string& path, std::vector<Example>& examples);
+    static int actionIndex(const std::string& reply);
+private:
+    // Most features taken from one utterance; the rest of a very long one is ignored
+    static const size_t MAX_FEATURES = 512;
+
+    // Variables
+    uint32_t buckets;
+    // buckets rows of CLASSES weights, row-major
+    std::vector<float> weights;
+    float bias[CLASSES];
+
+    // Methods
+    size_t features(const std::string& text, uint32_t* out) const;
+    void score(const uint32_t* features, size_t count, float* scores) const;
+    static std::string amountIn(const std::string& text);
+};
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * @file intentTool.cpp
+ * @brief Trains and evaluates the local intent model (see IntentModel).
+ * train fits weights to labelled utterances and writes them for the server's intent_model
+ * setting. eval checks a weights file against held-out utterances: accuracy per action,
+ * the confusion between actions, how often the whole reply (amount included) is right,
+ * and the time taken per utterance on this core.
+ *
+ * Usage: ./intent_tool train <examples.tsv> <weights file> [--epochs=30] [--buckets=16384]
+ *        ./intent_tool eval <weights file> <examples.tsv> [--min_confidence_percent=50]
+ * Examples are one "(action,amount)<TAB>utterance" per line.
+ * @author Kaden Oseen
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "intentModel.h"
+
+using namespace std;
+
+/**
+ * @brief Keeps the compiler from optimizing away a value computed while timing.
+ * @param value The value to keep
+ */
+template <typename T>
+static void keep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+/**
+ * @brief Trains a model and writes its weights.
+ * @return int 0 on success
+ */
+static int train(const string& examples_path, const string& weights_path, int epochs, uint32_t buckets) {
+    vector<IntentModel::Example> examples;
+    if (!IntentModel::readExamples(examples_path, examples)) {
+        return 1;
+    }
+    IntentModel model;
+    auto started = chrono::steady_clock::now();
+    model.train(examples, epochs, buckets);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    if (!model.save(weights_path)) {
+        return 1;
+    }
+    cout << "trained on " << examples.size() << " examples, " << epochs << " epochs, " << buckets
+         << " buckets in " << seconds << " s; wrote " << weights_path << endl;
+    return 0;
+}
+
+/**
+ * @brief Evaluates a model on held-out examples.
+ * @return int 0 on success
+ */
+static int evaluate(const string& weights_path, const string& examples_path, double min_confidence) {
+    IntentModel model;
+    vector<IntentModel::Example> examples;
+    if (!model.load(weights_path) || !IntentModel::readExamples(examples_path, examples)) {
+        return 1;
+    }
+    if (examples.empty()) {
+        cerr << "No examples in " << examples_path << endl;
+        return 1;
+    }
+    // Rows are the expected action, columns the predicted one; the last of each is unknown
+    const int LABELS = IntentModel::CLASSES + 1;
+    vector<vector<int>> confusion(LABELS, vector<int>(LABELS, 0));
+    int replies_right = 0;
+    for (const IntentModel::Example& example : examples) {
+        int expected = IntentModel::actionIndex(example.reply);
+        string reply = model.interpret(example.text, min_confidence);
+        int predicted = IntentModel::actionIndex(reply);
+        ++confusion[expected < 0 ? LABELS - 1 : expected][predicted < 0 ? LABELS - 1 : predicted];
+        if (reply == example.reply) {
+            ++replies_right;
+        } else {
+            cout << "wrong: " << example.text << " -> " << reply << " (expected " << example.reply << ")" << endl;
+        }
+    }
+
+    auto name = [](int label) { return label < IntentModel::CLASSES ? IntentModel::ACTIONS[label] : "unknown"; };
+    int actions_right = 0;
+    printf("%-10s %8s %8s %8s\n", "action", "examples", "recall", "precision");
+    for (int label = 0; label < LABELS; ++label) {
+        int expected = 0;
+        int predicted = 0;
+        for (int other = 0; other < LABELS; ++other) {
+            expected += confusion[label][other];
+            predicted += confusion[other][label];
+        }
+        actions_right += confusion[label][label];
+        printf("%-10s %8d %8.3f %8.3f\n", name(label), expected,
+               expected == 0 ? 0.0 : static_cast<double>(confusion[label][label]) / expected,
+               predicted == 0 ? 0.0 : static_cast<double>(confusion[label][label]) / predicted);
+    }
+    printf("confusion (rows expected, columns predicted):\n%-10s", "");
+    for (int label = 0; label < LABELS; ++label) {
+        printf(" %5.5s", name(label));
+    }
+    printf("\n");
+    for (int label = 0; label < LABELS; ++label) {
+        printf("%-10s", name(label));
+        for (int other = 0; other < LABELS; ++other) {
+            printf(" %5d", confusion[label][other]);
+        }
+        printf("\n");
+    }
+
+    // Time every utterance many times over, one at a time as the server would
+    vector<double> micros;
+    for (int pass = 0; pass < 200; ++pass) {
+        for (const IntentModel::Example& example : examples) {
+            auto started = chrono::steady_clock::now();
+            keep(model.interpret(example.text, min_confidence));
+            micros.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - started).count());
+        }
+    }
+    sort(micros.begin(), micros.end());
+    double total = 0;
+    for (double value : micros) {
+        total += value;
+    }
+    printf("action_accuracy=%.3f reply_accuracy=%.3f examples=%zu\n", static_cast<double>(actions_right) / examples.size(),
+           static_cast<double>(replies_right) / examples.size(), examples.size());
+    printf("latency_us mean=%.2f p50=%.2f p99=%.2f max=%.2f\n", total / micros.size(), micros[micros.size() / 2],
+           micros[micros.size() * 99 / 100], micros.back());
+    return 0;
+}
+
+/**
+ * @brief Runs the train or eval command.
+ * @return int 0 on success, 1 on failure or bad usage
+ */
+int main(int argc, char* argv[]) {
+    int epochs = 30;
+    uint32_t buckets = 16384;
+    int min_confidence_percent = 50;
+    vector<string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--epochs=", 0) == 0) {
+            epochs = stoi(arg.substr(9));
+        } else if (arg.rfind("--buckets=", 0) == 0) {
+            buckets = static_cast<uint32_t>(stoul(arg.substr(10)));
+        } else if (arg.rfind("--min_confidence_percent=", 0) == 0) {
+            min_confidence_percent = stoi(arg.substr(25));
+        } else {
+            arguments.push_back(arg);
+        }
+    }
+    if (arguments.size() == 3 && arguments[0] == "train" && epochs > 0 && buckets != 0 && (buckets & (buckets - 1)) == 0) {
+        return train(arguments[1], arguments[2], epochs, buckets);
+    }
+    if (arguments.size() == 3 && arguments[0] == "eval") {
+        return evaluate(arguments[1], arguments[2], min_confidence_percent / 100.0);
+    }
+    cerr << "Usage: ./intent_tool train <examples.tsv> <weights file> [--epochs=30] [--buckets=<power of two, 16384>]\n"
+         << "       ./intent_tool eval <weights file> <examples.tsv> [--min_confidence_percent=50]" << endl;
+    return 1;
+}
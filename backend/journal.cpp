@@ -0,0 +1,323 @@
+/**
+ * @file journal.cpp
+ * @brief Implementation of the Journal class.
+ * A batch is written as
+ *   B:<sequence>:<record count>
+ *   U:<username>:<balance>:<history entry>   (one line per record)
+ *   P:<payout id>:<amount>:<username>:<recipient>   (one line per queued payout)
+ *   S:<payout id>   (one line per settled payout)
+ *   R:<key>   (one line per transfer received from another node)
+ *   E:<sequence>:<CRC-32C of the lines above, in hex>
+ * @author Kaden Oseen
+ */
+
+#include "journal.h"
+#include "crc32c.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @name Journal
+ * @brief Constructor for the Journal class. The file is opened by recover().
+ *
+ * @param path The journal file
+ */
+Journal::Journal(const string& path) : path(path), fd(-1), bytes(0), sequence(0), broken(false) {}
+
+/**
+ * @name ~Journal
+ * @brief Destructor for the Journal class. Closes the file.
+ */
+Journal::~Journal() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * @name checksum
+ * @brief CRC-32C of a batch, used to tell a complete batch from a torn one.
+ *
+ * @param data The batch
+ * @param length Its length in bytes
+ * @return The checksum
+ */
+uint64_t Journal::checksum(const char* data, size_t length) {
+    return Crc32c::compute(data, length);
+}
+
+/**
+ * @name open
+ * @brief Opens the journal file for appending, creating it if needed.
+ *
+ * @return true if the file is open
+ */
+bool Journal::open() {
+    if (fd < 0) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            cerr << "Error: could not open " << path << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @name parse
+ * @brief Reads the batch starting at position, if it is complete and its checksum matches.
+ *
+ * @param contents Journal bytes
+ * @param position Where the batch starts; moved past it if it is complete
+ * @param batch Receives the batch
+ * @return true if a complete batch was read
+ */
+bool Journal::parse(const string& contents, size_t& position, Batch& batch) {
+    size_t start = position;
+    size_t cursor = position;
+
+    // Reads the next line; false if the contents end before the line does
+    auto next_line = [&](string& line) {
+        size_t end = contents.find('\n', cursor);
+        if (end == string::npos) {
+            return false;
+        }
+        line.assign(contents, cursor, end - cursor);
+        cursor = end + 1;
+        return true;
+    };
+
+    string line;
+    size_t count;
+    if (!next_line(line) || sscanf(line.c_str(), "B:%" SCNu64 ":%zu", &batch.sequence, &count) != 2) {
+        return false;
+    }
+    batch.records.clear();
+    batch.queued.clear();
+    batch.settled.clear();
+    batch.received.clear();
+    for (size_t i = 0; i < count; ++i) {
+        if (!next_line(line) || line.size() <= 2 || line[1] != ':') {
+            return false;
+        }
+        // Each kind of line has two fields before its free-form last field, except S and R
+        size_t first = line.find(':', 2);
+        size_t second = first != line.npos ? line.find(':', first + 1) : line.npos;
+        if (line[0] == 'U' && second != line.npos) {
+            Record record;
+            record.username = line.substr(2, first - 2);
+            record.balance = strtod(line.c_str() + first + 1, nullptr);
+            record.history = line.substr(second + 1);
+            batch.records.push_back(move(record));
+        } else if (line[0] == 'P' && second != line.npos && line.find(':', second + 1) != line.npos) {
+            Payout payout;
+            size_t third = line.find(':', second + 1);
+            payout.id = strtoull(line.c_str() + 2, nullptr, 10);
+            payout.amount = strtod(line.c_str() + first + 1, nullptr);
+            payout.username = line.substr(second + 1, third - second - 1);
+            payout.recipient = line.substr(third + 1);
+            batch.queued.push_back(move(payout));
+        } else if (line[0] == 'S') {
+            batch.settled.push_back(strtoull(line.c_str() + 2, nullptr, 10));
+        } else if (line[0] == 'R') {
+            batch.received.push_back(strtoull(line.c_str() + 2, nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    size_t trailer = cursor;
+    uint64_t trailer_sequence, expected;
+    if (!next_line(line) || sscanf(line.c_str(), "E:%" SCNu64 ":%" SCNx64, &trailer_sequence, &expected) != 2 ||
+        trailer_sequence != batch.sequence) {
+        return false;
+    }
+    if (checksum(contents.data() + start, trailer - start) != expected) {
+        return false;
+    }
+    position = cursor;
+    return true;
+}
+
+/**
+ * @name recover
+ * @brief Replays every complete batch in the journal, in order, and cuts off whatever
+ * follows the last one (a batch that was being written when the server stopped).
+ *
+ * @param checkpointed Sequence number of the last batch already in the users file;
+ * numbering continues from there if the journal is empty
+ * @param apply Called for each record with the sequence number of its batch
+ * @param payouts Called for each payout queued or settled, with the sequence number of its batch
+ * @param receipts Called for each transfer received from another node, if given
+ * @return The sequence number of the last batch
+ */
+uint64_t Journal::recover(uint64_t checkpointed, const Replay& apply, const PayoutReplay& payouts,
+                          const ReceiptReplay& receipts) {
+    sequence = checkpointed;
+    ifstream file(path, ios::binary);
+    string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    size_t position = 0;
+    Batch batch;
+    while (position < contents.size() && parse(contents, position, batch)) {
+        for (const Record& record : batch.records) {
+            apply(batch.sequence, record);
+        }
+        for (const Payout& payout : batch.queued) {
+            payouts(batch.sequence, payout, false);
+        }
+        for (uint64_t id : batch.settled) {
+            Payout payout;
+            payout.id = id;
+            payouts(batch.sequence, payout, true);
+        }
+        for (size_t i = 0; receipts && i < batch.received.size(); ++i) {
+            receipts(batch.sequence, batch.received[i]);
+        }
+        sequence = max(sequence, batch.sequence);
+    }
+
+    if (position < contents.size()) {
+        cerr << "Discarding " << contents.size() - position << " bytes of an incomplete batch at the end of " << path << endl;
+        if (truncate(path.c_str(), position) != 0) {
+            cerr << "Error: could not truncate " << path << endl;
+        }
+    }
+    bytes = position;
+    open();
+    return sequence;
+}
+
+/**
+ * @name append
+ * @brief Appends a batch of records and flushes it to stable storage.
+ *
+ * @param records The records, in the order they were applied
+ * @param queued Payouts to external recipients debited in this batch
+ * @param settled Payouts settled or refunded in this batch
+ * @param received Keys of the transfers from other nodes credited in this batch
+ * @return true if the batch is durable
+ */
+bool Journal::append(const vector<Record>& records, const vector<Payout>& queued, const vector<uint64_t>& settled,
+                     const vector<uint64_t>& received) {
+    if (broken || !open()) {
+        return false;
+    }
+    ostringstream out;
+    out << setprecision(BALANCE_PRECISION);
+    out << "B:" << sequence + 1 << ":" << records.size() + queued.size() + settled.size() + received.size() << "\n";
+    for (const Record& record : records) {
+        out << "U:" << record.username << ":" << record.balance << ":" << record.history << "\n";
+    }
+    for (const Payout& payout : queued) {
+        out << "P:" << payout.id << ":" << payout.amount << ":" << payout.username << ":" << payout.recipient << "\n";
+    }
+    for (uint64_t id : settled) {
+        out << "S:" << id << "\n";
+    }
+    for (uint64_t key : received) {
+        out << "R:" << key << "\n";
+    }
+    string batch = out.str();
+    out << "E:" << sequence + 1 << ":" << hex << checksum(batch.data(), batch.size()) << "\n";
+    batch = out.str();
+
+    size_t written = 0;
+    while (written < batch.size()) {
+        ssize_t result = write(fd, batch.data() + written, batch.size() - written);
+        if (result <= 0) {
+            cerr << "Error: could not write " << path << endl;
+            fail();
+            return false;
+        }
+        written += result;
+    }
+    if (fdatasync(fd) != 0) {
+        cerr << "Error: could not flush " << path << endl;
+        fail();
+        return false;
+    }
+    bytes += batch.size();
+    ++sequence;
+    last_batch = move(batch);
+    return true;
+}
+
+/**
+ * @name fail
+ * @brief Cuts off whatever a failed append left after the last durable batch and refuses
+ * every later append. After a failed flush the kernel may have dropped the dirty pages,
+ * so the batch cannot be retried, and one written after it would be lost with it when
+ * recovery stops at the torn batch.
+ */
+void Journal::fail() {
+    broken = true;
+    if (ftruncate(fd, bytes) != 0 || fdatasync(fd) != 0) {
+        cerr << "Error: could not cut " << path << " back to its last complete batch" << endl;
+    }
+    cerr << "Error: " << path << " accepts no more batches" << endl;
+}
+
+/**
+ * @name reset
+ * @brief Empties the journal once everything in it is in the users file. Sequence numbers
+ * keep counting, so a checkpoint can record which batches it holds.
+ *
+ * @return true if the journal was emptied
+ */
+bool Journal::reset() {
+    if (broken || !open() || ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+        cerr << "Error: could not empty " << path << endl;
+        return false;
+    }
+    bytes = 0;
+    return true;
+}
+
+/**
+ * @name size
+ * @brief Returns the size of the journal in bytes.
+ *
+ * @return The size
+ */
+size_t Journal::size() const {
+    return bytes;
+}
+
+/**
+ * @name failed
+ * @brief Whether an append has failed, so memory may hold changes the journal does not.
+ *
+ * @return true once an append has failed
+ */
+bool Journal::failed() const {
+    return broken;
+}
+
+/**
+ * @name lastSequence
+ * @brief Returns the sequence number of the last batch appended or recovered.
+ *
+ * @return The sequence number
+ */
+uint64_t Journal::lastSequence() const {
+    return sequence;
+}
+
+/**
+ * @name lastBatch
+ * @brief Returns the bytes of the last batch appended, exactly as written to the file.
+ *
+ * @return The batch, or an empty string if none was appended since recovery
+ */
+const string& Journal::lastBatch() const {
+    return last_batch;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file journal.h
+ * @brief Declaration of the Journal class.
+ * @author Kaden Oseen
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @class Journal
+ * @brief Append-only log of committed balance changes, kept next to the users file.
+ * Each batch of changes is appended with a single write and flushed before it is reported,
+ * so committing a transfer costs one small write instead of rewriting every account.
+ * A batch is framed by a header and a checksummed trailer; on recovery, batches are
+ * replayed in order and a batch cut short by a crash is discarded as a whole, so either
+ * both sides of a transfer survive or neither does, and an external transfer's debit
+ * survives only together with its payout. If an append fails, the journal is cut back to
+ * the last durable batch and refuses every later append, so no batch is ever written after
+ * a torn one and no sequence number is used twice.
+ */
+class Journal {
+public:
+    // Digits written for a balance, so a balance read back is the balance written
+    static const int BALANCE_PRECISION = 15;
+
+    /**
+     * @struct Record
+     * @brief One account's balance after a change, and the history entry the change added.
+     */
+    struct Record {
+        std::string username;
+        double balance = 0;
+        std::string history;
+    };
+
+    /**
+     * @struct Payout
+     * @brief A transfer to an external recipient, debited from the user but not yet settled.
+     */
+    struct Payout {
+        uint64_t id = 0;
+        std::string username;
+        std::string recipient;
+        double amount = 0;
+    };
+
+    /**
+     * @struct Batch
+     * @brief Everything one batch committed, as read back from the journal.
+     */
+    struct Batch {
+        uint64_t sequence = 0;
+        std::vector<Record> records;
+        std::vector<Payout> queued;
+        std::vector<uint64_t> settled;
+        std::vector<uint64_t> received;
+    };
+
+    using Replay = std::function<void(uint64_t sequence, const Record& record)>;
+    // Called with settled = false when a payout is queued, and true once it is settled or refunded
+    using PayoutReplay = std::function<void(uint64_t sequence, const Payout& payout, bool settled)>;
+    // Called for each transfer received from another node, by its cluster-wide key
+    using ReceiptReplay = std::function<void(uint64_t sequence, uint64_t key)>;
+
+    // Constructor and destructor
+    explicit Journal(const std::string& path);
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    // Methods
+    uint64_t recover(uint64_t checkpointed, const Replay& apply, const PayoutReplay& payouts,
+                     const ReceiptReplay& receipts = nullptr);
+    bool append(const std::vector<Record>& records, const std::vector<Payout>& queued = {},
+                const std::vector<uint64_t>& settled = {}, const std::vector<uint64_t>& received = {});
+    bool reset();
+    size_t size() const;
+    bool failed() const;
+    uint64_t lastSequence() const;
+    const std::string& lastBatch() const;
+    static bool parse(const std::string& contents, size_t& position, Batch& batch);
+private:
+    // Variables
+    std::string path;
+    int fd;
+    size_t bytes;
+    uint64_t sequence;
+    // Set once an append could not be made durable; nothing more is appended after it
+    bool broken;
+    // The bytes of the last batch appended, for shipping to a standby
+    std::string last_batch;
+
+    // Methods
+    bool open();
+    void fail();
+    static uint64_t checksum(const char* data, size_t length);
+};
+
+#endif
@@ -0,0 +1,369 @@
+/**
+ * @file lifecycle.cpp
+ * @brief Implementation of the Lifecycle class.
+ * Handles graceful draining on shutdown signals and passing the listening sockets to a
+ * replacement process over a Unix socket, so a restart never refuses a connection. The
+ * same connection tells the replacement when the database files are its own.
+ * @author Kaden Oseen
+ */
+
+#include "lifecycle.h"
+#include "session.h"
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Most descriptors passed in one handoff message (the kernel allows up to 253)
+static const int FDS_PER_MESSAGE = 64;
+
+// Shutdown request, set once by a signal or a completed handoff
+static mutex shutdown_mutex;
+static condition_variable shutdown_cv;
+static string shutdown_reason = "";
+
+// Every live session, so draining can reach the ones idling at a prompt
+static mutex sessions_mutex;
+static condition_variable sessions_cv;
+static unordered_set<Session*> live_sessions;
+static atomic<bool> drain_started(false);
+static atomic<bool> listeners_handed_off(false);
+
+// The handoff connection, held open until the old server has released the database:
+// in the new server, to the old one, and in the old server, to its successor
+static int predecessor = -1;
+static atomic<int> successor_connection(-1);
+
+// Sent by the old server once the handoff path is free for the new one to bind
+static const char PATH_RELEASED = 'P';
+
+/**
+ * @brief Builds the set of signals that request a shutdown
+ * @return The signal set
+ */
+static sigset_t shutdown_signals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    return signals;
+}
+
+/**
+ * @brief Fills in a Unix socket address for a path
+ * @param path The socket path
+ * @param address The address to fill in
+ * @return false if the path is too long
+ */
+static bool unix_address(const string& path, struct sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+/**
+ * @name blockSignals
+ * @brief Blocks the shutdown signals in the calling thread and every thread it starts.
+ * Must be called before any other thread exists. Also blocks SIGUSR1, which only a standby
+ * waits for (see Standby), and ignores SIGPIPE, so writing to a client that has gone away
+ * is reported as an error instead of killing the server.
+ */
+void Lifecycle::blockSignals() {
+    sigset_t signals = shutdown_signals();
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+/**
+ * @name startSignalThread
+ * @brief Starts a thread that turns SIGTERM/SIGINT into a shutdown request.
+ */
+void Lifecycle::startSignalThread() {
+    thread([]() {
+        sigset_t signals = shutdown_signals();
+        int signal_number = 0;
+        if (sigwait(&signals, &signal_number) == 0) {
+            requestShutdown(strsignal(signal_number));
+        }
+    }).detach();
+}
+
+/**
+ * @name requestShutdown
+ * @brief Asks the main thread to shut the server down. Only the first request counts.
+ *
+ * @param reason Why the server is shutting down, for the log
+ */
+void Lifecycle::requestShutdown(const string& reason) {
+    {
+        lock_guard<mutex> guard(shutdown_mutex);
+        if (shutdown_reason == "") {
+            shutdown_reason = reason;
+        }
+    }
+    shutdown_cv.notify_all();
+}
+
+/**
+ * @name waitForShutdown
+ * @brief Blocks until a shutdown has been requested.
+ *
+ * @return The reason given for the shutdown
+ */
+string Lifecycle::waitForShutdown() {
+    unique_lock<mutex> lock(shutdown_mutex);
+    shutdown_cv.wait(lock, []() { return shutdown_reason != ""; });
+    return shutdown_reason;
+}
+
+/**
+ * @name sessionStarted
+ * @brief Registers a session so draining can reach it.
+ *
+ * @param session The new session
+ */
+void Lifecycle::sessionStarted(Session* session) {
+    lock_guard<mutex> guard(sessions_mutex);
+    live_sessions.insert(session);
+}
+
+/**
+ * @name sessionEnded
+ * @brief Unregisters a session. Called before its socket is closed, so a session is never
+ * interrupted through a descriptor that has been reused.
+ *
+ * @param session The finished session
+ */
+void Lifecycle::sessionEnded(Session* session) {
+    {
+        lock_guard<mutex> guard(sessions_mutex);
+        live_sessions.erase(session);
+    }
+    sessions_cv.notify_all();
+}
+
+/**
+ * @name draining
+ * @brief Whether the server has started draining sessions.
+ *
+ * @return true once beginDrain has been called
+ */
+bool Lifecycle::draining() {
+    return drain_started;
+}
+
+/**
+ * @name beginDrain
+ * @brief Starts draining: sessions waiting at a safe prompt are closed now, and sessions in
+ * the middle of a transaction are left to finish it and log out on their own.
+ */
+void Lifecycle::beginDrain() {
+    drain_started = true;
+    lock_guard<mutex> guard(sessions_mutex);
+    for (Session* session : live_sessions) {
+        session->interrupt(false);
+    }
+}
+
+/**
+ * @name waitForSessions
+ * @brief Waits for every session to end.
+ *
+ * @param timeout The longest time to wait
+ * @return true if no sessions remain
+ */
+bool Lifecycle::waitForSessions(chrono::milliseconds timeout) {
+    unique_lock<mutex> lock(sessions_mutex);
+    return sessions_cv.wait_for(lock, timeout, []() { return live_sessions.empty(); });
+}
+
+/**
+ * @name closeAllSessions
+ * @brief Closes every remaining session, whatever it is doing. Used once the drain timeout expires.
+ */
+void Lifecycle::closeAllSessions() {
+    lock_guard<mutex> guard(sessions_mutex);
+    for (Session* session : live_sessions) {
+        session->interrupt(true);
+    }
+}
+
+/**
+ * @name inheritListeners
+ * @brief Takes the listening sockets from a running server through its handoff socket.
+ * Waits until the old server has released the handoff path before returning, so this
+ * process can bind it for the next restart.
+ *
+ * @param path The handoff socket path (empty to disable)
+ * @return The inherited listening sockets, or none if no old server is running
+ */
+vector<int> Lifecycle::inheritListeners(const string& path) {
+    vector<int> sockets;
+    struct sockaddr_un address;
+    if (path == "" || !unix_address(path, address)) {
+        return sockets;
+    }
+    int handoff_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(handoff_socket, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        close(handoff_socket);
+        return sockets;
+    }
+
+    // Messages carry a count and that many descriptors; a count of zero ends the list
+    while (true) {
+        int count = 0;
+        char control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+        struct iovec data = {&count, sizeof(count)};
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(handoff_socket, &message, MSG_WAITALL) != sizeof(count) || count == 0) {
+            break;
+        }
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header == nullptr || header->cmsg_type != SCM_RIGHTS) {
+            break;
+        }
+        int* received = reinterpret_cast<int*>(CMSG_DATA(header));
+        sockets.insert(sockets.end(), received, received + count);
+    }
+
+    // The old server says when the path is free, and closes its end once it has released
+    // the database (see waitForPredecessor)
+    char released;
+    if (recv(handoff_socket, &released, 1, 0) == 1 && released == PATH_RELEASED) {
+        predecessor = handoff_socket;
+    } else {
+        close(handoff_socket);
+    }
+    cout << "Inherited " << sockets.size() << " listening socket(s) from the previous server" << endl;
+    return sockets;
+}
+
+/**
+ * @name waitForPredecessor
+ * @brief After inheritListeners, waits until the old server has drained, committed its
+ * last batches and checkpointed, or has died, so this process loads every change it made
+ * and neither commits to the files while the other does. Clients that connect meanwhile
+ * wait in the listening sockets' backlog.
+ */
+void Lifecycle::waitForPredecessor() {
+    if (predecessor < 0) {
+        return;
+    }
+    cout << "Waiting for the previous server to release the database" << endl;
+    char done;
+    while (recv(predecessor, &done, 1, 0) > 0) {
+    }
+    close(predecessor);
+    predecessor = -1;
+}
+
+/**
+ * @name serveHandoff
+ * @brief Waits on a Unix socket for a replacement server and hands it the listening sockets.
+ * Once they are sent this server stops accepting and drains (see requestShutdown), and
+ * the replacement waits for releaseDatabase() before loading the accounts.
+ *
+ * @param path The handoff socket path (empty to disable)
+ * @param sockets The listening sockets to hand over
+ * @return true if the handoff socket is ready (or handoff is disabled)
+ */
+bool Lifecycle::serveHandoff(const string& path, const vector<int>& sockets) {
+    struct sockaddr_un address;
+    if (path == "") {
+        return true;
+    }
+    if (!unix_address(path, address)) {
+        cerr << "Handoff socket path is too long: " << path << endl;
+        return false;
+    }
+    // Any file left at the path belongs to a server that is gone (inheritListeners would have connected)
+    unlink(path.c_str());
+    int handoff_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (bind(handoff_socket, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(handoff_socket, 1) < 0) {
+        cerr << "Could not open handoff socket " << path << ": " << strerror(errno) << endl;
+        close(handoff_socket);
+        return false;
+    }
+
+    thread([handoff_socket, path, sockets]() {
+        int successor = accept(handoff_socket, nullptr, nullptr);
+        close(handoff_socket);
+        if (successor < 0) {
+            return;
+        }
+        size_t sent = 0;
+        while (true) {
+            int count = min<size_t>(FDS_PER_MESSAGE, sockets.size() - sent);
+            char control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+            memset(control, 0, sizeof(control));
+            struct iovec data = {&count, sizeof(count)};
+            struct msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &data;
+            message.msg_iovlen = 1;
+            if (count > 0) {
+                message.msg_control = control;
+                message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+                struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+                header->cmsg_level = SOL_SOCKET;
+                header->cmsg_type = SCM_RIGHTS;
+                header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+                memcpy(CMSG_DATA(header), sockets.data() + sent, sizeof(int) * count);
+            }
+            sendmsg(successor, &message, 0);
+            if (count == 0) {
+                break;
+            }
+            sent += count;
+        }
+        listeners_handed_off = true;
+        unlink(path.c_str());
+        // The connection stays open until releaseDatabase(), or until this process exits
+        send(successor, &PATH_RELEASED, 1, MSG_NOSIGNAL);
+        successor_connection = successor;
+        requestShutdown("listening sockets handed off to a new server");
+    }).detach();
+    return true;
+}
+
+/**
+ * @name handedOff
+ * @brief Whether the listening sockets now belong to a replacement server.
+ *
+ * @return true after a successful handoff
+ */
+bool Lifecycle::handedOff() {
+    return listeners_handed_off;
+}
+
+/**
+ * @name releaseDatabase
+ * @brief Tells the new server, if the listening sockets were handed off, that this one
+ * has checkpointed and will not write the database files again.
+ */
+void Lifecycle::releaseDatabase() {
+    int successor = successor_connection.exchange(-1);
+    if (successor >= 0) {
+        close(successor);
+    }
+}
@@ -0,0 +1,49 @@
+/**
+ * @file lifecycle.h
+ * @brief Declaration of the Lifecycle class.
+ * @author Kaden Oseen
+ */
+
+#ifndef LIFECYCLE_H
+#define LIFECYCLE_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Forward declaration of Session class
+class Session;
+
+/**
+ * @class Lifecycle
+ * @brief Process start-up and shutdown: signals, session draining and listener handoff.
+ * On SIGTERM/SIGINT, or once a new process has taken the listening sockets, the server
+ * stops accepting, lets in-flight transactions finish and then exits cleanly.
+ * The database files pass to the new process only once the old one has checkpointed,
+ * so the two never commit to them at the same time.
+ */
+class Lifecycle {
+public:
+    // Shutdown requests
+    static void blockSignals();
+    static void startSignalThread();
+    static void requestShutdown(const std::string& reason);
+    static std::string waitForShutdown();
+
+    // Session tracking and draining
+    static void sessionStarted(Session* session);
+    static void sessionEnded(Session* session);
+    static bool draining();
+    static void beginDrain();
+    static bool waitForSessions(std::chrono::milliseconds timeout);
+    static void closeAllSessions();
+
+    // Listener and database handoff between an old and a new server process
+    static std::vector<int> inheritListeners(const std::string& path);
+    static void waitForPredecessor();
+    static bool serveHandoff(const std::string& path, const std::vector<int>& sockets);
+    static bool handedOff();
+    static void releaseDatabase();
+};
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file listener.cpp
+ * @brief Implementation of the Listener class.
+ * Accepts client connections and hands each one to a new session thread.
+ * @author Kaden Oseen
+ */
+
+#include "listener.h"
+#include "config.h"
+#include "metrics.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @name Listener
+ * @brief Constructor for the Listener class.
+ *
+ * @param index Position of this listener, used to pick its core
+ * @param server_socket A bound, listening socket owned by this listener
+ * @param ssl_ctx The SSL context for new connections
+ * @param handler Runs each accepted connection
+ */
+Listener::Listener(int index, int server_socket, SSL_CTX* ssl_ctx, Handler handler)
+    : index(index), server_socket(server_socket), ssl_ctx(ssl_ctx), handler(handler) {
+    if (pipe(wake_pipe) < 0) {
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
+}
+
+/**
+ * @name ~Listener
+ * @brief Destructor for the Listener class.
+ * Stops the accept loop if needed. The listening socket is left open for its owner to close or hand off.
+ */
+Listener::~Listener() {
+    stop();
+    join();
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+}
+
+/**
+ * @name openSocket
+ * @brief Creates a non-blocking listening socket on every interface.
+ *
+ * @param port The port to bind
+ * @param backlog The listen backlog
+ * @param reuse_port Whether to set SO_REUSEPORT so other sockets can share the port
+ * @return The socket, or -1 if it could not be bound
+ */
+int Listener::openSocket(int port, int backlog, bool reuse_port) {
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (reuse_port) {
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    }
+
+    // Create a struct for the server address to bind to
+    struct sockaddr_in server_address;
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    server_address.sin_addr.s_addr = INADDR_ANY;
+
+    // Bind the socket to the server address and listen for incoming client requests
+    if (bind(server_socket, (struct sockaddr*) &server_address, sizeof(server_address)) < 0 ||
+        listen(server_socket, backlog) < 0) {
+        cerr << "Could not listen on port " << port << ": " << strerror(errno) << endl;
+        close(server_socket);
+        return -1;
+    }
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+    return server_socket;
+}
+
+/**
+ * @name start
+ * @brief Runs the accept loop on a new thread, optionally pinned to core (index % cores).
+ *
+ * @param pin_to_core Whether to pin the listener (and so its sessions) to one core
+ */
+void Listener::start(bool pin_to_core) {
+    worker = thread(&Listener::run, this);
+    if (pin_to_core) {
+        unsigned int cores = thread::hardware_concurrency();
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % (cores == 0 ? 1 : cores), &cpus);
+        if (pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus) != 0) {
+            cerr << "Could not pin listener " << index << " to a core" << endl;
+        }
+    }
+}
+
+/**
+ * @name stop
+ * @brief Stops accepting new connections. Sessions already started are unaffected.
+ * The listening socket itself is untouched, since it may have been handed to another process.
+ */
+void Listener::stop() {
+    char wake = 0;
+    if (write(wake_pipe[1], &wake, 1) < 0) {
+        cerr << "Could not wake listener " << index << endl;
+    }
+}
+
+/**
+ * @name join
+ * @brief Waits for the accept loop to finish.
+ */
+void Listener::join() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+/**
+ * @name run
+ * @brief Continuously accepts clients and passes each one to the handler.
+ * Returns once the listening socket has been stopped.
+ */
+void Listener::run() {
+    atomic<int64_t>& sessions_active = Metrics::counter("sessions_active");
+    atomic<int64_t>& sessions_accepted = Metrics::counter("sessions_accepted");
+    atomic<int64_t>& sessions_rejected = Metrics::counter("sessions_rejected");
+    int enable = 1;
+
+    struct pollfd waiting[2] = {{server_socket, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+
+    while (true) {
+        // Wait for a client or for stop()
+        int ready = poll(waiting, 2, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0 || waiting[1].revents != 0) {
+            return;
+        }
+        // Accept a new client connection; the socket is non-blocking in case another process won the race
+        int client_socket = accept(server_socket, nullptr, nullptr);
+        if (client_socket < 0) {
+            continue;
+        }
+        // Turn away clients beyond the session limit rather than queueing them
+        if (server_config.max_sessions != 0 && sessions_active >= server_config.max_sessions) {
+            ++sessions_rejected;
+            close(client_socket);
+            continue;
+        }
+        ++sessions_accepted;
+        ++sessions_active;
+        if (server_config.tcp_nodelay) {
+            setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+
+        // Create a new SSL object for the connection
+        SSL* ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(ssl, client_socket);
+
+        // The handler starts the session on its own thread or on an event loop
+        handler(client_socket, ssl);
+    }
+}
@@ -0,0 +1,45 @@
+/**
+ * @file listener.h
+ * @brief Declaration of the Listener class.
+ * @author Kaden Oseen
+ */
+
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <functional>
+#include <thread>
+#include <openssl/ssl.h>
+
+/**
+ * @class Listener
+ * @brief One accept loop on its own listening socket.
+ * With several listeners bound to the same port through SO_REUSEPORT, the kernel spreads
+ * new connections across them. Each listener may be pinned to a core, and session
+ * threads started by its handler inherit that pinning, so every core serves its own set of sessions.
+ */
+class Listener {
+public:
+    // Called on the listener's thread for every accepted connection; must not block
+    using Handler = std::function<void(int client_socket, SSL* ssl)>;
+
+    // Constructor
+    Listener(int index, int server_socket, SSL_CTX* ssl_ctx, Handler handler);
+    ~Listener();
+    // Methods
+    static int openSocket(int port, int backlog, bool reuse_port);
+    void start(bool pin_to_core);
+    void stop();
+    void join();
+    void run();
+private:
+    // Variables
+    int index;
+    int server_socket;
+    SSL_CTX* ssl_ctx;
+    Handler handler;
+    std::thread worker;
+    int wake_pipe[2];
+};
+
+#endif
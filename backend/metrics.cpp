@@ -0,0 +1,164 @@
+/**
+ * @file metrics.cpp
+ * @brief Implementation of the Metrics class.
+ * Counters are registered once by name and then updated lock-free by their owners.
+ * @author Kaden Oseen
+ */
+
+#include "metrics.h"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Registry of counters and sections, guarded by one mutex (only touched on registration and render)
+static mutex metrics_mutex;
+static map<string, unique_ptr<atomic<int64_t>>> counters;
+static vector<pair<string, function<string()>>> sections;
+static map<string, function<string(const string&)>> pages;
+
+/**
+ * @name counter
+ * @brief Returns the counter with the given name, creating it on first use.
+ * The reference stays valid for the life of the process, so callers can keep it.
+ *
+ * @param name The counter name
+ * @return The counter
+ */
+atomic<int64_t>& Metrics::counter(const string& name) {
+    lock_guard<mutex> guard(metrics_mutex);
+    auto& slot = counters[name];
+    if (!slot) {
+        slot.reset(new atomic<int64_t>(0));
+    }
+    return *slot;
+}
+
+/**
+ * @name addSection
+ * @brief Registers a named block of text rendered on every metrics request.
+ *
+ * @param name The section name
+ * @param render Function producing "key=value" lines for the section
+ */
+void Metrics::addSection(const string& name, function<string()> render) {
+    lock_guard<mutex> guard(metrics_mutex);
+    sections.push_back({name, render});
+}
+
+/**
+ * @name addPage
+ * @brief Registers a page served at its own path instead of the metrics text.
+ *
+ * @param path The path, e.g. "/report"
+ * @param render Function producing the page from the query string (the text after '?')
+ */
+void Metrics::addPage(const string& path, function<string(const string&)> render) {
+    lock_guard<mutex> guard(metrics_mutex);
+    pages[path] = render;
+}
+
+/**
+ * @brief Renders the page a request names, or the metrics text for any other path.
+ * @param request The start of an HTTP request, e.g. "GET /report?above=1000 HTTP/1.0"
+ * @return The body to send
+ */
+static string respond(const string& request) {
+    size_t start = request.find(' ');
+    size_t end = start == string::npos ? start : request.find_first_of(" \r\n", start + 1);
+    string target = start == string::npos ? "" : request.substr(start + 1, end - start - 1);
+    size_t question = target.find('?');
+    string path = target.substr(0, question);
+    string query = question == string::npos ? "" : target.substr(question + 1);
+    function<string(const string&)> page;
+    {
+        lock_guard<mutex> guard(metrics_mutex);
+        auto found = pages.find(path);
+        if (found != pages.end()) {
+            page = found->second;
+        }
+    }
+    return page ? page(query) : Metrics::render();
+}
+
+/**
+ * @name render
+ * @brief Renders every counter and section as plain text.
+ *
+ * @return The metrics text
+ */
+string Metrics::render() {
+    ostringstream out;
+    vector<pair<string, function<string()>>> snapshot;
+    {
+        lock_guard<mutex> guard(metrics_mutex);
+        out << "[counters]\n";
+        for (const auto& entry : counters) {
+            out << entry.first << "=" << entry.second->load() << "\n";
+        }
+        snapshot = sections;
+    }
+    // Sections render outside the lock, since they may look up counters themselves
+    for (const auto& section : snapshot) {
+        out << "[" << section.first << "]\n" << section.second();
+    }
+    return out.str();
+}
+
+/**
+ * @name serve
+ * @brief Starts a thread answering every connection on 127.0.0.1:port with the metrics text,
+ * or with a page registered for the requested path.
+ * Responds with a minimal HTTP header so it can be read with curl or a browser.
+ *
+ * @param port The local port to listen on
+ * @return true if the listener was started
+ */
+bool Metrics::serve(int port) {
+    int metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (metrics_socket < 0) {
+        return false;
+    }
+    int enable = 1;
+    setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    // Shared with a replacement server during a hot restart
+    setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(metrics_socket, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(metrics_socket, 16) < 0) {
+        cerr << "Could not start metrics listener on port " << port << endl;
+        close(metrics_socket);
+        return false;
+    }
+
+    thread([metrics_socket]() {
+        while (true) {
+            int client = accept(metrics_socket, nullptr, nullptr);
+            if (client < 0) {
+                continue;
+            }
+            // Only the request line matters; every path without a page returns the same text
+            char request[1024];
+            ssize_t received = recv(client, request, sizeof(request), 0);
+            string body = respond(string(request, received > 0 ? received : 0));
+            string reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " +
+                to_string(body.size()) + "\r\n\r\n" + body;
+            send(client, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+            close(client);
+        }
+    }).detach();
+    return true;
+}
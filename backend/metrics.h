@@ -0,0 +1,31 @@
+/**
+ * @file metrics.h
+ * @brief Declaration of the Metrics class.
+ * @author Kaden Oseen
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * @class Metrics
+ * @brief Process-wide counters and read-only status sections.
+ * Served as plain text on localhost when a metrics port is configured, along with pages
+ * rendered on request from their query string.
+ */
+class Metrics {
+public:
+    // Methods
+    static std::atomic<int64_t>& counter(const std::string& name);
+    static void addSection(const std::string& name, std::function<std::string()> render);
+    static void addPage(const std::string& path, std::function<std::string(const std::string&)> render);
+    static std::string render();
+    static bool serve(int port);
+};
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * @file outbox.cpp
+ * @brief Implementation of the Outbox class.
+ * @author Kaden Oseen
+ */
+
+#include "outbox.h"
+#include "metrics.h"
+#include "transferEngine.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * @name Outbox
+ * @brief Constructor for the Outbox class. Nothing is settled until start().
+ */
+Outbox::Outbox() : database(nullptr), engine(nullptr), max_batch(0), max_attempts(0), retry_delay(0), running(false) {}
+
+/**
+ * @name ~Outbox
+ * @brief Destructor for the Outbox class. Stops settling.
+ */
+Outbox::~Outbox() {
+    stop();
+}
+
+/**
+ * @name start
+ * @brief Queues every payout left unsettled by the last run and starts settling.
+ *
+ * @param database The database the payouts are committed in
+ * @param engine The engine that refunds rejected payouts
+ * @param gateway The gateway that pays external recipients
+ * @param max_batch Most payouts handed to the gateway at once
+ * @param max_attempts Attempts before a payout is refunded
+ * @param retry_delay Wait before the first retry; doubled for each one after
+ */
+void Outbox::start(DatabaseHandler& database, TransferEngine& engine, unique_ptr<SettlementGateway> gateway,
+                   int max_batch, int max_attempts, chrono::milliseconds retry_delay) {
+    this->database = &database;
+    this->engine = &engine;
+    this->gateway = move(gateway);
+    this->max_batch = max_batch;
+    this->max_attempts = max_attempts;
+    this->retry_delay = retry_delay;
+    for (const auto& payout : database.pendingPayouts()) {
+        add(payout);
+    }
+    running = true;
+    worker = thread(&Outbox::run, this);
+}
+
+/**
+ * @name stop
+ * @brief Stops settling once the batch in progress is done. Payouts still waiting stay in
+ * the journal and are settled by the next run.
+ */
+void Outbox::stop() {
+    {
+        lock_guard<mutex> guard(entries_mutex);
+        running = false;
+    }
+    entries_cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+/**
+ * @name add
+ * @brief Queues a payout for settlement. Called once the payout is durable.
+ *
+ * @param payout The payout
+ */
+void Outbox::add(const Journal::Payout& payout) {
+    static atomic<int64_t>& payouts_queued = Metrics::counter("payouts_queued");
+    ++payouts_queued;
+    {
+        lock_guard<mutex> guard(entries_mutex);
+        Entry entry;
+        entry.payout = payout;
+        entry.due = chrono::steady_clock::now();
+        entries.push_back(move(entry));
+    }
+    entries_cv.notify_one();
+}
+
+/**
+ * @name pending
+ * @brief Returns the number of payouts waiting for settlement.
+ *
+ * @return The number of payouts
+ */
+size_t Outbox::pending() {
+    lock_guard<mutex> guard(entries_mutex);
+    return entries.size();
+}
+
+/**
+ * @name refund
+ * @brief Gives a payout that cannot be paid back to the user. The refund is committed with
+ * the payout marked settled, so it happens exactly once.
+ *
+ * @param payout The payout
+ */
+void Outbox::refund(const Journal::Payout& payout) {
+    static atomic<int64_t>& payouts_refunded = Metrics::counter("payouts_refunded");
+    User* user = database->getRecipient(payout.username);
+    if (user == nullptr) {
+        cerr << "Error: cannot refund payout " << payout.id << " to unknown user " << payout.username << endl;
+        return;
+    }
+    ++payouts_refunded;
+    TransferEngine::Transfer transfer;
+    transfer.kind = TransferEngine::Kind::REFUND;
+    transfer.to = user;
+    transfer.amount = payout.amount;
+    transfer.recipient = payout.recipient;
+    transfer.payout = payout.id;
+    engine->submit(transfer, [](const TransferEngine::Result&) {});
+}
+
+/**
+ * @name run
+ * @brief Hands due payouts to the gateway in batches until stopped.
+ */
+void Outbox::run() {
+    static atomic<int64_t>& payouts_settled = Metrics::counter("payouts_settled");
+    static atomic<int64_t>& settlement_retries = Metrics::counter("settlement_retries");
+    vector<Entry> batch;
+    vector<Journal::Payout> payouts;
+    vector<uint64_t> settled;
+    while (true) {
+        {
+            unique_lock<mutex> lock(entries_mutex);
+            while (true) {
+                if (!running) {
+                    return;
+                }
+                auto now = chrono::steady_clock::now();
+                auto next_due = chrono::steady_clock::time_point::max();
+                for (const auto& entry : entries) {
+                    next_due = min(next_due, entry.due);
+                }
+                if (next_due <= now) {
+                    break;
+                }
+                if (next_due == chrono::steady_clock::time_point::max()) {
+                    entries_cv.wait(lock);
+                } else {
+                    entries_cv.wait_until(lock, next_due);
+                }
+            }
+            // Take the due payouts, oldest first
+            auto now = chrono::steady_clock::now();
+            batch.clear();
+            for (auto it = entries.begin(); it != entries.end() && batch.size() < static_cast<size_t>(max_batch);) {
+                if (it->due <= now) {
+                    batch.push_back(move(*it));
+                    it = entries.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        payouts.clear();
+        for (const auto& entry : batch) {
+            payouts.push_back(entry.payout);
+        }
+        vector<SettlementGateway::Outcome> outcomes = gateway->settle(payouts);
+        outcomes.resize(batch.size(), SettlementGateway::Outcome::RETRY);
+
+        settled.clear();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Entry& entry = batch[i];
+            if (outcomes[i] == SettlementGateway::Outcome::SETTLED) {
+                settled.push_back(entry.payout.id);
+            } else if (outcomes[i] == SettlementGateway::Outcome::REJECTED || ++entry.attempts >= max_attempts) {
+                refund(entry.payout);
+            } else {
+                ++settlement_retries;
+                entry.due = chrono::steady_clock::now() + retry_delay * (1 << min(entry.attempts - 1, 10));
+                lock_guard<mutex> guard(entries_mutex);
+                entries.push_back(move(entry));
+            }
+        }
+        if (!settled.empty()) {
+            // A payout whose settlement is lost in a crash is paid again by the next run,
+            // so the gateway is expected to ignore a payout id it has already paid
+            if (database->commit({}, {}, settled)) {
+                payouts_settled += settled.size();
+            } else {
+                cerr << "Error: could not record " << settled.size() << " settled payouts" << endl;
+            }
+        }
+    }
+}
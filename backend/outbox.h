@@ -0,0 +1,71 @@
+/**
+ * @file outbox.h
+ * @brief Declaration of the Outbox class.
+ * @author Kaden Oseen
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "databaseHandler.h"
+#include "journal.h"
+#include "settlementGateway.h"
+
+class TransferEngine;
+
+/**
+ * @class Outbox
+ * @brief Settles transfers to external recipients in the background.
+ * An external transfer is debited and queued as a payout in the same journal batch, so
+ * the session can reply at once. The outbox hands due payouts to the SettlementGateway in
+ * batches, marks settled ones in the journal, retries temporary failures with exponential
+ * backoff, and refunds a payout that is rejected or runs out of attempts.
+ */
+class Outbox {
+public:
+    // Constructor and destructor
+    Outbox();
+    ~Outbox();
+    // Methods
+    void start(DatabaseHandler& database, TransferEngine& engine, std::unique_ptr<SettlementGateway> gateway,
+               int max_batch, int max_attempts, std::chrono::milliseconds retry_delay);
+    void stop();
+    void add(const Journal::Payout& payout);
+    size_t pending();
+private:
+    /**
+     * @struct Entry
+     * @brief A payout waiting for settlement, and when to try it next.
+     */
+    struct Entry {
+        Journal::Payout payout;
+        int attempts = 0;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    // Variables
+    DatabaseHandler* database;
+    TransferEngine* engine;
+    std::unique_ptr<SettlementGateway> gateway;
+    int max_batch;
+    int max_attempts;
+    std::chrono::milliseconds retry_delay;
+    std::mutex entries_mutex;
+    std::condition_variable entries_cv;
+    std::deque<Entry> entries;
+    bool running;
+    std::thread worker;
+
+    // Methods
+    void run();
+    void refund(const Journal::Payout& payout);
+};
+
+#endif
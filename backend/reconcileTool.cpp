@@ -0,0 +1,38 @@
+/**
+ * @file reconcileTool.cpp
+ * @brief Checks a database's files offline (see Reconciliation): every record and block
+ * checksum of the users and history files, and every account's balance against its
+ * opening balance plus its history, with the journal applied as recovery would.
+ *
+ * Usage: ./reconcile_tool [users file, users.txt] [--threads=0] [--list=100]
+ * Prints "key=value" lines and exits with 0 if nothing is wrong, 1 otherwise.
+ * @author Kaden Oseen
+ */
+
+#include <iostream>
+#include <string>
+#include "reconciliation.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    string users_file = "users.txt";
+    int threads = 0;
+    size_t listed = 100;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--threads=", 0) == 0) {
+            threads = stoi(arg.substr(10));
+        } else if (arg.rfind("--list=", 0) == 0) {
+            listed = stoul(arg.substr(7));
+        } else if (arg.rfind("--", 0) == 0) {
+            cerr << "Usage: ./reconcile_tool [users file, users.txt] [--threads=<0 for one per core>] [--list=100]" << endl;
+            return 1;
+        } else {
+            users_file = arg;
+        }
+    }
+    Reconciliation report = Reconciliation::run(users_file, threads, listed);
+    cout << report.describe();
+    return report.clean() ? 0 : 1;
+}
@@ -0,0 +1,449 @@
+/**
+ * @file reconciliation.cpp
+ * @brief Implementation of the Reconciliation class.
+ * @author Kaden Oseen
+ */
+
+#include "reconciliation.h"
+#include "blockFile.h"
+#include "historyArchive.h"
+#include "historyLog.h"
+#include "journal.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * @struct Account
+ * @brief An account as the users file records it, amounts in cents.
+ */
+struct Account {
+    // Points into the users file's contents
+    string_view username;
+    int64_t balance;
+    int64_t opening;
+    bool opened;
+};
+
+/**
+ * @struct Findings
+ * @brief What one thread found in its part of a file.
+ */
+struct Findings {
+    vector<Account> accounts;
+    // Net of the history entries read, by account
+    vector<int64_t> net;
+    size_t entries = 0;
+    size_t damaged_records = 0;
+    size_t damaged_blocks = 0;
+    size_t orphaned = 0;
+    vector<string> problems;
+};
+
+/**
+ * @brief Converts an amount in dollars to whole cents.
+ */
+static int64_t to_cents(double amount) {
+    return llround(amount * 100);
+}
+
+/**
+ * @brief Reads a whole file.
+ * @param path The file
+ * @param contents Receives its contents
+ * @return false if it could not be opened
+ */
+static bool read_file(const string& path, string& contents) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    contents.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    return static_cast<bool>(file.read(&contents[0], contents.size()));
+}
+
+/**
+ * @brief Runs work(0) ... work(tasks - 1), each on its own thread (the first on this one).
+ */
+template <typename Work>
+static void in_parallel(size_t tasks, const Work& work) {
+    vector<thread> workers;
+    for (size_t task = 1; task < tasks; ++task) {
+        workers.emplace_back(work, task);
+    }
+    if (tasks > 0) {
+        work(0);
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Calls line(text, offset) for each line of a part of a file.
+ * @param contents The whole file, for offsets
+ * @param part The part
+ */
+template <typename Line>
+static void for_each_line(const string& contents, string_view part, const Line& line) {
+    size_t position = 0;
+    while (position < part.size()) {
+        size_t end = part.find('\n', position);
+        end = end == string_view::npos ? part.size() : end;
+        line(part.substr(position, end - position), static_cast<size_t>(part.data() - contents.data()) + position);
+        position = end + 1;
+    }
+}
+
+/**
+ * @brief Records a problem, if fewer than the most listed have been.
+ */
+static void note(vector<string>& problems, size_t max_listed, const string& file, const string& what, size_t offset) {
+    if (problems.size() < max_listed) {
+        problems.push_back(file + ": " + what + " at byte " + to_string(offset));
+    }
+}
+
+/**
+ * @brief Reads a users file record: username:password:balance, then the opening balance
+ * if it was recorded.
+ * @param record The record, without its checksum
+ * @param account Receives the account
+ * @return false if the record cannot be read
+ */
+static bool parse_account(string_view record, Account& account) {
+    size_t first = record.find(':');
+    size_t second = first == string_view::npos ? first : record.find(':', first + 1);
+    if (second == string_view::npos || first == 0) {
+        return false;
+    }
+    const char* end = record.data() + record.size();
+    double balance, opening;
+    auto parsed = from_chars(record.data() + second + 1, end, balance);
+    if (parsed.ec != errc()) {
+        return false;
+    }
+    account.username = record.substr(0, first);
+    account.balance = to_cents(balance);
+    account.opened = parsed.ptr < end && *parsed.ptr == ':' && from_chars(parsed.ptr + 1, end, opening).ec == errc();
+    account.opening = account.opened ? to_cents(opening) : 0;
+    return true;
+}
+
+/**
+ * @brief Which way and by how much a history entry moves its owner's balance, read as
+ * HistoryLog::parse reads the entry's kind, amount and parties, without its time or
+ * counterparty (the same fields User::historyNet adds up in the server).
+ * @param entry The entry
+ * @param owner The owner's username
+ * @return The change in cents
+ */
+static int64_t effect_of(string_view entry, string_view owner) {
+    size_t kind = entry.find(" --- ");
+    size_t dollar = kind == string_view::npos ? kind : entry.find(" --- $", kind + 5);
+    if (dollar == string_view::npos) {
+        return 0;
+    }
+    string_view name = entry.substr(kind + 5, dollar - kind - 5);
+    double amount = 0;
+    from_chars(entry.data() + dollar + 6, entry.data() + entry.size(), amount);
+    HistoryLog::Type type = HistoryLog::Type::OTHER;
+    if (name == "Deposit") {
+        type = HistoryLog::Type::DEPOSIT;
+    } else if (name == "Withdrawal") {
+        type = HistoryLog::Type::WITHDRAWAL;
+    } else if (name == "Refund") {
+        type = HistoryLog::Type::REFUND;
+    } else if (name == "Transfer") {
+        size_t parties = entry.find(" --- ", dollar + 6);
+        string_view other = parties == string_view::npos ? string_view() : entry.substr(parties + 5);
+        size_t arrow = other.find(" -> ");
+        if (arrow != string_view::npos) {
+            type = other.substr(0, arrow) == owner ? HistoryLog::Type::TRANSFER_OUT : HistoryLog::Type::TRANSFER_IN;
+        }
+    }
+    return HistoryLog::sign(type) * to_cents(amount);
+}
+
+/**
+ * @name run
+ * @brief Checks the users, history and journal files next to users_file.
+ *
+ * @param users_file The users file
+ * @param threads Threads to check with, 0 for one per core
+ * @param max_listed Most discrepancies and problems listed (all are counted)
+ * @return What was found
+ */
+Reconciliation Reconciliation::run(const string& users_file, int threads, size_t max_listed) {
+    auto started = chrono::steady_clock::now();
+    Reconciliation report;
+    report.threads = threads > 0 ? threads : max(1, static_cast<int>(thread::hardware_concurrency()));
+    string users, history, journal;
+    if (!read_file(users_file, users)) {
+        report.problems.push_back("could not open " + users_file);
+        return report;
+    }
+    string history_file = users_file + ".history";
+    read_file(history_file, history);
+    read_file(users_file + ".journal", journal);
+
+    // Accounts, a part of the users file per thread
+    vector<string_view> parts = BlockFile::split(users, report.threads);
+    bool sealed = BlockFile::isSealed(users);
+    vector<Findings> findings(parts.size());
+    in_parallel(parts.size(), [&](size_t part) {
+        Findings& found = findings[part];
+        BlockFile::Reader reader(part > 0 && sealed);
+        for_each_line(users, parts[part], [&](string_view line, size_t offset) {
+            BlockFile::Reader::Line kind;
+            string_view record;
+            Account account;
+            // A damaged record is still counted in if it can be read, as the server loads it
+            bool intact = reader.read(line, kind, record);
+            if (!intact) {
+                ++(kind == BlockFile::Reader::Line::BLOCK ? found.damaged_blocks : found.damaged_records);
+                note(found.problems, max_listed, users_file, kind == BlockFile::Reader::Line::BLOCK ?
+                     "block checksum mismatch" : "record checksum mismatch", offset);
+            }
+            if (kind != BlockFile::Reader::Line::RECORD) {
+                return;
+            }
+            if (parse_account(record, account)) {
+                found.accounts.push_back(account);
+            } else if (intact) {
+                ++found.damaged_records;
+                note(found.problems, max_listed, users_file, "unreadable record", offset);
+            }
+        });
+    });
+    vector<Account> accounts;
+    for (Findings& found : findings) {
+        accounts.insert(accounts.end(), make_move_iterator(found.accounts.begin()), make_move_iterator(found.accounts.end()));
+        found.accounts.clear();
+    }
+    // A username given twice is loaded twice, and the later account gets the history
+    unordered_map<string_view, uint32_t> index;
+    index.reserve(accounts.size());
+    for (uint32_t id = 0; id < accounts.size(); ++id) {
+        if (!index.emplace(accounts[id].username, id).second) {
+            index[accounts[id].username] = id;
+            if (report.problems.size() < max_listed) {
+                report.problems.push_back(users_file + ": account " + string(accounts[id].username) + " appears more than once");
+            }
+        }
+    }
+
+    // History, a part of the history file per thread, in either format; the file is
+    // ignored as it is by the server if it does not start with its sequence line
+    uint64_t history_sequence = 0;
+    if (sscanf(history.c_str(), "#sequence:%" SCNu64, &history_sequence) != 1) {
+        history.clear();
+    }
+    vector<Findings> history_findings;
+    if (HistoryArchive::isArchive(history)) {
+        // A range of the archive's accounts per thread, decoding their blocks
+        HistoryArchive::Reader archive;
+        if (!archive.open(history)) {
+            ++report.damaged_blocks;
+            report.problems.push_back(history_file + ": damaged after the first " + to_string(archive.accounts()) + " accounts");
+        }
+        size_t workers = min<size_t>(report.threads, max<size_t>(1, archive.accounts()));
+        history_findings.resize(workers);
+        in_parallel(workers, [&](size_t worker) {
+            Findings& found = history_findings[worker];
+            found.net.assign(accounts.size(), 0);
+            vector<HistoryArchive::Entry> entries;
+            size_t last = archive.accounts() * (worker + 1) / workers;
+            for (size_t account = archive.accounts() * worker / workers; account < last; ++account) {
+                auto owner = index.find(archive.owner(account));
+                if (owner == index.end()) {
+                    found.orphaned += archive.entries(account);
+                    continue;
+                }
+                for (size_t number = 0; number < archive.blocks(account); ++number) {
+                    const HistoryArchive::Block& block = archive.block(account, number);
+                    if (!archive.decode(block, entries)) {
+                        ++found.damaged_blocks;
+                        note(found.problems, max_listed, history_file, "block checksum mismatch",
+                             static_cast<size_t>(block.bytes.data() - history.data()));
+                        continue;
+                    }
+                    for (const HistoryArchive::Entry& entry : entries) {
+                        found.net[owner->second] += HistoryLog::sign(entry.type) * to_cents(entry.amount);
+                    }
+                    found.entries += entries.size();
+                }
+            }
+        });
+    } else {
+        parts = BlockFile::split(history, report.threads);
+        sealed = BlockFile::isSealed(history);
+        history_findings.resize(parts.size());
+        in_parallel(parts.size(), [&](size_t part) {
+            Findings& found = history_findings[part];
+            found.net.assign(accounts.size(), 0);
+            BlockFile::Reader reader(part > 0 && sealed);
+            // A checkpoint writes each account's entries together, so most lines have the
+            // owner of the line before
+            string_view last_owner;
+            uint32_t last_id = 0;
+            for_each_line(history, parts[part], [&](string_view line, size_t offset) {
+                BlockFile::Reader::Line kind;
+                string_view record;
+                if (!reader.read(line, kind, record)) {
+                    ++(kind == BlockFile::Reader::Line::BLOCK ? found.damaged_blocks : found.damaged_records);
+                    note(found.problems, max_listed, history_file, kind == BlockFile::Reader::Line::BLOCK ?
+                         "block checksum mismatch" : "record checksum mismatch", offset);
+                }
+                if (kind != BlockFile::Reader::Line::RECORD) {
+                    return;
+                }
+                size_t separator = record.find(':');
+                if (separator == string_view::npos || record.substr(0, separator) != last_owner) {
+                    auto owner = separator == string_view::npos ? index.end() : index.find(record.substr(0, separator));
+                    if (owner == index.end()) {
+                        ++found.orphaned;
+                        return;
+                    }
+                    last_owner = owner->first;
+                    last_id = owner->second;
+                }
+                ++found.entries;
+                found.net[last_id] += effect_of(record.substr(separator + 1), last_owner);
+            });
+        });
+    }
+
+    // The journal's complete batches, in order, as recovery applies them
+    vector<int64_t> journal_net(accounts.size(), 0);
+    size_t position = 0;
+    Journal::Batch batch;
+    while (Journal::parse(journal, position, batch)) {
+        ++report.journal_batches;
+        for (const Journal::Record& record : batch.records) {
+            auto owner = index.find(record.username);
+            if (owner == index.end()) {
+                ++report.orphaned;
+                continue;
+            }
+            accounts[owner->second].balance = to_cents(record.balance);
+            if (batch.sequence > history_sequence && !record.history.empty()) {
+                journal_net[owner->second] += effect_of(record.history, record.username);
+                ++report.history_entries;
+            }
+        }
+    }
+    if (position < journal.size() && report.problems.size() < max_listed) {
+        report.problems.push_back(users_file + ".journal: " + to_string(journal.size() - position) +
+                                  " bytes after the last complete batch, ignored as by recovery");
+    }
+
+    // Every account's balance against its opening balance and history, a range per thread
+    size_t workers = min<size_t>(report.threads, max<size_t>(1, accounts.size()));
+    vector<Reconciliation> ranges(workers);
+    in_parallel(workers, [&](size_t worker) {
+        Reconciliation& range = ranges[worker];
+        size_t first = accounts.size() * worker / workers;
+        size_t last = accounts.size() * (worker + 1) / workers;
+        for (size_t id = first; id < last; ++id) {
+            const Account& account = accounts[id];
+            if (!account.opened) {
+                ++range.unverified;
+                continue;
+            }
+            int64_t net = journal_net[id];
+            for (const Findings& found : history_findings) {
+                net += found.net[id];
+            }
+            if (account.balance != account.opening + net) {
+                if (range.discrepancies.size() < max_listed) {
+                    range.discrepancies.push_back({string(account.username), account.balance, account.opening + net});
+                }
+                ++range.discrepancy_count;
+            }
+        }
+    });
+
+    report.accounts = accounts.size();
+    for (vector<Findings>* file : {&findings, &history_findings}) {
+        for (const Findings& found : *file) {
+            report.history_entries += found.entries;
+            report.damaged_records += found.damaged_records;
+            report.damaged_blocks += found.damaged_blocks;
+            report.orphaned += found.orphaned;
+            report.problems.insert(report.problems.end(), found.problems.begin(), found.problems.end());
+        }
+    }
+    for (const Reconciliation& range : ranges) {
+        report.unverified += range.unverified;
+        report.discrepancy_count += range.discrepancy_count;
+        report.discrepancies.insert(report.discrepancies.end(), range.discrepancies.begin(), range.discrepancies.end());
+    }
+    report.problems.resize(min(report.problems.size(), max_listed));
+    report.discrepancies.resize(min(report.discrepancies.size(), max_listed));
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    return report;
+}
+
+/**
+ * @name clean
+ * @brief Whether every checksum matched and every checked balance matched its history.
+ *
+ * @return true if nothing is wrong
+ */
+bool Reconciliation::clean() const {
+    return damaged_records == 0 && damaged_blocks == 0 && discrepancy_count == 0 && accounts != 0;
+}
+
+/**
+ * @brief Writes an amount in cents as dollars.
+ */
+static string dollars(int64_t cents) {
+    ostringstream out;
+    out << fixed << setprecision(2) << static_cast<double>(cents) / 100;
+    return out.str();
+}
+
+/**
+ * @name describe
+ * @brief Renders the findings as "key=value" lines.
+ *
+ * @return The findings as text
+ */
+string Reconciliation::describe() const {
+    ostringstream out;
+    out << "accounts=" << accounts << "\n";
+    out << "unverified=" << unverified << "\n";
+    out << "history_entries=" << history_entries << "\n";
+    out << "journal_batches=" << journal_batches << "\n";
+    out << "damaged_records=" << damaged_records << "\n";
+    out << "damaged_blocks=" << damaged_blocks << "\n";
+    out << "orphaned=" << orphaned << "\n";
+    out << "discrepancies=" << discrepancy_count << "\n";
+    for (const Discrepancy& discrepancy : discrepancies) {
+        out << "discrepancy=" << discrepancy.username << " balance=" << dollars(discrepancy.balance)
+            << " expected=" << dollars(discrepancy.expected) << "\n";
+    }
+    for (const string& problem : problems) {
+        out << "problem=" << problem << "\n";
+    }
+    out << "threads=" << threads << "\n";
+    out << "seconds=" << fixed << setprecision(3) << seconds << "\n";
+    out << "accounts_per_second=" << setprecision(0) << (seconds > 0 ? accounts / seconds : 0) << "\n";
+    out << "entries_per_second=" << (seconds > 0 ? history_entries / seconds : 0) << "\n";
+    out << "status=" << (clean() ? "clean" : "discrepancies") << "\n";
+    return out.str();
+}
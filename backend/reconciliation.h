@@ -0,0 +1,62 @@
+/**
+ * @file reconciliation.h
+ * @brief Declaration of the Reconciliation class.
+ * @author Kaden Oseen
+ */
+
+#ifndef RECONCILIATION_H
+#define RECONCILIATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @class Reconciliation
+ * @brief Offline check of a database's files: every record and block checksum of the
+ * users and history files, and every account's balance against its opening balance plus
+ * the net of its history, with the journal's complete batches applied as recovery would.
+ *
+ * The files are read into memory and split at block lines (or, for a history file in
+ * HistoryArchive form, into ranges of accounts), so several threads check and parse
+ * separate parts; each thread adds up history into its own array of per-account totals,
+ * which are summed at the end. Safe to run next to a live server, which replaces
+ * its files atomically, but the journal may then end in a batch still being written.
+ */
+class Reconciliation {
+public:
+    /**
+     * @struct Discrepancy
+     * @brief An account whose balance is not its opening balance plus its history.
+     */
+    struct Discrepancy {
+        std::string username;
+        int64_t balance;
+        int64_t expected;
+    };
+
+    // Results, amounts in cents
+    size_t accounts = 0;
+    // Accounts from a users file without opening balances, which cannot be checked
+    size_t unverified = 0;
+    size_t history_entries = 0;
+    size_t journal_batches = 0;
+    size_t damaged_records = 0;
+    size_t damaged_blocks = 0;
+    // History entries and journal records for accounts not in the users file
+    size_t orphaned = 0;
+    size_t discrepancy_count = 0;
+    std::vector<Discrepancy> discrepancies;
+    // What was found wrong and where, at most max_listed
+    std::vector<std::string> problems;
+    double seconds = 0;
+    int threads = 0;
+
+    // Methods
+    static Reconciliation run(const std::string& users_file, int threads, size_t max_listed = 100);
+    bool clean() const;
+    std::string describe() const;
+};
+
+#endif
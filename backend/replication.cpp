@@ -0,0 +1,544 @@
+/**
+ * @file replication.cpp
+ * @brief Implementation of the Replication and Standby classes.
+ * The primary sends frames, each a header line followed by its payload:
+ *   <type> <sequence> <payload length>
+ * USERS, HISTORY and OUTBOX carry the snapshot's files, as of batch <sequence>; BATCH carries
+ * a journal batch exactly as appended; ACCOUNT carries a new "username:password:balance"
+ * line. The standby answers "ACK <sequence>" once everything up to that batch is durable.
+ * @author Kaden Oseen
+ */
+
+#include "replication.h"
+#include "databaseHandler.h"
+#include "journal.h"
+#include "metrics.h"
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief Fills in a Unix socket address for a path
+ * @param path The socket path
+ * @param address The address to fill in
+ * @return false if the path is too long
+ */
+static bool unix_address(const string& path, struct sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+/**
+ * @brief Writes a whole message to a socket.
+ * @param connection The socket
+ * @param message The message
+ * @return true if every byte was sent
+ */
+static bool write_all(int connection, const string& message) {
+    size_t sent = 0;
+    while (sent < message.size()) {
+        ssize_t result = send(connection, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+/**
+ * @name Replication
+ * @brief Constructor for the Replication class. Nothing is shipped until start().
+ */
+Replication::Replication() : database(nullptr), sync(false), timeout(0), listen_socket(-1), running(false),
+                             standby(-1), sending(false), shipped(0), acknowledged(0), lagging(false) {}
+
+/**
+ * @name ~Replication
+ * @brief Destructor for the Replication class. Stops shipping.
+ */
+Replication::~Replication() {
+    stop();
+}
+
+/**
+ * @name start
+ * @brief Listens for a standby on a Unix socket and ships the database's commits to it.
+ *
+ * @param path The socket path
+ * @param database The accounts to replicate
+ * @param sync Whether commits wait for the standby
+ * @param timeout Longest a commit waits for the standby
+ * @return true if the socket is listening
+ */
+bool Replication::start(const string& path, DatabaseHandler& database, bool sync, chrono::milliseconds timeout) {
+    struct sockaddr_un address;
+    if (!unix_address(path, address)) {
+        cerr << "Error: replication socket path is too long: " << path << endl;
+        return false;
+    }
+    listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    // A socket file left by a server that did not stop cleanly would fail the bind
+    unlink(path.c_str());
+    if (listen_socket < 0 || bind(listen_socket, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+        listen(listen_socket, 1) < 0) {
+        cerr << "Error: could not listen for a standby on " << path << endl;
+        if (listen_socket >= 0) {
+            close(listen_socket);
+            listen_socket = -1;
+        }
+        return false;
+    }
+    this->path = path;
+    this->database = &database;
+    this->sync = sync;
+    this->timeout = timeout;
+    running = true;
+    sender = thread(&Replication::send, this);
+    acceptor = thread(&Replication::accept, this);
+    database.replicateTo(this);
+    cout << "Waiting for a standby on " << path << " (" << (sync ? "sync" : "async") << ")" << endl;
+    return true;
+}
+
+/**
+ * @name stop
+ * @brief Ships what is already queued, then disconnects the standby and stops listening.
+ * A standby that sees the primary stop this way takes over.
+ */
+void Replication::stop() {
+    if (database == nullptr) {
+        return;
+    }
+    database->replicateTo(nullptr);
+    {
+        lock_guard<mutex> guard(state_mutex);
+        running = false;
+    }
+    frames_cv.notify_all();
+    ack_cv.notify_all();
+    sender.join();
+    {
+        lock_guard<mutex> guard(state_mutex);
+        if (standby >= 0) {
+            shutdown(standby, SHUT_RDWR);
+        }
+    }
+    // Wakes the blocked accept()
+    shutdown(listen_socket, SHUT_RDWR);
+    acceptor.join();
+    close(listen_socket);
+    listen_socket = -1;
+    unlink(path.c_str());
+    database = nullptr;
+}
+
+/**
+ * @name attached
+ * @brief Whether a standby is following this server.
+ *
+ * @return true if a standby is attached
+ */
+bool Replication::attached() {
+    lock_guard<mutex> guard(state_mutex);
+    return standby >= 0;
+}
+
+/**
+ * @name status
+ * @brief Renders the standby's state for the metrics endpoint.
+ *
+ * @return "key=value" lines
+ */
+string Replication::status() {
+    lock_guard<mutex> guard(state_mutex);
+    ostringstream out;
+    out << "mode=" << (sync ? "sync" : "async") << "\n";
+    out << "standby=" << (standby >= 0 ? (lagging ? "lagging" : "attached") : "none") << "\n";
+    out << "shipped=" << shipped << "\n";
+    out << "acknowledged=" << acknowledged << "\n";
+    return out.str();
+}
+
+/**
+ * @name ship
+ * @brief Queues a committed batch for the standby. Called holding the database's file lock,
+ * so batches are queued in journal order.
+ *
+ * @param sequence The batch's sequence number
+ * @param batch The batch, as appended to the journal
+ */
+void Replication::ship(uint64_t sequence, const string& batch) {
+    static atomic<int64_t>& replication_batches_shipped = Metrics::counter("replication_batches_shipped");
+    {
+        lock_guard<mutex> guard(state_mutex);
+        shipped = sequence;
+        if (standby < 0) {
+            return;
+        }
+        enqueue("BATCH", sequence, batch);
+    }
+    ++replication_batches_shipped;
+    frames_cv.notify_one();
+}
+
+/**
+ * @name shipAccount
+ * @brief Queues a new account for the standby. Called holding the database's file lock.
+ *
+ * @param entry The account's line in the users file
+ */
+void Replication::shipAccount(const string& entry) {
+    {
+        lock_guard<mutex> guard(state_mutex);
+        if (standby < 0) {
+            return;
+        }
+        enqueue("ACCOUNT", shipped, entry);
+    }
+    frames_cv.notify_one();
+}
+
+/**
+ * @name waitFor
+ * @brief In sync mode, waits until the standby has made a batch durable. Returns at once
+ * in async mode, with no standby, or while the standby is catching up after missing a
+ * deadline, so a lost standby costs each commit at most one timeout.
+ *
+ * @param sequence The batch's sequence number
+ */
+void Replication::waitFor(uint64_t sequence) {
+    static atomic<int64_t>& replication_ack_timeouts = Metrics::counter("replication_ack_timeouts");
+    if (!sync) {
+        return;
+    }
+    unique_lock<mutex> lock(state_mutex);
+    if (standby < 0 || lagging) {
+        return;
+    }
+    if (!ack_cv.wait_for(lock, timeout, [this, sequence]() { return acknowledged >= sequence || standby < 0 || !running; })) {
+        ++replication_ack_timeouts;
+        lagging = true;
+        cerr << "Standby did not acknowledge batch " << sequence << " within " << timeout.count()
+             << " ms, committing without it until it catches up" << endl;
+    }
+}
+
+/**
+ * @name enqueue
+ * @brief Adds a frame for the sender. Must hold state_mutex.
+ *
+ * @param type The frame type
+ * @param sequence The batch the frame belongs to
+ * @param payload The frame's payload
+ */
+void Replication::enqueue(const char* type, uint64_t sequence, const string& payload) {
+    string frame = string(type) + " " + to_string(sequence) + " " + to_string(payload.size()) + "\n";
+    frame += payload;
+    frames.push_back(move(frame));
+}
+
+/**
+ * @name accept
+ * @brief Follows each standby that connects, one at a time, until stopped.
+ */
+void Replication::accept() {
+    while (true) {
+        int connection = ::accept(listen_socket, nullptr, nullptr);
+        {
+            lock_guard<mutex> guard(state_mutex);
+            if (!running) {
+                if (connection >= 0) {
+                    close(connection);
+                }
+                return;
+            }
+        }
+        if (connection >= 0) {
+            follow(connection);
+        }
+    }
+}
+
+/**
+ * @name follow
+ * @brief Sends a snapshot to a newly connected standby, then reads its acknowledgements
+ * until it disconnects.
+ *
+ * @param connection The standby's connection
+ */
+void Replication::follow(int connection) {
+    // A standby that stops reading is dropped instead of holding the sender forever
+    timeval send_timeout = {static_cast<time_t>(timeout.count() / 1000), static_cast<suseconds_t>(timeout.count() % 1000 * 1000)};
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    uint64_t snapshot_sequence = 0;
+    database->snapshot([&](uint64_t sequence, const string& users_contents, const string& history_contents,
+                           const string& outbox_contents) {
+        lock_guard<mutex> guard(state_mutex);
+        frames.clear();
+        enqueue("USERS", sequence, users_contents);
+        enqueue("HISTORY", sequence, history_contents);
+        enqueue("OUTBOX", sequence, outbox_contents);
+        standby = connection;
+        shipped = sequence;
+        acknowledged = 0;
+        lagging = false;
+        snapshot_sequence = sequence;
+    });
+    frames_cv.notify_one();
+    cout << "Standby attached, sending a snapshot as of batch " << snapshot_sequence << endl;
+
+    string buffer;
+    char chunk[256];
+    while (true) {
+        ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            break;
+        }
+        buffer.append(chunk, received);
+        size_t end;
+        while ((end = buffer.find('\n')) != string::npos) {
+            uint64_t sequence;
+            if (sscanf(buffer.c_str(), "ACK %" SCNu64, &sequence) == 1) {
+                lock_guard<mutex> guard(state_mutex);
+                acknowledged = max(acknowledged, sequence);
+                if (lagging && acknowledged >= shipped) {
+                    lagging = false;
+                    cout << "Standby caught up at batch " << acknowledged << endl;
+                }
+            }
+            buffer.erase(0, end + 1);
+        }
+        ack_cv.notify_all();
+    }
+
+    // The sender may be writing to the connection; it is closed only once it is done
+    {
+        unique_lock<mutex> lock(state_mutex);
+        standby = -1;
+        frames.clear();
+        sent_cv.wait(lock, [this]() { return !sending; });
+    }
+    ack_cv.notify_all();
+    close(connection);
+    cout << "Standby detached" << endl;
+}
+
+/**
+ * @name send
+ * @brief Writes queued frames to the standby, as many at a time as have queued up,
+ * until stopped with nothing left to send.
+ */
+void Replication::send() {
+    unique_lock<mutex> lock(state_mutex);
+    string pending;
+    while (true) {
+        frames_cv.wait(lock, [this]() { return !running || (standby >= 0 && !frames.empty()); });
+        if (standby < 0 || frames.empty()) {
+            if (!running) {
+                return;
+            }
+            continue;
+        }
+        pending.clear();
+        for (const string& frame : frames) {
+            pending += frame;
+        }
+        frames.clear();
+        int connection = standby;
+        sending = true;
+        lock.unlock();
+        bool sent = write_all(connection, pending);
+        lock.lock();
+        sending = false;
+        if (!sent) {
+            cerr << "Error: could not write to the standby, dropping it" << endl;
+            // Ends follow()'s read, which detaches the standby
+            shutdown(connection, SHUT_RDWR);
+        }
+        sent_cv.notify_all();
+    }
+}
+
+/**
+ * @name follow
+ * @brief Follows the primary listening on path until promoted or stopped. Keeps trying to
+ * reach a primary that is not up yet; once synced, the primary going away promotes this
+ * server, as does SIGUSR1 at any time. SIGTERM/SIGINT stop it. These signals must already
+ * be blocked (see Lifecycle::blockSignals).
+ *
+ * @param path The primary's replication socket
+ * @return How following ended
+ */
+Standby::Outcome Standby::follow(const string& path) {
+    struct sockaddr_un address;
+    if (!unix_address(path, address)) {
+        cerr << "Error: replication socket path is too long: " << path << endl;
+        return Outcome::FAILED;
+    }
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    int signals = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (signals < 0) {
+        cerr << "Error: could not watch for signals" << endl;
+        return Outcome::FAILED;
+    }
+
+    bool synced = false;
+    bool waiting_logged = false;
+    Outcome outcome;
+    while (true) {
+        int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection >= 0 && connect(connection, (struct sockaddr*) &address, sizeof(address)) == 0) {
+            cout << "Following the primary at " << path << endl;
+            outcome = receive(connection, signals, synced);
+            close(connection);
+            // A primary lost before the snapshot arrived is waited for again
+            if (outcome != Outcome::PROMOTED || synced) {
+                break;
+            }
+        } else if (connection >= 0) {
+            close(connection);
+        }
+        if (!waiting_logged) {
+            cout << "Waiting for the primary at " << path << endl;
+            waiting_logged = true;
+        }
+        pollfd watch = {signals, POLLIN, 0};
+        if (poll(&watch, 1, RETRY_MS) > 0) {
+            signalfd_siginfo info;
+            read(signals, &info, sizeof(info));
+            outcome = info.ssi_signo == SIGUSR1 ? Outcome::PROMOTED : Outcome::STOPPED;
+            break;
+        }
+    }
+    close(signals);
+    if (outcome == Outcome::PROMOTED) {
+        cout << "Promoted to primary" << (synced ? "" : ", without a snapshot from the old one") << endl;
+    }
+    return outcome;
+}
+
+/**
+ * @name receive
+ * @brief Applies the primary's frames until the connection ends or a signal arrives.
+ *
+ * @param connection The connection to the primary
+ * @param signals A signalfd for SIGTERM, SIGINT and SIGUSR1
+ * @param synced Set once the snapshot is loaded
+ * @return PROMOTED if the primary went away or SIGUSR1 arrived, STOPPED on
+ * SIGTERM/SIGINT, FAILED if a frame could not be applied
+ */
+Standby::Outcome Standby::receive(int connection, int signals, bool& synced) {
+    static atomic<int64_t>& replication_batches_applied = Metrics::counter("replication_batches_applied");
+    DatabaseHandler* database = synced ? &DatabaseHandler::shared() : nullptr;
+    string users_contents, history_contents;
+    string buffer;
+    char chunk[65536];
+    bool acknowledging = true;
+    while (true) {
+        pollfd watch[2] = {{connection, POLLIN, 0}, {signals, POLLIN, 0}};
+        if (poll(watch, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return Outcome::FAILED;
+        }
+        if (watch[1].revents & POLLIN) {
+            signalfd_siginfo info;
+            read(signals, &info, sizeof(info));
+            return info.ssi_signo == SIGUSR1 ? Outcome::PROMOTED : Outcome::STOPPED;
+        }
+        ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            cout << "Lost the primary" << endl;
+            return Outcome::PROMOTED;
+        }
+        buffer.append(chunk, received);
+
+        // Apply every complete frame, then acknowledge the last batch once
+        size_t position = 0;
+        uint64_t acknowledge = 0;
+        while (true) {
+            size_t end = buffer.find('\n', position);
+            char type[16];
+            uint64_t sequence;
+            size_t length;
+            if (end == string::npos) {
+                break;
+            }
+            if (sscanf(buffer.c_str() + position, "%15s %" SCNu64 " %zu", type, &sequence, &length) != 3) {
+                cerr << "Error: malformed frame from the primary" << endl;
+                return Outcome::FAILED;
+            }
+            if (buffer.size() - end - 1 < length) {
+                break;
+            }
+            string payload = buffer.substr(end + 1, length);
+            position = end + 1 + length;
+            string kind = type;
+            if (kind == "USERS") {
+                users_contents = move(payload);
+            } else if (kind == "HISTORY") {
+                history_contents = move(payload);
+            } else if (kind == "OUTBOX") {
+                // The accounts are already loaded and cannot be swapped under the server
+                if (database != nullptr) {
+                    cerr << "Error: the primary sent a second snapshot" << endl;
+                    return Outcome::FAILED;
+                }
+                if (!DatabaseHandler::installSnapshot(users_contents, history_contents, payload)) {
+                    return Outcome::FAILED;
+                }
+                database = &DatabaseHandler::shared();
+                synced = true;
+                acknowledge = sequence;
+                cout << "Loaded the primary's snapshot as of batch " << sequence << endl;
+            } else if (kind == "BATCH" && database != nullptr) {
+                Journal::Batch batch;
+                size_t parsed = 0;
+                if (!Journal::parse(payload, parsed, batch) || !database->applyReplicated(batch)) {
+                    cerr << "Error: could not apply batch " << sequence << " from the primary" << endl;
+                    return Outcome::FAILED;
+                }
+                ++replication_batches_applied;
+                acknowledge = sequence;
+            } else if (kind == "ACCOUNT" && database != nullptr) {
+                istringstream iss(payload);
+                string username, password;
+                double balance;
+                if (getline(iss, username, ':') && getline(iss, password, ':') && iss >> balance) {
+                    database->addUser(username, password, balance);
+                }
+            } else {
+                cerr << "Error: unexpected " << kind << " frame from the primary" << endl;
+                return Outcome::FAILED;
+            }
+        }
+        buffer.erase(0, position);
+        // A primary that stopped reading may still have batches on the way, so they are
+        // applied until the connection ends
+        if (acknowledge != 0 && acknowledging && !write_all(connection, "ACK " + to_string(acknowledge) + "\n")) {
+            acknowledging = false;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+/**
+ * @file replication.h
+ * @brief Declaration of the Replication and Standby classes.
+ * @author Kaden Oseen
+ */
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class DatabaseHandler;
+
+/**
+ * @class Replication
+ * @brief The primary's side of log-shipping replication to a hot standby.
+ * A standby connects to a Unix socket and first receives a snapshot of the accounts, taken
+ * under the database's file lock. From then on, every batch committed to the journal is
+ * shipped to it byte for byte, in journal order, and every new account as it is created,
+ * so the standby never rewrites a whole file per transaction either. A sender thread does
+ * the writing, so a slow standby never holds up the commit itself.
+ *
+ * The standby acknowledges each batch once it is durable on its side. In sync mode a
+ * commit waits for that acknowledgement, so a transfer reported to a client survives the
+ * loss of the primary; if the standby does not answer within the timeout, or none is
+ * attached, the primary goes on alone until the standby has caught up again. One standby
+ * is followed at a time.
+ */
+class Replication {
+public:
+    // Constructor and destructor
+    Replication();
+    ~Replication();
+    // Methods
+    bool start(const std::string& path, DatabaseHandler& database, bool sync, std::chrono::milliseconds timeout);
+    void stop();
+    bool attached();
+    std::string status();
+    void ship(uint64_t sequence, const std::string& batch);
+    void shipAccount(const std::string& entry);
+    void waitFor(uint64_t sequence);
+private:
+    // Variables
+    std::string path;
+    DatabaseHandler* database;
+    bool sync;
+    std::chrono::milliseconds timeout;
+    int listen_socket;
+    std::thread acceptor;
+    std::thread sender;
+    bool running;
+    // Everything below is guarded by state_mutex
+    std::mutex state_mutex;
+    std::condition_variable frames_cv;
+    std::condition_variable ack_cv;
+    std::condition_variable sent_cv;
+    std::deque<std::string> frames;
+    // The attached standby's connection, or -1
+    int standby;
+    // Whether the sender is writing to the standby's connection outside the lock
+    bool sending;
+    // Last batch shipped, and last batch the standby has made durable
+    uint64_t shipped;
+    uint64_t acknowledged;
+    // Set when the standby missed a sync deadline, until it has caught up
+    bool lagging;
+
+    // Methods
+    void accept();
+    void follow(int connection);
+    void send();
+    void enqueue(const char* type, uint64_t sequence, const std::string& payload);
+};
+
+/**
+ * @class Standby
+ * @brief The standby's side of replication. Runs before the server opens any port: loads
+ * the primary's snapshot, then applies and acknowledges every batch it ships, until it is
+ * promoted, when the server starts serving clients from the replicated accounts.
+ */
+class Standby {
+public:
+    // How following the primary ended
+    enum class Outcome {
+        PROMOTED,   // the primary went away or SIGUSR1 arrived: serve clients
+        STOPPED,    // SIGTERM/SIGINT arrived: exit
+        FAILED      // the primary's stream could not be applied: exit with an error
+    };
+
+    // Methods
+    static Outcome follow(const std::string& path);
+private:
+    // Delay between attempts to reach a primary that is not up yet
+    static const int RETRY_MS = 500;
+
+    static Outcome receive(int connection, int signals, bool& synced);
+};
+
+#endif
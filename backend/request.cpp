@@ -1,11 +1,20 @@
 /**
  * @file requests.cpp
  * @brief Implementation of the Request class.
- * Makes requests to NLP server API in order to handle natural language input
+ * Makes requests to NLP server API in order to handle natural language input.
+ * Request bodies are spliced into a template serialized once, and the reply is scanned
+ * once for the one field needed instead of being parsed into a JSON tree.
  * @author Kaden Oseen
  */
 
 #include "request.h"
+#include "circuitBreaker.h"
+#include "intentModel.h"
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <utility>
 using namespace std;
 
 /**
@@ -13,10 +22,10 @@ using namespace std;
  * @brief Constructor for the Request class
 
  * @param input The user input to be sent to the NLP API
+ * @param memory Where the input, request body and response are kept
  */
-Request::Request(string input) : input(input) {
-    curl = curl_easy_init();
-}
+Request::Request(string_view input, pmr::memory_resource* memory)
+    : curl(nullptr), memory(memory), input(input, memory), response(memory) {}
 
 
 /**
@@ -25,82 +34,482 @@ Request::Request(string input) : input(input) {
  * Cleans up the curl object
  */
 Request::~Request() {
-    curl_easy_cleanup(curl);
+    if (curl != nullptr) {
+        curl_easy_cleanup(curl);
+    }
 }
 
 
+/**
+ * @name prepareHandle
+ * @brief Sets up a curl handle to post the request body within a deadline.
+ * @param handle The handle
+ * @param headers The request headers
+ * @param body The request body, which must outlive the transfer
+ * @param response Receives the response body
+ * @param timeout Time allowed for the whole transfer
+ */
+void Request::prepareHandle(CURL* handle, curl_slist* headers, const pmr::string& body, pmr::string* response,
+                            chrono::milliseconds timeout) {
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(handle, CURLOPT_URL, server_config.nlp_endpoint.c_str());
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, body.c_str());
+    // Set the write callback function to receive the response
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &Request::writeCallback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, response);
+    // Never wait on the NLP server past the deadline, and count error statuses as failures
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, static_cast<long>(max<int64_t>(1, timeout.count())));
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(max<int64_t>(1, timeout.count())));
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+}
+
 /**
  * @name execute
  * @brief Execute the curl request to NLP API
- * Creates a request to the NLP API with the user input and system message
+ * Creates a request to the NLP API with the user input and system message. The request must
+ * finish within nlp_timeout_ms. With nlp_hedge, a duplicate is sent if the first has taken
+ * longer than 95% of recent requests, and whichever answers first is used. While the NLP
+ * circuit breaker is open the request fails at once, without reaching the NLP server.
+ * With an intent_model configured, the input is interpreted locally and the NLP server is
+ * never asked.
  * @return true If the request was successful
  * @return false If the request failed
  */
 bool Request::execute() {
+    static atomic<int64_t>& nlp_requests = Metrics::counter("nlp_requests");
+    static atomic<int64_t>& nlp_failures = Metrics::counter("nlp_failures");
+    static atomic<int64_t>& nlp_timeouts = Metrics::counter("nlp_timeouts");
+    static atomic<int64_t>& nlp_rejected = Metrics::counter("nlp_rejected");
+    static atomic<int64_t>& nlp_hedged = Metrics::counter("nlp_hedged");
+    static atomic<int64_t>& nlp_hedge_wins = Metrics::counter("nlp_hedge_wins");
+    static atomic<int64_t>& nlp_local = Metrics::counter("nlp_local");
+    if (intent_model.loaded()) {
+        ++nlp_local;
+        response = intent_model.interpret(string(input), server_config.intent_min_confidence_percent / 100.0);
+        return true;
+    }
+    if (!nlp_breaker.allow()) {
+        ++nlp_rejected;
+        return false;
+    }
+    ++nlp_requests;
+    if (curl == nullptr) {
+        curl = curl_easy_init();
+    }
+
     // Set the headers
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, "Content-Type: application/json");
-    // Authorization token (should be stored in .env, but leaving hardcoded as it has a request limit and for ease of use by TA)
-    headers = curl_slist_append(headers, "Authorization: Bearer API_KEY_HERE");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-    // Set the request URL and body
-    Json::Value requestBody;
-    requestBody["model"] = "gpt-3.5-turbo";
-    // Create the messages array for the model to process
-    Json::Value messages(Json::arrayValue);
+    // Authorization token from the server configuration (nlp_api_key)
+    pmr::string authorization("Authorization: Bearer ", memory);
+    authorization += server_config.nlp_api_key;
+    headers = curl_slist_append(headers, authorization.c_str());
+
+    // The request body, built from the prebuilt template
+    pmr::string requestBodyString = buildBody();
+
+    // A hedge is only worth sending once there are recent latencies to time it by
+    chrono::milliseconds timeout(server_config.nlp_timeout_ms);
+    chrono::milliseconds hedge_delay = max(nlp_breaker.percentile(0.95), chrono::milliseconds(server_config.nlp_hedge_min_ms));
+    bool hedging = server_config.nlp_hedge && nlp_breaker.percentile(0.95).count() > 0 && hedge_delay < timeout;
+    auto started = chrono::steady_clock::now();
+    auto deadline = started + timeout;
+
+    CURLM* multi = curl_multi_init();
+    prepareHandle(curl, headers, requestBodyString, &response, timeout);
+    curl_multi_add_handle(multi, curl);
+    CURL* hedge = nullptr;
+    pmr::string hedge_response(memory);
+    int launched = 1;
+    int finished = 0;
+    CURL* winner = nullptr;
+    CURLcode failure = CURLE_OK;
+    bool timed_out = false;
+    while (true) {
+        int running;
+        curl_multi_perform(multi, &running);
+        CURLMsg* message;
+        int left;
+        while ((message = curl_multi_info_read(multi, &left)) != nullptr) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            ++finished;
+            if (message->data.result == CURLE_OK) {
+                winner = winner == nullptr ? message->easy_handle : winner;
+            } else {
+                failure = message->data.result;
+            }
+        }
+        if (winner != nullptr || finished == launched) {
+            break;
+        }
+        auto now = chrono::steady_clock::now();
+        if (now >= deadline) {
+            timed_out = true;
+            break;
+        }
+        if (hedging && hedge == nullptr && now - started >= hedge_delay) {
+            hedge = curl_easy_init();
+            prepareHandle(hedge, headers, requestBodyString, &hedge_response, chrono::duration_cast<chrono::milliseconds>(deadline - now));
+            curl_multi_add_handle(multi, hedge);
+            ++launched;
+            ++nlp_hedged;
+            continue;
+        }
+        auto wake = hedging && hedge == nullptr ? min(deadline, started + hedge_delay) : deadline;
+        int wait_ms = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(wake - now).count()) + 1;
+        curl_multi_poll(multi, nullptr, 0, wait_ms, nullptr);
+    }
+    chrono::milliseconds latency = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started);
+    curl_multi_remove_handle(multi, curl);
+    if (hedge != nullptr) {
+        curl_multi_remove_handle(multi, hedge);
+    }
+    curl_multi_cleanup(multi);
+    curl_slist_free_all(headers);
+    if (winner != nullptr && winner == hedge) {
+        response = move(hedge_response);
+        ++nlp_hedge_wins;
+    }
+    if (hedge != nullptr) {
+        curl_easy_cleanup(hedge);
+    }
+
+    // Check if request failed, then set response to "assistant" response from model
+    bool success = winner != nullptr && parseResponse(response, response);
+    nlp_breaker.record(success, timed_out ? timeout : latency);
+    if (!success) {
+        ++nlp_failures;
+        if (timed_out) {
+            ++nlp_timeouts;
+            cerr << "NLP request timed out after " << timeout.count() << " ms" << endl;
+        } else if (winner == nullptr) {
+            cerr << "curl request failed: " << curl_easy_strerror(failure) << endl;
+        }
+    }
+    return success;
+}
+
+
+/**
+ * @name status
+ * @brief Renders the NLP circuit breaker and how often requests are hedged, for the
+ * metrics endpoint.
+ *
+ * @return "key=value" lines
+ */
+string Request::status() {
+    int64_t requests = Metrics::counter("nlp_requests").load();
+    int64_t hedged = Metrics::counter("nlp_hedged").load();
+    ostringstream out;
+    out << nlp_breaker.status();
+    out << "hedge_delay_ms=" << (server_config.nlp_hedge ? max(nlp_breaker.percentile(0.95).count(), static_cast<int64_t>(server_config.nlp_hedge_min_ms)) : 0) << "\n";
+    out << "hedge_rate_percent=" << (requests == 0 ? 0.0 : 100.0 * hedged / requests) << "\n";
+    return out.str();
+}
+
+
+/**
+ * @name executeAsync
+ * @brief Coroutine version of execute for sessions running on an EventLoop.
+ * The request runs on the blocking pool and the session resumes on its loop when it completes.
+ *
+ * @return true If the request was successful
+ */
+Task<bool> Request::executeAsync() {
+    // A local interpretation takes microseconds, so it runs on the loop itself
+    if (intent_model.loaded()) {
+        co_return execute();
+    }
+    co_return co_await blocking_pool.run<bool>([this]() { return execute(); });
+}
+
+
+/**
+ * @brief Appends text to a JSON string literal being built, escaping what JSON requires.
+ * @param out The JSON being built, a std::string or a std::pmr::string
+ * @param text The text, in UTF-8
+ */
+template <typename String>
+static void append_escaped(String& out, string_view text) {
+    static const char HEX[] = "0123456789abcdef";
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += HEX[c >> 4];
+                    out += HEX[c & 0xf];
+                } else {
+                    out += c;
+                }
+        }
+    }
+}
+
+/**
+ * @brief Returns the parts of the request body before and after the user's text.
+ * Everything but the user's text is the same for every request, so it is serialized once.
+ * @return The part before the user's text, and the part after it
+ */
+static const pair<string, string>& body_template() {
     // System message lets the model know what it's job is
-    Json::Value systemMessage;
-    systemMessage["role"] = "system";
-    systemMessage["content"] = "You are a banking system where users use natural language to withdraw, deposit, transfer, check balance, view history, go back (backwards), view their options, or logout. \
+    static const char* SYSTEM_MESSAGE = "You are a banking system where users use natural language to withdraw, deposit, transfer, check balance, view history, go back (backwards), view their options, or logout. \
     After a message from the user, you will respond with a single message. Give ONLY two words for what the user is trying to do in the exact format: (action,amount) \
     where action is a single word string (deposit, transfer, withdraw, balance, history, backwards, options or logout) and amount is a number with maximum 2 decimal places (0 for balance, history, backwards, options or logout). \
     If a user requests to change to regular prompts or or go back in any way, respond with (backwards,0). If a user does not specify an amount with a request such as deposit, withdraw or transfer, return -1 as the value.\
     Remove ALL spaces. If unknown or not 100% sure, return (unknown,0).";
-    messages.append(systemMessage);
-    // User message is the input from the user
-    Json::Value userMessage;
-    userMessage["role"] = "user";
-    userMessage["content"] = input;
-    messages.append(userMessage);
-    requestBody["messages"] = messages;
-    cout << requestBody << endl;
-
-    // Convert the request body to a string
-    std::string requestBodyString = requestBody.toStyledString();
-
-    // Set the request URL and body
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.openai.com/v1/chat/completions");
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, requestBodyString.c_str());
+    // The model is fixed once the configuration is loaded
+    static const pair<string, string> parts = []() {
+        pair<string, string> template_parts;
+        string& before = template_parts.first;
+        before = "{\"model\":\"";
+        append_escaped(before, server_config.nlp_model);
+        before += "\",\"messages\":[{\"role\":\"system\",\"content\":\"";
+        append_escaped(before, SYSTEM_MESSAGE);
+        before += "\"},{\"role\":\"user\",\"content\":\"";
+        template_parts.second = "\"}]}";
+        return template_parts;
+    }();
+    return parts;
+}
+
+/**
+ * @name buildBody
+ * @brief Builds the JSON body of the chat completion request for the user input
+ *
+ * @return The serialized request body, in the request's memory
+ */
+pmr::string Request::buildBody() const {
+    const pair<string, string>& parts = body_template();
+    pmr::string body(memory);
+    body.reserve(parts.first.size() + input.size() + parts.second.size() + 16);
+    body += parts.first;
+    append_escaped(body, input);
+    body += parts.second;
+    return body;
+}
 
-    // Set the write callback function to receive the response
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &Request::writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
 
-    // Execute the request
-    CURLcode res = curl_easy_perform(curl);
+/**
+ * @brief Position in a JSON text being scanned. Values that are not needed are skipped
+ * without being decoded, so a response is read once, with no tree built.
+ */
+struct JsonCursor {
+    const char* position;
+    const char* end;
+    // Where keys being compared are decoded
+    pmr::memory_resource* memory;
+
+    // Skips whitespace; false at the end of the text
+    bool skipSpace() {
+        while (position < end && (*position == ' ' || *position == '\n' || *position == '\r' || *position == '\t')) {
+            ++position;
+        }
+        return position < end;
+    }
+
+    // Consumes the given character, after any whitespace
+    bool expect(char c) {
+        if (!skipSpace() || *position != c) {
+            return false;
+        }
+        ++position;
+        return true;
+    }
+
+    // Reads four hex digits of a \u escape
+    bool readHex(unsigned& value) {
+        if (end - position < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *position++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= c - '0';
+            } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+                value |= (c | 0x20) - 'a' + 10;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
 
-    // Check if request failed
-    if (res != CURLE_OK) {
-        cerr << "curl request failed: " << curl_easy_strerror(res) << endl;
+    // Reads a string, decoding its escapes into out, or only skipping it if out is null
+    bool readString(pmr::string* out) {
+        if (!expect('"')) {
+            return false;
+        }
+        while (position < end) {
+            // Copy the run of plain characters in one go
+            const char* run = position;
+            while (position < end && *position != '"' && *position != '\\') {
+                ++position;
+            }
+            if (out != nullptr) {
+                out->append(run, position - run);
+            }
+            if (position == end) {
+                return false;
+            }
+            if (*position++ == '"') {
+                return true;
+            }
+            if (position == end) {
+                return false;
+            }
+            char escape = *position++;
+            char decoded;
+            switch (escape) {
+                case '"': case '\\': case '/': decoded = escape; break;
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'u': {
+                    unsigned code;
+                    if (!readHex(code)) {
+                        return false;
+                    }
+                    // A surrogate pair encodes one character outside the basic plane
+                    if (code >= 0xd800 && code < 0xdc00 && end - position >= 6 && position[0] == '\\' && position[1] == 'u') {
+                        position += 2;
+                        unsigned low;
+                        if (!readHex(low) || low < 0xdc00 || low >= 0xe000) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    if (out != nullptr) {
+                        if (code < 0x80) {
+                            *out += static_cast<char>(code);
+                        } else if (code < 0x800) {
+                            *out += static_cast<char>(0xc0 | (code >> 6));
+                            *out += static_cast<char>(0x80 | (code & 0x3f));
+                        } else if (code < 0x10000) {
+                            *out += static_cast<char>(0xe0 | (code >> 12));
+                            *out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                            *out += static_cast<char>(0x80 | (code & 0x3f));
+                        } else {
+                            *out += static_cast<char>(0xf0 | (code >> 18));
+                            *out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+                            *out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                            *out += static_cast<char>(0x80 | (code & 0x3f));
+                        }
+                    }
+                    continue;
+                }
+                default:
+                    return false;
+            }
+            if (out != nullptr) {
+                *out += decoded;
+            }
+        }
         return false;
     }
 
-    // Parse the JSON response
-    Json::Value root;
-    Json::CharReaderBuilder builder;
-    Json::CharReader* reader = builder.newCharReader();
-    std::string errors;
+    // Skips one value of any type, including everything nested in it
+    bool skipValue() {
+        if (!skipSpace()) {
+            return false;
+        }
+        if (*position == '"') {
+            return readString(nullptr);
+        }
+        if (*position != '{' && *position != '[') {
+            // A number, true, false or null
+            const char* start = position;
+            while (position < end && *position != ',' && *position != '}' && *position != ']' &&
+                   *position != ' ' && *position != '\n' && *position != '\r' && *position != '\t') {
+                ++position;
+            }
+            return position != start;
+        }
+        int depth = 0;
+        while (position < end) {
+            char c = *position;
+            if (c == '"') {
+                if (!readString(nullptr)) {
+                    return false;
+                }
+                continue;
+            }
+            ++position;
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-    if (!reader->parse(response.c_str(), response.c_str() + response.size(), &root, &errors)) {
-        cerr << "Failed to parse response: " << errors << endl;
-        return "";
+    // Moves to the value of the named member of the object starting here
+    bool findMember(const char* name) {
+        if (!expect('{')) {
+            return false;
+        }
+        pmr::string key(memory);
+        while (true) {
+            if (!skipSpace() || *position == '}') {
+                return false;
+            }
+            key.clear();
+            if (!readString(&key) || !expect(':')) {
+                return false;
+            }
+            if (key == name) {
+                return true;
+            }
+            if (!skipValue()) {
+                return false;
+            }
+            if (!expect(',')) {
+                return false;
+            }
+        }
     }
+};
 
-    // Set response to "assistant" response from model
-    response = root["choices"][0]["message"]["content"].asString();
 
-    // Return true if request succeeded
+/**
+ * @name parseResponse
+ * @brief Extracts the assistant message from a chat completion response in one pass over
+ * the raw body, skipping everything but choices[0].message.content
+ *
+ * @param raw The raw JSON response body
+ * @param content Set to the content of the first choice, in the memory content already uses
+ * @return true If the response held a first choice with a message
+ */
+bool Request::parseResponse(string_view raw, pmr::string& content) {
+    pmr::memory_resource* memory = content.get_allocator().resource();
+    JsonCursor cursor = {raw.data(), raw.data() + raw.size(), memory};
+    pmr::string message(memory);
+    if (!cursor.findMember("choices") || !cursor.expect('[') || !cursor.findMember("message") ||
+        !cursor.findMember("content")) {
+        cerr << "Failed to parse response: no choices[0].message.content" << endl;
+        return false;
+    }
+    // A message with no text (null content) reads as empty
+    if (cursor.skipSpace() && *cursor.position == '"' && !cursor.readString(&message)) {
+        cerr << "Failed to parse response: malformed content" << endl;
+        return false;
+    }
+    content = move(message);
     return true;
 }
 
@@ -110,9 +519,9 @@ bool Request::execute() {
  * @name result
  * @brief Get the result of the curl request
  * 
- * @return string The formatted response from the request
+ * @return The formatted response from the request, valid as long as the request
  */
-string Request::result() {
+string_view Request::result() const {
     return response;
 }
 
@@ -129,6 +538,6 @@ string Request::result() {
  */
 size_t Request::writeCallback(void* contents, size_t size, size_t nmemb, void* userp) {
     // Append the contents of the response to jsonData string
-    ((string*)userp)->append((char*)contents, size * nmemb);
+    ((pmr::string*)userp)->append((char*)contents, size * nmemb);
     return size * nmemb;
 }
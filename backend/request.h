@@ -7,31 +7,45 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 
+#include <chrono>
 #include <iostream>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <curl/curl.h>
-#include <jsoncpp/json/json.h>
+#include "config.h"
+#include "globals.h"
+#include "task.h"
 
 /**
  * @class Request
  * @brief Class for making curl requests
+ * The input, request body and response are kept in the memory the request is given, such
+ * as the arena of the session step that makes it.
  * 
  * @param input The user input to send to the server
  */
 class Request {
     private:
-        // Curl object and url
+        // Curl object, made when the NLP server is first asked
         CURL* curl;
-        std::string input;
-        std::string response;
+        std::pmr::memory_resource* memory;
+        std::pmr::string input;
+        std::pmr::string response;
     public:
         // Constructor and destructor
-        Request(std::string input);
+        Request(std::string_view input, std::pmr::memory_resource* memory = std::pmr::get_default_resource());
         ~Request();
         // Methods
         bool execute();
-        std::string result();
+        Task<bool> executeAsync();
+        std::string_view result() const;
+        std::pmr::string buildBody() const;
+        static bool parseResponse(std::string_view raw, std::pmr::string& content);
+        static std::string status();
     private:
+        static void prepareHandle(CURL* handle, curl_slist* headers, const std::pmr::string& body, std::pmr::string* response,
+                                  std::chrono::milliseconds timeout);
         // Callback function for writing the response
         static size_t writeCallback(void* contents, size_t size, size_t nmemb, void* userp);
 };
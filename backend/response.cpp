@@ -0,0 +1,113 @@
+/**
+ * @file response.cpp
+ * @brief Implementation of the Response class.
+ * @author Kaden Oseen
+ */
+
+#include "response.h"
+#include <cstdio>
+
+using namespace std;
+
+// Initial buffer size, enough for every fixed reply and a short transaction history
+static const size_t INITIAL_CAPACITY = 4096;
+
+/**
+ * @name Response
+ * @brief Constructor for the Response class. Reserves the buffer up front.
+ */
+Response::Response() {
+    buffer.reserve(INITIAL_CAPACITY);
+}
+
+/**
+ * @name begin
+ * @brief Starts a new reply, keeping the buffer's capacity.
+ * Every message to the client starts with a newline.
+ *
+ * @return The response, for chaining
+ */
+Response& Response::begin() {
+    buffer.assign(1, '\n');
+    return *this;
+}
+
+/**
+ * @name operator<<
+ * @brief Appends a fragment to the reply.
+ *
+ * @param fragment The text to append
+ * @return The response, for chaining
+ */
+Response& Response::operator<<(string_view fragment) {
+    buffer.append(fragment.data(), fragment.size());
+    return *this;
+}
+
+/**
+ * @name operator<<
+ * @brief Appends a balance with two decimal places, cut off the same way as
+ * to_string(value) with its last four digits removed.
+ *
+ * @param amount The amount to append
+ * @return The response, for chaining
+ */
+Response& Response::operator<<(Amount amount) {
+    // Large enough for any double printed with %f
+    char digits[512];
+    int length = snprintf(digits, sizeof(digits), "%f", amount.value);
+    if (length > 4) {
+        buffer.append(digits, length - 4);
+    }
+    return *this;
+}
+
+/**
+ * @name operator<<
+ * @brief Appends each entry followed by a newline.
+ *
+ * @param entries The entries to append
+ * @return The response, for chaining
+ */
+Response& Response::operator<<(const HistoryLog::View& entries) {
+    for (const auto& entry : entries) {
+        buffer.append(entry);
+        buffer.push_back('\n');
+    }
+    return *this;
+}
+
+/**
+ * @name operator<<
+ * @brief Appends each entry found by a history query followed by a newline.
+ *
+ * @param entries The entries to append
+ * @return The response, for chaining
+ */
+Response& Response::operator<<(const vector<const string*>& entries) {
+    for (const string* entry : entries) {
+        buffer.append(*entry);
+        buffer.push_back('\n');
+    }
+    return *this;
+}
+
+/**
+ * @name data
+ * @brief Returns the reply text.
+ *
+ * @return Pointer to the reply, valid until the next change
+ */
+const char* Response::data() const {
+    return buffer.data();
+}
+
+/**
+ * @name size
+ * @brief Returns the length of the reply in bytes.
+ *
+ * @return The reply length
+ */
+size_t Response::size() const {
+    return buffer.size();
+}
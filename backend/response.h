@@ -0,0 +1,75 @@
+/**
+ * @file response.h
+ * @brief Declaration of the Response class and the fixed message fragments sent to clients.
+ * @author Kaden Oseen
+ */
+
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "historyLog.h"
+
+/**
+ * @struct Messages
+ * @brief Message fragments shared by every session. They live in static storage, so
+ * appending one to a reply never allocates.
+ */
+struct Messages {
+    static constexpr std::string_view OPTIONS = "\n\
+    1. View Balance\n\
+    2. Deposit\n\
+    3. Withdraw\n\
+    4. Transfer Funds\n\
+    5. View Transaction History\n\
+    6. Change to NLP\n\
+    7. LogOut\n\
+    8. Search Transaction History\n\
+    9. Export Statement\n";
+    static constexpr std::string_view WHAT_ELSE = "\nWhat else can I help you with today?";
+    static constexpr std::string_view WHAT_TODAY = "What would you like to do today?";
+    static constexpr std::string_view INVALID_VALUE = "Invalid value.\nWhat else can I help you with today?";
+    static constexpr std::string_view LOGGED_IN = "Successfully logged in!\nWould you like to use natural language prompts today? (y/n)";
+    static constexpr std::string_view HISTORY_SEARCH = "What are you looking for? For example: \"transfers to bob last month\", \"deposits over $500\", \"withdrawals since 2024-05-01\" or \"last 5 transfers\"";
+    static constexpr std::string_view EXPORT_FORMAT = "Which format would you like, csv or binary? To resume an export, add the first entry you still need, e.g. \"csv 5000\"";
+    static constexpr std::string_view NLP_UNAVAILABLE = "Natural language requests are unavailable right now, switching to the menu.";
+    static constexpr std::string_view TRANSFER_TARGET = "Who would you like to transfer to?\n\
+            1. Existing user\n\
+            2. External user (by email)";
+};
+
+/**
+ * @struct Amount
+ * @brief A balance to append to a Response, formatted with two decimal places.
+ */
+struct Amount {
+    double value;
+};
+
+/**
+ * @class Response
+ * @brief A reply to a client, gathered from fragments into one reusable buffer.
+ * Each session keeps one Response, so once its buffer has grown to the size of the largest
+ * reply, building and sending a reply does not allocate. The whole reply goes out in a
+ * single SSL_write, as the client expects one message per read.
+ */
+class Response {
+public:
+    // Constructor
+    Response();
+    // Building a reply
+    Response& begin();
+    Response& operator<<(std::string_view fragment);
+    Response& operator<<(Amount amount);
+    Response& operator<<(const HistoryLog::View& entries);
+    Response& operator<<(const std::vector<const std::string*>& entries);
+    // Reading the reply
+    const char* data() const;
+    size_t size() const;
+private:
+    std::string buffer;
+};
+
+#endif
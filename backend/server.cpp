@@ -1,7 +1,7 @@
 /**
  * @file server.cpp
  * @brief Starts a server to handle NLP Banking client requests.
- * Uses threads to handle many clients at once.
+ * Runs each client session on its own thread, or as a coroutine on a few event loop threads.
  * @author Kaden Oseen
  */
 
@@ -9,85 +9,329 @@
 
 using namespace std;
 
-const int PORT = 3001;
-
 /**
  * @brief Handles a session with a client.
  * Creates a session for the client and starts the session. Shuts down the SSL afterwards and closes socket.
  * @param client_socket The socket to communicate with the client.
  */
 void handle_session(int client_socket, SSL* ssl) {
-    // Create a new Session object and start the session
+    static atomic<int64_t>& sessions_active = Metrics::counter("sessions_active");
+    // Bound the handshake so a silent client cannot hold the thread forever
+    TimerWheel::Timer handshake_timer;
+    handshake_timer.callback = [client_socket]() {
+        shutdown(client_socket, SHUT_RDWR);
+    };
+    session_timers.schedule(handshake_timer, session_timeouts.forState(SessionState::HANDSHAKE));
     int testSSL = SSL_accept(ssl);
+    session_timers.cancel(handshake_timer);
     if(testSSL == 1){
         cout << "SSL connection established" << endl;
     }else{
         cout << "SSL connection failed" << endl;
+        SSL_free(ssl);
+        close(client_socket);
+        --sessions_active;
         return;
     }
     std::cerr << "SSL state: " << SSL_state_string(ssl) << std::endl;
 
-    Session session(client_socket, ssl);
-    session.start_session();
+    // Create a new Session object and start the session
+    try {
+        Session session(client_socket, ssl);
+        session.start_session();
+    } catch (const exception& e) {
+        cerr << "Session ended with error: " << e.what() << endl;
+    }
 
     // Clean up the SSL object and close the client socket
     cout << "Closing connection" << endl;
     SSL_shutdown(ssl);
     SSL_free(ssl);
     close(client_socket);
+    --sessions_active;
+}
+
+/**
+ * @brief Coroutine version of handle_session for sessions running on an EventLoop.
+ * The socket is made non-blocking and the handshake and session suspend on the loop
+ * whenever they would wait on the client.
+ * @param client_socket The socket to communicate with the client.
+ * @param ssl The SSL object for the connection.
+ * @param loop The event loop running the session.
+ */
+Task<void> serve_session(int client_socket, SSL* ssl, EventLoop* loop) {
+    static atomic<int64_t>& sessions_active = Metrics::counter("sessions_active");
+    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+    // Bound the handshake; shutting the socket down wakes the waiting coroutine
+    TimerWheel::Timer handshake_timer;
+    handshake_timer.callback = [client_socket]() {
+        shutdown(client_socket, SHUT_RDWR);
+    };
+    session_timers.schedule(handshake_timer, session_timeouts.forState(SessionState::HANDSHAKE));
+    int testSSL;
+    while ((testSSL = SSL_accept(ssl)) != 1) {
+        int error = SSL_get_error(ssl, testSSL);
+        if (error == SSL_ERROR_WANT_READ) {
+            co_await loop->wait(client_socket, EPOLLIN);
+        } else if (error == SSL_ERROR_WANT_WRITE) {
+            co_await loop->wait(client_socket, EPOLLOUT);
+        } else {
+            break;
+        }
+    }
+    session_timers.cancel(handshake_timer);
+    if(testSSL == 1){
+        cout << "SSL connection established" << endl;
+        // Create a new Session object and run the session on this loop
+        try {
+            Session session(client_socket, ssl, loop);
+            co_await session.run_session();
+        } catch (const exception& e) {
+            cerr << "Session ended with error: " << e.what() << endl;
+        }
+        // Best effort close_notify; the socket is non-blocking so this never waits
+        cout << "Closing connection" << endl;
+        SSL_shutdown(ssl);
+    }else{
+        cout << "SSL connection failed" << endl;
+    }
+    SSL_free(ssl);
+    loop->forget(client_socket);
+    close(client_socket);
+    --sessions_active;
 }
 
 
 /**
  * @brief Starts the server and listens for incoming client requests.
- * Initializes SSL, socket and address, and starts a new thread for each client.
+ * Loads the configuration, initializes SSL and the listening sockets, and starts the acceptor threads.
+ * Runs until SIGTERM/SIGINT or a hot restart, then drains sessions and exits cleanly.
+ * Started with replicate_from, it first runs as a standby until promoted.
+ * @param argc Argument count, see ServerConfig::load for the accepted flags.
+ * @param argv Argument vector.
  * @return int Exit code.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    // Signals are handled by one thread, so block them before any other thread starts
+    Lifecycle::blockSignals();
+
+    // Load and validate the configuration before touching anything else
+    if (!server_config.load(argc, argv) || !cluster.configure(server_config.cluster_nodes, server_config.node_id)) {
+        return 1;
+    }
+    session_timeouts.handshake = chrono::milliseconds(server_config.handshake_timeout_ms);
+    session_timeouts.login = chrono::milliseconds(server_config.login_timeout_ms);
+    session_timeouts.authenticated = chrono::milliseconds(server_config.idle_timeout_ms);
+    CircuitBreaker::Settings breaker_settings;
+    breaker_settings.window = server_config.nlp_breaker_window;
+    breaker_settings.error_percent = server_config.nlp_breaker_error_percent;
+    breaker_settings.latency_limit = chrono::milliseconds(server_config.nlp_breaker_latency_ms);
+    breaker_settings.cooldown = chrono::milliseconds(server_config.nlp_breaker_cooldown_ms);
+    nlp_breaker.configure(breaker_settings);
+    if (server_config.intent_model != "") {
+        if (!intent_model.load(server_config.intent_model)) {
+            return 1;
+        }
+        cout << "Interpreting natural language requests with " << server_config.intent_model << endl;
+    }
+
+    // A standby follows its primary's commits and opens no port until it takes over
+    if (server_config.replicate_from != "") {
+        Standby::Outcome outcome = Standby::follow(server_config.replicate_from);
+        if (outcome == Standby::Outcome::FAILED) {
+            return 1;
+        }
+        if (outcome == Standby::Outcome::STOPPED) {
+            DatabaseHandler::shared().checkpoint();
+            cout << "Standby stopped" << endl;
+            return 0;
+        }
+    }
+
+    // Initialize libcurl once, before any thread can make an NLP request
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
     // Initialize OpenSSL library
     SSL_library_init();
     SSL_load_error_strings();
 
     // Create a new SSL context
     SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_server_method());
+    // A coroutine session retries a write from its pending output, which a later reply of
+    // the same step may have appended to and so moved
+    SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     // Load the server's certificate and private key
-    SSL_CTX_use_certificate_file(ssl_ctx, "server.crt", SSL_FILETYPE_PEM);
-    SSL_CTX_use_PrivateKey_file(ssl_ctx, "server.key", SSL_FILETYPE_PEM);
+    if (SSL_CTX_use_certificate_file(ssl_ctx, server_config.cert_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ssl_ctx, server_config.key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
+        cerr << "Could not load certificate or key: " << ERR_error_string(ERR_get_error(), NULL) << endl;
+        SSL_CTX_free(ssl_ctx);
+        return 1;
+    }
     
-    // Create a socket for the server to use
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    // One listening socket per acceptor; several acceptors share the port through SO_REUSEPORT.
+    // During a hot restart the sockets come from the running server instead.
+    int acceptors = server_config.acceptor_threads;
+    if (acceptors == 0) {
+        acceptors = max(1u, thread::hardware_concurrency());
+    }
+    vector<int> server_sockets = Lifecycle::inheritListeners(server_config.handoff_socket);
+    if (!server_sockets.empty()) {
+        acceptors = server_sockets.size();
+    }
+    while ((int) server_sockets.size() < acceptors) {
+        int server_socket = Listener::openSocket(server_config.port, server_config.backlog,
+                                                 server_config.reuse_port || acceptors > 1);
+        if (server_socket < 0) {
+            for (int open_socket : server_sockets) {
+                close(open_socket);
+            }
+            SSL_CTX_free(ssl_ctx);
+            return 1;
+        }
+        server_sockets.push_back(server_socket);
+    }
+
+    // Route SIGTERM/SIGINT to a single thread and offer the sockets to the next server
+    Lifecycle::startSignalThread();
+    if (!Lifecycle::serveHandoff(server_config.handoff_socket, server_sockets)) {
+        SSL_CTX_free(ssl_ctx);
+        return 1;
+    }
+
+    // Start the wheel that enforces handshake and idle timeouts
+    session_timers.start();
+
+    // During a hot restart the old server commits until it has drained; load the accounts
+    // only once its last checkpoint is on disk
+    Lifecycle::waitForPredecessor();
+
+    // Load the accounts and start committing balance changes
+    transfer_engine.start(DatabaseHandler::shared(), server_config.transfer_threads, server_config.transfer_batch, &outbox);
+    // In a cluster, payouts to accounts on other nodes are delivered to those nodes
+    unique_ptr<SettlementGateway> gateway = SettlementGateway::create(server_config.settlement_gateway);
+    if (cluster.enabled()) {
+        gateway.reset(new ClusterSettlementGateway(cluster, move(gateway)));
+    }
+    outbox.start(DatabaseHandler::shared(), transfer_engine, move(gateway),
+                 server_config.settlement_batch, server_config.settlement_attempts,
+                 chrono::milliseconds(server_config.settlement_retry_ms));
+    if (!cluster.start(DatabaseHandler::shared(), transfer_engine)) {
+        return 1;
+    }
+    if (server_config.replication_socket != "") {
+        if (!replication.start(server_config.replication_socket, DatabaseHandler::shared(),
+                               server_config.replication_mode == "sync",
+                               chrono::milliseconds(server_config.replication_timeout_ms))) {
+            return 1;
+        }
+        Metrics::addSection("replication", []() { return replication.status(); });
+    }
 
-    // Create a struct for the server address to bind to
-    struct sockaddr_in server_address;
-    memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(PORT);
-    server_address.sin_addr.s_addr = INADDR_ANY;
+    // Expose counters and the effective configuration
+    Metrics::addSection("nlp", []() { return Request::status(); });
+    Metrics::addSection("config", []() { return server_config.describe(); });
+    Metrics::addPage("/report", [](const string& query) {
+        BalanceReport::Options options;
+        options.threads = server_config.report_threads;
+        if (!BalanceReport::parseQuery(query, options)) {
+            return string("Usage: /report?above=<dollars>&below=<dollars>&limit=<accounts>\n");
+        }
+        DatabaseHandler& database = DatabaseHandler::shared();
+        BalanceReport report = BalanceReport::run(database.getBalances(), options);
+        vector<string> above_names, below_names;
+        for (uint32_t id : report.above_ids) {
+            above_names.push_back(database.usernameOf(id));
+        }
+        for (uint32_t id : report.below_ids) {
+            below_names.push_back(database.usernameOf(id));
+        }
+        return report.describe(above_names, below_names);
+    });
+    if (server_config.metrics_port != 0 && !Metrics::serve(server_config.metrics_port)) {
+        return 1;
+    }
 
-    // Bind the socket to the server address
-    bind(server_socket, (struct sockaddr*) &server_address, sizeof(server_address));
+    cout << "Listening on port " << server_config.port << " with " << acceptors << " acceptor(s)" << endl;
 
-    // Listen for incoming client requests
-    listen(server_socket, 5);
+    // Each session gets its own thread, or with session_mode = coroutines is spread
+    // round-robin across the event loops
+    vector<unique_ptr<EventLoop>> loops;
+    Listener::Handler start_session = [](int client_socket, SSL* ssl) {
+        thread(handle_session, client_socket, ssl).detach();
+    };
+    if (server_config.session_mode == "coroutines") {
+        int loop_count = server_config.event_loops;
+        if (loop_count == 0) {
+            loop_count = max(1u, thread::hardware_concurrency());
+        }
+        for (int i = 0; i < loop_count; ++i) {
+            loops.emplace_back(new EventLoop());
+            loops.back()->start(i, server_config.pin_acceptors && loop_count > 1);
+        }
+        blocking_pool.start(server_config.blocking_threads);
+        start_session = [&loops](int client_socket, SSL* ssl) {
+            static atomic<size_t> next_loop(0);
+            EventLoop* loop = loops[next_loop++ % loops.size()].get();
+            loop->spawn(serve_session(client_socket, ssl, loop));
+        };
+        cout << "Running sessions as coroutines on " << loop_count << " event loop(s)" << endl;
+    }
 
-    cout << "Listening on port " << PORT << endl;
+    // Accept clients on every listener, each on its own thread, until they stop
+    vector<unique_ptr<Listener>> listeners;
+    for (int i = 0; i < acceptors; ++i) {
+        listeners.emplace_back(new Listener(i, server_sockets[i], ssl_ctx, start_session));
+        listeners.back()->start(server_config.pin_acceptors && acceptors > 1);
+    }
 
-    // Continuously accept incoming client requests and handle sessions in separate threads
-    while (true) {
-        // Accept a new client connection and create a new SSL object
-        int client_socket = accept(server_socket, nullptr, nullptr);
-        SSL* ssl = SSL_new(ssl_ctx);
-        SSL_set_fd(ssl, client_socket);
+    // Run until a signal arrives or a new server has taken the listening sockets
+    string reason = Lifecycle::waitForShutdown();
+    cout << "Shutting down: " << reason << endl;
+
+    // Stop accepting; the sockets themselves stay open until they are closed below
+    for (auto& listener : listeners) {
+        listener->stop();
+    }
+    listeners.clear();
+    for (int server_socket : server_sockets) {
+        close(server_socket);
+    }
+
+    // Close idle sessions now and give in-flight transactions time to finish
+    Lifecycle::beginDrain();
+    if (!Lifecycle::waitForSessions(chrono::milliseconds(server_config.drain_timeout_ms))) {
+        cout << "Drain timeout reached, closing remaining sessions" << endl;
+        Lifecycle::closeAllSessions();
+        Lifecycle::waitForSessions(chrono::milliseconds(server_config.handshake_timeout_ms));
+    }
 
-        // Create a new thread to handle the session
-        thread t(handle_session, client_socket, ssl);
-        // Detach the thread
-        t.detach();
+    // Commit the last balance changes and finish the last NLP requests while the loops can
+    // still resume the sessions waiting for them; later calls complete at once
+    cluster.stop();
+    outbox.stop();
+    transfer_engine.stop();
+    blocking_pool.stop();
+    // A loop is destroyed only once no session is left to run on it
+    if (Lifecycle::waitForSessions(chrono::milliseconds(server_config.handshake_timeout_ms))) {
+        loops.clear();
+    } else {
+        cout << "Sessions still open, leaving their event loops in place" << endl;
+        for (auto& loop : loops) {
+            loop->stop();
+            loop->join();
+            loop.release();
+        }
     }
 
-    // Clean up the SSL context and close the server socket
+    // The standby receives every last batch before it sees the primary go and takes over;
+    // then the journal is folded into the users file and the SSL context cleaned up
+    replication.stop();
+    DatabaseHandler::shared().checkpoint();
+    // A server that took the listening sockets may now load the database
+    Lifecycle::releaseDatabase();
+    session_timers.stop();
     SSL_CTX_free(ssl_ctx);
-    close(server_socket);
+    cout << "Server stopped" << endl;
     return 0;
 }
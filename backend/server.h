@@ -13,7 +13,24 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "request.h"
 #include "session.h"
+#include "config.h"
+#include "metrics.h"
+#include "listener.h"
+#include "lifecycle.h"
+#include "eventLoop.h"
+#include "task.h"
+#include "outbox.h"
+#include "cluster.h"
+#include "replication.h"
+#include "circuitBreaker.h"
+#include "intentModel.h"
+#include "balanceReport.h"
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 #endif
@@ -7,6 +7,8 @@
  */
 
 #include "session.h"
+#include <sys/epoll.h>
+#include <climits>
 
 using namespace std;
 
@@ -15,532 +17,1144 @@ using namespace std;
  * 
  * @param socket The socket to communicate with the client.
  * @param new_ssl The SSL object to use for encryption.
+ * @param loop The event loop running the session, or nullptr if it has its own thread.
  */
-Session::Session(int socket, SSL* new_ssl) : m_socket(socket), ssl(new_ssl) {}
+Session::Session(int socket, SSL* new_ssl, EventLoop* loop)
+    : m_socket(socket), ssl(new_ssl), loop(loop), retry_length(0), nlp(false), user(nullptr), state(SessionState::LOGIN), timed_out(false),
+      interruptible(false), dbHandler(DatabaseHandler::shared()), step_arena(step_memory, sizeof(step_memory)) {
+    // Shutting the socket down wakes the blocked SSL_read, which then reports an exit
+    idle_timer.callback = [this]() {
+        timed_out = true;
+        shutdown(m_socket, SHUT_RDWR);
+    };
+    Lifecycle::sessionStarted(this);
+}
+
+/**
+ * @brief Destructor for a Session object
+ * Cancels the idle timer so it can never fire on a socket that has been closed and reused.
+ */
+Session::~Session() {
+    session_timers.cancel(idle_timer);
+    Lifecycle::sessionEnded(this);
+}
+
+
+// Input handler for each dialog state, indexed by DialogState
+const Session::InputHandler Session::INPUT_HANDLERS[] = {
+    &Session::on_welcome,
+    &Session::on_login_username,
+    &Session::on_login_password,
+    &Session::on_create_username,
+    &Session::on_create_password,
+    &Session::on_nlp_choice,
+    &Session::on_menu,
+    &Session::on_amount,
+    &Session::on_amount_retry,
+    &Session::on_transfer_target,
+    &Session::on_transfer_recipient,
+    &Session::on_confirm,
+    &Session::on_leave_nlp,
+    &Session::on_history_search,
+    &Session::on_export_format,
+    &Session::on_waiting,
+    &Session::on_waiting,
+    &Session::on_waiting,
+    &Session::on_waiting,
+    &Session::on_closed
+};
 
+/**
+ * @struct ActionText
+ * @brief Per-action text: the name used by the NLP model and the prompts around it.
+ */
+struct ActionText {
+    string_view name;
+    string_view amount_prompt;
+    string_view cancelled;
+};
+
+// Text for each action, indexed by Action
+static const ActionText ACTION_TEXT[] = {
+    {"", "", ""},
+    {"balance", "", ""},
+    {"deposit", "How much would you like to deposit?", "Deposit cancelled."},
+    {"withdraw", "How much would you like to withdraw?", "Withdrawal cancelled."},
+    {"transfer", "How much would you like to transfer?", "Transfer cancelled."},
+    {"history", "", ""},
+    {"backwards", "", ""},
+    {"options", "", ""},
+    {"logout", "", ""},
+    {"", "", ""},
+    {"", "", ""},
+    {"", "", ""}
+};
+
+/**
+ * @brief Returns the text for an action.
+ * @param action The action
+ * @return The action's name and prompts
+ */
+static const ActionText& text_for(Session::Action action) {
+    return ACTION_TEXT[static_cast<size_t>(action)];
+}
 
 /**
  * @brief Starts a new session for a client connecting to the server
- * Loops until the client disconnects or logs out, handling requests as sent by client.
+ * Feeds each message from the client to the dialog until the client disconnects or logs out.
+ * The dialog itself never blocks, so this loop is the only place the session waits on the
+ * client or the NLP server.
  */
 void Session::start_session() {
 
     cout << "Starting new session..." << endl;
+    begin();
+    while (!finished()) {
+        if (dialog.state == DialogState::INTERPRETING) {
+            Request req(dialog.value, &step_arena);
+            bool success = req.execute();
+            on_interpreted(success, success ? req.result() : string_view());
+        } else if (dialog.state == DialogState::PREPARING) {
+            on_prepared(cluster.prepare(dialog.recipient_node, dialog.recipient, dialog.amount));
+        } else if (dialog.state == DialogState::COMMITTING) {
+            on_committed(transfer_engine.submitAndWait(dialog.transfer));
+        } else if (dialog.state == DialogState::EXPORTING) {
+            continue_export();
+        } else {
+            on_event(receive_message());
+        }
+        // Nothing the step allocated from the arena is still in use
+        step_arena.release();
+    }
+    // Remove user from active_sessions map
+    disconnect();
+}
+
+/**
+ * @brief Coroutine version of start_session for sessions running on an EventLoop.
+ * Suspends instead of blocking while waiting on the client or the NLP server, so the
+ * loop's thread is free to run other sessions in the meantime.
+ */
+Task<void> Session::run_session() {
+
+    cout << "Starting new session..." << endl;
+    begin();
+    while (co_await send_message_async() && !finished()) {
+        if (dialog.state == DialogState::INTERPRETING) {
+            Request req(dialog.value, &step_arena);
+            bool success = co_await req.executeAsync();
+            on_interpreted(success, success ? req.result() : string_view());
+        } else if (dialog.state == DialogState::PREPARING) {
+            // The recipient's node is asked from the blocking pool, so the loop keeps running
+            on_prepared(co_await blocking_pool.run<Cluster::Vote>([this]() {
+                return cluster.prepare(dialog.recipient_node, dialog.recipient, dialog.amount);
+            }));
+        } else if (dialog.state == DialogState::COMMITTING) {
+            on_committed(co_await transfer_engine.submitAsync(dialog.transfer));
+        } else if (dialog.state == DialogState::EXPORTING) {
+            // The previous chunk has been sent; let the loop's other sessions run before the next
+            co_await loop->yield();
+            continue_export();
+        } else {
+            on_event(co_await receive_message_async());
+        }
+        // Nothing the step allocated from the arena is still in use
+        step_arena.release();
+    }
+    // Remove user from active_sessions map
+    disconnect();
+}
+
+/**
+ * @brief Sends the welcome message and waits for the client to log in or create an account.
+ */
+void Session::begin() {
     // Send welcome message to client and ask if they have an existing account
     send_message("Welcome to NLP banking!\n1. Login to existing account\n2. Create Account");
-    string response = receive_message();
-    if(response == "exit"){
-        disconnect();
-        return;
+    dialog.state = DialogState::WELCOME;
+}
+
+/**
+ * @brief Advances the dialog by one message from the client.
+ * Runs the handler for the current state, which replies and moves to the next state.
+ * An "exit" message (disconnect, timeout or drain) or a failed send ends the session.
+ *
+ * @param input The message received from the client.
+ * @return true if the session expects another message, false once it has ended.
+ */
+bool Session::on_event(string_view input) {
+    static_assert(sizeof(INPUT_HANDLERS) / sizeof(INPUT_HANDLERS[0]) == static_cast<size_t>(DialogState::COUNT),
+                  "one input handler per dialog state");
+    if (input == "exit") {
+        close_dialog();
+        return false;
+    }
+    try {
+        (this->*INPUT_HANDLERS[static_cast<size_t>(dialog.state)])(input);
+        finish_step();
     }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        close_dialog();
+    }
+    return !finished();
+}
+
+/**
+ * @brief Advances the dialog with the NLP server's interpretation of the last request.
+ *
+ * @param success Whether the NLP request succeeded.
+ * @param response The model's reply.
+ * @return true if the session expects another message, false once it has ended.
+ */
+bool Session::on_interpreted(bool success, string_view response) {
+    try {
+        on_interpretation(success, response);
+        finish_step();
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        close_dialog();
+    }
+    return !finished();
+}
+
+/**
+ * @brief Advances the dialog with the recipient node's vote on a transfer to another node.
+ *
+ * @param vote The vote.
+ * @return true if the session expects another message, false once it has ended.
+ */
+bool Session::on_prepared(Cluster::Vote vote) {
+    try {
+        on_prepare(vote);
+        finish_step();
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        close_dialog();
+    }
+    return !finished();
+}
+
+/**
+ * @brief Advances the dialog with the outcome of the balance change it submitted.
+ *
+ * @param result The outcome, once it is durable.
+ * @return true if the session expects another message, false once it has ended.
+ */
+bool Session::on_committed(const TransferEngine::Result& result) {
+    try {
+        on_commit(result);
+        finish_step();
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        close_dialog();
+    }
+    return !finished();
+}
+
+/**
+ * @brief Sends the next chunk of the statement being exported.
+ *
+ * @return true if the session expects another message or chunk, false once it has ended.
+ */
+bool Session::continue_export() {
+    try {
+        send_statement_chunk();
+        finish_step();
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        close_dialog();
+    }
+    return !finished();
+}
+
+/**
+ * @brief Ends a step of the dialog. Logs the user out between requests once the server is draining.
+ */
+void Session::finish_step() {
+    if (dialog.state == DialogState::MENU && Lifecycle::draining()) {
+        send_message("105");
+        close_dialog();
+    }
+}
+
+/**
+ * @brief Whether the dialog has ended.
+ *
+ * @return true once the client has logged out, failed to log in or disconnected.
+ */
+bool Session::finished() const {
+    return dialog.state == DialogState::CLOSED;
+}
+
+/**
+ * @brief Ends the dialog. The connection itself is released by disconnect().
+ */
+void Session::close_dialog() {
+    dialog.state = DialogState::CLOSED;
+}
+
+/**
+ * @brief Handles the choice between logging in and creating an account.
+ *
+ * @param input "1" to log in, "2" to create an account.
+ */
+void Session::on_welcome(string_view input) {
     // Call login function if user has an existing account
-    if(response == "1"){
-        bool success = login();
-        if(!success){
-            disconnect();
-            return;
-        }
+    if (input == "1") {
+        send_message("Username:");
+        dialog.state = DialogState::LOGIN_USERNAME;
     }
     // Call create account function if user does not have an existing account
-    else if(response == "2"){
-        bool success = createAccount();
-        if(!success){
-            disconnect();
-            return;
-        }
-    }else{
+    else if (input == "2") {
+        send_message("Please create a username: ");
+        dialog.state = DialogState::CREATE_USERNAME;
+    } else {
+        close_dialog();
+    }
+}
+
+/**
+ * @brief Sends the client to the node that owns an account, if it is not this one.
+ * Only the owner logs an account in, so its login registry holds every session for it.
+ *
+ * @param username The account the client asked for.
+ * @return true if the client was redirected and the dialog has ended.
+ */
+bool Session::redirect(string_view username) {
+    static atomic<int64_t>& sessions_redirected = Metrics::counter("sessions_redirected");
+    if (cluster.isLocal(username)) {
+        return false;
+    }
+    ++sessions_redirected;
+    const Cluster::Node& owner = cluster.node(cluster.ownerOf(username));
+    send_message(reply.begin() << "107 " << owner.host << ":" << to_string(owner.client_port));
+    close_dialog();
+    return true;
+}
+
+/**
+ * @brief Login step for existing users: checks the username exists.
+ * Asks again until an existing username is given. An account on another node is
+ * redirected there.
+ *
+ * @param input The username.
+ */
+void Session::on_login_username(string_view input) {
+    if (redirect(input)) {
         return;
     }
+    // checks if username exists
+    if (dbHandler.getRecipient(input) != nullptr) {
+        dialog.username = input;
+        dialog.tries = 0;
+        send_message("Password:");
+        dialog.state = DialogState::LOGIN_PASSWORD;
+    } else {
+        cout << "User attempted to login with invalid username " << input << endl;
+        send_message("Invalid username, please try again.\nUsername: ");
+    }
+}
 
-    // Loop until user exits session
-    while (true) {
-        // Requests messages from users and processes them until exit message is received.
-        string request = receive_message();
-        if(request == "exit"){
-            disconnect();
-            return;
-        }
-        try {
-            process_request(request);
+/**
+ * @brief Login step for existing users: checks the password.
+ * Gives 3 attempts for successful login before disconnecting, and refuses a user
+ * who is already logged in elsewhere.
+ *
+ * @param input The password.
+ */
+void Session::on_login_password(string_view input) {
+    // Hashes password and checks if the user exists in the database
+    string new_password = get_hash(input);
+    User* newUser = dbHandler.getUser(dialog.username, new_password);
+    if (newUser == nullptr) {
+        cout << "User " << dialog.username << " failed to logged in " << "with password: " << input << endl;
+        // Handle case when user exceeds login attempts
+        if (++dialog.tries >= 3) {
+            send_message("106");
+            close_dialog();
+        } else {
+            send_message("Incorrect password, please try again.\nPassword:");
         }
-        catch (const exception& e) {
-            cerr << "Error: " << e.what() << endl;
-            break;
+        return;
+    }
+    {
+        // Checks if user is already logged in with mutex lock
+        lock_guard<mutex> guard(active_sessions_mutex);
+        auto it = active_sessions.find(newUser->getId());
+        if (it != active_sessions.end() && it->second) {
+            send_message("101");
+            close_dialog();
+            return;
         }
+        active_sessions[newUser->getId()] = this;
+        user = newUser;
+        state = SessionState::AUTHENTICATED;
     }
-    // Remove user from active_sessions map
-    
-    lock_guard<mutex> guard(active_sessions_mutex);
-    active_sessions.erase(user->getUsername());
-    
+    cout << "User " << newUser->getUsername() << " successfully logged in " << "with password: " << newUser->getPassword() << endl;
+    ask_nlp_choice();
 }
 
 /**
- * @brief Login method for existing users
- * Asks client for username and password, checks if user exists in database and if password is correct.
- * Gives 3 attempts for successful login before disconnecting.
- * @return true if login is successful, false otherwise.
+ * @brief Account creation step: checks the username is not taken. An account that
+ * belongs on another node is created there.
+ *
+ * @param input The new username.
  */
-bool Session::login(){
-    bool success = false;
-    string username = "";
-    int tries = 0;
-    send_message("Username:");
-    // Loop for up to 3 login attempts
-    while(strcmp(username.c_str(), "") == 0){
-        string received = receive_message();
-        if(received == "exit"){
-            disconnect();
-            return false;
-        }
-        // checks if username exists
-        if(dbHandler.getRecipient(received) != nullptr){
-            username = received;
-        }else {
-            cout << "User attempted to login with invalid username " << username << endl;
-            send_message("Invalid username, please try again.\nUsername: ");
-        }
+void Session::on_create_username(string_view input) {
+    if (redirect(input)) {
+        return;
     }
-    // Asks for password, gives 3 attempts for success
-    while (!success && tries < 3) {
-        if(tries == 0){
-            send_message("Password:");
-        }else{
-            send_message("Incorrect password, please try again.\nPassword:");
-        }
-        string password = receive_message();
-        if(password == "exit"){
-            disconnect();
-            return false;
+    if (dbHandler.getRecipient(input) != nullptr) {
+        send_message("104");
+        cout << "User failed to create account (existing username: " << input << ")" << endl;
+        close_dialog();
+        return;
+    }
+    dialog.username = input;
+    send_message("Please enter a password:");
+    dialog.state = DialogState::CREATE_PASSWORD;
+}
+
+/**
+ * @brief Account creation step: hashes the password and stores the new user in the database.
+ *
+ * @param input The new password.
+ */
+void Session::on_create_password(string_view input) {
+    string new_password = get_hash(input);
+    user = dbHandler.addUser(dialog.username, new_password, 0);
+    // Another session created the same username first
+    if (user == nullptr) {
+        send_message("104");
+        cout << "User failed to create account (existing username: " << dialog.username << ")" << endl;
+        close_dialog();
+        return;
+    }
+    state = SessionState::AUTHENTICATED;
+    cout << "User " << user->getUsername() << " successfully created account " << "with password: " << user->getPassword() << endl;
+    ask_nlp_choice();
+}
+
+/**
+ * @brief Asks a newly logged in user whether they want natural language prompts.
+ */
+void Session::ask_nlp_choice() {
+    send_message(Messages::LOGGED_IN);
+    dialog.state = DialogState::NLP_CHOICE;
+}
+
+/**
+ * @brief Sets the NLP flag and sends the welcome message.
+ *
+ * @param input "y" for natural language prompts.
+ */
+void Session::on_nlp_choice(string_view input) {
+    nlp = input == "y";
+    if (nlp) {
+        send_message(reply.begin() << "Welcome " << dialog.username << "!\n" << Messages::WHAT_TODAY);
+    } else {
+        send_message(reply.begin() << "Welcome " << dialog.username << "!\n" << Messages::WHAT_TODAY << Messages::OPTIONS);
+    }
+    dialog.state = DialogState::MENU;
+}
+
+/**
+ * @brief Processes a request received from the client at the menu.
+ * In NLP mode the request is interpreted by the NLP server; otherwise it is a menu option.
+ *
+ * @param input The request to process.
+ */
+void Session::on_menu(string_view input) {
+    // "export <format> [first entry]" starts or resumes an export in either mode
+    if (input.rfind("export ", 0) == 0) {
+        start_export(input.substr(7));
+        return;
+    }
+    // If NLP is enabled, the request is sent to the NLP server by whoever runs the session
+    if (nlp) {
+        dialog.value = input;
+        dialog.state = DialogState::INTERPRETING;
+        return;
+    }
+    // Menu options 1-9, in the order they are listed in Messages::OPTIONS
+    static const Action MENU_ACTIONS[] = {Action::BALANCE, Action::DEPOSIT, Action::WITHDRAW, Action::TRANSFER,
+                                          Action::HISTORY, Action::BACKWARDS, Action::LOGOUT, Action::SEARCH, Action::EXPORT};
+    unsigned option = input.empty() ? UINT_MAX : static_cast<unsigned char>(input[0]) - '1';
+    if (option >= sizeof(MENU_ACTIONS) / sizeof(MENU_ACTIONS[0])) {
+        send_message("Invalid option, please try again.");
+        return;
+    }
+    Action action = MENU_ACTIONS[option];
+    // Amounts are asked for before the action starts
+    if (text_for(action).amount_prompt != "") {
+        send_message(text_for(action).amount_prompt);
+        dialog.action = action;
+        dialog.state = DialogState::AMOUNT;
+        return;
+    }
+    begin_action(action, "");
+}
+
+/**
+ * @brief Handles the NLP server's interpretation of a request, "(action,value)".
+ * A history request is answered with the entries matching any conditions in the request
+ * itself, such as "transfers to bob last month". If the NLP request failed, timed out or was refused by the open circuit breaker, the
+ * session falls back to the numbered menu, so the client always gets a reply.
+ *
+ * @param success Whether the NLP request succeeded.
+ * @param response The model's reply.
+ */
+void Session::on_interpretation(bool success, string_view response) {
+    static atomic<int64_t>& nlp_fallbacks = Metrics::counter("nlp_fallbacks");
+    dialog.state = DialogState::MENU;
+    if (!success) {
+        ++nlp_fallbacks;
+        nlp = false;
+        send_message(reply.begin() << Messages::NLP_UNAVAILABLE << Messages::WHAT_ELSE << Messages::OPTIONS);
+        return;
+    }
+    // Views into the reply, which lasts until the step ends
+    string_view name = response.substr(1, response.find(",") - 1);
+    string_view value = response.substr(response.find(",") + 1, response.size() - response.find(",") - 2);
+    Action action = Action::UNKNOWN;
+    for (size_t i = 0; i < sizeof(ACTION_TEXT) / sizeof(ACTION_TEXT[0]); ++i) {
+        if (ACTION_TEXT[i].name != "" && ACTION_TEXT[i].name == name) {
+            action = static_cast<Action>(i);
+            break;
         }
-        // Hashes password and checks if the user exists in the database
-        string new_password = get_hash(password);
-        User* newUser = dbHandler.getUser(username, new_password);
-        if (newUser != nullptr) {
-            // Checks if user is already logged in with mutex lock
-            lock_guard<mutex> guard(active_sessions_mutex);
-            
-            auto it = active_sessions.find(username);
-            
-            if (it != active_sessions.end() && it->second) {
-                send_message("101");
-                return false;
-            }
-            active_sessions[username] = this;
+    }
+    if (action == Action::HISTORY) {
+        // dialog.value still holds the request
+        send_history(HistoryFilter::parse(dialog.value, time(nullptr)));
+        return;
+    }
+    begin_action(action, value);
+}
 
-            cout << "User " << newUser->getUsername() << " successfully logged in " << "with password: " << newUser->getPassword() << endl;
+/**
+ * @brief Handles an amount typed in answer to a menu option's amount prompt.
+ *
+ * @param input The amount.
+ */
+void Session::on_amount(string_view input) {
+    begin_action(dialog.action, removeCharacters(input));
+}
 
-            // Ask if user wants to use natural language prompts
-            send_message("Successfully logged in!\nWould you like to use natural language prompts today? (y/n)");
-            string response = receive_message();
-            if(response == "exit"){
-                disconnect();
-                return false;
+/**
+ * @brief Starts a banking action. Actions that need more input send the next prompt
+ * and move to the state that waits for it; the rest reply and return to the menu.
+ *
+ * @param action The action to perform.
+ * @param value The amount given with the action, if any.
+ */
+void Session::begin_action(Action action, string_view value) {
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    dialog.action = action;
+    dialog.value = value;
+    dialog.state = DialogState::MENU;
+
+    switch (action) {
+        case Action::DEPOSIT:
+        case Action::WITHDRAW:
+            try {
+                dialog.amount = stod(dialog.value);
+            } catch (const exception& e) {
+                send_message(reply.begin() << Messages::INVALID_VALUE << Messages::OPTIONS);
+                return;
+            }
+            // The NLP model gives a negative amount when the request did not include one
+            if (dialog.amount < 0) {
+                send_message(text_for(action).amount_prompt);
+                dialog.state = DialogState::AMOUNT_RETRY;
+                return;
             }
-            if(response == "y"){
+            ask_confirmation();
+            break;
+        case Action::TRANSFER:
+            // Ask the user who they want to transfer funds to
+            send_message(Messages::TRANSFER_TARGET);
+            dialog.state = DialogState::TRANSFER_TARGET;
+            break;
+        case Action::BALANCE:
+            // If the user requests their balance, inform them and ask for further requests
+            // (read from a snapshot, so transfers from other sessions never hold it up)
+            send_message(reply.begin() << "Your balance is: " << Amount{user->snapshot().balance} << Messages::WHAT_ELSE << options);
+            break;
+        case Action::HISTORY:
+            // If the user requests their transaction history, send transaction log.
+            send_history(HistoryLog::Query());
+            break;
+        case Action::SEARCH:
+            send_message(Messages::HISTORY_SEARCH);
+            dialog.state = DialogState::HISTORY_SEARCH;
+            break;
+        case Action::EXPORT:
+            send_message(Messages::EXPORT_FORMAT);
+            dialog.state = DialogState::EXPORT_FORMAT;
+            break;
+        case Action::BACKWARDS:
+            if (nlp) {
+                send_message("Are you sure you would like to switch to regular prompts? (y/n)");
+                dialog.state = DialogState::LEAVE_NLP;
+            } else {
                 nlp = true;
-                send_message("Welcome " + username + "!\nWhat would you like to do today?");
-            }else{
-                nlp = false;
-                send_message("Welcome " + username + "!\nWhat would you like to do today?" + OPTIONS_MESSAGE);
+                send_message("What can I help you with today?");
+            }
+            break;
+        case Action::OPTIONS:
+            send_message("You can withdraw, deposit, transfer, check your balance, change back to normal inputs, or view your transaction history.\nWhat would you like to do today?");
+            break;
+        case Action::LOGOUT:
+            // Send logout code to client.
+            send_message("105");
+            close_dialog();
+            break;
+        default:
+            if (nlp) {
+                send_message("Sorry I didn't get that. Please try again.\nWhat can I help you with?");
+            } else {
+                send_message(reply.begin() << "Invalid action." << Messages::WHAT_ELSE << Messages::OPTIONS);
             }
-            // Send welcome message and set class user object
-            user = newUser;
-            success = true;
+            break;
+    }
+}
 
-        } else {
-            cout << "User " << username << " failed to logged in " << "with password: " << password << endl;
-            ++tries;
-        }
+/**
+ * @brief Handles the amount asked for when the NLP request did not include one.
+ *
+ * @param input The amount.
+ */
+void Session::on_amount_retry(string_view input) {
+    dialog.value = removeCharacters(input);
+    dialog.state = DialogState::MENU;
+    try {
+        dialog.amount = stod(dialog.value);
+    } catch (const exception& e) {
+        send_message(reply.begin() << Messages::INVALID_VALUE << Messages::OPTIONS);
+        return;
     }
-    // Handle case when user exceeds login attempts
-    if (!success) {
-        send_message("106");
-        return false;
+    ask_confirmation();
+}
+
+/**
+ * @brief Handles the choice between an existing and an external transfer recipient.
+ *
+ * @param input "1" for an existing user, "2" for an external user by email.
+ */
+void Session::on_transfer_target(string_view input) {
+    dialog.choice = input == "1" || input == "2" ? input[0] : 0;
+    if (dialog.choice == '1') {
+        // If the user wants to transfer to an existing user, ask for the recipient's username
+        send_message("Please enter the recipient's username:");
+    } else if (dialog.choice == '2') {
+        send_message("Please enter the recipient's email:");
+    } else {
+        send_message(reply.begin() << "Transfer cancelled." << Messages::WHAT_ELSE << (nlp ? string_view() : Messages::OPTIONS));
+        dialog.state = DialogState::MENU;
+        return;
     }
-    return true;
+    dialog.state = DialogState::TRANSFER_RECIPIENT;
 }
 
 /**
- * @brief Create account method for new users
- * Asks client for username and password, checks if username is existing.
- * Hashes password and stores new user in database.
- * @return true if acccount creation is successful, false otherwise.
+ * @brief Handles the transfer recipient and checks they can receive the transfer.
+ *
+ * @param input The recipient's username or email.
  */
-bool Session::createAccount(){
-    send_message("Please create a username: ");
-    string username = receive_message();
-    if(username == "exit"){
-        disconnect();
-        return false;
+void Session::on_transfer_recipient(string_view input) {
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    dialog.recipient = input;
+    dialog.state = DialogState::MENU;
+    // Check if the recipient exists in the database; the node owning a recipient on
+    // another node is asked once the transfer is confirmed
+    dialog.recipient_user = dbHandler.getRecipient(input);
+    dialog.recipient_node = dialog.choice == '1' && !cluster.isLocal(input) ? cluster.ownerOf(input) : -1;
+    if (dialog.recipient_user == nullptr && dialog.choice == '1' && dialog.recipient_node < 0) {
+        // If the recipient does not exist, inform the user and ask for further requests
+        send_message(reply.begin() << "Recipient does not exist." << Messages::WHAT_ELSE << options);
+        return;
     }
-    if(dbHandler.getRecipient(username) != nullptr){
-        send_message("104");
-        cout << "User failed to create account (existing username: " << username << ")" << endl;
-        return false;
+    if (input == user->getUsername()) {
+        send_message(reply.begin() << "You cannot transfer to yourself." << Messages::WHAT_ELSE << options);
+        return;
     }
-    send_message("Please enter a password:");
-    string password = receive_message();
-    if(password == "exit"){
-        disconnect();
-        return false;
+    try {
+        dialog.amount = stod(dialog.value);
+    } catch (const exception& e) {
+        send_message(reply.begin() << Messages::INVALID_VALUE << Messages::OPTIONS);
+        return;
     }
-    string new_password = get_hash(password);
-    user = dbHandler.addUser(username, new_password, 0);
-    cout << "User " << user->getUsername() << " successfully created account " << "with password: " << user->getPassword() << endl;
-    // Ask if user wants to use natural language prompts
-    send_message("Successfully logged in!\nWould you like to use natural language prompts today? (y/n)");
-    string response = receive_message();
-    if(response == "exit"){
-        disconnect();
-        return false;
+    if (dialog.amount < 0) {
+        send_message(reply.begin() << "How much would you like to transfer to " << dialog.recipient << "?");
+        dialog.state = DialogState::AMOUNT_RETRY;
+        return;
     }
-    // Sets NLP flag and sends welcome message
-    if(response == "y"){
-        nlp = true;
-        send_message("Welcome " + username + "!\nWhat would you like to do today?");
-    }else{
+    ask_confirmation();
+}
+
+/**
+ * @brief Asks the user to confirm the pending deposit, withdrawal or transfer.
+ */
+void Session::ask_confirmation() {
+    reply.begin() << "Are you sure you want to " << text_for(dialog.action).name << " " << dialog.value;
+    if (dialog.action == Action::TRANSFER) {
+        reply << " to " << dialog.recipient;
+    }
+    send_message(reply << "? (y/n)");
+    dialog.state = DialogState::CONFIRM;
+}
+
+/**
+ * @brief Submits the pending transaction to the TransferEngine if the user confirms it.
+ * The session waits in COMMITTING until the change is applied and durable, after waiting in
+ * PREPARING for the vote of the node owning a recipient on another node.
+ *
+ * @param input "y" or "yes" to confirm.
+ */
+void Session::on_confirm(string_view input) {
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    dialog.state = DialogState::MENU;
+    if (input != "y" && input != "yes") {
+        // If the user cancels, inform them and ask for further requests
+        // (a cancelled deposit has never listed the menu options)
+        send_message(reply.begin() << text_for(dialog.action).cancelled << Messages::WHAT_ELSE
+                     << (dialog.action == Action::DEPOSIT ? string_view() : options));
+        return;
+    }
+    // The change is applied by the transfer engine, which whoever runs the session waits on
+    dialog.transfer = TransferEngine::Transfer();
+    dialog.transfer.amount = dialog.amount;
+    switch (dialog.action) {
+        case Action::DEPOSIT:
+            dialog.transfer.kind = TransferEngine::Kind::DEPOSIT;
+            dialog.transfer.to = user;
+            break;
+        case Action::WITHDRAW:
+            dialog.transfer.kind = TransferEngine::Kind::WITHDRAW;
+            dialog.transfer.from = user;
+            break;
+        case Action::TRANSFER:
+            dialog.transfer.kind = TransferEngine::Kind::TRANSFER;
+            dialog.transfer.from = user;
+            dialog.transfer.to = dialog.recipient_user;
+            dialog.transfer.recipient = dialog.recipient;
+            // A recipient on another node is paid like an external one, once its node agrees
+            if (dialog.recipient_node >= 0) {
+                dialog.transfer.recipient = Cluster::recipientFor(dialog.recipient_node, dialog.recipient);
+                dialog.state = DialogState::PREPARING;
+                return;
+            }
+            break;
+        default:
+            return;
+    }
+    dialog.state = DialogState::COMMITTING;
+}
+
+/**
+ * @brief First phase of a transfer to another node: commits it once the recipient's node
+ * has voted yes, and otherwise cancels it.
+ *
+ * @param vote The recipient node's vote.
+ */
+void Session::on_prepare(Cluster::Vote vote) {
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    if (vote == Cluster::Vote::YES) {
+        dialog.state = DialogState::COMMITTING;
+        return;
+    }
+    dialog.state = DialogState::MENU;
+    if (vote == Cluster::Vote::NO) {
+        send_message(reply.begin() << "Recipient does not exist." << Messages::WHAT_ELSE << options);
+    } else {
+        send_message(reply.begin() << "Transfer to " << dialog.recipient << " failed. Please try again later." << Messages::WHAT_ELSE << options);
+    }
+}
+
+/**
+ * @brief Tells the user the outcome of a confirmed deposit, withdrawal or transfer.
+ *
+ * @param result The outcome and the user's new balance, once both are durable.
+ */
+void Session::on_commit(const TransferEngine::Result& result) {
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    dialog.state = DialogState::MENU;
+    if (!result.committed) {
+        send_message(reply.begin() << "Your request could not be completed. Please try again later." << Messages::WHAT_ELSE << options);
+        return;
+    }
+    switch (dialog.action) {
+        case Action::DEPOSIT:
+            send_message(reply.begin() << "Deposit successful. New balance: " << Amount{result.balance} << Messages::WHAT_ELSE << options);
+            break;
+        case Action::WITHDRAW:
+            if (result.success) {
+                send_message(reply.begin() << "Withdrawal successful. New balance: " << Amount{result.balance} << Messages::WHAT_ELSE << options);
+            } else {
+                send_message(reply.begin() << "Insufficient funds" << Messages::WHAT_ELSE << options);
+            }
+            break;
+        case Action::TRANSFER:
+            if (result.success) {
+                // If the transfer is successful, inform the user of their new balance
+                send_message(reply.begin() << "Transfer to " << dialog.recipient << " successful. New balance: " << Amount{result.balance} << Messages::WHAT_ELSE << options);
+            } else {
+                // If the transfer fails due to insufficient funds, inform the user and ask for further requests
+                send_message(reply.begin() << "Transfer to " << dialog.recipient << " failed. Insufficient funds!" << Messages::WHAT_ELSE << options);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Handles the confirmation to switch from NLP back to menu prompts.
+ *
+ * @param input "y" to switch.
+ */
+void Session::on_leave_nlp(string_view input) {
+    dialog.state = DialogState::MENU;
+    if (input == "y") {
         nlp = false;
-        send_message("Welcome " + username + "!\nWhat would you like to do today?" + OPTIONS_MESSAGE);
+        send_message(reply.begin() << Messages::WHAT_TODAY << Messages::OPTIONS);
+    } else {
+        send_message("What else can I help you with today?");
     }
-    return true;
+}
+
+/**
+ * @brief Handles the conditions typed at the history search prompt.
+ *
+ * @param input The conditions, e.g. "deposits over 500".
+ */
+void Session::on_history_search(string_view input) {
+    dialog.state = DialogState::MENU;
+    send_history(HistoryFilter::parse(string(input), time(nullptr)));
+}
+
+/**
+ * @brief Sends the transaction log entries matching a query, or the whole log for an
+ * empty query. Entries are found through the log's indexes and read from a snapshot, so
+ * neither waits for transfers in progress.
+ *
+ * @param query The conditions.
+ */
+void Session::send_history(const HistoryLog::Query& query) {
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    User::Snapshot snapshot = user->snapshot();
+    if (!query.filtered()) {
+        if (snapshot.history.empty()) {
+            send_message(reply.begin() << "You have no transactions." << Messages::WHAT_ELSE << options);
+        } else {
+            send_message(reply.begin() << user->getUsername() << "'s Transaction Log:\n" << snapshot.history << Messages::WHAT_ELSE << options);
+        }
+        return;
+    }
+    vector<const string*> found = user->findTransactions(snapshot.history, query);
+    string description = HistoryFilter::describe(query);
+    if (found.empty()) {
+        send_message(reply.begin() << "You have no " << description << "." << Messages::WHAT_ELSE << options);
+    } else {
+        send_message(reply.begin() << user->getUsername() << "'s " << description << ":\n" << found << Messages::WHAT_ELSE << options);
+    }
+}
+
+/**
+ * @brief Handles the format (and first entry) typed at the statement export prompt.
+ *
+ * @param input The request, e.g. "csv" or "binary 5000".
+ */
+void Session::on_export_format(string_view input) {
+    start_export(input);
+}
+
+/**
+ * @brief Starts exporting the user's history as it is now, from the requested entry on.
+ * The session then sends it in chunks from the EXPORTING state, one chunk at a time.
+ *
+ * @param request The format and optionally the first entry, e.g. "csv 5000".
+ */
+void Session::start_export(string_view request) {
+    static atomic<int64_t>& statements_exported = Metrics::counter("statements_exported");
+    string_view options = nlp ? string_view() : Messages::OPTIONS;
+    dialog.state = DialogState::MENU;
+    StatementExport::Format format;
+    size_t first;
+    if (!StatementExport::parseRequest(request, format, first)) {
+        send_message(reply.begin() << "Invalid export request, expected csv or binary and an optional first entry." << Messages::WHAT_ELSE << options);
+        return;
+    }
+    size_t end = user->snapshot().history.size();
+    if (first > end) {
+        send_message(reply.begin() << "Your history has only " << to_string(end) << " entries." << Messages::WHAT_ELSE << options);
+        return;
+    }
+    ++statements_exported;
+    cout << "Exporting " << user->getUsername() << "'s entries " << first << " to " << end << " as " << StatementExport::name(format) << endl;
+    dialog.export_format = format;
+    dialog.export_position = first;
+    dialog.export_end = end;
+    dialog.state = DialogState::EXPORTING;
+}
+
+/**
+ * @brief Sends one chunk of the statement being exported: "108 <format> <first entry>
+ * <entries> <bytes>" on a line, then that many bytes. The last chunk has no entries; its
+ * bytes are the reply that returns the user to the menu. Each chunk is encoded into the
+ * same buffer, so an export never holds more than one chunk, and the idle deadline is
+ * renewed per chunk, so a client that stops reading is disconnected.
+ */
+void Session::send_statement_chunk() {
+    static atomic<int64_t>& statement_entries_exported = Metrics::counter("statement_entries_exported");
+    string_view format = StatementExport::name(dialog.export_format);
+    size_t first = dialog.export_position;
+    export_chunk.clear();
+    if (first < dialog.export_end) {
+        session_timers.schedule(idle_timer, session_timeouts.forState(state));
+        dialog.export_position = StatementExport::encode(*user, dialog.export_format, first, dialog.export_end,
+                                                         server_config.export_chunk_bytes, export_chunk);
+        statement_entries_exported += dialog.export_position - first;
+        send_reply(reply.begin() << "108 " << format << " " << to_string(first) << " " << to_string(dialog.export_position - first)
+                   << " " << to_string(export_chunk.size()) << "\n" << export_chunk);
+        return;
+    }
+    session_timers.cancel(idle_timer);
+    export_chunk.append("Statement exported. To get later entries, export from entry ").append(to_string(first)).append(".");
+    export_chunk.append(Messages::WHAT_ELSE).append(nlp ? string_view() : Messages::OPTIONS);
+    send_message(reply.begin() << "108 " << format << " " << to_string(first) << " 0 " << to_string(export_chunk.size()) << "\n" << export_chunk);
+    // Give the chunk's memory back; exports are rare
+    string().swap(export_chunk);
+    dialog.state = DialogState::MENU;
+}
+
+/**
+ * @brief Ignores input while an NLP request, a vote or a balance change is in flight (never
+ * called: the session waits for it instead of the client in these states).
+ */
+void Session::on_waiting(string_view) {
+}
+
+/**
+ * @brief Ignores input that arrives after the dialog has ended.
+ */
+void Session::on_closed(string_view) {
 }
 
 
 /**
  * @brief Receives a message from the client over a TLS-encrypted connection.
  * Ensures client did not unexpectedly disconnect by checking if bytes received.
- * Handles unexpected disconnects by returning the "exit" message.
+ * Handles unexpected disconnects and idle timeouts by returning the "exit" message.
+ * The message is read into the step arena, so it lasts until the step ends.
  * 
- * @param ssl The SSL object representing the TLS connection.
- * 
- * @return string The message received from the client.
+ * @return string_view The message received from the client.
+ */
+string_view Session::receive_message() {
+    if (!begin_receive()) {
+        return "exit";
+    }
+    char* buffer = static_cast<char*>(step_arena.allocate(MESSAGE_SIZE, 1));
+    int bytes_received = SSL_read(ssl, buffer, MESSAGE_SIZE);
+    return end_receive(bytes_received, buffer);
+}
+
+/**
+ * @brief Coroutine version of receive_message for sessions running on an EventLoop.
+ * The socket is non-blocking; the session suspends until it is readable.
+ *
+ * @return string_view The message received from the client, or "exit".
  */
-string Session::receive_message() {
-    char buffer[1024];
-    memset(buffer, 0, sizeof(buffer));
-    int bytes_received = SSL_read(ssl, buffer, 1024);
-    cout << "Received message: " << buffer << endl;
+Task<string_view> Session::receive_message_async() {
+    if (!begin_receive()) {
+        co_return "exit";
+    }
+    char* buffer = static_cast<char*>(step_arena.allocate(MESSAGE_SIZE, 1));
+    int bytes_received;
+    while (true) {
+        bytes_received = SSL_read(ssl, buffer, MESSAGE_SIZE);
+        if (bytes_received > 0) {
+            break;
+        }
+        // TLS may need to write (renegotiation) before it can read
+        int error = SSL_get_error(ssl, bytes_received);
+        if (error == SSL_ERROR_WANT_READ) {
+            co_await loop->wait(m_socket, EPOLLIN);
+        } else if (error == SSL_ERROR_WANT_WRITE) {
+            co_await loop->wait(m_socket, EPOLLOUT);
+        } else {
+            break;
+        }
+    }
+    co_return end_receive(bytes_received, buffer);
+}
+
+/**
+ * @brief Prepares to wait for a message: marks whether the wait may be interrupted by a
+ * draining server and arms the idle deadline for the current state.
+ *
+ * @return false if the server is draining and the session should end instead.
+ */
+bool Session::begin_receive() {
+    // Waiting at the menu or before login is a safe point for a draining server to close the session
+    interruptible = state != SessionState::AUTHENTICATED || dialog.state == DialogState::MENU;
+    if (interruptible && Lifecycle::draining()) {
+        interruptible = false;
+        return false;
+    }
+    // Arm the idle deadline for the current state only while waiting on the client
+    session_timers.schedule(idle_timer, session_timeouts.forState(state));
+    return true;
+}
+
+/**
+ * @brief Finishes waiting for a message and turns the result of SSL_read into the message.
+ *
+ * @param bytes_received The result of SSL_read.
+ * @param buffer The bytes read.
+ * @return string_view The message, or "exit" if the client disconnected or timed out.
+ */
+string_view Session::end_receive(int bytes_received, const char* buffer) {
+    session_timers.cancel(idle_timer);
+    interruptible = false;
+    cout << "Received message: ";
+    cout.write(buffer, max(bytes_received, 0)) << endl;
     // If no bytes were received or error occurred, close socket
     if (bytes_received <= 0) {
+        if (timed_out) {
+            static atomic<int64_t>& sessions_timed_out = Metrics::counter("sessions_timed_out");
+            ++sessions_timed_out;
+            cout << "Session timed out waiting for client" << endl;
+        }
         return "exit";
     }else{
-        return string(buffer, bytes_received);
+        return string_view(buffer, bytes_received);
     }
     
 }
 
 /**
  * @brief Sends a message to the client over a TLS-encrypted connection.
- * Converts message to a c_str and sends it to the client via SSL_write.
+ * Copies the message into the session's reply buffer and sends it.
  * 
- * @param ssl The SSL object representing the TLS connection.
  * @param message The message to send to the client.
  */
-void Session::send_message(const string& message) {
-    string newMessage = "\n" + message;
-    const char* message_cstr = newMessage.c_str();
-    cout << "Sending message: " << message_cstr << endl;
-    int message_length = strlen(message_cstr);
-    // Send message and check if all bytes were sent
-    int bytes_sent = SSL_write(ssl, message_cstr, message_length);
-    if (bytes_sent == -1) {
-        // Print the error message to stderr
-        std::cerr << "Error sending message: " << ERR_error_string(ERR_get_error(), NULL) << std::endl;
-        // Throw a runtime error
-        throw std::runtime_error("Error sending message");
-    }
+void Session::send_message(string_view message) {
+    send_message(reply.begin() << message);
 }
 
-
-
-
 /**
- * @brief Processes a request received from the client.
- * Determines whether or not to interpret request with NLP.
- * Message interpreted and action/value sent to handle_request.
+ * @brief Sends a reply built in the session's reply buffer to the client.
+ * The reply is sent with a single SSL_write so the client receives it in one read.
  * 
- * @param request The request to process.
- */
-void Session::process_request(const string& request) {
-    // If NLP is enabled, create a Request object and execute the request with NLP server
-    if(nlp){
-        Request req(request);
-        if (req.execute()) {
-            // If request was executed successfully, parse the response and handle the request
-            string response = req.result();
-            string action = response.substr(1, response.find(",") - 1);
-            string value = response.substr(response.find(",") + 1, response.size() - response.find(",") - 2);
-            handle_request(action, value);
-        }
-    }else{
-        // If NLP is disabled, switch statement used to check action chosen
-        string value = "";
-        switch (request[0]) {
-            case '1':
-                handle_request("balance", "");
-                break;
-            case '2':
-                send_message("How much would you like to deposit?");
-                value = receive_message();
-                value = removeCharacters(value);
-                handle_request("deposit", value);
-                break;
-            case '3':
-                send_message("How much would you like to withdraw?");
-                value = receive_message();
-                value = removeCharacters(value);
-                handle_request("withdraw", value);
-                break;
-            case '4':
-                send_message("How much would you like to transfer?");
-                value = receive_message();
-                value = removeCharacters(value);
-                handle_request("transfer", value);
-                break;
-            case '5':
-                handle_request("history", "");
-                break;
-            case '6':
-                handle_request("backwards", value);
-                break;
-            case '7':
-                handle_request("logout", value);
-                break;
-            default:
-                send_message("Invalid option, please try again.");
-                break;
-        }
-    }
+ * @param response The reply to send, normally reply.begin() followed by its fragments.
+ */
+void Session::send_message(const Response& response) {
+    cout << "Sending message: ";
+    cout.write(response.data(), response.size()) << endl;
+    send_reply(response);
 }
 
 /**
- * @brief Handles a banking request received from the client.
- * Handles specific requests, delegating to the TransactionHandler class to perform transactions.
- * Responsible for confirming user actions and sending appropriate messages to the client.
- * 
- * @param action The action to perform.
- * @param value The value associated with the action.
+ * @brief Sends a reply without logging it, for statement chunks.
+ *
+ * @param response The reply to send.
  */
-void Session::handle_request(string action, string value){
-    // Create a TransactionHandler object to handle transactions
-    TransactionHandler transaction_handler;
-    string options = "";
-    if(!nlp){
-        options = OPTIONS_MESSAGE;
+void Session::send_reply(const Response& response) {
+    // On an event loop the socket is non-blocking: whatever cannot be sent now is kept
+    // for send_message_async, in order
+    if (loop != nullptr && !pending_output.empty()) {
+        pending_output.append(response.data(), response.size());
+        return;
     }
-    double amount;
-
-    // Verify the user's requested action and execute the appropriate transaction
-    try {
-        if (action == "deposit") {
-            try{
-                amount = stod(value);
-            }catch(const exception& e){
-                send_message("Invalid value.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-                return;
-            }
-            if(amount < 0){
-                send_message("How much would you like to deposit?");
-                value = receive_message();
-                value = removeCharacters(value);
-                try{
-                    amount = stod(value);
-                }catch(const exception& e){
-                    send_message("Invalid value.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-                    return;
-                }
-            }
-            // Ask the user if they are sure they want to deposit the specified value
-            send_message("Are you sure you want to deposit " + value + "? (y/n)");
-            string response = receive_message();
-            
-            // If the user confirms, execute the deposit transaction
-            if (response == "y" || response == "yes") {
-                transaction_handler.handleTransaction(TransactionHandler::TransactionType::DEPOSIT, user, amount);
-                string bal = to_string(user->getBalance());
-                bal = bal.substr(0, bal.size() - 4);
-
-                send_message("Deposit successful. New balance: " + bal + "\nWhat else can I help you with today?" + options);
-                
-                // Update the user's balance in the database
-                dbHandler.updateUserBalance(user);
-            } else {
-                // If the user cancels the deposit, inform them and ask for further requests
-
-                send_message("Deposit cancelled.\nWhat else can I help you with today?");
-            }
-        } else if (action == "withdraw") {
-            try{
-                amount = stod(value);
-            }catch(const exception& e){
-                send_message("Invalid value.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-                return;
-            }
-            if(amount < 0){
-                send_message("How much would you like to withdraw?");
-                value = receive_message();
-                value = removeCharacters(value);
-                try{
-                    amount = stod(value);
-                }catch(const exception& e){
-                    send_message("Invalid value.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-                    return;
-                }
-            }
-            // Ask the user if they are sure they want to withdraw the specified value
-            send_message("Are you sure you want to withdraw " + value + "? (y/n)");
-            string response = receive_message();
-            
-            // If the user confirms, execute the withdrawal transaction
-            if (response == "y" || response == "yes") {
-                
-                string reply = transaction_handler.handleTransaction(TransactionHandler::TransactionType::WITHDRAW, user, amount);
-                send_message(reply + "\nWhat else can I help you with today?" + options);
-                
-                // Update the user's balance in the database
-                dbHandler.updateUserBalance(user);
-            } else {
-                // If the user cancels the withdrawal, inform them and ask for further requests
-                send_message("Withdrawal cancelled.\nWhat else can I help you with today?" + options);
-            }
-        } else if (action == "transfer") {
-            // Ask the user who they want to transfer funds to
-            send_message("Who would you like to transfer to?\n\
-            1. Existing user\n\
-            2. External user (by email)");
-            string choice = receive_message();
-            if(choice == "1"){
-                // If the user wants to transfer to an existing user, ask for the recipient's username
-                send_message("Please enter the recipient's username:");
-            }else if(choice == "2"){
-                send_message("Please enter the recipient's email:");
-            }else{
-                send_message("Transfer cancelled.\nWhat else can I help you with today?" + options);
-            }
-            string recipient = receive_message();
-            // Check if the recipient exists in the database
-            User* recipient_user = dbHandler.getRecipient(recipient);
-            if (recipient_user == nullptr && choice == "1") {
-                // If the recipient does not exist, inform the user and ask for further requests
-                send_message("Recipient does not exist.\nWhat else can I help you with today?" + options);
-                return;
-            } else if(recipient == user->getUsername()){
-                send_message("You cannot transfer to yourself.\nWhat else can I help you with today?" + options);
-                return;
-            } else {
-                try{
-                    amount = stod(value);
-                }catch(const exception& e){
-                    send_message("Invalid value.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-                    return;
-                }
-                if(amount < 0){
-                        send_message("How much would you like to transfer to " + recipient + "?");
-                        value = receive_message();
-                        value = removeCharacters(value);
-                        try{
-                            amount = stod(value);
-                        }catch(const exception& e){
-                            send_message("Invalid value.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-                            return;
-                        }
-                        
-                }
-                // If the recipient exists, ask the user if they are sure they want to transfer the specified value
-                send_message("Are you sure you want to transfer " + value + " to " + recipient + "? (y/n)");
-                string response = receive_message();
-                
-                // If the user confirms, execute the transfer transaction
-                if (response == "y" || response == "yes") {
-                    
-                    bool reply = transaction_handler.handleTransfer(user, recipient_user, amount);
-                    
-                    if(reply){
-                        string bal = to_string(user->getBalance());
-                        bal = bal.substr(0, bal.size() - 4);
-                        // If the transfer is successful, inform the user and update both users' balances in the database
-                        send_message("Transfer to " + recipient + " successful. New balance: " + bal + "\nWhat else can I help you with today?" + options);
-                        dbHandler.updateUserBalance(user);
-                        if(recipient_user != nullptr){
-                            dbHandler.updateUserBalance(recipient_user);
-                        }
-                    } else {
-                        // If the transfer fails due to insufficient funds, inform the user and ask for further requests
-                        send_message("Transfer to " + recipient + " failed. Insufficient funds!\nWhat else can I help you with today?" + options);
-                    }
-                // If the user cancels the transfer, inform them and ask for further requests
-                } else {
-                    send_message("Transfer cancelled.\nWhat else can I help you with today?" + options);
-                }
-            }
-        } else if (action == "balance") {
-            // If the user requests their balance, inform them and ask for further requests
-            string bal = to_string(user->getBalance());
-            bal = bal.substr(0, bal.size() - 4);
-            send_message("Your balance is: " + bal + "\nWhat else can I help you with today?" + options);
-        }
-        else if(action == "history"){
-            // If the user requests their transaction history, send transaction log.
-            string transactions = user->getTransactionLog();
-            if(transactions == ""){
-                send_message("You have no transactions.\nWhat else can I help you with today?" + options);
-            }else{
-                send_message(user->getUsername() + "'s Transaction Log:\n" + user->getTransactionLog() + "\nWhat else can I help you with today?" + options);
-            }
-        }
-        else if (action == "backwards"){
-            if(nlp){
-                send_message("Are you sure you would like to switch to regular prompts? (y/n)");
-                string response = receive_message();
-                if(response == "exit"){
-                    disconnect();
-                    return;
-                }
-                // Sets NLP flag and sends welcome message
-                if(response == "y"){
-                    nlp = false;
-                    send_message("What would you like to do today?" + OPTIONS_MESSAGE);
-                }else {
-                    send_message("What else can I help you with today?");
-                }
-            }else{
-                nlp = true;
-                send_message("What can I help you with today?");
-            }
-            
+    // Send message and check if all bytes were sent
+    int bytes_sent = SSL_write(ssl, response.data(), response.size());
+    if (bytes_sent <= 0 && loop != nullptr) {
+        int error = SSL_get_error(ssl, bytes_sent);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            pending_output.assign(response.data(), response.size());
+            retry_length = response.size();
+            return;
         }
-        else if (action == "options"){
-            send_message("You can withdraw, deposit, transfer, check your balance, change back to normal inputs, or view your transaction history.\nWhat would you like to do today?");
+    }
+    if (bytes_sent <= 0) {
+        // Print the error message to stderr
+        std::cerr << "Error sending message: " << ERR_error_string(ERR_get_error(), NULL) << std::endl;
+        // Throw a runtime error
+        throw std::runtime_error("Error sending message");
+    }
+}
+
+/**
+ * @brief Sends the output that send_message could not send without blocking.
+ * A TLS write that could not finish must be retried with the same length, so the first
+ * retry sends exactly the bytes of the original attempt. Replies queued meanwhile may move
+ * them, which the server's SSL context allows (SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER).
+ *
+ * @return true once everything is sent, false if the connection failed.
+ */
+Task<bool> Session::send_message_async() {
+    while (!pending_output.empty()) {
+        size_t length = retry_length != 0 ? retry_length : pending_output.size();
+        int bytes_sent = SSL_write(ssl, pending_output.data(), length);
+        if (bytes_sent > 0) {
+            pending_output.erase(0, bytes_sent);
+            retry_length = 0;
+            continue;
         }
-        else if (action == "logout"){
-            // Send logout code to client.
-            send_message("105");
-            disconnect();
+        retry_length = length;
+        int error = SSL_get_error(ssl, bytes_sent);
+        if (error == SSL_ERROR_WANT_WRITE) {
+            co_await loop->wait(m_socket, EPOLLOUT);
+        } else if (error == SSL_ERROR_WANT_READ) {
+            co_await loop->wait(m_socket, EPOLLIN);
         } else {
-            if(nlp){
-                send_message("Sorry I didn't get that. Please try again.\nWhat can I help you with?");
-            }else{
-                send_message("Invalid action.\nWhat else can I help you with today?" + OPTIONS_MESSAGE);
-            }
+            cerr << "Error sending message: " << ERR_error_string(ERR_get_error(), NULL) << endl;
+            co_return false;
         }
-    } catch (const exception& e) {
-        send_message("Error: " + string(e.what()));
     }
+    co_return true;
 }
 
 
+
+
 /**
  * @brief Disconnects the client from the server.
- * Closes socket and ends connection.
+ * Shuts the socket down and releases the user's login, if this session holds it.
+ * The socket itself is closed by the owner of the connection once the session ends.
  */
 void Session::disconnect() {
-    close(m_socket);
+    shutdown(m_socket, SHUT_RDWR);
+    if (user == nullptr) {
+        return;
+    }
     try{
         lock_guard<mutex> guard(active_sessions_mutex);
-        active_sessions.erase(user->getUsername());
+        auto it = active_sessions.find(user->getId());
+        if (it != active_sessions.end() && it->second == this) {
+            active_sessions.erase(it);
+        }
     }
     catch (const exception& e){
         cout << "Error: " << e.what() << endl;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Interrupts the session from another thread by shutting its socket down.
+ * Without force, only a session waiting at a safe point (the menu or login) is interrupted,
+ * so a transaction that is waiting on a confirmation is allowed to finish.
+ *
+ * @param force Interrupt the session whatever it is doing.
+ */
+void Session::interrupt(bool force) {
+    if (force || interruptible) {
+        shutdown(m_socket, SHUT_RDWR);
+    }
+}
@@ -9,7 +9,10 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <cstring>
+#include <cstddef>
+#include <memory_resource>
 #include <mutex>
 #include <unistd.h>
 #include "request.h"
@@ -17,9 +20,21 @@
 #include "user.h"
 #include "globals.h"
 #include "transactionHandler.h"
+#include "metrics.h"
+#include "lifecycle.h"
+#include "response.h"
+#include "eventLoop.h"
+#include "task.h"
+#include "transferEngine.h"
+#include "cluster.h"
+#include "historyFilter.h"
+#include "statementExport.h"
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <iomanip>
+#include <atomic>
+#include <cstdint>
+#include <sys/socket.h>
 
 
 /**
@@ -30,33 +45,151 @@
  */
 class Session {
 public:
+    // Steps of the banking dialog. Each names the input the session is waiting for.
+    enum class DialogState : uint8_t {
+        WELCOME,
+        LOGIN_USERNAME,
+        LOGIN_PASSWORD,
+        CREATE_USERNAME,
+        CREATE_PASSWORD,
+        NLP_CHOICE,
+        MENU,
+        AMOUNT,
+        AMOUNT_RETRY,
+        TRANSFER_TARGET,
+        TRANSFER_RECIPIENT,
+        CONFIRM,
+        LEAVE_NLP,
+        HISTORY_SEARCH,
+        EXPORT_FORMAT,
+        INTERPRETING,
+        PREPARING,
+        COMMITTING,
+        EXPORTING,
+        CLOSED,
+        COUNT
+    };
+    // Banking actions, chosen from the menu or interpreted from a natural language prompt
+    enum class Action : uint8_t {
+        NONE,
+        BALANCE,
+        DEPOSIT,
+        WITHDRAW,
+        TRANSFER,
+        HISTORY,
+        BACKWARDS,
+        OPTIONS,
+        LOGOUT,
+        SEARCH,
+        EXPORT,
+        UNKNOWN
+    };
     // Constructor and destructor
-    Session(int socket, SSL* new_ssl);
+    Session(int socket, SSL* new_ssl, EventLoop* loop = nullptr);
+    ~Session();
     void start_session();
+    Task<void> run_session();
+    void begin();
+    bool on_event(std::string_view input);
+    bool on_interpreted(bool success, std::string_view response);
+    bool on_prepared(Cluster::Vote vote);
+    bool on_committed(const TransferEngine::Result& result);
+    bool continue_export();
+    bool finished() const;
     void disconnect();
+    void interrupt(bool force);
 private:
+    /**
+     * @struct Dialog
+     * @brief Everything the session must remember between two inputs.
+     */
+    struct Dialog {
+        DialogState state = DialogState::WELCOME;
+        Action action = Action::NONE;
+        uint8_t tries = 0;
+        char choice = 0;
+        double amount = 0;
+        User* recipient_user = nullptr;
+        // Node owning the recipient, if it is not this one
+        int recipient_node = -1;
+        TransferEngine::Transfer transfer;
+        std::string username;
+        std::string value;
+        std::string recipient;
+        // Statement export in progress: the next entry to send and the end of the snapshot
+        StatementExport::Format export_format = StatementExport::Format::CSV;
+        size_t export_position = 0;
+        size_t export_end = 0;
+    };
+    using InputHandler = void (Session::*)(std::string_view input);
+    static const InputHandler INPUT_HANDLERS[];
+
+    // Scratch memory per dialog step, and the largest message read from the client at once
+    static constexpr size_t STEP_MEMORY = 8192;
+    static constexpr int MESSAGE_SIZE = 1024;
+
     // Variables
     int m_socket;
     SSL* ssl;
+    EventLoop* loop;
+    std::string pending_output;
+    size_t retry_length;
     bool nlp;
     User* user;
-    DatabaseHandler dbHandler;
-    const std::string OPTIONS_MESSAGE = "\n\
-    1. View Balance\n\
-    2. Deposit\n\
-    3. Withdraw\n\
-    4. Transfer Funds\n\
-    5. View Transaction History\n\
-    6. Change to NLP\n\
-    7. LogOut\n";
+    SessionState state;
+    Dialog dialog;
+    TimerWheel::Timer idle_timer;
+    std::atomic<bool> timed_out;
+    std::atomic<bool> interruptible;
+    DatabaseHandler& dbHandler;
+    Response reply;
+    std::string export_chunk;
+    // Memory for what a dialog step needs only until it ends: the message received and
+    // the buffers of an NLP request. Released after every step, so a step allocates from
+    // the heap only if it outgrows step_memory.
+    alignas(std::max_align_t) std::byte step_memory[STEP_MEMORY];
+    std::pmr::monotonic_buffer_resource step_arena;
 
     // Methods
-    std::string receive_message();
-    void send_message(const std::string& message);
-    void process_request(const std::string& request);
-    void handle_request(std::string action, std::string value);
-    bool login();
-    bool createAccount();
+    std::string_view receive_message();
+    Task<std::string_view> receive_message_async();
+    bool begin_receive();
+    std::string_view end_receive(int bytes_received, const char* buffer);
+    void send_message(std::string_view message);
+    void send_message(const Response& response);
+    void send_reply(const Response& response);
+    Task<bool> send_message_async();
+    // Input handlers, one per dialog state
+    void on_welcome(std::string_view input);
+    void on_login_username(std::string_view input);
+    void on_login_password(std::string_view input);
+    void on_create_username(std::string_view input);
+    void on_create_password(std::string_view input);
+    void on_nlp_choice(std::string_view input);
+    void on_menu(std::string_view input);
+    void on_amount(std::string_view input);
+    void on_amount_retry(std::string_view input);
+    void on_transfer_target(std::string_view input);
+    void on_transfer_recipient(std::string_view input);
+    void on_confirm(std::string_view input);
+    void on_leave_nlp(std::string_view input);
+    void on_history_search(std::string_view input);
+    void on_export_format(std::string_view input);
+    void on_waiting(std::string_view input);
+    void on_closed(std::string_view input);
+    // Dialog steps shared between handlers
+    void on_interpretation(bool success, std::string_view response);
+    void on_prepare(Cluster::Vote vote);
+    void on_commit(const TransferEngine::Result& result);
+    bool redirect(std::string_view username);
+    void begin_action(Action action, std::string_view value);
+    void send_history(const HistoryLog::Query& query);
+    void start_export(std::string_view request);
+    void send_statement_chunk();
+    void ask_confirmation();
+    void ask_nlp_choice();
+    void finish_step();
+    void close_dialog();
 };
 
 #endif
@@ -0,0 +1,63 @@
+/**
+ * @file settlementGateway.cpp
+ * @brief Implementation of the settlement gateways.
+ * @author Kaden Oseen
+ */
+
+#include "settlementGateway.h"
+#include "config.h"
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+/**
+ * @name create
+ * @brief Creates the gateway named by the settlement_gateway setting.
+ *
+ * @param name The gateway name
+ * @return The gateway, or nullptr if there is none by that name
+ */
+unique_ptr<SettlementGateway> SettlementGateway::create(const string& name) {
+    if (name == "stub") {
+        return unique_ptr<SettlementGateway>(new StubSettlementGateway(server_config.settlement_stub_failure_percent,
+                                                                      chrono::milliseconds(server_config.settlement_stub_latency_ms)));
+    }
+    return nullptr;
+}
+
+/**
+ * @name StubSettlementGateway
+ * @brief Constructor for the StubSettlementGateway class.
+ *
+ * @param failure_percent Percentage of attempts that fail and must be retried
+ * @param latency Time each batch takes to settle
+ */
+StubSettlementGateway::StubSettlementGateway(int failure_percent, chrono::milliseconds latency)
+    : failure_percent(failure_percent), latency(latency), random(random_device()()) {}
+
+/**
+ * @name settle
+ * @brief Pretends to pay a batch of payouts.
+ *
+ * @param payouts The payouts
+ * @return One outcome per payout
+ */
+vector<SettlementGateway::Outcome> StubSettlementGateway::settle(const vector<Journal::Payout>& payouts) {
+    this_thread::sleep_for(latency);
+    static const string REJECTED_SUFFIX = ".invalid";
+    vector<Outcome> outcomes;
+    for (const auto& payout : payouts) {
+        const string& recipient = payout.recipient;
+        if (recipient.size() >= REJECTED_SUFFIX.size() &&
+            recipient.compare(recipient.size() - REJECTED_SUFFIX.size(), string::npos, REJECTED_SUFFIX) == 0) {
+            outcomes.push_back(Outcome::REJECTED);
+        } else if (static_cast<int>(random() % 100) < failure_percent) {
+            outcomes.push_back(Outcome::RETRY);
+        } else {
+            cout << "Settled payout " << payout.id << ": $" << payout.amount << " from " << payout.username << " to " << recipient << endl;
+            outcomes.push_back(Outcome::SETTLED);
+        }
+    }
+    return outcomes;
+}
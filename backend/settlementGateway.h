@@ -0,0 +1,59 @@
+/**
+ * @file settlementGateway.h
+ * @brief Declaration of the SettlementGateway interface and its local stub.
+ * @author Kaden Oseen
+ */
+
+#ifndef SETTLEMENT_GATEWAY_H
+#define SETTLEMENT_GATEWAY_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include "journal.h"
+
+/**
+ * @class SettlementGateway
+ * @brief Pays external recipients. Implementations wrap a payment network; the Outbox calls
+ * settle() from its own thread, so an implementation may block on the network.
+ */
+class SettlementGateway {
+public:
+    // Outcome of one payout
+    enum class Outcome : uint8_t {
+        SETTLED,    // paid
+        RETRY,      // not paid this time, try again later
+        REJECTED    // can never be paid; the money goes back to the user
+    };
+
+    virtual ~SettlementGateway() = default;
+    // Settles a batch of payouts; returns one outcome per payout, in the same order
+    virtual std::vector<Outcome> settle(const std::vector<Journal::Payout>& payouts) = 0;
+
+    static std::unique_ptr<SettlementGateway> create(const std::string& name);
+};
+
+/**
+ * @class StubSettlementGateway
+ * @brief Local stand-in for a payment network, for testing. Settles every payout after a
+ * short delay, except that a configurable share of attempts fail temporarily and
+ * recipients ending in ".invalid" are rejected.
+ */
+class StubSettlementGateway : public SettlementGateway {
+public:
+    // Constructor
+    StubSettlementGateway(int failure_percent, std::chrono::milliseconds latency);
+    // Methods
+    std::vector<Outcome> settle(const std::vector<Journal::Payout>& payouts) override;
+private:
+    // Variables
+    int failure_percent;
+    std::chrono::milliseconds latency;
+    std::mt19937 random;
+};
+
+#endif
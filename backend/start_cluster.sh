@@ -0,0 +1,24 @@
+#!/bin/bash
+# Starts a cluster of NODES servers on this machine (3 by default). Node i takes clients on
+# port CLIENT_PORT+i and the other nodes on port CLUSTER_PORT+i, and keeps the accounts it
+# owns in users.<i>.txt, first copied from users.txt. Other arguments go to every node,
+# e.g. ./start_cluster.sh --session_mode=coroutines
+NODES=${NODES:-3}
+CLIENT_PORT=${CLIENT_PORT:-3001}
+CLUSTER_PORT=${CLUSTER_PORT:-4001}
+HOST=${HOST:-127.0.0.1}
+
+nodes=""
+for ((i = 0; i < NODES; i++)); do
+    nodes+="${nodes:+,}$HOST:$((CLIENT_PORT + i)):$((CLUSTER_PORT + i))"
+done
+
+for ((i = 0; i < NODES; i++)); do
+    [ -f users.$i.txt ] || cp users.txt users.$i.txt
+    ./server --cluster_nodes=$nodes --node_id=$i --port=$((CLIENT_PORT + i)) --users_file=users.$i.txt "$@" > node.$i.log 2>&1 &
+done
+echo "Started $NODES nodes: $nodes (logs in node.<id>.log)"
+
+# Stop every node together
+trap 'kill $(jobs -p) 2>/dev/null; wait' INT TERM
+wait
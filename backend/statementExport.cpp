@@ -0,0 +1,212 @@
+/**
+ * @file statementExport.cpp
+ * @brief Implementation of the StatementExport class.
+ * @author Kaden Oseen
+ */
+
+#include "statementExport.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+using namespace std;
+
+// CSV name of each HistoryLog::Type
+static const string_view TYPE_NAMES[] = {"deposit", "withdrawal", "transfer_out", "transfer_in", "refund", "other"};
+static_assert(sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]) == static_cast<size_t>(HistoryLog::Type::COUNT),
+              "one name per history type");
+
+static const string_view CSV_HEADER = "entry,time,type,amount,counterparty\n";
+
+/**
+ * @brief Appends an integer in decimal.
+ * @param out The text to append to
+ * @param value The integer
+ */
+static void append_integer(string& out, int64_t value) {
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+/**
+ * @brief Appends an amount in cents as dollars with two decimal places.
+ * @param out The text to append to
+ * @param cents The amount
+ */
+static void append_cents(string& out, int64_t cents) {
+    if (cents < 0) {
+        out.push_back('-');
+        cents = -cents;
+    }
+    append_integer(out, cents / 100);
+    out.push_back('.');
+    out.push_back(static_cast<char>('0' + cents % 100 / 10));
+    out.push_back(static_cast<char>('0' + cents % 10));
+}
+
+/**
+ * @brief Appends a time key as "YYYY-MM-DD hh:mm:ss", or nothing if the entry had no time.
+ * @param out The text to append to
+ * @param key The time as YYYYMMDDhhmmss
+ */
+static void append_time(string& out, int64_t key) {
+    if (key <= 0) {
+        return;
+    }
+    char text[19];
+    // Fill the 14 digits from the last, skipping the separators
+    static const int POSITIONS[] = {18, 17, 15, 14, 12, 11, 9, 8, 6, 5, 3, 2, 1, 0};
+    for (int position : POSITIONS) {
+        text[position] = static_cast<char>('0' + key % 10);
+        key /= 10;
+    }
+    text[4] = text[7] = '-';
+    text[10] = ' ';
+    text[13] = text[16] = ':';
+    out.append(text, sizeof(text));
+}
+
+/**
+ * @brief Appends a CSV field, quoted if it holds a comma, quote or line break.
+ * @param out The text to append to
+ * @param field The field
+ */
+static void append_field(string& out, string_view field) {
+    if (field.find_first_of(",\"\r\n") == string_view::npos) {
+        out.append(field);
+        return;
+    }
+    out.push_back('"');
+    for (char c : field) {
+        if (c == '"') {
+            out.push_back('"');
+        }
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+/**
+ * @brief Finds the other party of a transfer or refund in its entry, as HistoryLog::parse does,
+ * without parsing the rest again.
+ * @param record The entry's record
+ * @return The counterparty, or "" for deposits and withdrawals
+ */
+static string_view counterparty_of(const HistoryLog::Record& record) {
+    if (record.type != HistoryLog::Type::TRANSFER_OUT && record.type != HistoryLog::Type::TRANSFER_IN &&
+        record.type != HistoryLog::Type::REFUND) {
+        return string_view();
+    }
+    string_view entry = *record.entry;
+    size_t dollar = entry.find(" --- $");
+    size_t parties = dollar == string_view::npos ? dollar : entry.find(" --- ", dollar + 6);
+    if (parties == string_view::npos) {
+        return string_view();
+    }
+    string_view other = entry.substr(parties + 5);
+    if (record.type == HistoryLog::Type::REFUND) {
+        return other;
+    }
+    size_t arrow = other.find(" -> ");
+    return record.type == HistoryLog::Type::TRANSFER_OUT ? other.substr(arrow + 4) : other.substr(0, arrow);
+}
+
+/**
+ * @brief Appends an integer as 8 little-endian bytes.
+ * @param out The bytes to append to
+ * @param value The integer
+ */
+static void append_int64(string& out, int64_t value) {
+    uint64_t bits = static_cast<uint64_t>(value);
+    for (int byte = 0; byte < 8; ++byte) {
+        out.push_back(static_cast<char>(bits >> (byte * 8)));
+    }
+}
+
+/**
+ * @name parseRequest
+ * @brief Reads an export request: the format ("csv" or "binary") and optionally the first
+ * entry to export, e.g. "csv" or "binary 120000".
+ *
+ * @param text The request
+ * @param format Receives the format
+ * @param first Receives the first entry, 0 if none was given
+ * @return true if the request was valid
+ */
+bool StatementExport::parseRequest(string_view text, Format& format, size_t& first) {
+    size_t space = text.find(' ');
+    string_view name = text.substr(0, space);
+    if (name == "csv") {
+        format = Format::CSV;
+    } else if (name == "binary") {
+        format = Format::BINARY;
+    } else {
+        return false;
+    }
+    first = 0;
+    if (space == string_view::npos) {
+        return true;
+    }
+    string_view number = text.substr(space + 1);
+    auto parsed = from_chars(number.data(), number.data() + number.size(), first);
+    return parsed.ec == errc() && parsed.ptr == number.data() + number.size();
+}
+
+/**
+ * @name name
+ * @brief Returns the name of a format, as given in a request.
+ *
+ * @param format The format
+ * @return "csv" or "binary"
+ */
+string_view StatementExport::name(Format format) {
+    return format == Format::CSV ? "csv" : "binary";
+}
+
+/**
+ * @name encode
+ * @brief Appends entries from position on until the output holds max_bytes or end is
+ * reached, always at least one entry. Reads the user's records without locking.
+ *
+ * @param user The owner of the history
+ * @param format The format
+ * @param position The first entry to encode
+ * @param end One past the last entry to encode, at most the size of a snapshot already taken
+ * @param max_bytes Output size at which to stop
+ * @param out The output to append to
+ * @return The position of the first entry not encoded
+ */
+size_t StatementExport::encode(const User& user, Format format, size_t position, size_t end, size_t max_bytes, string& out) {
+    if (format == Format::CSV && position == 0) {
+        out.append(CSV_HEADER);
+    }
+    while (position < end) {
+        const HistoryLog::Record& record = user.getTransactionRecord(position);
+        string_view counterparty = counterparty_of(record);
+        int64_t cents = llround(record.amount * 100);
+        if (format == Format::CSV) {
+            append_integer(out, static_cast<int64_t>(position));
+            out.push_back(',');
+            append_time(out, record.time);
+            out.push_back(',');
+            out.append(TYPE_NAMES[static_cast<size_t>(record.type)]);
+            out.push_back(',');
+            append_cents(out, cents);
+            out.push_back(',');
+            append_field(out, counterparty);
+            out.push_back('\n');
+        } else {
+            size_t length = min<size_t>(counterparty.size(), 255);
+            append_int64(out, record.time);
+            append_int64(out, cents);
+            out.push_back(static_cast<char>(record.type));
+            out.push_back(static_cast<char>(length));
+            out.append(counterparty.substr(0, length));
+        }
+        ++position;
+        if (out.size() >= max_bytes) {
+            break;
+        }
+    }
+    return position;
+}
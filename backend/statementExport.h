@@ -0,0 +1,39 @@
+/**
+ * @file statementExport.h
+ * @brief Declaration of the StatementExport class.
+ * @author Kaden Oseen
+ */
+
+#ifndef STATEMENT_EXPORT_H
+#define STATEMENT_EXPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "user.h"
+
+/**
+ * @class StatementExport
+ * @brief Encodes a user's transaction history as a statement, a slice at a time, so a
+ * session can stream a history of any length through one bounded buffer.
+ *
+ * CSV has a header row (only when starting from the first entry) and then one row per entry:
+ * entry,time,type,amount,counterparty. The binary form is one record per entry, little-endian:
+ * int64 time as YYYYMMDDhhmmss, int64 amount in cents, uint8 type (HistoryLog::Type),
+ * uint8 counterparty length and the counterparty's bytes. Entries are numbered from the
+ * oldest, so an export that was cut off can be resumed from the next entry it did not receive.
+ */
+class StatementExport {
+public:
+    enum class Format : uint8_t {
+        CSV,
+        BINARY
+    };
+
+    static bool parseRequest(std::string_view text, Format& format, size_t& first);
+    static std::string_view name(Format format);
+    static size_t encode(const User& user, Format format, size_t position, size_t end, size_t max_bytes, std::string& out);
+};
+
+#endif
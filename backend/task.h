@@ -0,0 +1,149 @@
+/**
+ * @file task.h
+ * @brief Declaration of the Task coroutine type.
+ * @author Kaden Oseen
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <utility>
+
+template <typename T>
+class Task;
+
+/**
+ * @struct TaskPromiseBase
+ * @brief State shared by every Task promise: who to resume when the task finishes,
+ * and any exception it threw.
+ */
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool detached = false;
+
+    /**
+     * @struct FinalAwaiter
+     * @brief Resumes the awaiting coroutine, or frees a detached task's frame.
+     */
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            TaskPromiseBase& promise = handle.promise();
+            if (promise.detached) {
+                if (promise.exception) {
+                    try {
+                        std::rethrow_exception(promise.exception);
+                    } catch (const std::exception& e) {
+                        std::cerr << "Detached task failed: " << e.what() << std::endl;
+                    } catch (...) {
+                        std::cerr << "Detached task failed" << std::endl;
+                    }
+                }
+                handle.destroy();
+                return std::noop_coroutine();
+            }
+            return promise.continuation ? promise.continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    // Tasks are lazy: they start when awaited or detached
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+/**
+ * @struct TaskPromise
+ * @brief Promise for a Task that produces a value.
+ */
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+    T take() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+/**
+ * @struct TaskPromise<void>
+ * @brief Promise for a Task that produces nothing.
+ */
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void take() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+/**
+ * @class Task
+ * @brief A lazily started coroutine whose result is obtained with co_await.
+ * Awaiting a task runs it until it finishes and then resumes the awaiting coroutine
+ * directly (symmetric transfer), so chains of tasks never grow the thread's stack.
+ * A task can instead be detached to run on its own; its frame is freed when it finishes.
+ * The frame holds only the coroutine's locals, so a suspended session costs a few
+ * kilobytes of heap instead of a thread stack.
+ */
+template <typename T = void>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /**
+     * @brief Gives up ownership so the task frees itself when it finishes.
+     * @return The handle to resume to start the task
+     */
+    std::coroutine_handle<> detach() {
+        handle.promise().detached = true;
+        return std::exchange(handle, nullptr);
+    }
+
+    // Awaiting starts the task and suspends the caller until it finishes
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    T await_resume() { return handle.promise().take(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+#endif
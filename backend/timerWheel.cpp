@@ -0,0 +1,196 @@
+/**
+ * @file timerWheel.cpp
+ * @brief Implementation of the TimerWheel class.
+ * Keeps per-session idle and handshake deadlines without a thread or a scan per session.
+ * @author Kaden Oseen
+ */
+
+#include "timerWheel.h"
+
+using namespace std;
+
+/**
+ * @name TimerWheel
+ * @brief Constructor for the TimerWheel class.
+ * Every slot is an empty circular list headed by a sentinel timer.
+ *
+ * @param tick The resolution of the wheel
+ */
+TimerWheel::TimerWheel(chrono::milliseconds tick) : tick_length(tick), current_tick(0), running(false) {
+    for (auto& level : slots) {
+        for (auto& slot : level) {
+            slot.prev = &slot;
+            slot.next = &slot;
+        }
+    }
+}
+
+/**
+ * @name ~TimerWheel
+ * @brief Destructor for the TimerWheel class.
+ * Stops the wheel thread if it is still running.
+ */
+TimerWheel::~TimerWheel() {
+    stop();
+}
+
+/**
+ * @name start
+ * @brief Starts the background thread that advances the wheel in real time.
+ */
+void TimerWheel::start() {
+    lock_guard<mutex> guard(wheel_mutex);
+    if (running) {
+        return;
+    }
+    running = true;
+    worker = thread(&TimerWheel::run, this);
+}
+
+/**
+ * @name stop
+ * @brief Stops the background thread. Pending timers stay scheduled but will not fire.
+ */
+void TimerWheel::stop() {
+    {
+        lock_guard<mutex> guard(wheel_mutex);
+        running = false;
+    }
+    wheel_cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+/**
+ * @name schedule
+ * @brief Schedules (or reschedules) a timer to fire after the given delay.
+ *
+ * @param timer The timer to schedule
+ * @param delay Time until the timer fires, rounded up to a whole tick
+ */
+void TimerWheel::schedule(Timer& timer, chrono::milliseconds delay) {
+    uint64_t ticks = (delay.count() + tick_length.count() - 1) / tick_length.count();
+    lock_guard<mutex> guard(wheel_mutex);
+    unlink(timer);
+    timer.expiry = current_tick + (ticks == 0 ? 1 : ticks);
+    insert(timer);
+}
+
+/**
+ * @name cancel
+ * @brief Cancels a timer. Once this returns the callback is neither running nor pending.
+ *
+ * @param timer The timer to cancel
+ */
+void TimerWheel::cancel(Timer& timer) {
+    lock_guard<mutex> guard(wheel_mutex);
+    unlink(timer);
+}
+
+/**
+ * @name advance
+ * @brief Advances the wheel by a number of ticks, firing anything that expires.
+ *
+ * @param ticks The number of ticks to advance
+ */
+void TimerWheel::advance(uint64_t ticks) {
+    lock_guard<mutex> guard(wheel_mutex);
+    for (uint64_t i = 0; i < ticks; ++i) {
+        tick();
+    }
+}
+
+/**
+ * @name insert
+ * @brief Places a timer in the slot matching its expiry. Caller holds the lock.
+ * Level n holds timers due within 64^(n+1) ticks, indexed by bits [6n, 6n+6) of the expiry.
+ *
+ * @param timer The timer to insert
+ */
+void TimerWheel::insert(Timer& timer) {
+    uint64_t delta = timer.expiry - current_tick;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    // Clamp anything beyond the range of the wheel to its furthest deadline
+    if (level == LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))) {
+        timer.expiry = current_tick + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    }
+    Timer& head = slots[level][(timer.expiry >> (SLOT_BITS * level)) & SLOT_MASK];
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+/**
+ * @name unlink
+ * @brief Removes a timer from whatever slot holds it, if any.
+ *
+ * @param timer The timer to remove
+ */
+void TimerWheel::unlink(Timer& timer) {
+    if (timer.next == nullptr) {
+        return;
+    }
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = nullptr;
+    timer.next = nullptr;
+}
+
+/**
+ * @name cascade
+ * @brief Re-files every timer in the current slot of a higher level into lower levels.
+ *
+ * @param level The level to cascade from
+ */
+void TimerWheel::cascade(int level) {
+    Timer& head = slots[level][(current_tick >> (SLOT_BITS * level)) & SLOT_MASK];
+    while (head.next != &head) {
+        Timer* timer = head.next;
+        unlink(*timer);
+        insert(*timer);
+    }
+}
+
+/**
+ * @name tick
+ * @brief Moves the wheel forward one tick and fires the timers now due. Caller holds the lock.
+ */
+void TimerWheel::tick() {
+    ++current_tick;
+    // Each time a level wraps, pull the next slot of the level above down
+    for (int level = 1; level < LEVELS; ++level) {
+        if ((current_tick & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        cascade(level);
+    }
+    Timer& head = slots[0][current_tick & SLOT_MASK];
+    while (head.next != &head) {
+        Timer* timer = head.next;
+        unlink(*timer);
+        if (timer->callback) {
+            timer->callback();
+        }
+    }
+}
+
+/**
+ * @name run
+ * @brief Body of the wheel thread. Catches up on any ticks missed while asleep.
+ */
+void TimerWheel::run() {
+    auto next = chrono::steady_clock::now() + tick_length;
+    unique_lock<mutex> lock(wheel_mutex);
+    while (running) {
+        wheel_cv.wait_until(lock, next, [this] { return !running; });
+        while (running && chrono::steady_clock::now() >= next) {
+            tick();
+            next += tick_length;
+        }
+    }
+}
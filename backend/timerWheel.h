@@ -0,0 +1,72 @@
+/**
+ * @file timerWheel.h
+ * @brief Declaration of the TimerWheel class.
+ * @author Kaden Oseen
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * @class TimerWheel
+ * @brief Hierarchical timer wheel for session deadlines.
+ * Timers are intrusive list nodes owned by the caller, so scheduling, rescheduling
+ * and cancelling are all O(1). A background thread advances the wheel once per tick
+ * and runs the callbacks of expired timers.
+ */
+class TimerWheel {
+public:
+    /**
+     * @struct Timer
+     * @brief A single deadline. Owned by the caller and must outlive its scheduling.
+     * The callback runs on the wheel thread while the wheel is locked, so it must be
+     * short and must not call back into the wheel.
+     */
+    struct Timer {
+        std::function<void()> callback;
+        uint64_t expiry = 0;
+        Timer* prev = nullptr;
+        Timer* next = nullptr;
+    };
+
+    // Constructor and destructor
+    explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(100));
+    ~TimerWheel();
+    // Methods
+    void start();
+    void stop();
+    void schedule(Timer& timer, std::chrono::milliseconds delay);
+    void cancel(Timer& timer);
+    void advance(uint64_t ticks);
+private:
+    // Wheel geometry: 4 levels of 64 slots covers 2^24 ticks (~19 days at 100ms)
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const uint64_t SLOT_MASK = SLOTS - 1;
+
+    // Variables
+    std::chrono::milliseconds tick_length;
+    uint64_t current_tick;
+    Timer slots[LEVELS][SLOTS];
+    std::mutex wheel_mutex;
+    std::condition_variable wheel_cv;
+    std::thread worker;
+    bool running;
+
+    // Methods
+    void insert(Timer& timer);
+    static void unlink(Timer& timer);
+    void cascade(int level);
+    void tick();
+    void run();
+};
+
+#endif
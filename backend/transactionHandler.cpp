@@ -56,8 +56,9 @@ string TransactionHandler::handleTransaction(TransactionType transactionType, Us
  * @param user The user to transfer from.
  * @param recipient The user to transfer to.
  * @param value The value to transfer.
+ * @param remote Name of the recipient when it is an account on another node.
 */
-bool TransactionHandler::handleTransfer(User* user, User* recipient, double value) {
+bool TransactionHandler::handleTransfer(User* user, User* recipient, double value, const string& remote) {
     // Checks if the user has enough funds to transfer
     if (user->getBalance() < value || value < 0) {
         return false;
@@ -71,6 +72,10 @@ bool TransactionHandler::handleTransfer(User* user, User* recipient, double valu
         recipient->updateBalance(value);
         transactionLog << timestamp << " --- Transfer --- $" << value << " --- " << user->getUsername() << " -> " << recipient->getUsername();
         user->addTransaction(transactionLog.str());
+        recipient->addTransaction(transactionLog.str());
+    }else if(!remote.empty()){
+        transactionLog << timestamp << " --- Transfer --- $" << value << " --- " << user->getUsername() << " -> " << remote;
+        user->addTransaction(transactionLog.str());
     }else{
         transactionLog << timestamp << " --- Transfer --- $" << value << " --- " << user->getUsername() << " -> ExternalRecipient";
         user->addTransaction(transactionLog.str());
@@ -25,7 +25,7 @@ public:
     };
     // Methods
     static std::string handleTransaction(TransactionType transactionType, User* user, double value);
-    bool handleTransfer(User* user, User* recipient, double value);
+    bool handleTransfer(User* user, User* recipient, double value, const std::string& remote = "");
 };
 
 #endif
@@ -0,0 +1,389 @@
+/**
+ * @file transferEngine.cpp
+ * @brief Implementation of the TransferEngine class.
+ * Replaces one users file rewrite per balance change with one durable write per batch,
+ * and keeps concurrent sessions from overwriting each other's balances.
+ * @author Kaden Oseen
+ */
+
+#include "transferEngine.h"
+#include "cluster.h"
+#include "metrics.h"
+#include "outbox.h"
+#include "transactionHandler.h"
+#include <algorithm>
+#include <sstream>
+#include <future>
+#include <iostream>
+#include <latch>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * @name TransferEngine
+ * @brief Constructor for the TransferEngine class. Nothing runs until start().
+ */
+TransferEngine::TransferEngine() : database(nullptr), outbox(nullptr), max_batch(0), running(false), stopped(false),
+                                   failed(false), applier_threads(0) {}
+
+/**
+ * @name ~TransferEngine
+ * @brief Destructor for the TransferEngine class. Commits what is queued and stops.
+ */
+TransferEngine::~TransferEngine() {
+    stop();
+}
+
+/**
+ * @name start
+ * @brief Starts the committer thread and the threads that apply large waves.
+ *
+ * @param database The accounts to change and the file to commit them to
+ * @param threads Threads applying each wave
+ * @param max_batch Most changes committed together
+ * @param outbox Receives each payout to an external recipient once it is durable
+ */
+void TransferEngine::start(DatabaseHandler& database, int threads, int max_batch, Outbox* outbox) {
+    this->database = &database;
+    this->outbox = outbox;
+    this->max_batch = max_batch;
+    applier_threads = threads;
+    appliers.start(threads);
+    running = true;
+    stopped = false;
+    committer = thread(&TransferEngine::run, this);
+}
+
+/**
+ * @name stop
+ * @brief Commits everything already submitted, then stops the engine's threads.
+ */
+void TransferEngine::stop() {
+    {
+        lock_guard<mutex> guard(queue_mutex);
+        running = false;
+        stopped = true;
+    }
+    queue_cv.notify_all();
+    if (committer.joinable()) {
+        committer.join();
+    }
+    appliers.stop();
+}
+
+/**
+ * @name submit
+ * @brief Queues a change. The callback runs on the engine's thread once it is durable,
+ * so it must be short. Once the engine is stopped it runs at once, on the caller's thread,
+ * with an unsuccessful result.
+ *
+ * @param transfer The change
+ * @param done Receives the outcome
+ */
+void TransferEngine::submit(const Transfer& transfer, Callback done) {
+    bool accepted = false;
+    {
+        lock_guard<mutex> guard(queue_mutex);
+        if (!stopped) {
+            queued.push_back(transfer);
+            queued_callbacks.push_back(move(done));
+            accepted = true;
+        }
+    }
+    if (!accepted) {
+        done(Result());
+        return;
+    }
+    queue_cv.notify_one();
+}
+
+/**
+ * @name submitAndWait
+ * @brief Queues a change and blocks until it is durable.
+ *
+ * @param transfer The change
+ * @return The outcome
+ */
+TransferEngine::Result TransferEngine::submitAndWait(const Transfer& transfer) {
+    promise<Result> outcome;
+    future<Result> ready = outcome.get_future();
+    submit(transfer, [&outcome](const Result& result) { outcome.set_value(result); });
+    return ready.get();
+}
+
+/**
+ * @name submitAsync
+ * @brief Returns an awaiter that queues a change and suspends the calling coroutine until
+ * it is durable. Must be awaited from a coroutine running on an EventLoop.
+ *
+ * @param transfer The change
+ * @return The awaiter, which yields the outcome
+ */
+TransferEngine::CommitAwaiter TransferEngine::submitAsync(const Transfer& transfer) {
+    return CommitAwaiter{*this, transfer, Result()};
+}
+
+/**
+ * @name await_suspend
+ * @brief Submits the change; the callback resumes the coroutine on its own loop.
+ *
+ * @param handle The waiting coroutine
+ */
+void TransferEngine::CommitAwaiter::await_suspend(coroutine_handle<> handle) {
+    EventLoop* loop = EventLoop::current();
+    engine.submit(transfer, [this, loop, handle](const Result& outcome) {
+        result = outcome;
+        loop->post(handle);
+    });
+}
+
+/**
+ * @name schedule
+ * @brief Splits a batch into waves of changes that share no account.
+ * Each change goes in the wave after the last one that touches either of its accounts,
+ * so changes to the same account are applied in the order they were submitted and the
+ * outcome is the same as applying the whole batch one change at a time.
+ *
+ * @param batch The changes, in submission order
+ * @return The indexes of the changes in each wave, waves in the order to apply them
+ */
+vector<vector<size_t>> TransferEngine::schedule(const vector<Transfer>& batch) {
+    vector<vector<size_t>> waves;
+    // Keyed by account id
+    unordered_map<uint32_t, size_t> next_wave;
+    next_wave.reserve(batch.size() * 2);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const User* accounts[2] = {batch[i].from, batch[i].to};
+        size_t wave = 0;
+        for (const User* account : accounts) {
+            if (account != nullptr) {
+                auto it = next_wave.find(account->getId());
+                if (it != next_wave.end()) {
+                    wave = max(wave, it->second);
+                }
+            }
+        }
+        for (const User* account : accounts) {
+            if (account != nullptr) {
+                next_wave[account->getId()] = wave + 1;
+            }
+        }
+        if (wave == waves.size()) {
+            waves.emplace_back();
+        }
+        waves[wave].push_back(i);
+    }
+    return waves;
+}
+
+/**
+ * @name apply
+ * @brief Applies one change to the in-memory accounts, delegating to the TransactionHandler.
+ *
+ * @param transfer The change
+ * @param change Receives the journal records of the change
+ * @return The outcome and the submitting user's new balance
+ */
+TransferEngine::Result TransferEngine::apply(const Transfer& transfer, Change& change) {
+    Result result;
+    bool credit = transfer.kind == Kind::DEPOSIT || transfer.kind == Kind::REFUND || transfer.kind == Kind::RECEIVE;
+    User* owner = credit ? transfer.to : transfer.from;
+    auto locks = database->lockAccounts(transfer.from, transfer.to);
+    // Readers of either account see the change whole or not at all
+    User* other = transfer.kind == Kind::TRANSFER ? transfer.to : nullptr;
+    owner->beginUpdate();
+    if (other != nullptr) {
+        other->beginUpdate();
+    }
+    switch (transfer.kind) {
+        case Kind::DEPOSIT:
+            TransactionHandler::handleTransaction(TransactionHandler::TransactionType::DEPOSIT, owner, transfer.amount);
+            result.success = true;
+            break;
+        case Kind::WITHDRAW:
+            // handleTransaction reports a refused withdrawal only in its message
+            result.success = transfer.amount >= 0 && owner->getBalance() >= transfer.amount;
+            if (result.success) {
+                TransactionHandler::handleTransaction(TransactionHandler::TransactionType::WITHDRAW, owner, transfer.amount);
+            }
+            break;
+        case Kind::TRANSFER: {
+            TransactionHandler transaction_handler;
+            // An account on another node is named in the history like a local one
+            int node;
+            string remote;
+            Cluster::parseRecipient(transfer.recipient, node, remote);
+            result.success = transaction_handler.handleTransfer(transfer.from, transfer.to, transfer.amount, remote);
+            // The money leaves the bank only once the payout is settled
+            if (result.success && transfer.to == nullptr) {
+                change.payout.id = database->newPayoutId();
+                change.payout.username = owner->getUsername();
+                change.payout.recipient = transfer.recipient;
+                change.payout.amount = transfer.amount;
+                // One journal line per payout
+                replace(change.payout.recipient.begin(), change.payout.recipient.end(), '\n', ' ');
+            }
+            break;
+        }
+        case Kind::REFUND: {
+            owner->updateBalance(transfer.amount);
+            int node;
+            string remote;
+            bool cross_shard = Cluster::parseRecipient(transfer.recipient, node, remote);
+            stringstream transactionLog;
+            transactionLog << getTimestamp() << " --- Refund --- $" << transfer.amount << " --- " << (cross_shard ? remote : transfer.recipient);
+            owner->addTransaction(transactionLog.str());
+            change.settled = transfer.payout;
+            result.success = true;
+            break;
+        }
+        case Kind::RECEIVE: {
+            owner->updateBalance(transfer.amount);
+            stringstream transactionLog;
+            transactionLog << getTimestamp() << " --- Transfer --- $" << transfer.amount << " --- " << transfer.recipient << " -> " << owner->getUsername();
+            owner->addTransaction(transactionLog.str());
+            change.received = transfer.payout;
+            result.success = true;
+            break;
+        }
+    }
+    if (other != nullptr) {
+        other->endUpdate();
+    }
+    owner->endUpdate();
+    result.balance = owner->getBalance();
+    if (result.success) {
+        User* changed[2] = {owner, transfer.kind == Kind::TRANSFER ? transfer.to : nullptr};
+        for (int i = 0; i < 2 && changed[i] != nullptr; ++i) {
+            change.records[i].username = changed[i]->getUsername();
+            change.records[i].balance = changed[i]->getBalance();
+            change.records[i].history = changed[i]->lastTransaction();
+        }
+    }
+    return result;
+}
+
+/**
+ * @name applyWave
+ * @brief Applies one wave, splitting large waves across the applier threads.
+ *
+ * @param batch The batch the wave belongs to
+ * @param wave Indexes of the changes in the wave
+ * @param results Receives the outcome of each change, by index
+ */
+void TransferEngine::applyWave(const vector<Transfer>& batch, const vector<size_t>& wave, vector<Result>& results) {
+    size_t chunks = min<size_t>(applier_threads, wave.size() / PARALLEL_WAVE);
+    if (chunks <= 1) {
+        for (size_t index : wave) {
+            results[index] = apply(batch[index], changes[index]);
+        }
+        return;
+    }
+    // Changes in a wave share no account, so the chunks never touch the same balance
+    latch done(chunks);
+    size_t chunk_size = (wave.size() + chunks - 1) / chunks;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        appliers.submit([&, chunk]() {
+            size_t end = min(wave.size(), (chunk + 1) * chunk_size);
+            for (size_t i = chunk * chunk_size; i < end; ++i) {
+                results[wave[i]] = apply(batch[wave[i]], changes[wave[i]]);
+            }
+            done.count_down();
+        });
+    }
+    done.wait();
+}
+
+/**
+ * @name run
+ * @brief Takes whatever has been queued as a batch, applies it wave by wave, commits it
+ * with one journal append and reports the outcomes. While a batch is being committed, new
+ * changes queue up for the next one, so the batch size grows with the load.
+ */
+void TransferEngine::run() {
+    static atomic<int64_t>& transfers_committed = Metrics::counter("transfers_committed");
+    static atomic<int64_t>& transfer_batches = Metrics::counter("transfer_batches");
+    static atomic<int64_t>& transfer_commit_failures = Metrics::counter("transfer_commit_failures");
+    vector<Transfer> batch;
+    vector<Callback> callbacks;
+    vector<Result> results;
+    vector<Journal::Record> records;
+    vector<Journal::Payout> queued_payouts;
+    vector<uint64_t> settled_payouts;
+    vector<uint64_t> received_transfers;
+    while (true) {
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]() { return !running || !queued.empty(); });
+            if (queued.empty()) {
+                return;
+            }
+            size_t count = min<size_t>(queued.size(), max_batch);
+            batch.assign(queued.begin(), queued.begin() + count);
+            callbacks.assign(make_move_iterator(queued_callbacks.begin()), make_move_iterator(queued_callbacks.begin() + count));
+            queued.erase(queued.begin(), queued.begin() + count);
+            queued_callbacks.erase(queued_callbacks.begin(), queued_callbacks.begin() + count);
+        }
+        if (failed) {
+            // Nothing more is applied once memory holds a batch the journal does not
+            for (size_t i = 0; i < batch.size(); ++i) {
+                callbacks[i](Result());
+            }
+            continue;
+        }
+
+        // Held until the batch is committed, so no snapshot sees it applied but not journaled
+        auto batch_guard = database->lockBatch();
+        results.assign(batch.size(), Result());
+        changes.assign(batch.size(), Change());
+        for (const auto& wave : schedule(batch)) {
+            applyWave(batch, wave, results);
+        }
+        // Journal the changes in submission order, which keeps each account's entries in order
+        records.clear();
+        queued_payouts.clear();
+        settled_payouts.clear();
+        received_transfers.clear();
+        for (auto& change : changes) {
+            for (auto& record : change.records) {
+                if (!record.username.empty()) {
+                    records.push_back(move(record));
+                }
+            }
+            if (change.payout.id != 0) {
+                queued_payouts.push_back(move(change.payout));
+            }
+            if (change.settled != 0) {
+                settled_payouts.push_back(change.settled);
+            }
+            if (change.received != 0) {
+                received_transfers.push_back(change.received);
+            }
+        }
+        // The outcomes are only reported once the whole batch is durable
+        bool committed = records.empty() || database->commit(records, queued_payouts, settled_payouts, received_transfers);
+        batch_guard.unlock();
+        if (!committed) {
+            ++transfer_commit_failures;
+            failed = true;
+            cerr << "Error: could not commit a batch of " << batch.size() << " balance changes; "
+                 << "no further changes will be committed" << endl;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                callbacks[i](Result());
+            }
+            continue;
+        }
+        transfers_committed += batch.size();
+        ++transfer_batches;
+        if (outbox != nullptr) {
+            for (const auto& payout : queued_payouts) {
+                outbox->add(payout);
+            }
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            results[i].committed = true;
+            callbacks[i](results[i]);
+        }
+    }
+}
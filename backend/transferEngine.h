@@ -0,0 +1,145 @@
+/**
+ * @file transferEngine.h
+ * @brief Declaration of the TransferEngine class.
+ * @author Kaden Oseen
+ */
+
+#ifndef TRANSFER_ENGINE_H
+#define TRANSFER_ENGINE_H
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "blockingPool.h"
+#include "databaseHandler.h"
+#include "eventLoop.h"
+#include "journal.h"
+#include "user.h"
+
+class Outbox;
+
+/**
+ * @class TransferEngine
+ * @brief Applies every balance change from every session, in batches.
+ * Sessions submit deposits, withdrawals and transfers to one queue. The engine takes
+ * everything queued as a batch and splits it into waves: a change goes in the wave after
+ * the last one touching either of its accounts, so each wave touches each account at most
+ * once and can be applied in parallel, while changes to the same account keep the order
+ * they were submitted in. The batch is then made durable with one append to the journal,
+ * holding every changed balance and history entry, before any session is told the outcome.
+ * If a batch cannot be made durable, its changes and every change after it are reported
+ * as failed: history entries cannot be taken back once readers may have seen them, so
+ * the engine stops committing rather than build on changes the journal does not hold.
+ */
+class TransferEngine {
+public:
+    // Kinds of balance change
+    enum class Kind : uint8_t {
+        DEPOSIT,
+        WITHDRAW,
+        TRANSFER,
+        REFUND,
+        RECEIVE
+    };
+
+    /**
+     * @struct Transfer
+     * @brief One balance change. Deposits, refunds and receipts credit to; withdrawals and
+     * transfers debit from. A transfer with no to is a payout to the external recipient (or
+     * to an account on another node), settled later by the Outbox; a refund returns the payout
+     * with the given id. A receipt credits a transfer from recipient, the sender on another
+     * node, whose cluster-wide key is given as payout.
+     */
+    struct Transfer {
+        Kind kind = Kind::TRANSFER;
+        User* from = nullptr;
+        User* to = nullptr;
+        double amount = 0;
+        std::string recipient;
+        uint64_t payout = 0;
+    };
+
+    /**
+     * @struct Result
+     * @brief The outcome of a change and the submitting user's balance right after it.
+     * A change whose batch could not be made durable is reported as not committed, and
+     * neither succeeded nor has a balance to show.
+     */
+    struct Result {
+        bool success = false;
+        double balance = 0;
+        bool committed = false;
+    };
+
+    using Callback = std::function<void(const Result& result)>;
+
+    /**
+     * @struct CommitAwaiter
+     * @brief Submits a change and resumes the coroutine on its loop once it is durable.
+     */
+    struct CommitAwaiter {
+        TransferEngine& engine;
+        Transfer transfer;
+        Result result;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        Result await_resume() const noexcept { return result; }
+    };
+
+    // Constructor and destructor
+    TransferEngine();
+    ~TransferEngine();
+    // Methods
+    void start(DatabaseHandler& database, int threads, int max_batch, Outbox* outbox = nullptr);
+    void stop();
+    void submit(const Transfer& transfer, Callback done);
+    Result submitAndWait(const Transfer& transfer);
+    CommitAwaiter submitAsync(const Transfer& transfer);
+    static std::vector<std::vector<size_t>> schedule(const std::vector<Transfer>& batch);
+private:
+    // Smallest wave worth splitting across threads
+    static const size_t PARALLEL_WAVE = 256;
+
+    /**
+     * @struct Change
+     * @brief What applying one change wrote: the accounts it changed, any payout it
+     * queued or settled, and any transfer from another node it credited.
+     */
+    struct Change {
+        Journal::Record records[2];
+        Journal::Payout payout;
+        uint64_t settled = 0;
+        uint64_t received = 0;
+    };
+
+    // Variables
+    DatabaseHandler* database;
+    Outbox* outbox;
+    int max_batch;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::vector<Transfer> queued;
+    std::vector<Callback> queued_callbacks;
+    // What each change of the batch being applied wrote
+    std::vector<Change> changes;
+    bool running;
+    // Set by stop(), so a later change fails instead of waiting for a committer that is gone
+    bool stopped;
+    // Set once a batch could not be committed (used by the committer thread only)
+    bool failed;
+    std::thread committer;
+    BlockingPool appliers;
+    int applier_threads;
+
+    // Methods
+    void run();
+    void applyWave(const std::vector<Transfer>& batch, const std::vector<size_t>& wave, std::vector<Result>& results);
+    Result apply(const Transfer& transfer, Change& change);
+};
+
+#endif
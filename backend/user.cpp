@@ -17,7 +17,7 @@ using namespace std;
  * @param balance The balance of the user.
  */
 User::User(const string& username, const string& password, double balance)
-    : username(username), password(password), balance(balance) {}
+    : username(username), password(password), version(0), balance(balance), opening(balance), columns(nullptr), id(0) {}
 
 /**
  * @name getUsername
@@ -25,7 +25,7 @@ User::User(const string& username, const string& password, double balance)
  * 
  * @return The username of the user.
  */
-string User::getUsername() const {
+const string& User::getUsername() const {
     return username;
 }
 
@@ -35,7 +35,7 @@ string User::getUsername() const {
  * 
  * @return The password of the user.
  */
-string User::getPassword() const {
+const string& User::getPassword() const {
     return password;
 }
 
@@ -46,7 +46,45 @@ string User::getPassword() const {
  * @return The balance of the user.
  */
 double User::getBalance() const {
-    return balance;
+    return balance.load(memory_order_relaxed);
+}
+
+/**
+ * @name getOpening
+ * @brief Returns the balance the account had before its oldest transaction log entry.
+ * 
+ * @return The opening balance.
+ */
+double User::getOpening() const {
+    return opening;
+}
+
+/**
+ * @name historyNet
+ * @brief Adds up the money in minus the money out over the whole transaction log. Only
+ * for the holder of the account's lock.
+ * 
+ * @return The net in cents.
+ */
+int64_t User::historyNet() const {
+    int64_t net = 0;
+    size_t entries = transactionLog.view().size();
+    for (size_t position = 0; position < entries; ++position) {
+        const HistoryLog::Record& record = transactionLog.record(position);
+        net += HistoryLog::sign(record.type) * BalanceColumns::toCents(record.amount);
+    }
+    return net;
+}
+
+/**
+ * @name getId
+ * @brief Returns the account's id: its position in the balance column it is attached
+ * to, which the database also uses to find the account (see DatabaseHandler::userById).
+ * 
+ * @return The id, 0 if the user is not attached.
+ */
+uint32_t User::getId() const {
+    return id;
 }
 
 /**
@@ -56,7 +94,20 @@ double User::getBalance() const {
  * @param amount The amount to update the balance with.
  */
 void User::updateBalance(double amount) {
-    balance += amount;
+    setBalance(balance.load(memory_order_relaxed) + amount);
+}
+
+/**
+ * @name setBalance
+ * @brief Sets the balance of the user, as recovered from the journal.
+ * 
+ * @param balance The new balance.
+ */
+void User::setBalance(double balance) {
+    this->balance.store(balance, memory_order_relaxed);
+    if (columns != nullptr) {
+        columns->set(id, BalanceColumns::toCents(balance));
+    }
 }
 
 /**
@@ -68,13 +119,107 @@ void User::updateBalance(double amount) {
 string User::getTransactionLog() const {
     std::string result;
 
-    for (const auto& entry : transactionLog) {
+    for (const auto& entry : transactionLog.view()) {
         result += entry + "\n";
     }
 
     return result;
 }
 
+/**
+ * @name getTransactions
+ * @brief Returns the transaction log entries of the user, without copying them.
+ * 
+ * @return The transaction log entries written so far, oldest first.
+ */
+HistoryLog::View User::getTransactions() const {
+    return transactionLog.view();
+}
+
+/**
+ * @name lastTransaction
+ * @brief Returns the newest transaction log entry. Only for the holder of the account's
+ * lock, and only if the log is not empty.
+ * 
+ * @return The newest entry.
+ */
+const string& User::lastTransaction() const {
+    return transactionLog.back();
+}
+
+/**
+ * @name snapshot
+ * @brief Reads the balance and transaction log as of one moment, without locking.
+ * Retries while an update is in progress or if one happened during the read.
+ * 
+ * @return The balance and the log entries that led to it.
+ */
+User::Snapshot User::snapshot() const {
+    while (true) {
+        uint32_t before = version.load(memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        Snapshot snapshot = {balance.load(memory_order_relaxed), transactionLog.view()};
+        atomic_thread_fence(memory_order_acquire);
+        if (version.load(memory_order_relaxed) == before) {
+            return snapshot;
+        }
+    }
+}
+
+/**
+ * @name getTransactionRecord
+ * @brief Returns the parsed fields of one transaction log entry, without locking.
+ * 
+ * @param position The entry, counted from the oldest; must be in a snapshot() already taken
+ * @return The entry's time, amount, type and text.
+ */
+const HistoryLog::Record& User::getTransactionRecord(size_t position) const {
+    return transactionLog.record(position);
+}
+
+/**
+ * @name findTransactions
+ * @brief Finds the transaction log entries that match a query, through the log's indexes,
+ * so the time taken depends on how many match rather than on the length of the log.
+ * 
+ * @param history The entries to search, from snapshot()
+ * @param query The conditions
+ * @return The matching entries, oldest first.
+ */
+vector<const string*> User::findTransactions(const HistoryLog::View& history, const HistoryLog::Query& query) const {
+    return transactionLog.query(history, query);
+}
+
+/**
+ * @name beginUpdate
+ * @brief Starts a change to the balance and log; readers wait until endUpdate().
+ * Must hold the account's lock.
+ */
+void User::beginUpdate() {
+    version.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @name endUpdate
+ * @brief Ends a change started by beginUpdate() and publishes it to readers.
+ */
+void User::endUpdate() {
+    version.fetch_add(1, memory_order_release);
+}
+
+/**
+ * @name setOpening
+ * @brief Sets the balance the account had before its oldest transaction log entry.
+ * 
+ * @param opening The opening balance.
+ */
+void User::setOpening(double opening) {
+    this->opening = opening;
+}
+
 /**
  * @name addTransaction
  * @brief Adds a transaction to the transaction log of the user.
@@ -82,5 +227,17 @@ string User::getTransactionLog() const {
  * @param transaction The transaction to add to the transaction log.
  */
 void User::addTransaction(const string& transaction) {
-    transactionLog.push_back(transaction);
+    transactionLog.append(transaction, username);
+}
+
+/**
+ * @name attach
+ * @brief Adds the account to a balance column, which is kept up to date with the balance
+ * from then on. Called once, as the account is added to the database.
+ * 
+ * @param columns The column
+ */
+void User::attach(BalanceColumns& columns) {
+    id = columns.add(BalanceColumns::toCents(getBalance()));
+    this->columns = &columns;
 }
@@ -10,10 +10,17 @@
 #include <string>
 #include <vector>
 #include <iomanip>
+#include <atomic>
+#include <cstdint>
+#include "historyLog.h"
+#include "balanceColumns.h"
 
 /**
  * @class User
  * @brief Class for storing user data.
+ * The balance and history are changed only under the account's lock, inside
+ * beginUpdate()/endUpdate(). snapshot() reads both without any lock: a sequence counter
+ * that is odd while an update is in progress tells a reader to try again.
  * 
  * @param username The username of the user.
  * @param password The password of the user.
@@ -21,27 +28,59 @@
  */
 class User {
 public:
+    /**
+     * @struct Snapshot
+     * @brief A balance and the history that led to it, as of the same moment.
+     */
+    struct Snapshot {
+        double balance;
+        HistoryLog::View history;
+    };
+
     // Constructors
-    User() : username(""), password(""), balance(0.0) {}
+    User() : username(""), password(""), version(0), balance(0.0), opening(0.0), columns(nullptr), id(0) {}
     User(const std::string& username, const std::string& password, double balance);
+    User(const User&) = delete;
+    User& operator=(const User&) = delete;
     
     // Getters
-    std::string getUsername() const;
-    std::string getPassword() const;
+    const std::string& getUsername() const;
+    const std::string& getPassword() const;
     double getBalance() const;
+    double getOpening() const;
+    int64_t historyNet() const;
+    uint32_t getId() const;
     std::string getTransactionLog() const;
+    HistoryLog::View getTransactions() const;
+    const std::string& lastTransaction() const;
+    Snapshot snapshot() const;
+    const HistoryLog::Record& getTransactionRecord(size_t position) const;
+    std::vector<const std::string*> findTransactions(const HistoryLog::View& history, const HistoryLog::Query& query) const;
 
     // Setters
+    void beginUpdate();
+    void endUpdate();
     void updateBalance(double amount);
+    void setBalance(double balance);
+    void setOpening(double opening);
     void addTransaction(const std::string& transaction);
+    void attach(BalanceColumns& columns);
 
 private:
     // Private variables
     // add recipient list
     std::string username;
     std::string password;
-    double balance;
-    std::vector<std::string> transactionLog;
+    // Odd while an update is in progress
+    std::atomic<uint32_t> version;
+    std::atomic<double> balance;
+    // The balance before the oldest history entry, so the balance is always this plus the
+    // history's net; set when the account is created or loaded
+    double opening;
+    HistoryLog transactionLog;
+    // The column the balance is mirrored to, in cents, and the account's id in it
+    BalanceColumns* columns;
+    uint32_t id;
 };
 
 
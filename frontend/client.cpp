@@ -7,6 +7,8 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdio>
+#include <string>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -20,33 +22,32 @@ const int PORT = 3001;
 const char* SERVER_IP = "INSERT_IP_HERE";
 
 /**
- * @brief Connects to the NLP Banking server using TLS and interacts with the user through the terminal.
- * 
- * @return int Exit code.
+ * @brief Connects to a server and completes the TLS handshake.
+ *
+ * @param ssl_ctx The TLS configuration.
+ * @param ip The IP address of the server.
+ * @param port The port of the server.
+ * @param client_socket Receives the connected socket.
+ * @return SSL* The TLS connection, or nullptr if it could not be established.
  */
-int main() {
-    // Initialize the OpenSSL library and load the necessary algorithms and error messages
-    SSL_library_init();
-    SSL_load_error_strings();
-    OpenSSL_add_all_algorithms();
-
+SSL* open_connection(SSL_CTX* ssl_ctx, const char* ip, int port, int& client_socket) {
     // Create a socket for the client to use
-    int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+    client_socket = socket(AF_INET, SOCK_STREAM, 0);
 
     // Check if socket was created successfully
     if (client_socket < 0) {
         cerr << "Error: client socket creation failed" << endl;
-        return 1;
+        return nullptr;
     }
 
     // Create a struct for the server address to connect to
     struct sockaddr_in server_address;
     memset(&server_address, 0, sizeof(server_address));
     server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(PORT);
+    server_address.sin_port = htons(port);
 
     // Set the IP address of the server
-    server_address.sin_addr.s_addr = inet_addr(SERVER_IP);
+    server_address.sin_addr.s_addr = inet_addr(ip);
 
     // Attempt to connect to the server with the given address
     int connect_result = connect(client_socket, (struct sockaddr*)&server_address, sizeof(server_address));
@@ -54,17 +55,7 @@ int main() {
     // Check if the connection was successful
     if (connect_result < 0) {
         cerr << "Failed to connect to server\n";
-        return 1;
-    }
-
-    // Create a context object to hold the TLS configuration
-    SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_client_method());
-
-
-    // Load the server's certificate
-    if (SSL_CTX_load_verify_locations(ssl_ctx, "server.crt", nullptr) != 1) {
-        cerr << "Failed to load server certificate" << endl;
-        return 1;
+        return nullptr;
     }
 
     // Create a secure socket object for the client to use
@@ -80,11 +71,114 @@ int main() {
     if (ssl_connect_result != 1) {
         cerr << "Failed to establish TLS connection\n";
         cerr << "SSL state: " << SSL_state_string(ssl) << endl;
+        SSL_free(ssl);
+        return nullptr;
+    }
+    return ssl;
+}
+
+/**
+ * @brief Reads more bytes from the server.
+ *
+ * @param ssl The TLS connection.
+ * @param received The bytes read so far, appended to.
+ * @return true if bytes were read, false if the connection closed.
+ */
+bool read_more(SSL* ssl, string& received) {
+    char buffer[16384];
+    int bytes_received = SSL_read(ssl, buffer, sizeof(buffer));
+    if (bytes_received <= 0) {
+        return false;
+    }
+    received.append(buffer, bytes_received);
+    return true;
+}
+
+/**
+ * @brief Receives a statement export. The server sends chunks of "108 <format> <first entry>
+ * <entries> <bytes>" on a line followed by that many bytes, which are written to
+ * statement.csv or statement.bin (appended to when the export resumes from a later entry),
+ * until a chunk with no entries, whose bytes are the server's next message.
+ *
+ * @param ssl The TLS connection.
+ * @param received The bytes of the first chunk read so far, starting with its header.
+ * @return The server's message after the export, or "" if the connection closed.
+ */
+string receive_statement(SSL* ssl, string received) {
+    FILE* statement = nullptr;
+    while (true) {
+        // The header, after the newline every message starts with
+        size_t header_end;
+        while ((header_end = received.find('\n', 1)) == string::npos) {
+            if (!read_more(ssl, received)) {
+                return "";
+            }
+        }
+        char format[16];
+        size_t first, entries, bytes;
+        if (sscanf(received.c_str(), "\n108 %15s %zu %zu %zu", format, &first, &entries, &bytes) != 4) {
+            cerr << "Invalid statement chunk" << endl;
+            return "";
+        }
+        while (received.size() < header_end + 1 + bytes) {
+            if (!read_more(ssl, received)) {
+                return "";
+            }
+        }
+        string payload = received.substr(header_end + 1, bytes);
+        received.erase(0, header_end + 1 + bytes);
+        if (entries == 0) {
+            if (statement != nullptr) {
+                fclose(statement);
+            }
+            return payload;
+        }
+        if (statement == nullptr) {
+            string path = strcmp(format, "csv") == 0 ? "statement.csv" : "statement.bin";
+            statement = fopen(path.c_str(), first == 0 ? "wb" : "ab");
+            if (statement == nullptr) {
+                cerr << "Could not write " << path << endl;
+                return "";
+            }
+            cout << "Saving statement to " << path << " from entry " << first << "..." << endl;
+        }
+        fwrite(payload.data(), 1, payload.size(), statement);
+    }
+}
+
+/**
+ * @brief Connects to the NLP Banking server using TLS and interacts with the user through the terminal.
+ * 
+ * @return int Exit code.
+ */
+int main() {
+    // Initialize the OpenSSL library and load the necessary algorithms and error messages
+    SSL_library_init();
+    SSL_load_error_strings();
+    OpenSSL_add_all_algorithms();
+
+    // Create a context object to hold the TLS configuration
+    SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_client_method());
+
+
+    // Load the server's certificate
+    if (SSL_CTX_load_verify_locations(ssl_ctx, "server.crt", nullptr) != 1) {
+        cerr << "Failed to load server certificate" << endl;
+        return 1;
+    }
+
+    // Connect to the server
+    int client_socket;
+    SSL* ssl = open_connection(ssl_ctx, SERVER_IP, PORT, client_socket);
+    if (ssl == nullptr) {
         return 1;
     }
 
     // Set finished flag to false to indicate session has started
     bool finished = false;
+    // The login choice and the last message sent, repeated if the server redirects the client
+    string login_choice = "";
+    string last_message = "";
 
     // Loop while session is ongoing
     while (!finished){
@@ -93,13 +187,13 @@ int main() {
         memset(message, 0, sizeof(message));
 
         // Receive response from server using SSL_read() function
-        int bytes_received = SSL_read(ssl, message, 1024);
-        message[bytes_received] = '\0';
+        int bytes_received = SSL_read(ssl, message, sizeof(message) - 1);
 
         // Check if no bytes were received (connection closed)
-        if (bytes_received == 0){
+        if (bytes_received <= 0){
             break;
         }
+        message[bytes_received] = '\0';
 
         // Check if message is a special code indicating user is already logged in
         if(strcmp(message, "\n101") == 0){
@@ -121,9 +215,37 @@ int main() {
             cout << "Too many login attempts, exiting..." << endl;
             break;
         }
+        // Check if message is a special code sending the client to the server that holds the account
+        else if(strncmp(message, "\n107 ", 5) == 0){
+            string address = message + 5;
+            string ip = address.substr(0, address.find(':'));
+            int port = atoi(address.substr(address.find(':') + 1).c_str());
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+            close(client_socket);
+            ssl = open_connection(ssl_ctx, ip.c_str(), port, client_socket);
+            if (ssl == nullptr) {
+                return 1;
+            }
+            // Repeat the login choice and the username; the reply to the username is shown as usual
+            for (const string& repeated : {login_choice, last_message}) {
+                SSL_read(ssl, message, 1024);
+                SSL_write(ssl, repeated.c_str(), repeated.size());
+            }
+            continue;
+        }
+
+        // A statement export arrives in chunks, saved to a file, then the next message
+        string text = message;
+        if (strncmp(message, "\n108 ", 5) == 0) {
+            text = receive_statement(ssl, string(message, bytes_received));
+            if (text.empty()) {
+                break;
+            }
+        }
 
         // Print server response to console
-        cout << message << endl;
+        cout << text << endl;
 
         // Get user input from console
         cin.getline(message, 1024);
@@ -142,6 +264,10 @@ int main() {
 
         // Send user input to server using SSL_write() function
         int send_result = SSL_write(ssl, message, strlen(message));
+        if (login_choice.empty()) {
+            login_choice = message;
+        }
+        last_message = message;
 
         // Check if message was sent successfully
         if (send_result == -1) {
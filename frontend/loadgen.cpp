@@ -0,0 +1,866 @@
+/**
+ * @file loadgen.cpp
+ * @brief Load generator and soak test for the NLP Banking server.
+ * Opens many concurrent TLS sessions that log in and replay a configurable mix of deposits,
+ * withdrawals, transfers, balance, history and statement export requests in menu or NLP mode, using the same
+ * message protocol as client.cpp. Can stand in for the NLP API with a local stub.
+ * Reports throughput, latency percentiles per operation and the special codes seen, and
+ * checks that the total money held by the bank is conserved.
+ *
+ * Usage: ./loadgen --accounts=<user:password file> [--key=value ...], see print_usage for options.
+ * @author Kaden Oseen
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+using namespace std;
+
+// Operations a virtual user can perform, in report order
+enum Operation { LOGIN, DEPOSIT, WITHDRAW, TRANSFER, BALANCE, HISTORY, EXPORT, LOGOUT, OPERATION_COUNT };
+static const char* OPERATION_NAMES[OPERATION_COUNT] = {
+    "login", "deposit", "withdraw", "transfer", "balance", "history", "export", "logout"
+};
+
+// Special codes sent by the server in place of a message (107 is followed by the address
+// of the cluster node that owns the account)
+static const char* CODES[] = {"101", "104", "105", "106", "107"};
+
+/**
+ * @struct Options
+ * @brief Command line settings for a run.
+ */
+struct Options {
+    string host = "127.0.0.1";
+    int port = 3001;
+    string accounts = "";
+    int create = 0;
+    int sessions = 50;
+    int seconds = 30;
+    int ops_per_session = 20;
+    string mode = "menu";
+    string mix = "deposit:25,withdraw:20,transfer:25,balance:20,history:10";
+    int nlp_stub_port = 0;
+    int nlp_stub_fail_percent = 0;
+    int nlp_stub_slow_percent = 0;
+    int nlp_stub_slow_ms = 10000;
+    int max_amount = 50;
+};
+
+/**
+ * @struct Account
+ * @brief Credentials for one bank account used by the run.
+ */
+struct Account {
+    string username;
+    string password;
+};
+
+/**
+ * @struct Stats
+ * @brief Results collected by every virtual user, merged under a mutex.
+ */
+struct Stats {
+    mutex stats_mutex;
+    vector<double> latencies[OPERATION_COUNT];
+    int64_t failures[OPERATION_COUNT] = {0};
+    map<string, int64_t> codes;
+    double deposited = 0;
+    double withdrawn = 0;
+    int64_t nlp_fallbacks = 0;
+    int64_t exported_entries = 0;
+};
+
+static Options options;
+static vector<Account> accounts;
+static mutex pool_mutex;
+static vector<int> free_accounts;
+static Stats stats;
+static SSL_CTX* ssl_ctx = nullptr;
+
+/**
+ * @class Connection
+ * @brief One TLS connection to the server, speaking the client.cpp protocol.
+ */
+class Connection {
+public:
+    Connection() : client_socket(-1), ssl(nullptr) {}
+    ~Connection() {
+        disconnect();
+    }
+
+    /**
+     * @brief Connects to the server given on the command line and completes the TLS handshake.
+     * @return true if connected
+     */
+    bool open() {
+        return open(options.host, options.port);
+    }
+
+    /**
+     * @brief Connects to a server and completes the TLS handshake.
+     * @param host The server's IP address
+     * @param port The server's port
+     * @return true if connected
+     */
+    bool open(const string& host, int port) {
+        client_socket = socket(AF_INET, SOCK_STREAM, 0);
+        int enable = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        struct sockaddr_in server_address;
+        memset(&server_address, 0, sizeof(server_address));
+        server_address.sin_family = AF_INET;
+        server_address.sin_port = htons(port);
+        server_address.sin_addr.s_addr = inet_addr(host.c_str());
+        if (connect(client_socket, (struct sockaddr*) &server_address, sizeof(server_address)) < 0) {
+            return false;
+        }
+        ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(ssl, client_socket);
+        return SSL_connect(ssl) == 1;
+    }
+
+    /**
+     * @brief Follows a "107 <host>:<port>" redirect to the cluster node that owns an account.
+     * @param reply The redirect
+     * @return true if connected to the new node
+     */
+    bool redirect(const string& reply) {
+        size_t colon = reply.rfind(':');
+        if (colon == string::npos) {
+            return false;
+        }
+        disconnect();
+        return open(reply.substr(4, colon - 4), atoi(reply.c_str() + colon + 1));
+    }
+
+    /**
+     * @brief Receives one server message, including any records already buffered behind it.
+     * @return The message without its leading newline, or "" if the connection closed
+     */
+    string receive() {
+        char buffer[16384];
+        string message = "";
+        do {
+            int bytes_received = SSL_read(ssl, buffer, sizeof(buffer));
+            if (bytes_received <= 0) {
+                return message;
+            }
+            message.append(buffer, bytes_received);
+        } while (SSL_pending(ssl) > 0);
+        if (message.size() > 0 && message[0] == '\n') {
+            message.erase(0, 1);
+        }
+        return message;
+    }
+
+    /**
+     * @brief Receives a statement export: chunks of "108 <format> <first entry> <entries>
+     * <bytes>" on a line followed by that many bytes, until the chunk with no entries, whose
+     * bytes are the server's next message.
+     * @param entries Receives the number of entries exported
+     * @return The message after the export, or "" if the connection closed or the chunks
+     * were not consecutive
+     */
+    string receive_statement(size_t& entries) {
+        char buffer[16384];
+        string received = "";
+        size_t expected = string::npos;
+        entries = 0;
+        while (true) {
+            size_t header_end = received.find('\n', 1);
+            size_t first = 0, count = 0, bytes = 0;
+            // A reply that is not a chunk is the server refusing the export
+            if (header_end != string::npos && sscanf(received.c_str(), "\n108 %*s %zu %zu %zu", &first, &count, &bytes) != 3) {
+                return "";
+            }
+            if (header_end == string::npos || received.size() < header_end + 1 + bytes) {
+                int bytes_received = SSL_read(ssl, buffer, sizeof(buffer));
+                if (bytes_received <= 0) {
+                    return "";
+                }
+                received.append(buffer, bytes_received);
+                continue;
+            }
+            if (expected != string::npos && first != expected) {
+                return "";
+            }
+            expected = first + count;
+            entries += count;
+            if (count == 0) {
+                return received.substr(header_end + 1, bytes);
+            }
+            received.erase(0, header_end + 1 + bytes);
+        }
+    }
+
+    /**
+     * @brief Sends one message to the server.
+     * @param message The message to send
+     * @return true if it was sent
+     */
+    bool send(const string& message) {
+        return SSL_write(ssl, message.c_str(), message.size()) > 0;
+    }
+
+    /**
+     * @brief Sends a message and returns the reply.
+     * @param message The message to send
+     * @return The reply, or "" if the connection failed
+     */
+    string exchange(const string& message) {
+        if (!send(message)) {
+            return "";
+        }
+        return receive();
+    }
+
+private:
+    int client_socket;
+    SSL* ssl;
+
+    /**
+     * @brief Closes the connection, if open.
+     */
+    void disconnect() {
+        if (ssl != nullptr) {
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+            ssl = nullptr;
+        }
+        if (client_socket >= 0) {
+            close(client_socket);
+            client_socket = -1;
+        }
+    }
+};
+
+/**
+ * @brief Records a special code if the message is one.
+ * @param message A server message
+ * @return true if the message was a special code
+ */
+static bool record_code(const string& message) {
+    for (const char* code : CODES) {
+        if (message == code || (message.rfind(code, 0) == 0 && message[3] == ' ')) {
+            lock_guard<mutex> guard(stats.stats_mutex);
+            stats.codes[code]++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Extracts the first number following a marker in a message.
+ * @param message The server message
+ * @param marker Text that precedes the number
+ * @return The number, or NAN if it is not present
+ */
+static double number_after(const string& message, const string& marker) {
+    size_t position = message.find(marker);
+    if (position == string::npos) {
+        return NAN;
+    }
+    try {
+        return stod(message.substr(position + marker.size()));
+    } catch (const exception& e) {
+        return NAN;
+    }
+}
+
+/**
+ * @brief Takes a random account that no other virtual user is logged in to.
+ * @param generator Random number generator of the calling thread
+ * @return The account index, or -1 if all are in use
+ */
+static int acquire_account(mt19937& generator) {
+    lock_guard<mutex> guard(pool_mutex);
+    if (free_accounts.empty()) {
+        return -1;
+    }
+    size_t pick = uniform_int_distribution<size_t>(0, free_accounts.size() - 1)(generator);
+    int account = free_accounts[pick];
+    free_accounts[pick] = free_accounts.back();
+    free_accounts.pop_back();
+    return account;
+}
+
+/**
+ * @brief Returns an account to the pool.
+ * @param account The account index
+ */
+static void release_account(int account) {
+    lock_guard<mutex> guard(pool_mutex);
+    free_accounts.push_back(account);
+}
+
+/**
+ * @brief Sends the login or create choice and then the username, following a redirect to
+ * the cluster node that owns the account.
+ * @param connection An open connection that has received the welcome
+ * @param choice "1" to log in, "2" to create the account
+ * @param username The account
+ * @return The reply to the username
+ */
+static string send_username(Connection& connection, const string& choice, const string& username) {
+    connection.exchange(choice);
+    string reply = connection.exchange(username);
+    if (reply.rfind("107 ", 0) == 0 && record_code(reply)) {
+        if (!connection.redirect(reply) || connection.receive().find("Welcome") == string::npos) {
+            return "";
+        }
+        connection.exchange(choice);
+        reply = connection.exchange(username);
+    }
+    return reply;
+}
+
+/**
+ * @brief Logs in to an account and picks menu or NLP prompts.
+ * @param connection An open connection that has not received the welcome yet
+ * @param account The account to log in to
+ * @param nlp Whether to ask for natural language prompts
+ * @return true if the session is ready for requests
+ */
+static bool login(Connection& connection, const Account& account, bool nlp) {
+    if (connection.receive().find("Welcome") == string::npos) {
+        return false;
+    }
+    if (send_username(connection, "1", account.username).find("Password") == string::npos) {
+        return false;
+    }
+    string reply = connection.exchange(account.password);
+    if (record_code(reply) || reply.find("Successfully logged in") == string::npos) {
+        return false;
+    }
+    return connection.exchange(nlp ? "y" : "n").find("Welcome") != string::npos;
+}
+
+/**
+ * @brief Creates a new account through the normal client dialog.
+ * @param account The credentials to create
+ * @return true if the account was created
+ */
+static bool create_account(const Account& account) {
+    Connection connection;
+    if (!connection.open() || connection.receive().find("Welcome") == string::npos) {
+        return false;
+    }
+    send_username(connection, "2", account.username);
+    string reply = connection.exchange(account.password);
+    if (record_code(reply) || reply.find("Successfully logged in") == string::npos) {
+        return false;
+    }
+    connection.exchange("n");
+    connection.send("exit");
+    return true;
+}
+
+/**
+ * @brief Performs one banking operation through the menu or NLP dialog.
+ * @param connection A logged in connection
+ * @param operation The operation to perform
+ * @param self Index of the logged in account
+ * @param nlp Whether the session uses natural language prompts; cleared if the server
+ * moves the session to the menu because the NLP API is unavailable
+ * @param generator Random number generator of the calling thread
+ * @return true if the server answered as expected
+ */
+static bool perform(Connection& connection, Operation operation, int self, bool& nlp, mt19937& generator) {
+    int amount = uniform_int_distribution<int>(1, options.max_amount)(generator);
+    string value = to_string(amount);
+    string reply;
+    // The server answers a failed NLP request with the menu instead of doing anything
+    auto fell_back = [&]() {
+        if (!nlp || reply.find("switching to the menu") == string::npos) {
+            return false;
+        }
+        nlp = false;
+        lock_guard<mutex> guard(stats.stats_mutex);
+        ++stats.nlp_fallbacks;
+        return true;
+    };
+    switch (operation) {
+        case DEPOSIT:
+            reply = nlp ? connection.exchange("I would like to deposit " + value + " dollars")
+                        : (connection.exchange("2"), connection.exchange(value));
+            if (fell_back()) {
+                return true;
+            }
+            if (reply.find("Are you sure") == string::npos) {
+                return false;
+            }
+            reply = connection.exchange("y");
+            if (reply.find("Deposit successful") != string::npos) {
+                lock_guard<mutex> guard(stats.stats_mutex);
+                stats.deposited += amount;
+                return true;
+            }
+            return false;
+        case WITHDRAW:
+            reply = nlp ? connection.exchange("please withdraw " + value + " dollars")
+                        : (connection.exchange("3"), connection.exchange(value));
+            if (fell_back()) {
+                return true;
+            }
+            if (reply.find("Are you sure") == string::npos) {
+                return false;
+            }
+            reply = connection.exchange("y");
+            if (reply.find("Withdrawal successful") != string::npos) {
+                lock_guard<mutex> guard(stats.stats_mutex);
+                stats.withdrawn += amount;
+                return true;
+            }
+            return reply.find("Insufficient funds") != string::npos;
+        case TRANSFER: {
+            int recipient = uniform_int_distribution<int>(0, accounts.size() - 1)(generator);
+            if (recipient == self) {
+                recipient = (recipient + 1) % accounts.size();
+            }
+            reply = nlp ? connection.exchange("transfer " + value + " dollars to a friend")
+                        : (connection.exchange("4"), connection.exchange(value));
+            if (fell_back()) {
+                return true;
+            }
+            if (reply.find("Who would you like to transfer to") == string::npos) {
+                return false;
+            }
+            if (connection.exchange("1").find("username") == string::npos) {
+                return false;
+            }
+            reply = connection.exchange(accounts[recipient].username);
+            if (reply.find("Are you sure") == string::npos) {
+                return false;
+            }
+            reply = connection.exchange("y");
+            return reply.find("successful") != string::npos || reply.find("Insufficient funds") != string::npos;
+        }
+        case BALANCE:
+            reply = connection.exchange(nlp ? "what is my balance" : "1");
+            return fell_back() || !isnan(number_after(reply, "Your balance is: "));
+        case HISTORY:
+            reply = connection.exchange(nlp ? "show me my transaction history" : "5");
+            return fell_back() || reply.find("Transaction Log") != string::npos || reply.find("no transactions") != string::npos;
+        case EXPORT: {
+            // The export command is understood in both modes
+            size_t entries;
+            if (!connection.send("export csv")) {
+                return false;
+            }
+            reply = connection.receive_statement(entries);
+            if (reply.find("Statement exported") == string::npos) {
+                return false;
+            }
+            lock_guard<mutex> guard(stats.stats_mutex);
+            stats.exported_entries += entries;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Reads the balance of every account, a few accounts at a time in parallel.
+ * Retries briefly, since a session that was just dropped may still hold its login (101).
+ * @return The balance of each account, NAN where it could not be read
+ */
+static vector<double> read_balances() {
+    vector<double> balances(accounts.size(), NAN);
+    atomic<size_t> next(0);
+    vector<thread> readers;
+    for (int i = 0; i < 16; ++i) {
+        readers.emplace_back([&]() {
+            for (size_t index = next++; index < accounts.size(); index = next++) {
+                for (int attempt = 0; attempt < 5 && isnan(balances[index]); ++attempt) {
+                    if (attempt > 0) {
+                        this_thread::sleep_for(chrono::milliseconds(200));
+                    }
+                    Connection connection;
+                    if (connection.open() && login(connection, accounts[index], false)) {
+                        balances[index] = number_after(connection.exchange("1"), "Your balance is: ");
+                        connection.exchange("7");
+                    }
+                }
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    return balances;
+}
+
+/**
+ * @brief Body of one virtual user: repeatedly logs in, runs a batch of operations and logs out.
+ * @param argument Pointer to the deadline of the run
+ * @return nullptr
+ */
+static void* virtual_user(void* argument) {
+    auto deadline = *static_cast<chrono::steady_clock::time_point*>(argument);
+    mt19937 generator(random_device{}());
+
+    // Cumulative weights for picking operations
+    vector<pair<Operation, int>> weights;
+    int total_weight = 0;
+    stringstream mix(options.mix);
+    string entry;
+    while (getline(mix, entry, ',')) {
+        string name = entry.substr(0, entry.find(':'));
+        int weight = stoi(entry.substr(entry.find(':') + 1));
+        for (int operation = DEPOSIT; operation <= EXPORT; ++operation) {
+            if (name == OPERATION_NAMES[operation]) {
+                total_weight += weight;
+                weights.push_back({static_cast<Operation>(operation), total_weight});
+            }
+        }
+    }
+
+    while (chrono::steady_clock::now() < deadline) {
+        int account = acquire_account(generator);
+        if (account < 0) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            continue;
+        }
+        bool nlp = options.mode == "nlp" || (options.mode == "mixed" && generator() % 2 == 0);
+
+        Connection connection;
+        auto started = chrono::steady_clock::now();
+        bool ok = connection.open() && login(connection, accounts[account], nlp);
+        auto finished = chrono::steady_clock::now();
+        {
+            lock_guard<mutex> guard(stats.stats_mutex);
+            stats.latencies[LOGIN].push_back(chrono::duration<double, milli>(finished - started).count());
+            stats.failures[LOGIN] += ok ? 0 : 1;
+        }
+
+        for (int i = 0; ok && i < options.ops_per_session && chrono::steady_clock::now() < deadline; ++i) {
+            int roll = uniform_int_distribution<int>(1, total_weight)(generator);
+            Operation operation = lower_bound(weights.begin(), weights.end(), roll,
+                [](const pair<Operation, int>& weight, int value) { return weight.second < value; })->first;
+            started = chrono::steady_clock::now();
+            ok = perform(connection, operation, account, nlp, generator);
+            finished = chrono::steady_clock::now();
+            lock_guard<mutex> guard(stats.stats_mutex);
+            stats.latencies[operation].push_back(chrono::duration<double, milli>(finished - started).count());
+            stats.failures[operation] += ok ? 0 : 1;
+        }
+
+        if (ok) {
+            started = chrono::steady_clock::now();
+            string reply = connection.exchange(nlp ? "logout" : "7");
+            finished = chrono::steady_clock::now();
+            bool logged_out = record_code(reply) && reply == "105";
+            lock_guard<mutex> guard(stats.stats_mutex);
+            stats.latencies[LOGOUT].push_back(chrono::duration<double, milli>(finished - started).count());
+            stats.failures[LOGOUT] += logged_out ? 0 : 1;
+        }
+        release_account(account);
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Guesses the (action,amount) answer the NLP API would give for a message.
+ * @param text The user message
+ * @return The model answer in the server's expected format
+ */
+static string stub_answer(string text) {
+    transform(text.begin(), text.end(), text.begin(), ::tolower);
+    static const char* ACTIONS[] = {"deposit", "withdraw", "transfer", "balance", "history", "options", "logout"};
+    string action = "unknown";
+    for (const char* candidate : ACTIONS) {
+        if (text.find(candidate) != string::npos) {
+            action = candidate;
+            break;
+        }
+    }
+    if (text.find("back") != string::npos || text.find("regular") != string::npos) {
+        action = "backwards";
+    }
+    string amount = "0";
+    if (action == "deposit" || action == "withdraw" || action == "transfer") {
+        size_t digit = text.find_first_of("0123456789");
+        amount = digit == string::npos ? "-1" : text.substr(digit, text.find_first_not_of("0123456789.", digit) - digit);
+    }
+    return "(" + action + "," + amount + ")";
+}
+
+/**
+ * @brief Serves one request to the NLP stub.
+ * @param client The accepted connection
+ */
+static void stub_request(int client) {
+    string request = "";
+    char buffer[8192];
+    size_t header_end = string::npos;
+    size_t content_length = 0;
+    while (true) {
+        ssize_t bytes_received = recv(client, buffer, sizeof(buffer), 0);
+        if (bytes_received <= 0) {
+            close(client);
+            return;
+        }
+        request.append(buffer, bytes_received);
+        if (header_end == string::npos && (header_end = request.find("\r\n\r\n")) != string::npos) {
+            string headers = request.substr(0, header_end);
+            transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+            size_t length = headers.find("content-length:");
+            content_length = length == string::npos ? 0 : stoul(headers.substr(length + 15));
+        }
+        if (header_end != string::npos && request.size() >= header_end + 4 + content_length) {
+            break;
+        }
+    }
+
+    // The user message is the last "content" string in the request body
+    string text = "";
+    size_t key = request.rfind("\"content\"");
+    if (key != string::npos) {
+        size_t quote = request.find('"', request.find(':', key) + 1);
+        for (size_t i = quote + 1; i < request.size() && request[i] != '"'; ++i) {
+            if (request[i] == '\\' && i + 1 < request.size()) {
+                ++i;
+            }
+            text += request[i];
+        }
+    }
+    // Simulated incidents: some requests hang for a while, some fail outright
+    static thread_local mt19937 generator(random_device{}());
+    if (static_cast<int>(generator() % 100) < options.nlp_stub_slow_percent) {
+        this_thread::sleep_for(chrono::milliseconds(options.nlp_stub_slow_ms));
+    }
+    bool fail = static_cast<int>(generator() % 100) < options.nlp_stub_fail_percent;
+    string body = "{\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"" +
+        stub_answer(text) + "\"},\"finish_reason\":\"stop\"}]}";
+    string reply = string(fail ? "HTTP/1.1 503 Service Unavailable" : "HTTP/1.1 200 OK") + "\r\nContent-Type: application/json\r\nConnection: close\r\nContent-Length: " +
+        to_string(body.size()) + "\r\n\r\n" + body;
+    send(client, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+    close(client);
+}
+
+/**
+ * @brief Starts a local HTTP stand-in for the NLP chat completions API.
+ * Point the server at it with --nlp_endpoint=http://127.0.0.1:<port>/v1/chat/completions.
+ * @param port The local port to listen on
+ * @return true if the stub is listening
+ */
+static bool start_nlp_stub(int port) {
+    int stub_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(stub_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(stub_socket, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(stub_socket, 1024) < 0) {
+        cerr << "Could not start NLP stub on port " << port << endl;
+        return false;
+    }
+    thread([stub_socket]() {
+        while (true) {
+            int client = accept(stub_socket, nullptr, nullptr);
+            if (client >= 0) {
+                thread(stub_request, client).detach();
+            }
+        }
+    }).detach();
+    return true;
+}
+
+/**
+ * @brief Returns a percentile of sorted samples.
+ * @param samples Sorted latencies
+ * @param fraction The percentile as a fraction (0.99 for p99)
+ * @return The sample at that percentile
+ */
+static double percentile(const vector<double>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t index = min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    return samples[index];
+}
+
+/**
+ * @brief Prints the command line options.
+ */
+static void print_usage() {
+    cerr << "Usage: ./loadgen --accounts=<file> [options]\n"
+         << "  --accounts=<file>       user:password lines (e.g. backend/passwords.txt)\n"
+         << "  --create=<n>            create n extra accounts before the run\n"
+         << "  --host=<ip> --port=<n>  server address (127.0.0.1:3001)\n"
+         << "  --sessions=<n>          concurrent sessions (50)\n"
+         << "  --seconds=<n>           length of the run (30)\n"
+         << "  --ops_per_session=<n>   operations between login and logout (20)\n"
+         << "  --mode=menu|nlp|mixed   prompt style (menu)\n"
+         << "  --mix=<op:weight,...>   operation mix over deposit, withdraw, transfer, balance, history, export\n"
+         << "  --max_amount=<n>        largest amount per operation (50)\n"
+         << "  --nlp_stub_port=<n>     serve a local NLP API stub on this port\n"
+         << "  --nlp_stub_fail_percent=<n>  stub requests answered with 503 (0)\n"
+         << "  --nlp_stub_slow_percent=<n>  stub requests held for --nlp_stub_slow_ms=<n> first (0, 10000)\n";
+}
+
+/**
+ * @brief Parses options, runs the load and prints the report.
+ * @return int 0 if money was conserved, 1 otherwise.
+ */
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equals == string::npos) {
+            print_usage();
+            return 1;
+        }
+        string key = arg.substr(2, equals - 2);
+        string value = arg.substr(equals + 1);
+        if (key == "host") options.host = value;
+        else if (key == "port") options.port = stoi(value);
+        else if (key == "accounts") options.accounts = value;
+        else if (key == "create") options.create = stoi(value);
+        else if (key == "sessions") options.sessions = stoi(value);
+        else if (key == "seconds") options.seconds = stoi(value);
+        else if (key == "ops_per_session") options.ops_per_session = stoi(value);
+        else if (key == "mode") options.mode = value;
+        else if (key == "mix") options.mix = value;
+        else if (key == "max_amount") options.max_amount = stoi(value);
+        else if (key == "nlp_stub_port") options.nlp_stub_port = stoi(value);
+        else if (key == "nlp_stub_fail_percent") options.nlp_stub_fail_percent = stoi(value);
+        else if (key == "nlp_stub_slow_percent") options.nlp_stub_slow_percent = stoi(value);
+        else if (key == "nlp_stub_slow_ms") options.nlp_stub_slow_ms = stoi(value);
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    // Initialize the OpenSSL library; the load generator does not verify the server certificate
+    SSL_library_init();
+    SSL_load_error_strings();
+    signal(SIGPIPE, SIG_IGN);
+    ssl_ctx = SSL_CTX_new(TLS_client_method());
+
+    if (options.nlp_stub_port != 0 && !start_nlp_stub(options.nlp_stub_port)) {
+        return 1;
+    }
+
+    // Load existing accounts and create any extra ones requested
+    if (options.accounts != "") {
+        ifstream file(options.accounts);
+        string line;
+        while (getline(file, line)) {
+            size_t colon = line.find(':');
+            if (colon != string::npos) {
+                accounts.push_back({line.substr(0, colon), line.substr(colon + 1)});
+            }
+        }
+    }
+    string prefix = "lg" + to_string(time(nullptr) % 100000) + "_";
+    for (int i = 0; i < options.create; ++i) {
+        Account account = {prefix + to_string(i), "pw" + to_string(i)};
+        if (create_account(account)) {
+            accounts.push_back(account);
+        } else {
+            cerr << "Could not create account " << account.username << endl;
+        }
+    }
+
+    // Drop accounts that cannot be logged in to, and take the starting total from the rest
+    vector<double> balances = read_balances();
+    double starting_total = 0;
+    vector<Account> usable;
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        if (isnan(balances[i])) {
+            cerr << "Skipping account " << accounts[i].username << " (could not log in)" << endl;
+            continue;
+        }
+        usable.push_back(accounts[i]);
+        starting_total += balances[i];
+    }
+    accounts = usable;
+    if (accounts.size() < 2) {
+        cerr << "Need at least two accounts" << endl;
+        print_usage();
+        return 1;
+    }
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        free_accounts.push_back(i);
+    }
+
+    cout << "accounts=" << accounts.size() << " starting_total=" << fixed << setprecision(2) << starting_total << endl;
+
+    // Small stacks so thousands of virtual users fit comfortably
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(options.seconds);
+    auto started = chrono::steady_clock::now();
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, 256 * 1024);
+    vector<pthread_t> users(options.sessions);
+    for (auto& user : users) {
+        pthread_create(&user, &attributes, virtual_user, &deadline);
+    }
+    for (auto& user : users) {
+        pthread_join(user, nullptr);
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    // Per-operation report
+    int64_t total_operations = 0;
+    cout << left << setw(10) << "operation" << right << setw(10) << "count" << setw(10) << "failed"
+         << setw(12) << "ops/s" << setw(10) << "p50 ms" << setw(10) << "p99 ms" << setw(10) << "p999 ms" << endl;
+    for (int operation = 0; operation < OPERATION_COUNT; ++operation) {
+        vector<double>& samples = stats.latencies[operation];
+        sort(samples.begin(), samples.end());
+        total_operations += samples.size();
+        cout << left << setw(10) << OPERATION_NAMES[operation] << right << setw(10) << samples.size()
+             << setw(10) << stats.failures[operation] << setw(12) << setprecision(1) << samples.size() / elapsed
+             << setprecision(2) << setw(10) << percentile(samples, 0.5) << setw(10) << percentile(samples, 0.99)
+             << setw(10) << percentile(samples, 0.999) << endl;
+    }
+    cout << "total_ops=" << total_operations << " seconds=" << setprecision(1) << elapsed
+         << " throughput=" << total_operations / elapsed << " ops/s" << endl;
+    for (const char* code : CODES) {
+        cout << "code_" << code << "=" << stats.codes[code] << " ";
+    }
+    cout << "nlp_fallbacks=" << stats.nlp_fallbacks << " exported_entries=" << stats.exported_entries << endl;
+
+    // Transfers move money between accounts, so only deposits and withdrawals change the total
+    double ending_total = 0;
+    for (double balance : read_balances()) {
+        ending_total += balance;
+    }
+    double expected_total = starting_total + stats.deposited - stats.withdrawn;
+    bool conserved = !isnan(ending_total) && fabs(ending_total - expected_total) < 0.005 * accounts.size() + 0.005;
+    cout << setprecision(2) << "deposited=" << stats.deposited << " withdrawn=" << stats.withdrawn
+         << " expected_total=" << expected_total << " ending_total=" << ending_total
+         << " money_conserved=" << (conserved ? "yes" : "NO") << endl;
+
+    SSL_CTX_free(ssl_ctx);
+    return conserved ? 0 : 1;
+}